@@ -0,0 +1,154 @@
+#include "main.h"
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+/*
+Fixed workload benchmark. Renders a set amount of frames (after a warmup) and emits per phase frame statistics as JSON,
+so that numbers can be diffed between builds.
+Built as the hello_bench target, which compiles the renderer with HELIUM_BENCHMARK so main.cpp does not provide main().
+
+usage: hello_bench [--frames N] [--warmup N] [--out file.json] [--windowed] [--gpu-profile out.csv|out.json] [--cpu-trace trace.json]
+Results are written to benchmark.json unless --out is given.
+*/
+
+struct PhaseStats{
+    double min = 0.0;
+    double median = 0.0;
+    double p95 = 0.0;
+    double p99 = 0.0;
+    double mean = 0.0;
+    double max = 0.0;
+};
+
+// Nearest-rank percentile over an already sorted sample set.
+static double percentile(const std::vector<double>& sorted, double p){
+    if (sorted.empty()){
+        return 0.0;
+    }
+    size_t rank = static_cast<size_t>(std::ceil(p / 100.0 * sorted.size()));
+    rank = std::clamp<size_t>(rank, 1, sorted.size());
+    return sorted[rank - 1];
+}
+
+static PhaseStats computeStats(std::vector<double> samples){
+    PhaseStats stats{};
+    if (samples.empty()){
+        return stats;
+    }
+    std::sort(samples.begin(), samples.end());
+    double sum = 0.0;
+    for (double s : samples){
+        sum += s;
+    }
+    stats.min = samples.front();
+    stats.max = samples.back();
+    stats.median = percentile(samples, 50.0);
+    stats.p95 = percentile(samples, 95.0);
+    stats.p99 = percentile(samples, 99.0);
+    stats.mean = sum / samples.size();
+    return stats;
+}
+
+static void writePhase(std::ostream& out, const char* name, const PhaseStats& s, bool last){
+    out << "    \"" << name << "\": {"
+        << "\"min\": " << s.min
+        << ", \"median\": " << s.median
+        << ", \"p95\": " << s.p95
+        << ", \"p99\": " << s.p99
+        << ", \"mean\": " << s.mean
+        << ", \"max\": " << s.max
+        << "}" << (last ? "" : ",") << "\n";
+}
+
+int main(int argc, char** argv){
+    uint32_t frames = 1000;
+    uint32_t warmup = 100;
+    bool headless = true; // Perf CI runs on display-less machines.
+    // Setup logs go to stdout, so results always go to a file to keep them machine readable.
+    std::string outPath = "benchmark.json";
+    std::string gpuProfilePath;
+    std::string cpuTracePath;
+    for (int i = 1; i < argc; i++){
+        if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc){
+            frames = static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+        }else if (strcmp(argv[i], "--warmup") == 0 && i + 1 < argc){
+            warmup = static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+        }else if (strcmp(argv[i], "--out") == 0 && i + 1 < argc){
+            outPath = argv[++i];
+        }else if (strcmp(argv[i], "--windowed") == 0){
+            headless = false;
+        }else if (strcmp(argv[i], "--gpu-profile") == 0 && i + 1 < argc){
+            gpuProfilePath = argv[++i];
+        }else if (strcmp(argv[i], "--cpu-trace") == 0 && i + 1 < argc){
+            cpuTracePath = argv[++i];
+        }else{
+            std::cerr << "usage: " << argv[0] << " [--frames N] [--warmup N] [--out file.json] [--windowed] [--gpu-profile out.csv|out.json] [--cpu-trace trace.json]" << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    CpuProfiler::setThreadName("main");
+    HelloTriangleApplication app(headless);
+    app.setGpuProfileOutput(gpuProfilePath);
+    std::vector<HelloTriangleApplication::FrameTimings> samples;
+    double runSeconds = 0.0;
+    try{
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        samples = app.runFixedWorkload(warmup, frames);
+        // Includes setup and warmup, fps below only accounts for the measured frames.
+        runSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if (!cpuTracePath.empty()){
+            CpuProfiler::exportChromeTrace(cpuTracePath);
+        }
+    }catch (const std::exception& e){
+        std::cerr << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::vector<double> waitFence, acquire, uploadSubmit, record, submit, present, total;
+    double frameTimeSum = 0.0;
+    for (const auto& t : samples){
+        waitFence.push_back(t.waitFenceMs);
+        acquire.push_back(t.acquireMs);
+        uploadSubmit.push_back(t.uploadSubmitMs);
+        record.push_back(t.recordMs);
+        submit.push_back(t.submitMs);
+        present.push_back(t.presentMs);
+        total.push_back(t.totalMs);
+        frameTimeSum += t.totalMs;
+    }
+    // Throughput is computed on the measured frames only, setup and warmup are excluded from frameTimeSum.
+    double fps = frameTimeSum > 0.0 ? samples.size() / (frameTimeSum / 1000.0) : 0.0;
+
+    std::ostringstream json;
+    json << "{\n";
+    json << "  \"headless\": " << (headless ? "true" : "false") << ",\n";
+    json << "  \"warmup_frames\": " << warmup << ",\n";
+    json << "  \"requested_frames\": " << frames << ",\n";
+    json << "  \"measured_frames\": " << samples.size() << ",\n";
+    json << "  \"run_seconds\": " << runSeconds << ",\n";
+    json << "  \"fps\": " << fps << ",\n";
+    json << "  \"unit\": \"ms\",\n";
+    json << "  \"phases\": {\n";
+    writePhase(json, "wait_fence", computeStats(waitFence), false);
+    writePhase(json, "acquire", computeStats(acquire), false);
+    writePhase(json, "upload_submit", computeStats(uploadSubmit), false);
+    writePhase(json, "record", computeStats(record), false);
+    writePhase(json, "submit", computeStats(submit), false);
+    writePhase(json, "present", computeStats(present), false);
+    writePhase(json, "frame", computeStats(total), true);
+    json << "  }\n";
+    json << "}\n";
+
+    std::ofstream file(outPath);
+    if (!file.is_open()){
+        std::cerr << "could not open " << outPath << std::endl;
+        return EXIT_FAILURE;
+    }
+    file << json.str();
+    std::cout << json.str();
+    std::cout << "benchmark results written to " << outPath << std::endl;
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,180 @@
+#include "main.h"
+
+/*
+Bindless texture table. Set 1 of gPipeline holds every texture view in a sampled image array (binding 0) next to the shared
+sampler (binding 1), it is bound once per frame and f4_bindlessTextures indexes it with BindlessConstants::textureIndex.
+Material changes cost a push constant instead of a descriptor set bind, and materials no longer need sets of their own.
+
+The array is partially bound and updated after bind, but a slot read by a frame in flight is never rewritten: a texture whose
+view changes (streaming, budget moves) gets a new slot and the old one goes back to bindlessSlots MAX_FRAMES_IN_FLIGHT frames
+later, with the old view. Every texture thus holds at most MAX_FRAMES_IN_FLIGHT + 1 slots.
+*/
+
+/*
+Checks the descriptor indexing features the table needs (VK_EXT_descriptor_indexing and VK_KHR_maintenance3 are supported)
+and fills the ones to enable. Picks the capacity of the table within the device limits.
+*/
+bool HelloTriangleApplication::selectBindlessTextures(VkPhysicalDeviceFeatures& features, VkPhysicalDeviceDescriptorIndexingFeaturesEXT& descriptorIndexing){
+    auto getFeatures2 = (PFN_vkGetPhysicalDeviceFeatures2KHR) vkGetInstanceProcAddr(instance, "vkGetPhysicalDeviceFeatures2KHR");
+    auto getProperties2 = (PFN_vkGetPhysicalDeviceProperties2KHR) vkGetInstanceProcAddr(instance, "vkGetPhysicalDeviceProperties2KHR");
+    if (getFeatures2 == nullptr || getProperties2 == nullptr){
+        return false;
+    }
+    VkPhysicalDeviceDescriptorIndexingFeaturesEXT supported{};
+    supported.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT;
+    VkPhysicalDeviceFeatures2KHR supportedFeatures{};
+    supportedFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2_KHR;
+    supportedFeatures.pNext = &supported;
+    getFeatures2(physGraphicDevice, &supportedFeatures);
+    // The index comes from a push constant: dynamically uniform, no nonuniform indexing needed.
+    if (!supportedFeatures.features.shaderSampledImageArrayDynamicIndexing || !supported.runtimeDescriptorArray
+        || !supported.descriptorBindingPartiallyBound || !supported.descriptorBindingSampledImageUpdateAfterBind
+        || !supported.descriptorBindingUpdateUnusedWhilePending){
+        return false;
+    }
+
+    VkPhysicalDeviceDescriptorIndexingPropertiesEXT limits{};
+    limits.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_PROPERTIES_EXT;
+    VkPhysicalDeviceProperties2KHR properties{};
+    properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2_KHR;
+    properties.pNext = &limits;
+    getProperties2(physGraphicDevice, &properties);
+    bindlessTextureCapacity = std::min({
+        BINDLESS_TEXTURE_CAPACITY,
+        limits.maxPerStageDescriptorUpdateAfterBindSampledImages,
+        limits.maxDescriptorSetUpdateAfterBindSampledImages
+    });
+
+    features.shaderSampledImageArrayDynamicIndexing = VK_TRUE;
+    descriptorIndexing = {};
+    descriptorIndexing.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT;
+    descriptorIndexing.runtimeDescriptorArray = VK_TRUE;
+    descriptorIndexing.descriptorBindingPartiallyBound = VK_TRUE;
+    descriptorIndexing.descriptorBindingSampledImageUpdateAfterBind = VK_TRUE;
+    descriptorIndexing.descriptorBindingUpdateUnusedWhilePending = VK_TRUE;
+    return true;
+}
+
+// Needed by createPipeline(), before the textures are known: the array has a fixed capacity.
+void HelloTriangleApplication::createBindlessLayout(){
+    std::array<VkDescriptorSetLayoutBinding, 2> bindings{};
+    bindings[0].binding = 0;
+    bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+    bindings[0].descriptorCount = bindlessTextureCapacity;
+    bindings[0].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+    bindings[1].binding = 1;
+    bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_SAMPLER;
+    bindings[1].descriptorCount = 1;
+    bindings[1].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+
+    // Slots never written are never read, and free slots are written while frames in flight read the others.
+    std::array<VkDescriptorBindingFlagsEXT, 2> bindingFlags = {
+        VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT_EXT | VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT_EXT
+            | VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT_EXT,
+        0
+    };
+    VkDescriptorSetLayoutBindingFlagsCreateInfoEXT bindingFlagsInfo{};
+    bindingFlagsInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO_EXT;
+    bindingFlagsInfo.bindingCount = static_cast<uint32_t>(bindingFlags.size());
+    bindingFlagsInfo.pBindingFlags = bindingFlags.data();
+
+    VkDescriptorSetLayoutCreateInfo layoutInfo{};
+    layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    layoutInfo.pNext = &bindingFlagsInfo;
+    layoutInfo.flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT_EXT;
+    layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
+    layoutInfo.pBindings = bindings.data();
+    if (vkCreateDescriptorSetLayout(logiDevice, &layoutInfo, nullptr, &bindlessDescriptorSetLayout) != VK_SUCCESS){
+        throw std::runtime_error("failed to create bindless texture set layout");
+    }
+}
+
+// Allocates the table and writes the sampler and a slot for every texture.
+void HelloTriangleApplication::createBindlessTable(){
+    HELIUM_PROFILE_FUNCTION();
+    if (textures.size() * (MAX_FRAMES_IN_FLIGHT + 1) > bindlessTextureCapacity){
+        throw std::runtime_error("too many textures for the bindless texture table");
+    }
+    std::array<VkDescriptorPoolSize, 2> poolSizes{};
+    poolSizes[0].type = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+    poolSizes[0].descriptorCount = bindlessTextureCapacity;
+    poolSizes[1].type = VK_DESCRIPTOR_TYPE_SAMPLER;
+    poolSizes[1].descriptorCount = 1;
+    VkDescriptorPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    poolInfo.flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT_EXT;
+    poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+    poolInfo.pPoolSizes = poolSizes.data();
+    poolInfo.maxSets = 1;
+    if (vkCreateDescriptorPool(logiDevice, &poolInfo, nullptr, &bindlessDescriptorPool) != VK_SUCCESS){
+        throw std::runtime_error("failed to create bindless texture pool");
+    }
+
+    VkDescriptorSetAllocateInfo allocationInfo{};
+    allocationInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    allocationInfo.descriptorPool = bindlessDescriptorPool;
+    allocationInfo.descriptorSetCount = 1;
+    allocationInfo.pSetLayouts = &bindlessDescriptorSetLayout;
+    if (vkAllocateDescriptorSets(logiDevice, &allocationInfo, &bindlessDescriptorSet) != VK_SUCCESS){
+        throw std::runtime_error("failed to allocate bindless texture set");
+    }
+
+    VkDescriptorImageInfo samplerInfo{};
+    samplerInfo.sampler = textureSampler;
+    VkWriteDescriptorSet writeSamplerOp{};
+    writeSamplerOp.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    writeSamplerOp.dstSet = bindlessDescriptorSet;
+    writeSamplerOp.dstBinding = 1;
+    writeSamplerOp.descriptorCount = 1;
+    writeSamplerOp.descriptorType = VK_DESCRIPTOR_TYPE_SAMPLER;
+    writeSamplerOp.pImageInfo = &samplerInfo;
+    vkUpdateDescriptorSets(logiDevice, 1, &writeSamplerOp, 0, nullptr);
+
+    bindlessSlots.init(bindlessTextureCapacity);
+    bindlessSlotViews.assign(bindlessTextureCapacity, VK_NULL_HANDLE);
+    for (uint32_t t = 0; t < textures.size(); t++){
+        writeBindlessTexture(t);
+    }
+    std::cout << "bindless textures: " << bindlessSlots.getUsed() << "/" << bindlessSlots.getCapacity() << " slots" << std::endl;
+}
+
+// Writes the current view of a texture into a new slot. Room is guaranteed by the check of createBindlessTable().
+void HelloTriangleApplication::writeBindlessTexture(uint32_t t){
+    Texture& texture = textures[t];
+    texture.bindlessSlot = bindlessSlots.allocate();
+    bindlessSlotViews[texture.bindlessSlot] = texture.view;
+
+    VkDescriptorImageInfo textureInfo{};
+    textureInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    textureInfo.imageView = texture.view;
+    VkWriteDescriptorSet writeTextureOp{};
+    writeTextureOp.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    writeTextureOp.dstSet = bindlessDescriptorSet;
+    writeTextureOp.dstBinding = 0;
+    writeTextureOp.dstArrayElement = texture.bindlessSlot;
+    writeTextureOp.descriptorCount = 1;
+    writeTextureOp.descriptorType = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+    writeTextureOp.pImageInfo = &textureInfo;
+    vkUpdateDescriptorSets(logiDevice, 1, &writeTextureOp, 0, nullptr);
+}
+
+// Gives the textures whose view changed this frame a new slot, the frames in flight keep reading the old one.
+void HelloTriangleApplication::updateBindlessTextures(){
+    bindlessSlots.reclaim(frameCounter);
+    for (uint32_t t = 0; t < textures.size(); t++){
+        if (bindlessSlotViews[textures[t].bindlessSlot] == textures[t].view){
+            continue;
+        }
+        // Same delay as the retired view it points to.
+        bindlessSlots.free(textures[t].bindlessSlot, frameCounter + MAX_FRAMES_IN_FLIGHT);
+        writeBindlessTexture(t);
+    }
+}
+
+void HelloTriangleApplication::destroyBindlessResources(){
+    if (!bindlessTextures){
+        return;
+    }
+    vkDestroyDescriptorPool(logiDevice, bindlessDescriptorPool, nullptr);
+    vkDestroyDescriptorSetLayout(logiDevice, bindlessDescriptorSetLayout, nullptr);
+}
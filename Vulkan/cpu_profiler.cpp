@@ -0,0 +1,128 @@
+#include "cpu_profiler.h"
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <vector>
+
+namespace {
+
+// Single producer (the owning thread), read by the exporter.
+struct ThreadRing{
+    uint32_t threadId = 0;
+    std::atomic<const char*> threadName{nullptr};
+    std::atomic<uint64_t> head{0}; // Total zones ever written, the ring holds the last RING_CAPACITY of them.
+    std::unique_ptr<CpuProfiler::Zone[]> zones{new CpuProfiler::Zone[CpuProfiler::RING_CAPACITY]};
+};
+
+struct Registry{
+    std::mutex lock;
+    // Rings are never freed while the process runs, so zones of threads that already exited can still be exported.
+    std::vector<std::unique_ptr<ThreadRing>> rings;
+};
+
+Registry& registry(){
+    static Registry r;
+    return r;
+}
+
+const std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+
+ThreadRing& localRing(){
+    thread_local ThreadRing* ring = nullptr;
+    if (ring == nullptr){
+        Registry& r = registry();
+        std::lock_guard<std::mutex> guard(r.lock);
+        r.rings.push_back(std::make_unique<ThreadRing>());
+        ring = r.rings.back().get();
+        ring->threadId = static_cast<uint32_t>(r.rings.size());
+    }
+    return *ring;
+}
+
+} // namespace
+
+uint64_t CpuProfiler::nowNs(){
+    return static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch).count()
+    );
+}
+
+void CpuProfiler::record(const char* name, uint64_t startNs, uint64_t endNs){
+    ThreadRing& ring = localRing();
+    uint64_t head = ring.head.load(std::memory_order_relaxed);
+    ring.zones[head & (RING_CAPACITY - 1)] = {name, startNs, endNs};
+    // Publishes the zone to the exporter.
+    ring.head.store(head + 1, std::memory_order_release);
+}
+
+void CpuProfiler::setThreadName(const char* name){
+    localRing().threadName.store(name, std::memory_order_release);
+}
+
+#ifdef HELIUM_PROFILING
+// Minimal escaping, zone names are identifiers but __func__ may still contain odd characters on some compilers.
+static void writeEscaped(std::ostream& out, const char* s){
+    for (; *s; s++){
+        if (*s == '"' || *s == '\\'){
+            out << '\\';
+        }
+        out << *s;
+    }
+}
+#endif
+
+bool CpuProfiler::exportChromeTrace(const std::string& path){
+#ifndef HELIUM_PROFILING
+    return true;
+#else
+    std::ofstream file(path);
+    if (!file.is_open()){
+        std::cerr << "could not open " << path << std::endl;
+        return false;
+    }
+    Registry& r = registry();
+    std::lock_guard<std::mutex> guard(r.lock);
+
+    file << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+    bool first = true;
+    size_t exported = 0;
+    std::vector<Zone> snapshot;
+    for (const auto& ring : r.rings){
+        const char* threadName = ring->threadName.load(std::memory_order_acquire);
+        if (threadName != nullptr){
+            file << (first ? "" : ",\n") << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << ring->threadId
+                 << ", \"args\": {\"name\": \"";
+            writeEscaped(file, threadName);
+            file << "\"}}";
+            first = false;
+        }
+
+        uint64_t head = ring->head.load(std::memory_order_acquire);
+        uint64_t begin = head > RING_CAPACITY ? head - RING_CAPACITY : 0;
+        snapshot.clear();
+        for (uint64_t i = begin; i < head; i++){
+            snapshot.push_back(ring->zones[i & (RING_CAPACITY - 1)]);
+        }
+        // The owner may have kept recording while we copied, anything it wrapped over is torn and dropped.
+        uint64_t headAfter = ring->head.load(std::memory_order_acquire);
+        uint64_t firstValid = headAfter > RING_CAPACITY ? headAfter - RING_CAPACITY : 0;
+        size_t skip = firstValid > begin ? static_cast<size_t>(firstValid - begin) : 0;
+
+        for (size_t i = skip; i < snapshot.size(); i++){
+            const Zone& z = snapshot[i];
+            // Trace timestamps are in microseconds.
+            file << (first ? "" : ",\n") << "{\"name\": \"";
+            writeEscaped(file, z.name);
+            file << "\", \"ph\": \"X\", \"pid\": 1, \"tid\": " << ring->threadId
+                 << ", \"ts\": " << z.startNs / 1000.0
+                 << ", \"dur\": " << (z.endNs - z.startNs) / 1000.0 << "}";
+            first = false;
+            exported++;
+        }
+    }
+    file << "\n]}\n";
+    std::cout << "CPU trace with " << exported << " zones written to " << path << std::endl;
+    return true;
+#endif
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+/*
+Scoped CPU zone profiler.
+
+Each thread records finished zones into its own fixed size ring buffer, the owning thread is the only writer
+so recording a zone is two clock reads and a store, no locks. The rings are only registered (under a lock) the first time a thread records.
+exportChromeTrace() writes every ring as Chrome/Perfetto trace JSON (chrome://tracing or ui.perfetto.dev).
+
+Zones are compiled in by default, define HELIUM_DISABLE_PROFILING to remove them entirely.
+Zone names must outlive the profiler (string literals or __func__).
+*/
+#ifndef HELIUM_DISABLE_PROFILING
+#define HELIUM_PROFILING
+#endif
+
+#define HELIUM_PROFILE_CONCAT_INNER(a, b) a##b
+#define HELIUM_PROFILE_CONCAT(a, b) HELIUM_PROFILE_CONCAT_INNER(a, b)
+
+#ifdef HELIUM_PROFILING
+#define HELIUM_PROFILE_SCOPE(name) CpuProfileZone HELIUM_PROFILE_CONCAT(heliumProfileZone, __COUNTER__)(name)
+#define HELIUM_PROFILE_FUNCTION() HELIUM_PROFILE_SCOPE(__func__)
+#else
+#define HELIUM_PROFILE_SCOPE(name)
+#define HELIUM_PROFILE_FUNCTION()
+#endif
+
+class CpuProfiler{
+public:
+    struct Zone{
+        const char* name;
+        uint64_t startNs;
+        uint64_t endNs;
+    };
+
+    // Power of two so the ring index is a mask. Oldest zones are overwritten once a thread records more than this.
+    static constexpr uint32_t RING_CAPACITY = 1u << 16;
+
+    static uint64_t nowNs();
+    static void record(const char* name, uint64_t startNs, uint64_t endNs);
+    // Name shown for the calling thread in the trace viewer.
+    static void setThreadName(const char* name);
+    // Returns false if the file could not be written. No-op (returns true) when profiling is compiled out.
+    static bool exportChromeTrace(const std::string& path);
+};
+
+class CpuProfileZone{
+public:
+    explicit CpuProfileZone(const char* zoneName) :
+        name(zoneName),
+        startNs(CpuProfiler::nowNs()){
+    }
+    ~CpuProfileZone(){
+        CpuProfiler::record(name, startNs, CpuProfiler::nowNs());
+    }
+    CpuProfileZone(const CpuProfileZone&) = delete;
+    CpuProfileZone& operator=(const CpuProfileZone&) = delete;
+
+private:
+    const char* name;
+    uint64_t startNs;
+};
@@ -0,0 +1,264 @@
+#include "main.h"
+#ifdef HELIUM_GPU_CULLING
+
+/*
+Meshlet culling, see meshlet.h for the bounds and c1_meshletCulling for the tests.
+The pass compacts the indices of the visible meshlets into a per frame index buffer and counts them into one
+VkDrawIndexedIndirectCommand per submesh, so every submesh stays a single indexed draw of gPipeline and needs neither
+multiDrawIndirect nor drawIndirectCount. Each submesh owns the region of the index buffer its full level fits in, and gets
+a dispatch over the meshlets of its selected LOD. Per frame buffers, like the MVP ones: the frame that last used them was
+waited on through its fence.
+*/
+void HelloTriangleApplication::createCullingResources(){
+    HELIUM_PROFILE_FUNCTION();
+    const void* meshletData = meshlets.data();
+    meshletCount = static_cast<uint32_t>(meshlets.size());
+    if (meshCache.isOpen()){
+        meshletData = meshCache.meshletData();
+        meshletCount = static_cast<uint32_t>(meshCache.meshletCount());
+    }
+
+    VkPhysicalDeviceProperties deviceProperties;
+    vkGetPhysicalDeviceProperties(physGraphicDevice, &deviceProperties);
+    uint32_t familyCount = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(physGraphicDevice, &familyCount, nullptr);
+    std::vector<VkQueueFamilyProperties> families(familyCount);
+    vkGetPhysicalDeviceQueueFamilyProperties(physGraphicDevice, &familyCount, families.data());
+    uint32_t graphicsFamily = findRequiredQueueFamily(physGraphicDevice).graphicsFamilyIndex.value();
+    // Draw commands are reset with vkCmdUpdateBuffer, which takes at most 65536 bytes.
+    const size_t maxSubmeshes = 65536 / sizeof(VkDrawIndexedIndirectCommand);
+    uint32_t largestDispatch = 0;
+    emptyDraws.clear();
+    uint32_t visibleIndexCount = 0;
+    for (const Submesh& submesh : submeshes){
+        for (uint32_t l = 0; l < submesh.lodCount; l++){
+            largestDispatch = std::max(largestDispatch, submesh.lods[l].meshletCount);
+        }
+        VkDrawIndexedIndirectCommand emptyDraw{};
+        emptyDraw.instanceCount = 1;
+        emptyDraw.firstIndex = visibleIndexCount;
+        emptyDraws.push_back(emptyDraw);
+        // Coarser levels never have more indices than the full one.
+        visibleIndexCount += submesh.lods[0].indexCount;
+    }
+    // One workgroup per meshlet, dispatched on the graphics queue right before the render pass.
+    if (meshletCount == 0 || largestDispatch > deviceProperties.limits.maxComputeWorkGroupCount[0] || submeshes.size() > maxSubmeshes
+        || (families[graphicsFamily].queueFlags & VK_QUEUE_COMPUTE_BIT) == 0){
+        std::cout << "meshlet culling disabled (" << meshletCount << " meshlets), drawing every index" << std::endl;
+        gpuCulling = false;
+        return;
+    }
+    gpuCulling = true;
+
+    createAndFillDeviceBuffer(
+        meshletData,
+        static_cast<VkDeviceSize>(meshletCount) * sizeof(Meshlet),
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+        meshletBuffer,
+        meshletBufferMemory
+    );
+
+    visibleIndexBuffers.resize(MAX_FRAMES_IN_FLIGHT);
+    visibleIndexBuffersMemory.resize(MAX_FRAMES_IN_FLIGHT);
+    drawIndirectBuffers.resize(MAX_FRAMES_IN_FLIGHT);
+    drawIndirectBuffersMemory.resize(MAX_FRAMES_IN_FLIGHT);
+    for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; i++){
+        // Worst case every meshlet of the full mesh is visible. Always 32 bit, the pass widens 16 bit indices.
+        createAndBindDeviceBuffer(
+            static_cast<VkDeviceSize>(visibleIndexCount) * sizeof(uint32_t),
+            VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+            visibleIndexBuffers[i],
+            visibleIndexBuffersMemory[i]
+        );
+        // Reset with vkCmdUpdateBuffer every frame, then the pass adds the index count of each visible meshlet.
+        createAndBindDeviceBuffer(
+            emptyDraws.size() * sizeof(VkDrawIndexedIndirectCommand),
+            VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+            drawIndirectBuffers[i],
+            drawIndirectBuffersMemory[i]
+        );
+    }
+
+    /*
+    Bindings, all storage buffers:
+    0: meshlets
+    1: source indices (the index buffer, read as 32 bit words)
+    2: visible indices of this frame
+    3: draw commands of this frame, one per submesh
+    */
+    std::array<VkDescriptorSetLayoutBinding, 4> bindings{};
+    for (uint32_t b = 0; b < bindings.size(); b++){
+        bindings[b].binding = b;
+        bindings[b].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        bindings[b].descriptorCount = 1;
+        bindings[b].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+        bindings[b].pImmutableSamplers = nullptr;
+    }
+    VkDescriptorSetLayoutCreateInfo layoutCreationInfo{};
+    layoutCreationInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    layoutCreationInfo.bindingCount = static_cast<uint32_t>(bindings.size());
+    layoutCreationInfo.pBindings = bindings.data();
+    if (vkCreateDescriptorSetLayout(logiDevice, &layoutCreationInfo, nullptr, &cullingDescriptorSetLayout) != VK_SUCCESS){
+        throw std::runtime_error("failed to create culling descriptor set layout");
+    }
+
+    VkDescriptorPoolSize poolSize{};
+    poolSize.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    poolSize.descriptorCount = static_cast<uint32_t>(bindings.size() * MAX_FRAMES_IN_FLIGHT);
+    VkDescriptorPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    poolInfo.poolSizeCount = 1;
+    poolInfo.pPoolSizes = &poolSize;
+    poolInfo.maxSets = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
+    if (vkCreateDescriptorPool(logiDevice, &poolInfo, nullptr, &cullingDescriptorPool) != VK_SUCCESS){
+        throw std::runtime_error("failed to create culling descriptor pool");
+    }
+
+    std::vector<VkDescriptorSetLayout> layouts(MAX_FRAMES_IN_FLIGHT, cullingDescriptorSetLayout);
+    VkDescriptorSetAllocateInfo allocationInfo{};
+    allocationInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    allocationInfo.descriptorPool = cullingDescriptorPool;
+    allocationInfo.descriptorSetCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
+    allocationInfo.pSetLayouts = layouts.data();
+    cullingDescriptorSets.resize(MAX_FRAMES_IN_FLIGHT);
+    if (vkAllocateDescriptorSets(logiDevice, &allocationInfo, cullingDescriptorSets.data()) != VK_SUCCESS){
+        throw std::runtime_error("failed to allocate culling descriptor sets");
+    }
+    for (size_t i = 0; i < cullingDescriptorSets.size(); i++){
+        std::array<VkDescriptorBufferInfo, 4> bufferInfos = {{
+            {meshletBuffer, 0, VK_WHOLE_SIZE},
+            {indexBuffer, 0, VK_WHOLE_SIZE},
+            {visibleIndexBuffers[i], 0, VK_WHOLE_SIZE},
+            {drawIndirectBuffers[i], 0, VK_WHOLE_SIZE},
+        }};
+        std::array<VkWriteDescriptorSet, 4> writes{};
+        for (uint32_t b = 0; b < writes.size(); b++){
+            writes[b].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+            writes[b].dstSet = cullingDescriptorSets[i];
+            writes[b].dstBinding = b;
+            writes[b].dstArrayElement = 0;
+            writes[b].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+            writes[b].descriptorCount = 1;
+            writes[b].pBufferInfo = &bufferInfos[b];
+        }
+        vkUpdateDescriptorSets(logiDevice, static_cast<uint32_t>(writes.size()), writes.data(), 0, nullptr);
+    }
+
+    // Frustum and camera change every frame, they are pushed rather than written to a buffer.
+    VkPushConstantRange pushConstantRange{};
+    pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    pushConstantRange.offset = 0;
+    pushConstantRange.size = sizeof(CullingConstants);
+    VkPipelineLayoutCreateInfo pipelineLayoutCreationInfo{};
+    pipelineLayoutCreationInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pipelineLayoutCreationInfo.setLayoutCount = 1;
+    pipelineLayoutCreationInfo.pSetLayouts = &cullingDescriptorSetLayout;
+    pipelineLayoutCreationInfo.pushConstantRangeCount = 1;
+    pipelineLayoutCreationInfo.pPushConstantRanges = &pushConstantRange;
+    if (vkCreatePipelineLayout(logiDevice, &pipelineLayoutCreationInfo, nullptr, &cullingPipelineLayout) != VK_SUCCESS){
+        throw std::runtime_error("failed to create culling pipeline layout");
+    }
+
+    std::vector<char> cShaderBinary = readFile("/Users/kambo/Helium/GameDev/Projects/CGSamples/Vulkan/shaders/c1_meshletCulling.spv");
+    VkShaderModule cShader = createShaderModule(cShaderBinary);
+    VkComputePipelineCreateInfo pipelineCreationInfo{};
+    pipelineCreationInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+    pipelineCreationInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    pipelineCreationInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    pipelineCreationInfo.stage.module = cShader;
+    pipelineCreationInfo.stage.pName = "main";
+    pipelineCreationInfo.layout = cullingPipelineLayout;
+    pipelineCreationInfo.basePipelineHandle = VK_NULL_HANDLE;
+    pipelineCreationInfo.basePipelineIndex = -1;
+    if (vkCreateComputePipelines(logiDevice, pipelineCache.get(), 1, &pipelineCreationInfo, nullptr, &cullingPipeline) != VK_SUCCESS){
+        throw std::runtime_error("failed to create culling pipeline");
+    }
+    vkDestroyShaderModule(logiDevice, cShader, nullptr);
+    std::cout << "meshlet culling: " << meshletCount << " meshlets, " << submeshes.size() << " submeshes" << std::endl;
+}
+
+void HelloTriangleApplication::destroyCullingResources(){
+    if (!gpuCulling){
+        return;
+    }
+    vkDestroyPipeline(logiDevice, cullingPipeline, nullptr);
+    vkDestroyPipelineLayout(logiDevice, cullingPipelineLayout, nullptr);
+    vkDestroyDescriptorPool(logiDevice, cullingDescriptorPool, nullptr);
+    vkDestroyDescriptorSetLayout(logiDevice, cullingDescriptorSetLayout, nullptr);
+    for (size_t i = 0; i < visibleIndexBuffers.size(); i++){
+        vkDestroyBuffer(logiDevice, visibleIndexBuffers[i], nullptr);
+        deviceAllocator.free(visibleIndexBuffersMemory[i]);
+        vkDestroyBuffer(logiDevice, drawIndirectBuffers[i], nullptr);
+        deviceAllocator.free(drawIndirectBuffersMemory[i]);
+    }
+    vkDestroyBuffer(logiDevice, meshletBuffer, nullptr);
+    deviceAllocator.free(meshletBufferMemory);
+}
+
+// Outside of the render pass, before the draw that consumes visibleIndexBuffers[currentFrame].
+void HelloTriangleApplication::recordCulling(VkCommandBuffer buffer){
+    if (!gpuCulling){
+        return;
+    }
+    gpuProfiler.beginScope(buffer, "culling");
+    vkCmdUpdateBuffer(buffer, drawIndirectBuffers[currentFrame], 0, emptyDraws.size() * sizeof(VkDrawIndexedIndirectCommand), emptyDraws.data());
+
+    VkMemoryBarrier resetBarrier{};
+    resetBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    resetBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    resetBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+    vkCmdPipelineBarrier(buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &resetBarrier, 0, nullptr, 0, nullptr);
+
+    vkCmdBindPipeline(buffer, VK_PIPELINE_BIND_POINT_COMPUTE, cullingPipeline);
+    vkCmdBindDescriptorSets(buffer, VK_PIPELINE_BIND_POINT_COMPUTE, cullingPipelineLayout, 0, 1, &cullingDescriptorSets[currentFrame], 0, nullptr);
+    for (uint32_t s = 0; s < submeshes.size(); s++){
+        const MeshLod& lod = submeshes[s].lods[submeshLods[s]];
+        if (lod.meshletCount == 0){
+            continue;
+        }
+        cullingConstants.firstMeshlet = lod.firstMeshlet;
+        cullingConstants.drawIndex = s;
+        vkCmdPushConstants(buffer, cullingPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(cullingConstants), &cullingConstants);
+        vkCmdDispatch(buffer, lod.meshletCount, 1, 1);
+    }
+
+    // The draw reads its count from the command and its indices from the compacted buffer.
+    VkMemoryBarrier cullingBarrier{};
+    cullingBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    cullingBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    cullingBarrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_INDEX_READ_BIT;
+    vkCmdPipelineBarrier(
+        buffer,
+        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+        VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_INPUT_BIT,
+        0, 1, &cullingBarrier, 0, nullptr, 0, nullptr);
+    gpuProfiler.endScope(buffer);
+}
+
+/*
+world: model matrix without the dequantization, meshlet bounds are in the space of the loaded positions.
+Planes are extracted from the rows of projection * view * world (Gribb & Hartmann), which puts them straight in that
+space. Depth is [0,1] (GLM_FORCE_DEPTH_ZERO_TO_ONE): the near plane is the third row alone.
+*/
+void HelloTriangleApplication::updateCullingConstants(const glm::mat4& world, const glm::mat4& view, const glm::mat4& projection){
+    glm::mat4 clip = projection * view * world;
+    glm::vec4 rows[4];
+    for (int r = 0; r < 4; r++){
+        rows[r] = glm::vec4(clip[0][r], clip[1][r], clip[2][r], clip[3][r]);
+    }
+    cullingConstants.planes[0] = rows[3] + rows[0]; // left
+    cullingConstants.planes[1] = rows[3] - rows[0]; // right
+    cullingConstants.planes[2] = rows[3] + rows[1]; // bottom (top with the flipped y)
+    cullingConstants.planes[3] = rows[3] - rows[1];
+    cullingConstants.planes[4] = rows[2]; // near
+    cullingConstants.planes[5] = rows[3] - rows[2]; // far
+    for (glm::vec4& plane : cullingConstants.planes){
+        // Unit normals, so the distance can be compared with the sphere radius.
+        plane /= glm::length(glm::vec3(plane));
+    }
+    cullingConstants.cameraPosition = glm::inverse(view * world) * glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+    cullingConstants.sixteenBitIndices = indexType == VK_INDEX_TYPE_UINT16 ? 1 : 0;
+}
+#endif
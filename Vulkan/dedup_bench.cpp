@@ -0,0 +1,157 @@
+#include "obj_parser.h"
+#include "thread_pool.h"
+#include "vertex_dedup.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+
+/*
+Microbenchmark for the vertex deduplication of loadModel(): the nested unordered_map it used before against
+VertexDedupTable, on an OBJ file (objects/viking_room.obj by default) and on a synthetic grid mesh with 10M indices.
+Only the dedup is timed, parsing is done once up front. Both versions must produce the same index buffer.
+
+usage: dedup_bench [--obj path] [--runs N] [--synthetic-indices N]
+*/
+
+struct DedupResult{
+    std::vector<uint32_t> indices;
+    size_t vertexCount = 0;
+};
+
+// The previous loadModel() loop, inner map copy included.
+static DedupResult dedupNestedMaps(const ObjMesh& mesh){
+    DedupResult result;
+    std::unordered_map<int, std::unordered_map<int,int>> indexToUVToVertCache;
+    for (const ObjIndex& i : mesh.indices){
+        if (indexToUVToVertCache.contains(i.vertex)){
+            std::unordered_map<int,int> UVToVert = indexToUVToVertCache[i.vertex];
+            if (UVToVert.contains(i.texcoord)){
+                result.indices.push_back(UVToVert[i.texcoord]);
+                continue;
+            }
+        }
+        indexToUVToVertCache[i.vertex][i.texcoord] = static_cast<int>(result.vertexCount);
+        result.indices.push_back(static_cast<uint32_t>(result.vertexCount));
+        result.vertexCount++;
+    }
+    return result;
+}
+
+static DedupResult dedupFlatTable(const ObjMesh& mesh){
+    DedupResult result;
+    VertexDedupTable dedup(mesh.indices.size(), mesh.positions.size() / 3, mesh.texcoords.size() / 2, 0);
+    result.indices.reserve(mesh.indices.size());
+    for (ObjIndex i : mesh.indices){
+        i.normal = -1;
+        uint32_t vertIndex;
+        if (dedup.findOrInsert(i, static_cast<uint32_t>(result.vertexCount), vertIndex)){
+            result.vertexCount++;
+        }
+        result.indices.push_back(vertIndex);
+    }
+    return result;
+}
+
+/*
+Grid of quads with its own texcoord per grid point, plus a UV seam every 16 columns (corners on the seam use a second
+texcoord) so some positions map to two vertices, like real meshes.
+*/
+static ObjMesh syntheticGrid(size_t targetIndices){
+    size_t side = 1;
+    while ((side + 1) * (side + 1) * 6 <= targetIndices){
+        side++;
+    }
+    const size_t points = side + 1;
+    ObjMesh mesh;
+    mesh.positions.reserve(points * points * 3);
+    mesh.texcoords.reserve(points * points * 2 * 2);
+    for (size_t y = 0; y < points; y++){
+        for (size_t x = 0; x < points; x++){
+            mesh.positions.insert(mesh.positions.end(), {static_cast<float>(x), static_cast<float>(y), 0.0f});
+            mesh.texcoords.insert(mesh.texcoords.end(), {static_cast<float>(x) / side, static_cast<float>(y) / side});
+        }
+    }
+    const int32_t seamBase = static_cast<int32_t>(points * points);
+    for (size_t y = 0; y < points; y++){
+        for (size_t x = 0; x < points; x++){
+            mesh.texcoords.insert(mesh.texcoords.end(), {1.0f - static_cast<float>(x) / side, static_cast<float>(y) / side});
+        }
+    }
+    mesh.indices.reserve(side * side * 6);
+    for (size_t y = 0; y < side; y++){
+        for (size_t x = 0; x < side; x++){
+            int32_t corners[4] = {
+                static_cast<int32_t>(y * points + x), static_cast<int32_t>(y * points + x + 1),
+                static_cast<int32_t>((y + 1) * points + x + 1), static_cast<int32_t>((y + 1) * points + x)
+            };
+            bool seam = x % 16 == 15;
+            auto corner = [&](int c){
+                int32_t texcoord = corners[c];
+                // Right side of the quads left of the seam uses the mirrored texcoords
+                if (seam && (c == 1 || c == 2)){
+                    texcoord += seamBase;
+                }
+                return ObjIndex{corners[c], texcoord, -1};
+            };
+            for (int c : {0, 1, 2, 0, 2, 3}){
+                mesh.indices.push_back(corner(c));
+            }
+        }
+    }
+    return mesh;
+}
+
+template <typename F>
+static double medianMilliseconds(uint32_t runs, F&& f){
+    std::vector<double> samples;
+    for (uint32_t r = 0; r < runs; r++){
+        auto start = std::chrono::steady_clock::now();
+        f();
+        samples.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+    }
+    std::sort(samples.begin(), samples.end());
+    return samples[samples.size() / 2];
+}
+
+static void run(const char* name, const ObjMesh& mesh, uint32_t runs){
+    DedupResult nested = dedupNestedMaps(mesh);
+    DedupResult flat = dedupFlatTable(mesh);
+    if (nested.vertexCount != flat.vertexCount || nested.indices != flat.indices){
+        throw std::runtime_error(std::string(name) + ": flat table and nested maps disagree");
+    }
+    double nestedMs = medianMilliseconds(runs, [&]{ dedupNestedMaps(mesh); });
+    double flatMs = medianMilliseconds(runs, [&]{ dedupFlatTable(mesh); });
+    std::cout << name << ": " << mesh.indices.size() << " indices -> " << flat.vertexCount << " vertices" << std::endl;
+    std::cout << "    nested unordered_map: " << nestedMs << " ms" << std::endl;
+    std::cout << "    flat table:           " << flatMs << " ms (" << nestedMs / flatMs << "x)" << std::endl;
+}
+
+int main(int argc, char** argv){
+    std::string objPath = "objects/viking_room.obj";
+    uint32_t runs = 5;
+    size_t syntheticIndices = 10'000'000;
+    for (int i = 1; i < argc; i++){
+        if (strcmp(argv[i], "--obj") == 0 && i + 1 < argc){
+            objPath = argv[++i];
+        }else if (strcmp(argv[i], "--runs") == 0 && i + 1 < argc){
+            runs = std::max(1u, static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10)));
+        }else if (strcmp(argv[i], "--synthetic-indices") == 0 && i + 1 < argc){
+            syntheticIndices = std::strtoull(argv[++i], nullptr, 10);
+        }else{
+            std::cerr << "usage: dedup_bench [--obj path] [--runs N] [--synthetic-indices N]" << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+    try{
+        run(objPath.c_str(), parseObj(objPath, ThreadPool::shared()), runs);
+        run("synthetic grid", syntheticGrid(syntheticIndices), runs);
+    }catch (const std::exception& e){
+        std::cerr << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
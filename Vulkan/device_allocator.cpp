@@ -0,0 +1,294 @@
+#include "device_allocator.h"
+#include <algorithm>
+#include <stdexcept>
+
+static VkDeviceSize nextPowerOfTwo(VkDeviceSize v){
+    VkDeviceSize p = 1;
+    while (p < v){
+        p <<= 1;
+    }
+    return p;
+}
+
+static uint32_t orderOf(VkDeviceSize nodeSize){
+    uint32_t order = 0;
+    while ((DeviceMemoryAllocator::MIN_NODE_SIZE << order) < nodeSize){
+        order++;
+    }
+    return order;
+}
+
+// Smallest free node of at least the given order, split down to it. Returns false if the block has no room.
+static bool buddyAllocate(DeviceMemoryBlock& block, uint32_t order, VkDeviceSize& offset){
+    uint32_t found = order;
+    while (found <= block.maxOrder && block.freeNodes[found].empty()){
+        found++;
+    }
+    if (found > block.maxOrder){
+        return false;
+    }
+    offset = *block.freeNodes[found].begin();
+    block.freeNodes[found].erase(block.freeNodes[found].begin());
+    // Keep the lower half, the upper half becomes a free buddy one order down.
+    while (found > order){
+        found--;
+        block.freeNodes[found].insert(offset + (DeviceMemoryAllocator::MIN_NODE_SIZE << found));
+    }
+    return true;
+}
+
+static void buddyFree(DeviceMemoryBlock& block, VkDeviceSize offset, uint32_t order){
+    // Merge with the buddy as long as it is free, the buddy of a node is found by flipping its size bit.
+    while (order < block.maxOrder){
+        VkDeviceSize buddy = offset ^ (DeviceMemoryAllocator::MIN_NODE_SIZE << order);
+        if (block.freeNodes[order].erase(buddy) == 0){
+            break;
+        }
+        offset = std::min(offset, buddy);
+        order++;
+    }
+    block.freeNodes[order].insert(offset);
+}
+
+static VkDeviceSize largestFreeNode(const DeviceMemoryBlock& block){
+    for (int32_t order = static_cast<int32_t>(block.maxOrder); order >= 0; order--){
+        if (!block.freeNodes[order].empty()){
+            return DeviceMemoryAllocator::MIN_NODE_SIZE << order;
+        }
+    }
+    return 0;
+}
+
+void DeviceMemoryAllocator::init(VkPhysicalDevice physicalDevice, VkDevice logicalDevice, VkDeviceSize blockSize){
+    device = logicalDevice;
+    preferredBlockSize = nextPowerOfTwo(std::max(blockSize, MIN_NODE_SIZE));
+    vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
+
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+    bufferImageGranularity = properties.limits.bufferImageGranularity;
+    maxAllocationCount = properties.limits.maxMemoryAllocationCount;
+    std::cout << "device allocator: " << preferredBlockSize / (1024 * 1024) << "MiB blocks, bufferImageGranularity " << bufferImageGranularity
+              << (bufferImageGranularity > MIN_NODE_SIZE ? " (linear and optimal resources use separate blocks)" : "") << std::endl;
+}
+
+void DeviceMemoryAllocator::destroy(){
+    for (Pool& pool : pools){
+        for (std::unique_ptr<DeviceMemoryBlock>& block : pool.blocks){
+            if (block->allocationCount > 0){
+                std::cerr << "device allocator: " << block->allocationCount << " allocations leaked in memory type " << pool.memoryType << std::endl;
+            }
+            releaseDeviceMemory(block->memory);
+        }
+    }
+    pools.clear();
+    if (dedicatedCount > 0){
+        std::cerr << "device allocator: " << dedicatedCount << " dedicated allocations leaked" << std::endl;
+    }
+}
+
+bool DeviceMemoryAllocator::isHostVisible(uint32_t memoryType) const{
+    return (memoryProperties.memoryTypes[memoryType].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) != 0;
+}
+
+VkDeviceSize DeviceMemoryAllocator::blockSizeFor(uint32_t memoryType) const{
+    // Small heaps (e.g. the 256MiB BAR heap on discrete GPUs) should not be eaten by a couple of blocks.
+    VkDeviceSize heapSize = memoryProperties.memoryHeaps[memoryProperties.memoryTypes[memoryType].heapIndex].size;
+    VkDeviceSize size = preferredBlockSize;
+    while (size > MIN_NODE_SIZE && size > heapSize / 8){
+        size >>= 1;
+    }
+    return size;
+}
+
+DeviceMemoryAllocator::Pool& DeviceMemoryAllocator::poolFor(uint32_t memoryType, bool linear){
+    // Node alignment already keeps linear and optimal resources on different granularity pages when it is small enough.
+    bool separate = bufferImageGranularity > MIN_NODE_SIZE;
+    bool poolLinear = separate ? linear : true;
+    for (Pool& pool : pools){
+        if (pool.memoryType == memoryType && pool.linear == poolLinear){
+            return pool;
+        }
+    }
+    Pool pool;
+    pool.memoryType = memoryType;
+    pool.linear = poolLinear;
+    pools.push_back(std::move(pool));
+    return pools.back();
+}
+
+VkDeviceMemory DeviceMemoryAllocator::allocateDeviceMemory(VkDeviceSize size, uint32_t memoryType, void** mapped){
+    if (maxAllocationCount != 0 && liveDeviceMemoryCount >= maxAllocationCount){
+        throw std::runtime_error("device allocator: maxMemoryAllocationCount reached");
+    }
+    VkMemoryAllocateInfo allocationInfo{};
+    allocationInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    allocationInfo.allocationSize = size;
+    allocationInfo.memoryTypeIndex = memoryType;
+
+    VkDeviceMemory memory;
+    if (vkAllocateMemory(device, &allocationInfo, nullptr, &memory) != VK_SUCCESS){
+        throw std::runtime_error("device allocator: failed to allocate device memory");
+    }
+    liveDeviceMemoryCount++;
+    *mapped = nullptr;
+    // Mapped once for its whole lifetime, mapping is not free and only one map per VkDeviceMemory is allowed anyway.
+    if (isHostVisible(memoryType) && vkMapMemory(device, memory, 0, VK_WHOLE_SIZE, 0, mapped) != VK_SUCCESS){
+        throw std::runtime_error("device allocator: failed to map host visible memory");
+    }
+    return memory;
+}
+
+void DeviceMemoryAllocator::releaseDeviceMemory(VkDeviceMemory memory){
+    // Freeing implicitly unmaps.
+    vkFreeMemory(device, memory, nullptr);
+    liveDeviceMemoryCount--;
+}
+
+DeviceAllocation DeviceMemoryAllocator::allocate(const VkMemoryRequirements& requirements, uint32_t memoryTypeIndex, bool linear){
+    DeviceAllocation allocation{};
+    allocation.size = requirements.size;
+    allocation.memoryType = memoryTypeIndex;
+
+    VkDeviceSize blockSize = blockSizeFor(memoryTypeIndex);
+    VkDeviceSize nodeSize = nextPowerOfTwo(std::max({requirements.size, requirements.alignment, MIN_NODE_SIZE}));
+    if (nodeSize > blockSize / 2){
+        void* mapped;
+        allocation.memory = allocateDeviceMemory(requirements.size, memoryTypeIndex, &mapped);
+        allocation.mapped = mapped;
+        dedicatedCount++;
+        dedicatedBytes += requirements.size;
+        return allocation;
+    }
+
+    uint32_t order = orderOf(nodeSize);
+    Pool& pool = poolFor(memoryTypeIndex, linear);
+    VkDeviceSize offset = 0;
+    DeviceMemoryBlock* target = nullptr;
+    for (std::unique_ptr<DeviceMemoryBlock>& block : pool.blocks){
+        if (buddyAllocate(*block, order, offset)){
+            target = block.get();
+            break;
+        }
+    }
+    if (target == nullptr){
+        auto block = std::make_unique<DeviceMemoryBlock>();
+        void* mapped;
+        block->memory = allocateDeviceMemory(blockSize, memoryTypeIndex, &mapped);
+        block->mapped = static_cast<uint8_t*>(mapped);
+        block->size = blockSize;
+        block->maxOrder = orderOf(blockSize);
+        block->freeNodes.resize(block->maxOrder + 1);
+        block->freeNodes[block->maxOrder].insert(0);
+        buddyAllocate(*block, order, offset);
+        target = block.get();
+        pool.blocks.push_back(std::move(block));
+    }
+
+    target->allocationCount++;
+    target->reservedBytes += nodeSize;
+    target->requestedBytes += requirements.size;
+
+    allocation.memory = target->memory;
+    allocation.offset = offset;
+    allocation.mapped = target->mapped != nullptr ? target->mapped + offset : nullptr;
+    allocation.block = target;
+    allocation.order = order;
+    return allocation;
+}
+
+void DeviceMemoryAllocator::free(DeviceAllocation& allocation){
+    if (allocation.memory == VK_NULL_HANDLE){
+        return;
+    }
+    if (allocation.block == nullptr){
+        releaseDeviceMemory(allocation.memory);
+        dedicatedCount--;
+        dedicatedBytes -= allocation.size;
+        allocation = {};
+        return;
+    }
+
+    DeviceMemoryBlock* block = allocation.block;
+    buddyFree(*block, allocation.offset, allocation.order);
+    block->allocationCount--;
+    block->reservedBytes -= MIN_NODE_SIZE << allocation.order;
+    block->requestedBytes -= allocation.size;
+
+    if (block->allocationCount == 0){
+        // Keep one empty block per pool around so that short lived resources (staging buffers) do not hit vkAllocateMemory every time.
+        for (Pool& pool : pools){
+            auto owner = std::find_if(pool.blocks.begin(), pool.blocks.end(), [block](const std::unique_ptr<DeviceMemoryBlock>& b){ return b.get() == block; });
+            if (owner == pool.blocks.end()){
+                continue;
+            }
+            bool otherEmpty = std::any_of(pool.blocks.begin(), pool.blocks.end(), [block](const std::unique_ptr<DeviceMemoryBlock>& b){
+                return b.get() != block && b->allocationCount == 0;
+            });
+            if (otherEmpty){
+                releaseDeviceMemory(block->memory);
+                pool.blocks.erase(owner);
+            }
+            break;
+        }
+    }
+    allocation = {};
+}
+
+DeviceMemoryAllocator::Stats DeviceMemoryAllocator::getStats() const{
+    Stats stats{};
+    VkDeviceSize contiguousFreeBytes = 0;
+    stats.dedicatedCount = dedicatedCount;
+    stats.dedicatedBytes = dedicatedBytes;
+    for (const Pool& pool : pools){
+        for (const std::unique_ptr<DeviceMemoryBlock>& block : pool.blocks){
+            stats.blockCount++;
+            stats.allocationCount += block->allocationCount;
+            stats.blockBytes += block->size;
+            stats.reservedBytes += block->reservedBytes;
+            stats.requestedBytes += block->requestedBytes;
+            VkDeviceSize largest = largestFreeNode(*block);
+            stats.largestFreeNode = std::max(stats.largestFreeNode, largest);
+            contiguousFreeBytes += largest;
+        }
+    }
+    if (stats.reservedBytes > 0){
+        stats.internalFragmentation = 1.0 - static_cast<double>(stats.requestedBytes) / stats.reservedBytes;
+    }
+    VkDeviceSize freeBytes = stats.blockBytes - stats.reservedBytes;
+    if (freeBytes > 0){
+        stats.externalFragmentation = 1.0 - static_cast<double>(contiguousFreeBytes) / freeBytes;
+    }
+    return stats;
+}
+
+VkDeviceSize DeviceMemoryAllocator::freeBytesOnHeap(uint32_t heapIndex) const{
+    VkDeviceSize freeBytes = 0;
+    for (const Pool& pool : pools){
+        if (memoryProperties.memoryTypes[pool.memoryType].heapIndex != heapIndex){
+            continue;
+        }
+        for (const std::unique_ptr<DeviceMemoryBlock>& block : pool.blocks){
+            freeBytes += block->size - block->reservedBytes;
+        }
+    }
+    return freeBytes;
+}
+
+void DeviceMemoryAllocator::printStats(const std::string& label) const{
+    Stats s = getStats();
+    std::cout << "device allocator (" << label << "): "
+              << s.allocationCount << " allocations in " << s.blockCount << " blocks (" << s.blockBytes / 1024 << "KiB), "
+              << s.dedicatedCount << " dedicated (" << s.dedicatedBytes / 1024 << "KiB), "
+              << "requested " << s.requestedBytes / 1024 << "KiB / reserved " << s.reservedBytes / 1024 << "KiB, "
+              << "internal fragmentation " << s.internalFragmentation * 100.0 << "%, "
+              << "external fragmentation " << s.externalFragmentation * 100.0 << "%, "
+              << "VkDeviceMemory objects " << liveDeviceMemoryCount << "/" << maxAllocationCount << std::endl;
+    for (const Pool& pool : pools){
+        for (const std::unique_ptr<DeviceMemoryBlock>& block : pool.blocks){
+            std::cout << "    type " << pool.memoryType << (pool.linear ? " linear " : " optimal ")
+                      << block->reservedBytes / 1024 << "/" << block->size / 1024 << "KiB used, "
+                      << block->allocationCount << " allocations" << std::endl;
+        }
+    }
+}
@@ -0,0 +1,110 @@
+#pragma once
+
+#include "heliumutils.h"
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+// One VkDeviceMemory carved up by DeviceMemoryAllocator, only the allocator touches it.
+struct DeviceMemoryBlock{
+    VkDeviceMemory memory = VK_NULL_HANDLE;
+    VkDeviceSize size = 0;
+    uint32_t maxOrder = 0; // size == MIN_NODE_SIZE << maxOrder
+    uint8_t* mapped = nullptr;
+    // Free node offsets per order. Ordered so the lowest offset is reused first, which keeps blocks compact.
+    std::vector<std::set<VkDeviceSize>> freeNodes;
+    VkDeviceSize reservedBytes = 0;
+    VkDeviceSize requestedBytes = 0;
+    uint32_t allocationCount = 0;
+};
+
+/*
+A range of device memory handed out by DeviceMemoryAllocator.
+Bind with vkBind*Memory(device, resource, allocation.memory, allocation.offset).
+*/
+struct DeviceAllocation{
+    VkDeviceMemory memory = VK_NULL_HANDLE;
+    VkDeviceSize offset = 0;
+    VkDeviceSize size = 0; // What was requested, the reserved range can be bigger (see DeviceMemoryAllocator)
+    // Persistently mapped pointer to offset for HOST_VISIBLE memory types, nullptr otherwise. Never vkMapMemory an allocation.
+    void* mapped = nullptr;
+    uint32_t memoryType = 0;
+
+    // Owning block, nullptr for dedicated allocations (own VkDeviceMemory).
+    DeviceMemoryBlock* block = nullptr;
+    uint32_t order = 0; // Buddy order of the reserved node: reserved size is MIN_NODE_SIZE << order
+};
+
+/*
+Sub-allocator for device memory.
+vkAllocateMemory is slow and drivers only guarantee maxMemoryAllocationCount (as low as 4096) live allocations,
+so instead of one allocation per resource we allocate big blocks per memory type and place resources inside them.
+
+Placement is a buddy allocator: each block is a power of two, split in halves until the smallest node fitting the request.
+Nodes are aligned to their own size, so any Vulkan alignment (always a power of two) up to the node size is satisfied for free.
+The price is internal fragmentation (up to ~50% of a node), reported by getStats().
+
+bufferImageGranularity: linear resources (buffers, linear images) and optimal images may not share a "page" of that size.
+If the granularity is bigger than MIN_NODE_SIZE they are kept in separate blocks, otherwise node alignment already keeps them apart.
+
+Requests bigger than half a block get a dedicated VkDeviceMemory.
+Not thread safe, only used from the thread that owns the device.
+*/
+class DeviceMemoryAllocator{
+public:
+    static constexpr VkDeviceSize DEFAULT_BLOCK_SIZE = 64ull * 1024 * 1024;
+    static constexpr VkDeviceSize MIN_NODE_SIZE = 256;
+
+    struct Stats{
+        uint32_t blockCount = 0;
+        uint32_t dedicatedCount = 0;
+        uint32_t allocationCount = 0; // Live sub-allocations (dedicated excluded)
+        VkDeviceSize blockBytes = 0;      // Total size of all blocks
+        VkDeviceSize reservedBytes = 0;   // Bytes taken by buddy nodes
+        VkDeviceSize requestedBytes = 0;  // Bytes actually requested by the resources living in those nodes
+        VkDeviceSize dedicatedBytes = 0;
+        VkDeviceSize largestFreeNode = 0; // Biggest request that fits without a new block
+        // 1 - requested/reserved: space lost to rounding up to a power of two
+        double internalFragmentation = 0.0;
+        // 1 - (sum of each block's largest free node)/freeBytes: how scattered the free space inside blocks is
+        double externalFragmentation = 0.0;
+    };
+
+    void init(VkPhysicalDevice physicalDevice, VkDevice device, VkDeviceSize preferredBlockSize = DEFAULT_BLOCK_SIZE);
+    // Frees every block, all allocations must have been freed (leaks are reported).
+    void destroy();
+
+    // linear: buffers and VK_IMAGE_TILING_LINEAR images, false for optimal images.
+    DeviceAllocation allocate(const VkMemoryRequirements& requirements, uint32_t memoryTypeIndex, bool linear);
+    void free(DeviceAllocation& allocation);
+
+    Stats getStats() const;
+    // Bytes of the blocks in memory heap heapIndex that no allocation uses, new allocations of its types fit there first.
+    VkDeviceSize freeBytesOnHeap(uint32_t heapIndex) const;
+    void printStats(const std::string& label) const;
+
+private:
+    struct Pool{
+        uint32_t memoryType = 0;
+        bool linear = true;
+        std::vector<std::unique_ptr<DeviceMemoryBlock>> blocks;
+    };
+
+    VkDevice device = VK_NULL_HANDLE;
+    VkPhysicalDeviceMemoryProperties memoryProperties{};
+    VkDeviceSize bufferImageGranularity = 1;
+    VkDeviceSize preferredBlockSize = DEFAULT_BLOCK_SIZE;
+    uint32_t maxAllocationCount = 0;
+    uint32_t liveDeviceMemoryCount = 0;
+
+    std::vector<Pool> pools; // One per memory type (times two when linear and optimal resources must be separated)
+    uint32_t dedicatedCount = 0;
+    VkDeviceSize dedicatedBytes = 0;
+
+    Pool& poolFor(uint32_t memoryType, bool linear);
+    VkDeviceSize blockSizeFor(uint32_t memoryType) const;
+    VkDeviceMemory allocateDeviceMemory(VkDeviceSize size, uint32_t memoryType, void** mapped);
+    void releaseDeviceMemory(VkDeviceMemory memory);
+    bool isHostVisible(uint32_t memoryType) const;
+};
@@ -25,6 +25,9 @@ bool HelloTriangleApplication::rateDeviceSupport(VkPhysicalDevice vkpd){
     if (!features.samplerAnisotropy){ // We need anisotropic filtering.
         return false;
     }
+    if (headless){ // No surface to check the swapchain against.
+        return true;
+    }
     SwapChainSpecifications swapChainSpecs = checkSwapChainSpecifications(vkpd);
     if (swapChainSpecs.presentModes.empty() || swapChainSpecs.imageFormats.empty()){
         return false;
@@ -78,16 +81,50 @@ HelloTriangleApplication::QueueFamilyIndices HelloTriangleApplication::findRequi
         if (family.queueFlags & VK_QUEUE_GRAPHICS_BIT){ // Find first family to support graphic command queueing.
             qfi.graphicsFamilyIndex = familyIndex;
         }
-        uint32_t surfacePresentationSupport = 0;
-        vkGetPhysicalDeviceSurfaceSupportKHR(vkpd, familyIndex, renderSurface, &surfacePresentationSupport);
-        if (surfacePresentationSupport){ // same as xxx != 0
-            qfi.presentationFamilyIndex = familyIndex;
+        if (headless){
+            // Nothing is ever presented, alias the presentation queue to the graphics one so the rest of the setup is unchanged.
+            qfi.presentationFamilyIndex = qfi.graphicsFamilyIndex;
+        }else{
+            uint32_t surfacePresentationSupport = 0;
+            vkGetPhysicalDeviceSurfaceSupportKHR(vkpd, familyIndex, renderSurface, &surfacePresentationSupport);
+            if (surfacePresentationSupport){ // same as xxx != 0
+                qfi.presentationFamilyIndex = familyIndex;
+            }
         }
         if(qfi.has_values()){
             break;
         }
         familyIndex++;
     }
+
+    #ifndef HELIUM_DISABLE_TRANSFER_QUEUE
+    /*
+    Optional family for staging copies, so they do not take time on the graphics queue.
+    Transfer only families (the DMA engines of discrete GPUs) first, then compute ones (async compute, transfers are implied).
+    Uploads copy partial images row by row, families with a coarser image transfer granularity than a texel are skipped.
+    */
+    std::optional<uint32_t> computeFamily;
+    for (uint32_t i = 0; i < familyCount; i++){
+        const VkQueueFamilyProperties& family = families[i];
+        if ((family.queueFlags & VK_QUEUE_GRAPHICS_BIT) != 0 || (family.queueFlags & (VK_QUEUE_TRANSFER_BIT | VK_QUEUE_COMPUTE_BIT)) == 0){
+            continue;
+        }
+        const VkExtent3D& granularity = family.minImageTransferGranularity;
+        if (granularity.width != 1 || granularity.height != 1 || granularity.depth != 1){
+            continue;
+        }
+        if ((family.queueFlags & VK_QUEUE_COMPUTE_BIT) == 0){
+            qfi.transferFamilyIndex = i;
+            break;
+        }
+        if (!computeFamily.has_value()){
+            computeFamily = i;
+        }
+    }
+    if (!qfi.transferFamilyIndex.has_value()){
+        qfi.transferFamilyIndex = computeFamily;
+    }
+    #endif
     return qfi;
 }
 
@@ -105,7 +142,8 @@ bool HelloTriangleApplication::supportsRequiredDeviceExtensions(VkPhysicalDevice
         std::cout << xt.extensionName << std::endl;
     }
     #endif
-    std::set<std::string> requiredExtensions(requiredDeviceExtensionNames.begin(), requiredDeviceExtensionNames.end());
+    std::vector<const char*> requiredExtensionNames = getRequiredDeviceExtensions();
+    std::set<std::string> requiredExtensions(requiredExtensionNames.begin(), requiredExtensionNames.end());
     for(const auto& ext: extensionProperties){
         requiredExtensions.erase(ext.extensionName);
     };
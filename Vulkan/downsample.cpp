@@ -0,0 +1,269 @@
+#include "main.h"
+
+/*
+Compute mip generation, see c2_mipDownsample for the reduction itself.
+One dispatch writes up to 12 levels of an image: every workgroup reduces a 64x64 tile through 6 levels in shared memory and
+the last one to finish carries on from the level with one texel per tile. Compared with the blits there is no barrier per level,
+the levels are not serialized on each other and level 0 is read once. The shader only knows rgba8, other formats (Hi-Z depth,
+HDR bloom chains) would need a variant with their storage format, the dispatch logic stays the same.
+*/
+void HelloTriangleApplication::createDownsampleResources(){
+    HELIUM_PROFILE_FUNCTION();
+    gpuDownsample = false;
+    #ifndef HELIUM_DISABLE_COMPUTE_MIPMAPS
+    VkPhysicalDeviceProperties deviceProperties;
+    vkGetPhysicalDeviceProperties(physGraphicDevice, &deviceProperties);
+    uint32_t familyCount = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(physGraphicDevice, &familyCount, nullptr);
+    std::vector<VkQueueFamilyProperties> families(familyCount);
+    vkGetPhysicalDeviceQueueFamilyProperties(physGraphicDevice, &familyCount, families.data());
+    uint32_t graphicsFamily = findRequiredQueueFamily(physGraphicDevice).graphicsFamilyIndex.value();
+    // 256 invocations and 20KiB of shared memory per workgroup are above the guaranteed minimums (128 and 16KiB).
+    const uint32_t sharedBytes = (32 * 32 + 16 * 16) * 16 + 4;
+    const VkPhysicalDeviceLimits& limits = deviceProperties.limits;
+    if ((families[graphicsFamily].queueFlags & VK_QUEUE_COMPUTE_BIT) == 0 || limits.maxComputeWorkGroupInvocations < 256
+        || limits.maxComputeWorkGroupSize[0] < 256 || limits.maxComputeSharedMemorySize < sharedBytes){
+        std::cout << "compute mip generation disabled, mips are blitted" << std::endl;
+        return;
+    }
+    gpuDownsample = true;
+
+    // Finished workgroups of the running dispatch, the last one puts it back to 0.
+    createAndBindDeviceBuffer(
+        sizeof(uint32_t),
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+        downsampleCounterBuffer,
+        downsampleCounterMemory
+    );
+    VkCommandBuffer cb = beginOneTimeCommands("layout_transition");
+    vkCmdFillBuffer(cb, downsampleCounterBuffer, 0, VK_WHOLE_SIZE, 0);
+    VkMemoryBarrier fillBarrier{};
+    fillBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    fillBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    fillBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+    vkCmdPipelineBarrier(cb, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &fillBarrier, 0, nullptr, 0, nullptr);
+    endAndSubmitOneTimeCommands(cb);
+
+    /*
+    Bindings:
+    0: every level of the image, storage images
+    1: the workgroup counter, storage buffer
+    */
+    std::array<VkDescriptorSetLayoutBinding, 2> bindings{};
+    bindings[0].binding = 0;
+    bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+    bindings[0].descriptorCount = DOWNSAMPLE_MAX_LEVELS;
+    bindings[0].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    bindings[1].binding = 1;
+    bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    bindings[1].descriptorCount = 1;
+    bindings[1].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    VkDescriptorSetLayoutCreateInfo layoutCreationInfo{};
+    layoutCreationInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    layoutCreationInfo.bindingCount = static_cast<uint32_t>(bindings.size());
+    layoutCreationInfo.pBindings = bindings.data();
+    if (vkCreateDescriptorSetLayout(logiDevice, &layoutCreationInfo, nullptr, &downsampleDescriptorSetLayout) != VK_SUCCESS){
+        throw std::runtime_error("failed to create downsample descriptor set layout");
+    }
+
+    VkPushConstantRange pushConstantRange{};
+    pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    pushConstantRange.offset = 0;
+    pushConstantRange.size = sizeof(DownsampleConstants);
+    VkPipelineLayoutCreateInfo pipelineLayoutCreationInfo{};
+    pipelineLayoutCreationInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pipelineLayoutCreationInfo.setLayoutCount = 1;
+    pipelineLayoutCreationInfo.pSetLayouts = &downsampleDescriptorSetLayout;
+    pipelineLayoutCreationInfo.pushConstantRangeCount = 1;
+    pipelineLayoutCreationInfo.pPushConstantRanges = &pushConstantRange;
+    if (vkCreatePipelineLayout(logiDevice, &pipelineLayoutCreationInfo, nullptr, &downsamplePipelineLayout) != VK_SUCCESS){
+        throw std::runtime_error("failed to create downsample pipeline layout");
+    }
+
+    std::vector<char> cShaderBinary = readFile("/Users/kambo/Helium/GameDev/Projects/CGSamples/Vulkan/shaders/c2_mipDownsample.spv");
+    VkShaderModule cShader = createShaderModule(cShaderBinary);
+    VkComputePipelineCreateInfo pipelineCreationInfo{};
+    pipelineCreationInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+    pipelineCreationInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    pipelineCreationInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    pipelineCreationInfo.stage.module = cShader;
+    pipelineCreationInfo.stage.pName = "main";
+    pipelineCreationInfo.layout = downsamplePipelineLayout;
+    pipelineCreationInfo.basePipelineHandle = VK_NULL_HANDLE;
+    pipelineCreationInfo.basePipelineIndex = -1;
+    if (vkCreateComputePipelines(logiDevice, pipelineCache.get(), 1, &pipelineCreationInfo, nullptr, &downsamplePipeline) != VK_SUCCESS){
+        throw std::runtime_error("failed to create downsample pipeline");
+    }
+    vkDestroyShaderModule(logiDevice, cShader, nullptr);
+    #endif
+}
+
+void HelloTriangleApplication::destroyDownsampleResources(){
+    if (!gpuDownsample){
+        return;
+    }
+    vkDestroyPipeline(logiDevice, downsamplePipeline, nullptr);
+    vkDestroyPipelineLayout(logiDevice, downsamplePipelineLayout, nullptr);
+    vkDestroyDescriptorSetLayout(logiDevice, downsampleDescriptorSetLayout, nullptr);
+    vkDestroyBuffer(logiDevice, downsampleCounterBuffer, nullptr);
+    deviceAllocator.free(downsampleCounterMemory);
+}
+
+/*
+Format of the storage views c2_mipDownsample writes the levels of a format through, VK_FORMAT_UNDEFINED when it cannot.
+sRGB formats are seldom storage capable: their images are created in the UNORM format (mutable) and the shader does the encoding.
+*/
+VkFormat HelloTriangleApplication::downsampleStorageFormat(VkFormat format){
+    if (!gpuDownsample){
+        return VK_FORMAT_UNDEFINED;
+    }
+    VkFormat storageFormat;
+    switch (format){
+        case VK_FORMAT_R8G8B8A8_SRGB:
+        case VK_FORMAT_R8G8B8A8_UNORM:
+            storageFormat = VK_FORMAT_R8G8B8A8_UNORM;
+            break;
+        default:
+            return VK_FORMAT_UNDEFINED;
+    }
+    VkFormatProperties formatProps;
+    vkGetPhysicalDeviceFormatProperties(physGraphicDevice, storageFormat, &formatProps);
+    if ((formatProps.optimalTilingFeatures & VK_FORMAT_FEATURE_STORAGE_IMAGE_BIT) == 0){
+        return VK_FORMAT_UNDEFINED;
+    }
+    return storageFormat;
+}
+
+/*
+Generates levels [1, levels) of image from level 0, which must be in GENERAL (levels > 1). Every level ends up SHADER_READ_ONLY.
+Recorded into the open upload batch, the views and the descriptor set of the image are released when it completes.
+Images whose level 6 is still wider than 64 texels (above 4096) get a dispatch per 6 levels until it is not.
+*/
+void HelloTriangleApplication::generateImageMipMapsCompute(VkImage image, VkFormat storageFormat, bool srgb, uint32_t width, uint32_t height, uint32_t levels){
+    HELIUM_PROFILE_FUNCTION();
+    // Level views, the bindings past the end of the chain repeat the last one.
+    std::vector<VkImageView> views(levels);
+    for (uint32_t l = 0; l < levels; l++){
+        views[l] = createViewFor2DImage(image, 1, storageFormat, VK_IMAGE_ASPECT_COLOR_BIT, static_cast<int>(l));
+    }
+    std::vector<uint32_t> baseLevels;
+    for (uint32_t base = 0; base + 1 < levels;){
+        uint32_t count = std::min(levels - 1 - base, DOWNSAMPLE_MAX_LEVELS - 1);
+        if (std::max(width >> base, height >> base) > 4096){
+            count = std::min(count, 6u); // The last workgroup could not cover level base + 6 by itself
+        }
+        baseLevels.push_back(base);
+        base += count;
+    }
+    baseLevels.push_back(levels - 1);
+
+    std::array<VkDescriptorPoolSize, 2> poolSizes{};
+    poolSizes[0].type = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+    poolSizes[0].descriptorCount = DOWNSAMPLE_MAX_LEVELS * static_cast<uint32_t>(baseLevels.size() - 1);
+    poolSizes[1].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    poolSizes[1].descriptorCount = static_cast<uint32_t>(baseLevels.size() - 1);
+    VkDescriptorPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+    poolInfo.pPoolSizes = poolSizes.data();
+    poolInfo.maxSets = static_cast<uint32_t>(baseLevels.size() - 1);
+    VkDescriptorPool pool;
+    if (vkCreateDescriptorPool(logiDevice, &poolInfo, nullptr, &pool) != VK_SUCCESS){
+        throw std::runtime_error("failed to create downsample descriptor pool");
+    }
+    std::vector<VkDescriptorSetLayout> layouts(baseLevels.size() - 1, downsampleDescriptorSetLayout);
+    std::vector<VkDescriptorSet> sets(layouts.size());
+    VkDescriptorSetAllocateInfo allocationInfo{};
+    allocationInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    allocationInfo.descriptorPool = pool;
+    allocationInfo.descriptorSetCount = static_cast<uint32_t>(sets.size());
+    allocationInfo.pSetLayouts = layouts.data();
+    if (vkAllocateDescriptorSets(logiDevice, &allocationInfo, sets.data()) != VK_SUCCESS){
+        throw std::runtime_error("failed to allocate downsample descriptor sets");
+    }
+    // Binding i of the set of a dispatch is level base + i, so the shader indexes its levels from the base.
+    for (size_t d = 0; d < sets.size(); d++){
+        std::array<VkDescriptorImageInfo, DOWNSAMPLE_MAX_LEVELS> imageInfos{};
+        for (uint32_t b = 0; b < DOWNSAMPLE_MAX_LEVELS; b++){
+            imageInfos[b].imageView = views[std::min(baseLevels[d] + b, levels - 1)];
+            imageInfos[b].imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+        }
+        VkDescriptorBufferInfo counterInfo{downsampleCounterBuffer, 0, VK_WHOLE_SIZE};
+        std::array<VkWriteDescriptorSet, 2> writes{};
+        writes[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        writes[0].dstSet = sets[d];
+        writes[0].dstBinding = 0;
+        writes[0].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+        writes[0].descriptorCount = DOWNSAMPLE_MAX_LEVELS;
+        writes[0].pImageInfo = imageInfos.data();
+        writes[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        writes[1].dstSet = sets[d];
+        writes[1].dstBinding = 1;
+        writes[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        writes[1].descriptorCount = 1;
+        writes[1].pBufferInfo = &counterInfo;
+        vkUpdateDescriptorSets(logiDevice, static_cast<uint32_t>(writes.size()), writes.data(), 0, nullptr);
+    }
+
+    VkCommandBuffer cb = beginOneTimeCommands("mip_generation");
+    // Level 0 was uploaded straight to GENERAL, the others are written without being read first.
+    VkImageMemoryBarrier levelsBarrier{};
+    levelsBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    levelsBarrier.image = image;
+    levelsBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    levelsBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    levelsBarrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    levelsBarrier.subresourceRange.baseMipLevel = 1;
+    levelsBarrier.subresourceRange.levelCount = levels - 1;
+    levelsBarrier.subresourceRange.baseArrayLayer = 0;
+    levelsBarrier.subresourceRange.layerCount = 1;
+    levelsBarrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    levelsBarrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+    levelsBarrier.srcAccessMask = 0;
+    levelsBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+    // The counter was last written by the previous generation (or filled), both on this queue.
+    VkMemoryBarrier counterBarrier{};
+    counterBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    counterBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    counterBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+    vkCmdPipelineBarrier(
+        cb, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+        1, &counterBarrier, 0, nullptr, 1, &levelsBarrier
+    );
+
+    vkCmdBindPipeline(cb, VK_PIPELINE_BIND_POINT_COMPUTE, downsamplePipeline);
+    for (size_t d = 0; d + 1 < baseLevels.size(); d++){
+        if (d > 0){
+            // The next dispatch reads the last level of this one, and reuses the counter.
+            vkCmdPipelineBarrier(cb, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &counterBarrier, 0, nullptr, 0, nullptr);
+        }
+        DownsampleConstants constants{};
+        constants.baseSize = glm::ivec2(std::max(1u, width >> baseLevels[d]), std::max(1u, height >> baseLevels[d]));
+        constants.levelCount = baseLevels[d + 1] - baseLevels[d];
+        constants.srgb = srgb ? 1 : 0;
+        uint32_t groupsX = (static_cast<uint32_t>(constants.baseSize.x) + 63) / 64;
+        uint32_t groupsY = (static_cast<uint32_t>(constants.baseSize.y) + 63) / 64;
+        constants.workGroupCount = groupsX * groupsY;
+        vkCmdBindDescriptorSets(cb, VK_PIPELINE_BIND_POINT_COMPUTE, downsamplePipelineLayout, 0, 1, &sets[d], 0, nullptr);
+        vkCmdPushConstants(cb, downsamplePipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(constants), &constants);
+        vkCmdDispatch(cb, groupsX, groupsY, 1);
+    }
+
+    levelsBarrier.subresourceRange.baseMipLevel = 0;
+    levelsBarrier.subresourceRange.levelCount = levels;
+    levelsBarrier.oldLayout = VK_IMAGE_LAYOUT_GENERAL;
+    levelsBarrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    levelsBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    levelsBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    vkCmdPipelineBarrier(cb, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &levelsBarrier);
+
+    // Before ending: without an open batch endAndSubmitOneTimeCommands() submits and waits, which runs it.
+    uploadBatchReleases.push_back([this, views, pool](){
+        for (VkImageView view : views){
+            vkDestroyImageView(logiDevice, view, nullptr);
+        }
+        vkDestroyDescriptorPool(logiDevice, pool, nullptr);
+    });
+    endAndSubmitOneTimeCommands(cb);
+}
@@ -0,0 +1,220 @@
+#include "gpu_profiler.h"
+#include <algorithm>
+#include <fstream>
+#include <stdexcept>
+
+void GpuProfiler::init(VkPhysicalDevice physicalDevice, VkDevice logicalDevice, uint32_t queueFamilyIndex, uint32_t frames){
+    device = logicalDevice;
+    framesInFlight = frames;
+
+    uint32_t familyCount = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &familyCount, nullptr);
+    std::vector<VkQueueFamilyProperties> families(familyCount);
+    vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &familyCount, families.data());
+    // 0 valid bits means the queue does not support timestamps at all.
+    uint32_t validBits = queueFamilyIndex < familyCount ? families[queueFamilyIndex].timestampValidBits : 0;
+    if (validBits == 0){
+        std::cout << "GPU timestamps not supported on the graphics queue, GPU profiler disabled" << std::endl;
+        return;
+    }
+    timestampMask = validBits >= 64 ? ~0ull : ((1ull << validBits) - 1);
+
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+    // Nanoseconds it takes for a timestamp to be incremented by 1.
+    nsPerTick = static_cast<double>(properties.limits.timestampPeriod);
+
+    VkQueryPoolCreateInfo queryPoolCreationInfo{};
+    queryPoolCreationInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+    queryPoolCreationInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+    // Two queries (begin, end) per scope.
+    queryPoolCreationInfo.queryCount = oneTimeQueryBase() + MAX_ONE_TIME_SCOPES * 2;
+    if (vkCreateQueryPool(device, &queryPoolCreationInfo, nullptr, &queryPool) != VK_SUCCESS){
+        throw std::runtime_error("failed to create timestamp query pool");
+    }
+    frameScopes.resize(framesInFlight);
+    std::cout << "GPU profiler enabled, " << nsPerTick << "ns per tick, " << validBits << " valid bits" << std::endl;
+}
+
+void GpuProfiler::destroy(){
+    if (queryPool != VK_NULL_HANDLE){
+        vkDestroyQueryPool(device, queryPool, nullptr);
+        queryPool = VK_NULL_HANDLE;
+    }
+}
+
+void GpuProfiler::beginFrame(VkCommandBuffer cb, uint32_t frameIndex){
+    if (!isEnabled()){
+        return;
+    }
+    // The fence for this frame index has been waited on, so what was recorded the last time it was used is available.
+    collect(frameQueryBase(frameIndex), frameScopes[frameIndex]);
+    frameScopes[frameIndex].clear();
+    openScopes.clear();
+    currentFrame = frameIndex;
+    vkCmdResetQueryPool(cb, queryPool, frameQueryBase(frameIndex), MAX_SCOPES_PER_FRAME * 2);
+}
+
+void GpuProfiler::beginScope(VkCommandBuffer cb, const char* name){
+    if (!isEnabled()){
+        return;
+    }
+    std::vector<RecordedScope>& scopes = frameScopes[currentFrame];
+    if (scopes.size() >= MAX_SCOPES_PER_FRAME){
+        openScopes.push_back(UINT32_MAX); // Keeps begin/end balanced, the scope is just not measured.
+        return;
+    }
+    uint32_t index = static_cast<uint32_t>(scopes.size());
+    scopes.push_back({name, static_cast<uint32_t>(openScopes.size()), false});
+    openScopes.push_back(index);
+    vkCmdWriteTimestamp(cb, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, queryPool, frameQueryBase(currentFrame) + index * 2);
+}
+
+void GpuProfiler::endScope(VkCommandBuffer cb){
+    if (!isEnabled() || openScopes.empty()){
+        return;
+    }
+    uint32_t index = openScopes.back();
+    openScopes.pop_back();
+    if (index == UINT32_MAX){
+        return;
+    }
+    // BOTTOM_OF_PIPE: written once all previously submitted commands completed every stage.
+    vkCmdWriteTimestamp(cb, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, queryPool, frameQueryBase(currentFrame) + index * 2 + 1);
+    frameScopes[currentFrame][index].closed = true;
+}
+
+uint32_t GpuProfiler::beginOneTimeScope(VkCommandBuffer cb, const char* name){
+    if (!isEnabled() || oneTimeScopes.size() >= MAX_ONE_TIME_SCOPES){
+        return UINT32_MAX;
+    }
+    uint32_t index = static_cast<uint32_t>(oneTimeScopes.size());
+    uint32_t query = oneTimeQueryBase() + index * 2;
+    oneTimeScopes.push_back({name, 0, false});
+    vkCmdResetQueryPool(cb, queryPool, query, 2);
+    vkCmdWriteTimestamp(cb, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, queryPool, query);
+    return index;
+}
+
+void GpuProfiler::endOneTimeScope(VkCommandBuffer cb, uint32_t scope){
+    if (!isEnabled() || scope == UINT32_MAX){
+        return;
+    }
+    vkCmdWriteTimestamp(cb, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, queryPool, oneTimeQueryBase() + scope * 2 + 1);
+    oneTimeScopes[scope].closed = true;
+}
+
+void GpuProfiler::collectOneTimeScopes(){
+    if (!isEnabled()){
+        return;
+    }
+    collect(oneTimeQueryBase(), oneTimeScopes);
+    oneTimeScopes.clear();
+}
+
+void GpuProfiler::collect(uint32_t firstQuery, const std::vector<RecordedScope>& scopes){
+    if (scopes.empty()){
+        return;
+    }
+    uint32_t queryCount = static_cast<uint32_t>(scopes.size()) * 2;
+    // Each query yields {value, availability}, no WAIT bit so this never blocks: unavailable queries are just skipped.
+    std::vector<uint64_t> results(queryCount * 2, 0);
+    VkResult r = vkGetQueryPoolResults(
+        device, queryPool, firstQuery, queryCount,
+        results.size() * sizeof(uint64_t), results.data(),
+        2 * sizeof(uint64_t),
+        VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT
+    );
+    if (r != VK_SUCCESS && r != VK_NOT_READY){
+        std::cerr << "failed to read timestamp queries: " << VkResultToString(r) << std::endl;
+        return;
+    }
+    for (size_t i = 0; i < scopes.size(); i++){
+        if (!scopes[i].closed){
+            continue;
+        }
+        uint64_t begin = results[i * 4];
+        uint64_t beginAvailable = results[i * 4 + 1];
+        uint64_t end = results[i * 4 + 2];
+        uint64_t endAvailable = results[i * 4 + 3];
+        if (!beginAvailable || !endAvailable){
+            continue;
+        }
+        uint64_t ticks = ((end & timestampMask) - (begin & timestampMask)) & timestampMask;
+        record(scopes[i].name, scopes[i].depth, ticks * nsPerTick / 1e6);
+    }
+}
+
+void GpuProfiler::record(const char* name, uint32_t depth, double ms){
+    for (ScopeStats& s : stats){
+        if (s.name == name){
+            s.samples++;
+            s.lastMs = ms;
+            s.totalMs += ms;
+            s.minMs = std::min(s.minMs, ms);
+            s.maxMs = std::max(s.maxMs, ms);
+            return;
+        }
+    }
+    ScopeStats s{};
+    s.name = name;
+    s.depth = depth;
+    s.samples = 1;
+    s.lastMs = ms;
+    s.totalMs = ms;
+    s.minMs = ms;
+    s.maxMs = ms;
+    stats.push_back(s);
+}
+
+double GpuProfiler::getScopeMs(const std::string& name) const{
+    for (const ScopeStats& s : stats){
+        if (s.name == name){
+            return s.lastMs;
+        }
+    }
+    return -1.0;
+}
+
+void GpuProfiler::dumpCSV(const std::string& path) const{
+    std::ofstream file(path);
+    if (!file.is_open()){
+        std::cerr << "could not open " << path << std::endl;
+        return;
+    }
+    file << "scope,depth,samples,last_ms,avg_ms,min_ms,max_ms\n";
+    for (const ScopeStats& s : stats){
+        file << s.name << "," << s.depth << "," << s.samples << ","
+             << s.lastMs << "," << s.totalMs / s.samples << "," << s.minMs << "," << s.maxMs << "\n";
+    }
+}
+
+void GpuProfiler::dumpJSON(const std::string& path) const{
+    std::ofstream file(path);
+    if (!file.is_open()){
+        std::cerr << "could not open " << path << std::endl;
+        return;
+    }
+    file << "{\n  \"unit\": \"ms\",\n  \"scopes\": [\n";
+    for (size_t i = 0; i < stats.size(); i++){
+        const ScopeStats& s = stats[i];
+        file << "    {\"name\": \"" << s.name << "\""
+             << ", \"depth\": " << s.depth
+             << ", \"samples\": " << s.samples
+             << ", \"last\": " << s.lastMs
+             << ", \"avg\": " << s.totalMs / s.samples
+             << ", \"min\": " << s.minMs
+             << ", \"max\": " << s.maxMs
+             << "}" << (i + 1 < stats.size() ? "," : "") << "\n";
+    }
+    file << "  ]\n}\n";
+}
+
+void GpuProfiler::dump(const std::string& path) const{
+    if (path.size() >= 4 && path.compare(path.size() - 4, 4, ".csv") == 0){
+        dumpCSV(path);
+    }else{
+        dumpJSON(path);
+    }
+    std::cout << "GPU profile written to " << path << std::endl;
+}
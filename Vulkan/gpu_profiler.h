@@ -0,0 +1,83 @@
+#pragma once
+
+#include "heliumutils.h"
+#include <string>
+#include <vector>
+
+/*
+GPU timestamp profiler.
+Scopes are delimited by vkCmdWriteTimestamp calls into a VkQueryPool.
+
+Frame scopes: each frame in flight owns a slice of the pool. The results of a slice are read back (without waiting)
+the next time the same frame index is recorded, i.e. MAX_FRAMES_IN_FLIGHT frames later, once its fence has been waited on.
+
+One-time scopes: used for upload/setup command buffers. They own a separate slice and are read back by collectOneTimeScopes()
+once the command buffers using them are known to be complete.
+
+Results are accumulated per scope name and can be queried or dumped as CSV/JSON.
+*/
+class GpuProfiler{
+public:
+    struct ScopeStats{
+        std::string name;
+        uint32_t depth = 0; // Nesting level, 0 for top level scopes
+        uint64_t samples = 0;
+        double lastMs = 0.0;
+        double totalMs = 0.0;
+        double minMs = 0.0;
+        double maxMs = 0.0;
+    };
+
+    static constexpr uint32_t MAX_SCOPES_PER_FRAME = 32;
+    static constexpr uint32_t MAX_ONE_TIME_SCOPES = 64;
+
+    void init(VkPhysicalDevice physicalDevice, VkDevice device, uint32_t queueFamilyIndex, uint32_t framesInFlight);
+    void destroy();
+    bool isEnabled() const { return queryPool != VK_NULL_HANDLE; }
+
+    // Must be called right after vkBeginCommandBuffer, outside of any render pass.
+    void beginFrame(VkCommandBuffer cb, uint32_t frameIndex);
+    void beginScope(VkCommandBuffer cb, const char* name);
+    void endScope(VkCommandBuffer cb);
+
+    // Returns the index to pass to endOneTimeScope, or UINT32_MAX if the scope is not recorded.
+    uint32_t beginOneTimeScope(VkCommandBuffer cb, const char* name);
+    void endOneTimeScope(VkCommandBuffer cb, uint32_t scope);
+    // Reads back all pending one-time scopes. Only call once their command buffers completed.
+    void collectOneTimeScopes();
+
+    const std::vector<ScopeStats>& getScopeStats() const { return stats; }
+    // Last measured duration of the named scope in milliseconds, negative if it was never measured.
+    double getScopeMs(const std::string& name) const;
+
+    void dumpCSV(const std::string& path) const;
+    void dumpJSON(const std::string& path) const;
+    // Picks the format from the extension (.csv, anything else is JSON)
+    void dump(const std::string& path) const;
+
+private:
+    struct RecordedScope{
+        const char* name;
+        uint32_t depth;
+        bool closed;
+    };
+
+    VkDevice device = VK_NULL_HANDLE;
+    VkQueryPool queryPool = VK_NULL_HANDLE;
+    double nsPerTick = 1.0;
+    uint64_t timestampMask = ~0ull;
+    uint32_t framesInFlight = 0;
+
+    uint32_t currentFrame = 0;
+    std::vector<std::vector<RecordedScope>> frameScopes; // Per frame in flight, in recording order
+    std::vector<uint32_t> openScopes; // Stack of indices into frameScopes[currentFrame]
+
+    std::vector<RecordedScope> oneTimeScopes;
+
+    std::vector<ScopeStats> stats;
+
+    uint32_t frameQueryBase(uint32_t frame) const { return frame * MAX_SCOPES_PER_FRAME * 2; }
+    uint32_t oneTimeQueryBase() const { return framesInFlight * MAX_SCOPES_PER_FRAME * 2; }
+    void collect(uint32_t firstQuery, const std::vector<RecordedScope>& scopes);
+    void record(const char* name, uint32_t depth, double ms);
+};
@@ -0,0 +1,17 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+/*
+FNV-1a over a byte range. Identifies sources and catches truncated or corrupted cache files (pipeline and mesh caches),
+not meant to resist tampering.
+*/
+inline uint64_t hashBytes(const char* data, size_t size){
+    uint64_t hash = 14695981039346656037ull;
+    for (size_t i = 0; i < size; i++){
+        hash ^= static_cast<uint8_t>(data[i]);
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
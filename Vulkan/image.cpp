@@ -2,6 +2,7 @@
 #include "main.h"
 
 stbi_uc* HelloTriangleApplication::loadImage(const char* path, int* width, int* height, int* channels){
+    HELIUM_PROFILE_FUNCTION();
     int a,b,c;
     stbi_uc* pixels = stbi_load(path, width, height, channels, STBI_rgb_alpha);
     return pixels;
@@ -9,10 +10,10 @@ stbi_uc* HelloTriangleApplication::loadImage(const char* path, int* width, int*
 
 
 /*
-Creates a view for a 2D image with no mip map levels and no layers.
+Creates a view for a 2D image over levels [baseMipLevel, baseMipLevel + mipmapLevels) and no layers.
 View will be generated with no swizzle. 
 */
-VkImageView HelloTriangleApplication::createViewFor2DImage(VkImage image, int mipmapLevels, VkFormat format, VkImageAspectFlags imageAspect){
+VkImageView HelloTriangleApplication::createViewFor2DImage(VkImage image, int mipmapLevels, VkFormat format, VkImageAspectFlags imageAspect, int baseMipLevel){
     VkImageView view;
 
     VkImageViewCreateInfo imageViewCreationInfo{};
@@ -22,7 +23,7 @@ VkImageView HelloTriangleApplication::createViewFor2DImage(VkImage image, int mi
     imageViewCreationInfo.image = image;
     imageViewCreationInfo.subresourceRange.aspectMask = imageAspect;
     imageViewCreationInfo.subresourceRange.baseArrayLayer = 0;
-    imageViewCreationInfo.subresourceRange.baseMipLevel = 0;
+    imageViewCreationInfo.subresourceRange.baseMipLevel = baseMipLevel;
     imageViewCreationInfo.subresourceRange.levelCount = std::max(1, mipmapLevels);
     // Multiple layers can be useful for steroscopic apps (VR) and have each eye map to a layer
     imageViewCreationInfo.subresourceRange.layerCount = 1;
@@ -48,17 +49,20 @@ VkImageView HelloTriangleApplication::createViewFor2DImage(VkImage image, int mi
 }
 
 void HelloTriangleApplication::generatateImageMipMaps(VkImage image, VkFormat f, int32_t sourceWidth, int32_t sourceHeight, uint32_t levels){
+    HELIUM_PROFILE_FUNCTION();
     VkFormatProperties formatProps;
     vkGetPhysicalDeviceFormatProperties(
         physGraphicDevice, f, &formatProps
     );
-    // TODO: check other format features, implement software mipmapping via stb_image_resize.
-    if ((formatProps.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT) == 0){
-        throw std::runtime_error("image format does not support linear filter sampling");
+    // createTexture() falls back to generateMipChain() (mip_generator.h) when these are missing.
+    const VkFormatFeatureFlags blitFeatures = VK_FORMAT_FEATURE_BLIT_SRC_BIT | VK_FORMAT_FEATURE_BLIT_DST_BIT
+                                            | VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+    if ((formatProps.optimalTilingFeatures & blitFeatures) != blitFeatures){
+        throw std::runtime_error("image format does not support linear filtered blits");
     }
 
 
-    VkCommandBuffer cb = beginOneTimeCommands();
+    VkCommandBuffer cb = beginOneTimeCommands("mip_generation");
 
     VkImageMemoryBarrier mipmapBarrier = {};
     mipmapBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
@@ -0,0 +1,181 @@
+#include "ktx2.h"
+#include "cpu_profiler.h"
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <numeric>
+
+uint32_t ktx2BlockBytes(uint32_t vkFormat){
+    switch (vkFormat){
+        case KTX2_FORMAT_BC1_RGB_SRGB: return 8;
+        case KTX2_FORMAT_BC7_SRGB: return 16;
+        default: return 0;
+    }
+}
+
+uint64_t ktx2LevelBytes(uint32_t vkFormat, uint32_t width, uint32_t height){
+    uint64_t blocksWide = (width + 3) / 4;
+    uint64_t blocksHigh = (height + 3) / 4;
+    return blocksWide * blocksHigh * ktx2BlockBytes(vkFormat);
+}
+
+/*
+Basic data format descriptor of a block compressed format: one sample covering the whole block, as in the examples of the
+Khronos data format specification. Only written for other tools, open() trusts vkFormat.
+*/
+static std::vector<uint32_t> basicDescriptor(uint32_t vkFormat){
+    const uint32_t colorModel = vkFormat == KTX2_FORMAT_BC7_SRGB ? 134 : 128; // KHR_DF_MODEL_BC7 : KHR_DF_MODEL_BC1A
+    const uint32_t primaries = 1; // KHR_DF_PRIMARIES_BT709
+    const uint32_t transfer = 2; // KHR_DF_TRANSFER_SRGB
+    const uint32_t blockBits = ktx2BlockBytes(vkFormat) * 8;
+    const uint32_t blockSize = 24 + 16; // Descriptor block with one sample
+    return {
+        4 + blockSize, // dfdTotalSize
+        0, // vendorId KHR, descriptorType basic
+        2u | (blockSize << 16), // versionNumber 1.3, descriptorBlockSize
+        colorModel | (primaries << 8) | (transfer << 16), // flags 0: straight alpha
+        3u | (3u << 8), // texelBlockDimension, minus one: 4x4x1x1
+        ktx2BlockBytes(vkFormat), // bytesPlane0
+        0, // bytesPlane4-7
+        (blockBits - 1) << 16, // bitOffset 0, bitLength, channel 0 (color), no qualifiers
+        0, // samplePosition
+        0, // sampleLower
+        0xFFFFFFFFu, // sampleUpper
+    };
+}
+
+bool Ktx2File::open(const std::string& path){
+    HELIUM_PROFILE_FUNCTION();
+    close();
+    std::error_code error;
+    if (!std::filesystem::exists(path, error)){
+        return false;
+    }
+    std::unique_ptr<MappedFile> mapped;
+    try{
+        mapped = std::make_unique<MappedFile>(path);
+    }catch (const std::exception& e){
+        std::cout << "ktx2: " << e.what() << std::endl;
+        return false;
+    }
+    Header header{};
+    const char* reason = nullptr;
+    if (mapped->size() < sizeof(Header)){
+        reason = "truncated";
+    }else{
+        memcpy(&header, mapped->data(), sizeof(header));
+        if (memcmp(header.identifier, IDENTIFIER, sizeof(IDENTIFIER)) != 0){
+            reason = "not a KTX2 file";
+        }else if (ktx2BlockBytes(header.vkFormat) == 0 || header.typeSize != 1){
+            reason = "unsupported format";
+        }else if (header.pixelWidth == 0 || header.pixelHeight == 0 || header.pixelDepth != 0 || header.layerCount > 1
+                  || header.faceCount != 1 || header.levelCount == 0 || header.levelCount > 32){
+            reason = "not a single 2D image";
+        }else if (header.supercompressionScheme != 0){
+            reason = "supercompressed";
+        }else if (mapped->size() < sizeof(Header) + header.levelCount * sizeof(LevelIndex)){
+            reason = "truncated";
+        }
+    }
+    std::vector<LevelIndex> index;
+    if (reason == nullptr){
+        index.resize(header.levelCount);
+        memcpy(index.data(), mapped->data() + sizeof(Header), index.size() * sizeof(LevelIndex));
+        for (uint32_t l = 0; l < header.levelCount && reason == nullptr; l++){
+            uint32_t width = std::max(1u, header.pixelWidth >> l);
+            uint32_t height = std::max(1u, header.pixelHeight >> l);
+            if (index[l].byteLength != ktx2LevelBytes(header.vkFormat, width, height)){
+                reason = "level size mismatch";
+            }else if (index[l].byteOffset > mapped->size() || index[l].byteLength > mapped->size() - index[l].byteOffset
+                      || index[l].byteOffset % ktx2BlockBytes(header.vkFormat) != 0){
+                reason = "level out of the file";
+            }
+        }
+    }
+    if (reason != nullptr){
+        std::cout << "ktx2: ignoring " << path << " (" << reason << ")" << std::endl;
+        return false;
+    }
+    file = std::move(mapped);
+    format = header.vkFormat;
+    pixelWidth = header.pixelWidth;
+    pixelHeight = header.pixelHeight;
+    levels = std::move(index);
+    return true;
+}
+
+void Ktx2File::close(){
+    file.reset();
+    format = 0;
+    pixelWidth = 0;
+    pixelHeight = 0;
+    levels.clear();
+}
+
+const void* Ktx2File::levelData(uint32_t level) const{
+    return file->data() + levels[level].byteOffset;
+}
+
+bool Ktx2File::write(const std::string& path, uint32_t vkFormat, uint32_t width, uint32_t height,
+                     const std::vector<std::vector<uint8_t>>& levelData){
+    HELIUM_PROFILE_FUNCTION();
+    std::vector<uint32_t> dfd = basicDescriptor(vkFormat);
+    Header header{};
+    memcpy(header.identifier, IDENTIFIER, sizeof(IDENTIFIER));
+    header.vkFormat = vkFormat;
+    header.typeSize = 1;
+    header.pixelWidth = width;
+    header.pixelHeight = height;
+    header.faceCount = 1;
+    header.levelCount = static_cast<uint32_t>(levelData.size());
+    header.dfdByteOffset = static_cast<uint32_t>(sizeof(Header) + levelData.size() * sizeof(LevelIndex));
+    header.dfdByteLength = static_cast<uint32_t>(dfd.size() * sizeof(uint32_t));
+
+    // The spec stores the smallest level first, each one aligned to lcm(block size, 4).
+    const uint64_t alignment = std::lcm<uint64_t>(ktx2BlockBytes(vkFormat), 4);
+    std::vector<LevelIndex> index(levelData.size());
+    uint64_t offset = header.dfdByteOffset + header.dfdByteLength;
+    for (size_t l = levelData.size(); l-- > 0;){
+        offset = (offset + alignment - 1) / alignment * alignment;
+        index[l].byteOffset = offset;
+        index[l].byteLength = levelData[l].size();
+        index[l].uncompressedByteLength = levelData[l].size();
+        offset += levelData[l].size();
+    }
+
+    // Same scheme as the mesh cache: a temporary file renamed over the old one, never a half written texture.
+    std::string tmpPath = path + ".tmp";
+    {
+        std::ofstream out(tmpPath, std::ios::binary | std::ios::trunc);
+        if (!out.is_open()){
+            std::cerr << "ktx2: cannot write " << tmpPath << std::endl;
+            return false;
+        }
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.write(reinterpret_cast<const char*>(index.data()), static_cast<std::streamsize>(index.size() * sizeof(LevelIndex)));
+        out.write(reinterpret_cast<const char*>(dfd.data()), static_cast<std::streamsize>(header.dfdByteLength));
+        uint64_t written = header.dfdByteOffset + header.dfdByteLength;
+        const char padding[16] = {};
+        for (size_t l = levelData.size(); l-- > 0;){
+            out.write(padding, static_cast<std::streamsize>(index[l].byteOffset - written));
+            out.write(reinterpret_cast<const char*>(levelData[l].data()), static_cast<std::streamsize>(levelData[l].size()));
+            written = index[l].byteOffset + levelData[l].size();
+        }
+        if (!out.good()){
+            std::cerr << "ktx2: failed writing " << tmpPath << std::endl;
+            out.close();
+            std::filesystem::remove(tmpPath);
+            return false;
+        }
+    }
+    std::error_code error;
+    std::filesystem::rename(tmpPath, path, error);
+    if (error){
+        std::cerr << "ktx2: cannot replace " << path << ": " << error.message() << std::endl;
+        std::filesystem::remove(tmpPath, error);
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include "mapped_file.h"
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+/*
+Minimal KTX2 container (https://registry.khronos.org/KTX/specs/2.0/ktxspec.v2.html), enough for the textures written by
+texture_cook: one 2D image, no array layers or faces, no supercompression, every level stored as the device takes it.
+
+Formats are Vulkan format values, the file is read and written without the Vulkan headers (the cooker is CPU only).
+Only block compressed sRGB formats are accepted for now, see ktx2BlockBytes().
+*/
+
+constexpr uint32_t KTX2_FORMAT_BC1_RGB_SRGB = 132; // VK_FORMAT_BC1_RGB_SRGB_BLOCK, 8 bytes per 4x4 block, opaque
+constexpr uint32_t KTX2_FORMAT_BC7_SRGB = 146; // VK_FORMAT_BC7_SRGB_BLOCK, 16 bytes per 4x4 block
+
+// Bytes per 4x4 block of vkFormat, 0 for formats this loader does not know.
+uint32_t ktx2BlockBytes(uint32_t vkFormat);
+// Bytes of a level of width x height texels, whole blocks.
+uint64_t ktx2LevelBytes(uint32_t vkFormat, uint32_t width, uint32_t height);
+
+class Ktx2File{
+public:
+    // Maps path and checks it, false when it is missing or not a file this loader can upload (reason is logged).
+    bool open(const std::string& path);
+    void close();
+    bool isOpen() const { return file != nullptr; }
+
+    uint32_t vkFormat() const { return format; }
+    uint32_t width() const { return pixelWidth; }
+    uint32_t height() const { return pixelHeight; }
+    uint32_t levelCount() const { return static_cast<uint32_t>(levels.size()); }
+    // Level 0 is the full size one, each following level halves the size (rounded down, at least 1).
+    const void* levelData(uint32_t level) const;
+    uint64_t levelSize(uint32_t level) const { return levels[level].byteLength; }
+
+    // levels[0] is the full size level. Best effort like the mesh cache: failures are logged and false is returned.
+    static bool write(const std::string& path, uint32_t vkFormat, uint32_t width, uint32_t height,
+                      const std::vector<std::vector<uint8_t>>& levels);
+
+private:
+    static constexpr uint8_t IDENTIFIER[12] = {0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n'};
+
+    struct Header{
+        uint8_t identifier[12];
+        uint32_t vkFormat;
+        uint32_t typeSize;
+        uint32_t pixelWidth;
+        uint32_t pixelHeight;
+        uint32_t pixelDepth;
+        uint32_t layerCount;
+        uint32_t faceCount;
+        uint32_t levelCount;
+        uint32_t supercompressionScheme;
+        uint32_t dfdByteOffset;
+        uint32_t dfdByteLength;
+        uint32_t kvdByteOffset;
+        uint32_t kvdByteLength;
+        uint64_t sgdByteOffset;
+        uint64_t sgdByteLength;
+    };
+    struct LevelIndex{
+        uint64_t byteOffset;
+        uint64_t byteLength;
+        uint64_t uncompressedByteLength;
+    };
+    static_assert(sizeof(Header) == 80, "KTX2 header is 80 bytes");
+    static_assert(sizeof(LevelIndex) == 24, "KTX2 level index entries are 24 bytes");
+
+    std::unique_ptr<MappedFile> file;
+    uint32_t format = 0;
+    uint32_t pixelWidth = 0;
+    uint32_t pixelHeight = 0;
+    std::vector<LevelIndex> levels;
+};
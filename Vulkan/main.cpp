@@ -15,15 +15,25 @@
 // #include <algorithm> // Necessary for std::clamp
 
 #include "main.h"
+#include <cstring>
 
 
+HelloTriangleApplication::HelloTriangleApplication(bool runHeadless, uint32_t headlessFrames) :
+    headless(runHeadless),
+    headlessFrameCount(headlessFrames){
+}
+
 void HelloTriangleApplication::run() {
     if (validationLayerEnabled){
         std::cout<< "VL Enabled" << std::endl;
     }else{
         std::cout<< "VL Disabled" << std::endl;
     }
-    initWindow();
+    if (headless){
+        std::cout<< "Headless mode, rendering " << headlessFrameCount << " offscreen frames" << std::endl;
+    }else{
+        initWindow();
+    }
     initVulkan();
     std::cout<< "starting main loop" << std::endl;
     mainLoop();
@@ -46,42 +56,73 @@ void HelloTriangleApplication::initWindow() {
 
 
 void HelloTriangleApplication::initVulkan() {
+    HELIUM_PROFILE_FUNCTION();
     createInstance();
     setupDebugMessenger();
-    setupRenderSurface();
+    if (!headless){
+        setupRenderSurface();
+    }
     setPhysicalDevice();
     createLogicalDevice();
     std::cout<< "created logical device" << std::endl;
-    createSwapChain();
-    std::cout<< "created swap chain" << std::endl;
+    deviceAllocator.init(physGraphicDevice, logiDevice);
+    selectMemoryPath();
+    gpuProfiler.init(physGraphicDevice, logiDevice, findRequiredQueueFamily(physGraphicDevice).graphicsFamilyIndex.value(), MAX_FRAMES_IN_FLIGHT);
+    if (headless){
+        createOffscreenTargets();
+        std::cout<< "created offscreen targets" << std::endl;
+    }else{
+        createSwapChain();
+        std::cout<< "created swap chain" << std::endl;
+    }
     createSwapChainViews();
     std::cout<< "created image view" << std::endl;
     createRenderPass();
     std::cout<< "created render pass" << std::endl;
     createDescriptorSetLayout();
     std::cout<< "created uniform buffer object bindings" << std::endl;
+    #ifndef HELIUM_DISABLE_PIPELINE_CACHE
+    pipelineCache.init(physGraphicDevice, logiDevice, PIPELINE_CACHE_DIRECTORY);
+    #endif
     createPipeline();
     std::cout<< "created pipeline" << std::endl;
     createCommandPool();
     std::cout << "created command pool" << std::endl;
+    #ifdef HELIUM_VERTEX_BUFFERS
+    createStagingRing();
+    std::cout << "created staging ring" << std::endl;
+    #endif
     createMsaaColorResources();
     std::cout << "created resources for multisampling" << std::endl;
     #ifdef HELIUM_VERTEX_BUFFERS
+    // Every transfer of the load phase goes into one submission, nothing waits on it: the first frame is queued behind it.
+    beginUploadBatch();
     createDepthPassResources();
     std::cout << "prepared depth pass" << std::endl;
-    createTextureImage();
-    std::cout << "created texture image" << std::endl;
-    createTextureImageView();
-    std::cout << "created view for texture image" << std::endl;
-    createTextureSampler();
-    std::cout << "created texture sampler" << std::endl;
     loadModel();
     std::cout << "loaded model from" << MODEL_PATH << std::endl;
-    std::cout << "loaded " << vertices.size() << " vertices" << std::endl;
+    std::cout << "loaded " << (meshCache.isOpen() ? meshCache.vertexCount() : vertices.size()) << " vertices" << std::endl;
+    createDownsampleResources();
+    std::cout << "created mip generation resources" << std::endl;
+    // After the model, its materials decide which textures are loaded.
+    createTextureImages();
+    std::cout << "created texture images" << std::endl;
+    createTextureImageViews();
+    std::cout << "created views for texture images" << std::endl;
+    createTextureSampler();
+    std::cout << "created texture sampler" << std::endl;
     createDeviceVertexBuffer();
     std::cout << "creates and bound vertex buffers" << std::endl;
     createDeviceIndexBuffer();
     std::cout << "created and bound index buffers" << std::endl;
+    #ifdef HELIUM_GPU_CULLING
+    createCullingResources();
+    std::cout << "created culling resources" << std::endl;
+    #endif
+    // Everything read from the mesh cache is filled (or its data is in the staging ring), the mapping is not needed anymore.
+    meshCache.close();
+    UploadTicket loadTicket = submitUploadBatch();
+    std::cout << "submitted upload batch " << loadTicket << std::endl;
     createCoherentUniformBuffers();
     std::cout << "created and bound uniform buffers" << std::endl;
     createDescriptorPool();
@@ -95,11 +136,20 @@ void HelloTriangleApplication::initVulkan() {
     std::cout<< "created command buffers" << std::endl;
     createSyncObjects();
     std::cout<< "created sync objects" << std::endl;
+    deviceAllocator.printStats("after init");
 }
 
 
 void HelloTriangleApplication::mainLoop() {
     std::cout<< "main loop" << std::endl;
+    if (headless){
+        // No window to close, so just run the requested amount of frames as fast as possible.
+        for (uint32_t i = 0; i < headlessFrameCount; i++){
+            drawFrame();
+        }
+        vkDeviceWaitIdle(logiDevice);
+        return;
+    }
     while( !glfwWindowShouldClose(window)){
         glfwPollEvents();
         drawFrame();
@@ -112,25 +162,42 @@ void HelloTriangleApplication::cleanup() {
 
     vkDestroyImageView(logiDevice, depthPassImageView, nullptr);
     vkDestroyImage(logiDevice, depthPassImage, nullptr);
-    vkFreeMemory(logiDevice, depthPassMemory, nullptr);
+    deviceAllocator.free(depthPassMemory);
 
     vkDestroySampler(logiDevice, textureSampler, nullptr);
-    vkDestroyImageView(logiDevice, textureImageView, nullptr);
-    vkDestroyImage(logiDevice, textureImageHandle, nullptr);
-    vkFreeMemory(logiDevice, textureImageDeviceMemory, nullptr);
+    for (Texture& texture : textures){
+        vkDestroyImageView(logiDevice, texture.view, nullptr);
+        vkDestroyImage(logiDevice, texture.image, nullptr);
+        deviceAllocator.free(texture.memory);
+    }
 
     for (size_t i =0 ; i < mvpMatUniformBuffers.size(); i++){
         vkDestroyBuffer(logiDevice, mvpMatUniformBuffers[i], nullptr);
-        vkFreeMemory(logiDevice, mvpMatUniformBuffersMemory[i], nullptr);
+        deviceAllocator.free(mvpMatUniformBuffersMemory[i]);
     }
     vkDestroyDescriptorPool(logiDevice, descriptorPool, nullptr);
     vkDestroyDescriptorSetLayout(logiDevice, mainDescriptorSetLayout, nullptr);
+    destroyBindlessResources();
     
+    // Runs the retirement callbacks still pending (command buffers, profiler scopes).
+    stagingRing.waitIdle();
+    destroyTextureStreams();
+    stagingRing.destroy();
+    vkDestroyBuffer(logiDevice, stagingRingBuffer, nullptr);
+    deviceAllocator.free(stagingRingMemory);
+
+    destroyDownsampleResources();
+    #ifdef HELIUM_GPU_CULLING
+    destroyCullingResources();
+    #endif
     vkDestroyBuffer(logiDevice, vertexBuffer, nullptr);
-    vkFreeMemory(logiDevice, vertexBufferMemory, nullptr);
+    deviceAllocator.free(vertexBufferMemory);
     vkDestroyBuffer(logiDevice, indexBuffer, nullptr);
-    vkFreeMemory(logiDevice, indexBufferMemory, nullptr);
+    deviceAllocator.free(indexBufferMemory);
 
+    // Persisted while the device is still alive, save() skips the write when the data did not change.
+    pipelineCache.save();
+    pipelineCache.destroy();
     vkDestroyPipeline(logiDevice, gPipeline, nullptr);
     vkDestroyPipelineLayout(logiDevice, pipelineLayout, nullptr);
     
@@ -140,38 +207,44 @@ void HelloTriangleApplication::cleanup() {
         vkDestroySemaphore(logiDevice, renderingFinishedSemaphores[i], nullptr);
         vkDestroyFence(logiDevice, frameFences[i], nullptr);
     }
+    for (VkSemaphore semaphore : uploadsDoneSemaphores){
+        vkDestroySemaphore(logiDevice, semaphore, nullptr);
+    }
+    for (VkSemaphore semaphore : uploadBatchSemaphores){
+        vkDestroySemaphore(logiDevice, semaphore, nullptr);
+    }
     vkDestroyCommandPool(logiDevice, commandPool, nullptr);
+    if (transferCommandPool != VK_NULL_HANDLE){
+        vkDestroyCommandPool(logiDevice, transferCommandPool, nullptr);
+    }
+    if (!gpuProfileOutputPath.empty()){
+        gpuProfiler.dump(gpuProfileOutputPath);
+    }
+    gpuProfiler.destroy();
+    deviceAllocator.destroy();
     // In order : Device generating renders -> render surface -> instance -> window -> glfw.
     vkDestroyDevice(logiDevice, nullptr);
     if(validationLayerEnabled){
         DestroyDebugMessengerExtension(instance, debugCallbackHandler, nullptr); // Ideally this should be caught by the debug messenger when destroy is not called, and yet it doesn't happen
     }
+    if (headless){
+        vkDestroyInstance(instance, nullptr);
+        return;
+    }
     vkDestroySurfaceKHR(instance, renderSurface, nullptr);
     vkDestroyInstance(instance, nullptr/*Optional callback pointer*/);
     glfwDestroyWindow(window);
     glfwTerminate(); // Once this function is called, glfwInit(L#30) must be called again before using most GLFW functions. This deallocates everything GLFW related.
 }
 
-struct FrameLogger{
-    template<typename T> FrameLogger& operator<<(const T& value){
-        #ifdef HELIUM_DEBUG_LOG_FRAMES
-        std::cout << value;
-        #endif
-        return *this;
-    }
-    
-    FrameLogger& operator<<(std::ostream& (*manipulator)(std::ostream&)){
-        #ifdef HELIUM_DEBUG_LOG_FRAMES
-        std::cout << manipulator;
-        #endif
-        return *this;
-    }
-};
+using FrameClock = std::chrono::steady_clock;
 
-void emitFenceStatus(VkDevice device, VkFence* fence){
-    FrameLogger flout;
-    VkResult status = vkGetFenceStatus(device, *fence);
-    flout << "Fence status: " << VkResultToString(status) << std::endl;
+// Milliseconds elapsed since mark, moves mark to now so consecutive calls time consecutive phases.
+static double lapMs(FrameClock::time_point& mark){
+    FrameClock::time_point now = FrameClock::now();
+    double elapsed = std::chrono::duration<double, std::milli>(now - mark).count();
+    mark = now;
+    return elapsed;
 }
 
 void HelloTriangleApplication::drawFrame(){
@@ -180,23 +253,46 @@ void HelloTriangleApplication::drawFrame(){
         return;
     }
     #endif
-    FrameLogger flout;
-    flout << "FRAME:"<< frameCounter << std::endl;
-    flout << "waiting for frame" << std::endl;
-    emitFenceStatus(logiDevice, &frameFences[currentFrame]);
-    
-    VkResult waitFencesResult =  vkWaitForFences(logiDevice, 1, &frameFences[currentFrame], VK_TRUE, UINT64_MAX);
-    
-    flout << "Wait fences result:------" << VkResultToString(waitFencesResult) << std::endl;
-    flout << "fence signaled" << std::endl;
+    HELIUM_PROFILE_SCOPE("frame");
+    lastFrameTimings = {};
+    FrameClock::time_point frameStart = FrameClock::now();
+    FrameClock::time_point phaseMark = frameStart;
+
+    {
+        HELIUM_PROFILE_SCOPE("wait_fence");
+        phaseMark = FrameClock::now();
+        if (vkWaitForFences(logiDevice, 1, &frameFences[currentFrame], VK_TRUE, UINT64_MAX) != VK_SUCCESS){
+            throw std::runtime_error("failed waiting for frame fence");
+        }
+        lastFrameTimings.waitFenceMs = lapMs(phaseMark);
+    }
+    #ifdef HELIUM_VERTEX_BUFFERS
+    // Staging memory used by uploads of frames that completed can be reused.
+    stagingRing.reclaim();
+    // Evicts or restores texture levels against the memory budget, before streaming so restored levels are requested right away.
+    budgetTextureMemory();
+    // Levels that landed with the completed uploads become sampleable, the next ones are queued with this frame's.
+    streamTextures();
+    #endif
     
-    updateModelViewProj(currentFrame);
+    {
+        HELIUM_PROFILE_SCOPE("update_mvp");
+        updateModelViewProj(currentFrame);
+    }
 
     uint32_t imageSwapchainIndex;
-    VkResult acquireImageResult = vkAcquireNextImageKHR(logiDevice, swapChain, UINT64_MAX, imageWriteableSemaphores[currentFrame], VK_NULL_HANDLE, &imageSwapchainIndex);
-
-    flout<< "Acquire image result:------" << VkResultToString(acquireImageResult) << std::endl;
-    flout << "acquired image, index is -- " << imageSwapchainIndex << std::endl;
+    VkResult acquireImageResult = VK_SUCCESS;
+    {
+        HELIUM_PROFILE_SCOPE("acquire");
+        phaseMark = FrameClock::now();
+        if (headless){
+            // The offscreen ring has one image per frame in flight, the fence we just waited on guarantees it's free.
+            imageSwapchainIndex = currentFrame;
+        }else{
+            acquireImageResult = vkAcquireNextImageKHR(logiDevice, swapChain, UINT64_MAX, imageWriteableSemaphores[currentFrame], VK_NULL_HANDLE, &imageSwapchainIndex);
+        }
+        lastFrameTimings.acquireMs = lapMs(phaseMark);
+    }
 
     if (acquireImageResult == VK_ERROR_OUT_OF_DATE_KHR){
         resetSwapChain();
@@ -205,32 +301,48 @@ void HelloTriangleApplication::drawFrame(){
         throw std::runtime_error("failed to acquire swap chain image!");
     }
 
-    emitFenceStatus(logiDevice, &frameFences[currentFrame]);
-    flout << "resetting fence" << std::endl;
-    
     if (vkResetFences(logiDevice, 1, &frameFences[currentFrame]) != VK_SUCCESS){
         throw std::runtime_error("can't reset fence?");
     };
     
-    flout << "fence reset" << std::endl;
-    emitFenceStatus(logiDevice, &frameFences[currentFrame]);
-    
-    VkResult resetResult = vkResetCommandBuffer(graphicsCBuffers[currentFrame], /*VK_COMMAND_BUFFER_RESET_RELEASE_RESOURCES_BIT*/ 0);
-    
-    flout << "buffer reset result is:------"<<VkResultToString(resetResult)<< std::endl;
-    flout << "reset command buffer" << std::endl;
-
-    recordCommandBuffer(graphicsCBuffers[currentFrame], imageSwapchainIndex);
-
-    flout << "recorded command buffer" << std::endl;
+    bool frameUploadsSubmitted = false;
+    {
+        // Its own phase: a transfer queue submit would otherwise count as recording.
+        HELIUM_PROFILE_SCOPE("upload_submit");
+        phaseMark = FrameClock::now();
+        #ifdef HELIUM_VERTEX_BUFFERS
+        frameUploadsSubmitted = submitFrameUploads();
+        #endif
+        lastFrameTimings.uploadSubmitMs = lapMs(phaseMark);
+    }
+    {
+        HELIUM_PROFILE_SCOPE("record");
+        phaseMark = FrameClock::now();
+        if (vkResetCommandBuffer(graphicsCBuffers[currentFrame], /*VK_COMMAND_BUFFER_RESET_RELEASE_RESOURCES_BIT*/ 0) != VK_SUCCESS){
+            throw std::runtime_error("failed to reset command buffer");
+        }
+        recordCommandBuffer(graphicsCBuffers[currentFrame], imageSwapchainIndex);
+        lastFrameTimings.recordMs = lapMs(phaseMark);
+    }
     
     VkSubmitInfo commandSubmitInfo{};
     commandSubmitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
 
-    VkSemaphore waitedSemaphores[] = {imageWriteableSemaphores[currentFrame]};
+    VkSemaphore waitedSemaphores[2];
     // In what stage to wait for the specified semaphores
-    VkPipelineStageFlags stagesToWaitOn[] = {VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT};
-    commandSubmitInfo.waitSemaphoreCount = 1;
+    VkPipelineStageFlags stagesToWaitOn[2];
+    uint32_t waitedSemaphoreCount = 0;
+    // Nothing to wait on or signal when headless, there is no presentation engine on the other side.
+    if (!headless){
+        waitedSemaphores[waitedSemaphoreCount] = imageWriteableSemaphores[currentFrame];
+        stagesToWaitOn[waitedSemaphoreCount++] = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+    }
+    if (frameUploadsSubmitted){
+        // Same stage as the source of the acquire barriers recorded for them.
+        waitedSemaphores[waitedSemaphoreCount] = uploadsDoneSemaphores[currentFrame];
+        stagesToWaitOn[waitedSemaphoreCount++] = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+    }
+    commandSubmitInfo.waitSemaphoreCount = waitedSemaphoreCount;
     commandSubmitInfo.pWaitSemaphores = waitedSemaphores;
     commandSubmitInfo.pWaitDstStageMask = stagesToWaitOn;
 
@@ -238,18 +350,29 @@ void HelloTriangleApplication::drawFrame(){
     commandSubmitInfo.pCommandBuffers = &graphicsCBuffers[currentFrame];
 
     VkSemaphore signaledSempahores[] = {renderingFinishedSemaphores[currentFrame]};
-    commandSubmitInfo.signalSemaphoreCount = 1;
+    commandSubmitInfo.signalSemaphoreCount = headless ? 0 : 1;
     commandSubmitInfo.pSignalSemaphores = signaledSempahores;
 
-    flout << "submitting to queue" << std::endl;
-    emitFenceStatus(logiDevice, &frameFences[currentFrame]);
-    
-    if( vkQueueSubmit(graphicsCommandQueue, 1, &commandSubmitInfo, frameFences[currentFrame]) != VK_SUCCESS){
-        throw std::runtime_error("failed to submit commands to queue");
+    {
+        HELIUM_PROFILE_SCOPE("submit");
+        phaseMark = FrameClock::now();
+        if( vkQueueSubmit(graphicsCommandQueue, 1, &commandSubmitInfo, frameFences[currentFrame]) != VK_SUCCESS){
+            throw std::runtime_error("failed to submit commands to queue");
+        }
+        lastFrameTimings.submitMs = lapMs(phaseMark);
+    }
+    #ifdef HELIUM_VERTEX_BUFFERS
+    // Also covers the transfer submission of the frame, the frame waited on it.
+    uploadScheduler.submitted(frameFences[currentFrame]);
+    #endif
+
+    if (headless){
+        lastFrameTimings.totalMs = lapMs(frameStart);
+        lastFrameTimings.completed = true;
+        frameCounter++;
+        currentFrame = frameCounter%MAX_FRAMES_IN_FLIGHT;
+        return;
     }
-    
-    flout << "submitted to queue" << std::endl;
-    emitFenceStatus(logiDevice, &frameFences[currentFrame]);
 
     VkPresentInfoKHR presentInfo{};
     presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
@@ -265,9 +388,13 @@ void HelloTriangleApplication::drawFrame(){
 
     // Not needed here because 1 swapchain => result = result from vkQueuePresentKHR
     // presentInfo.pResults = nullptr; // Used to pass an array of VkResult for running multiple swapchain presentations.
-    flout << "presenting" << std::endl;
-    
-    VkResult presentResult = vkQueuePresentKHR(presentCommandQueue, &presentInfo);
+    VkResult presentResult;
+    {
+        HELIUM_PROFILE_SCOPE("present");
+        phaseMark = FrameClock::now();
+        presentResult = vkQueuePresentKHR(presentCommandQueue, &presentInfo);
+        lastFrameTimings.presentMs = lapMs(phaseMark);
+    }
     if (presentResult == VK_ERROR_OUT_OF_DATE_KHR || presentResult == VK_SUBOPTIMAL_KHR || frameBufferResized){
         frameBufferResized = false;
         resetSwapChain();
@@ -276,22 +403,76 @@ void HelloTriangleApplication::drawFrame(){
         throw std::runtime_error("failed to present command queue");
     }
 
-    flout << "presented" << std::endl;
+    lastFrameTimings.totalMs = lapMs(frameStart);
+    lastFrameTimings.completed = true;
     frameCounter++;
     currentFrame = frameCounter%MAX_FRAMES_IN_FLIGHT;
 }
 
 
-int main() {
-    HelloTriangleApplication app;
+std::vector<HelloTriangleApplication::FrameTimings> HelloTriangleApplication::runFixedWorkload(uint32_t warmupFrames, uint32_t measuredFrames){
+    if (!headless){
+        initWindow();
+    }
+    initVulkan();
+
+    std::vector<FrameTimings> samples;
+    samples.reserve(measuredFrames);
+    for (uint32_t i = 0; i < warmupFrames + measuredFrames; i++){
+        if (!headless){
+            glfwPollEvents();
+        }
+        drawFrame();
+        // Frames interrupted by a swapchain reset do not represent the steady state workload.
+        if (i >= warmupFrames && lastFrameTimings.completed){
+            samples.push_back(lastFrameTimings);
+        }
+    }
+    vkDeviceWaitIdle(logiDevice);
+
+    cleanup();
+    return samples;
+}
+
+void HelloTriangleApplication::setGpuProfileOutput(const std::string& path){
+    gpuProfileOutputPath = path;
+}
+
+#ifndef HELIUM_BENCHMARK
+int main(int argc, char** argv) {
+    bool headless = false;
+    uint32_t headlessFrames = HelloTriangleApplication::HEADLESS_DEFAULT_FRAMES;
+    std::string gpuProfilePath;
+    std::string cpuTracePath;
+    for (int i = 1; i < argc; i++){
+        if (strcmp(argv[i], "--headless") == 0){
+            headless = true;
+        }else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc){
+            headlessFrames = static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+        }else if (strcmp(argv[i], "--gpu-profile") == 0 && i + 1 < argc){
+            gpuProfilePath = argv[++i];
+        }else if (strcmp(argv[i], "--cpu-trace") == 0 && i + 1 < argc){
+            cpuTracePath = argv[++i];
+        }else{
+            std::cerr << "usage: " << argv[0] << " [--headless] [--frames N] [--gpu-profile out.csv|out.json] [--cpu-trace trace.json]" << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+    CpuProfiler::setThreadName("main");
+    HelloTriangleApplication app(headless, headlessFrames);
+    app.setGpuProfileOutput(gpuProfilePath);
 
     try { 
         std::cout << "hello" << std::endl;
         app.run();
+        if (!cpuTracePath.empty()){
+            CpuProfiler::exportChromeTrace(cpuTracePath);
+        }
     } catch (const std::exception& e) {
         std::cerr << e.what() << std::endl;
         return EXIT_FAILURE;
     }
 
     return EXIT_SUCCESS;
-}
\ No newline at end of file
+}
+#endif
\ No newline at end of file
@@ -7,6 +7,18 @@
 #include <set>
 #include "heliumutils.h"
 #include "heliumdebug.h"
+#include "gpu_profiler.h"
+#include "cpu_profiler.h"
+#include "device_allocator.h"
+#include "upload_scheduler.h"
+#include "texture_loader.h"
+#include "ktx2.h"
+#include "slot_allocator.h"
+#include "pipeline_cache.h"
+#include "mesh_cache.h"
+#include "meshlet.h"
+#include "mesh_simplifier.h"
+#include "vertex_layout.h"
 #include <optional>
 // #include <cstdint> // Necessary for uint32_t
 #include <limits> // Necessary for std::numeric_limits
@@ -26,24 +38,62 @@
 
 #include "stb_image.h"
 #include <chrono>
+#include <atomic>
+#include <memory>
 
 #define HELIUM_VERTEX_BUFFERS
 #define HELIUM_LOAD_MODEL
-// #define HELIUM_DEBUG_LOG_FRAMES
+
+// Meshlet culling needs the meshlets built when loading a model.
+#if defined(HELIUM_LOAD_MODEL) && !defined(HELIUM_DISABLE_GPU_CULLING)
+#define HELIUM_GPU_CULLING
+#endif
 
 class HelloTriangleApplication{
 
 public:
+    /*
+    headless : skip GLFW, the surface and the swapchain and render into an offscreen image ring instead.
+               Useful for machines with no display (CI, render farms, lavapipe).
+    headlessFrames : how many frames to render before exiting when headless (there is no window to close).
+    */
+    explicit HelloTriangleApplication(bool headless = false, uint32_t headlessFrames = HEADLESS_DEFAULT_FRAMES);
     void run() ;
 
+    static constexpr uint32_t HEADLESS_DEFAULT_FRAMES = 600;
+
+    // CPU time spent in each phase of drawFrame(), in milliseconds.
+    struct FrameTimings{
+        double waitFenceMs = 0.0;
+        double acquireMs = 0.0;
+        double uploadSubmitMs = 0.0; // submitFrameUploads(), recording and submitting the transfer queue uploads (0 without one)
+        double recordMs = 0.0; // Command buffer reset + recordCommandBuffer
+        double submitMs = 0.0;
+        double presentMs = 0.0;
+        double totalMs = 0.0;
+        bool completed = false; // false if the frame bailed out early (e.g. swapchain reset)
+    };
+    /*
+    Same as run(), but renders warmupFrames + measuredFrames frames and returns the timings of the measured ones.
+    Used by the benchmark target (benchmark.cpp).
+    */
+    std::vector<FrameTimings> runFixedWorkload(uint32_t warmupFrames, uint32_t measuredFrames);
+    // Where to dump the GPU timestamp scopes at cleanup (.csv or .json), nothing is written if empty.
+    void setGpuProfileOutput(const std::string& path);
+
 private:
     // Const params
     const uint32_t WIDTH = 800;
     const uint32_t HEIGHT = 600;
     const int MAX_FRAMES_IN_FLIGHT = 3;
 
+    const bool headless;
+    const uint32_t headlessFrameCount;
+
     const std::string MODEL_PATH = "/Users/kambo/Helium/GameDev/Projects/CGSamples/Vulkan/objects/viking_room.obj";
     const std::string TEX_PATH = "/Users/kambo/Helium/GameDev/Projects/CGSamples/Vulkan/textures/viking_room.png";
+    // Where pipeline_cache_<uuid>_<driver>.bin files are kept between runs.
+    const std::string PIPELINE_CACHE_DIRECTORY = ".";
     
     const std::vector<const char*> validationLayerNames = {
         // Here the name has been removed because this validation layer crashes creation of frame buffer.
@@ -75,12 +125,16 @@ private:
     VkDevice logiDevice; 
     VkQueue graphicsCommandQueue;
     VkQueue presentCommandQueue;
+    VkQueue transferCommandQueue; // Same as graphicsCommandQueue when there is no dedicated transfer family
+    bool dedicatedTransferQueue = false;
     VkSwapchainKHR swapChain;
 
     VkFormat selectedSwapChainFormat;
     VkExtent2D selectedSwapChainWindowSize;
     std::vector<VkImage> swapChainImages;
     std::vector<VkImageView> swapChainImageViews;
+    // Only used when headless, swapChainImages then holds images we own instead of the ones from the swapchain.
+    std::vector<DeviceAllocation> offscreenImagesMemory;
     
     VkPipelineLayout pipelineLayout;
     VkRenderPass renderPass;
@@ -94,23 +148,159 @@ private:
     VkDescriptorSetLayout mainDescriptorSetLayout;
 
     VkBuffer vertexBuffer;
-    VkDeviceMemory vertexBufferMemory;
+    DeviceAllocation vertexBufferMemory;
 
     VkBuffer indexBuffer;
-    VkDeviceMemory indexBufferMemory;
+    DeviceAllocation indexBufferMemory;
+    // Set by createDeviceIndexBuffer(), the indices may come from the mesh cache rather than the indices vector.
+    uint32_t indexCount = 0;
+    VkIndexType indexType = VK_INDEX_TYPE_UINT32;
+    // Applied before the model matrix, maps quantized vertex positions back to the mesh bounds (identity for Vert).
+    glm::mat4 meshDequantization = glm::mat4(1.0f);
+    // Same for texture coordinates, xy scale and zw offset (identity for Vert).
+    glm::vec4 meshUvTransform = glm::vec4(1.0f, 1.0f, 0.0f, 0.0f);
+    #ifdef HELIUM_LOAD_MODEL
+    // LOD drawn this frame for every submesh, see selectMeshLods(). The sphere is in the space of the loaded positions, like the errors.
+    std::vector<uint32_t> submeshLods;
+    glm::vec4 meshBoundingSphere = glm::vec4(0.0f); // xyz center, w radius
+    #endif
+
+    #ifdef HELIUM_GPU_CULLING
+    /*
+    Meshlet culling (culling.cpp): every frame a compute pass tests the meshlets against the frustum and their normal cone
+    and copies the indices of the visible ones into visibleIndexBuffers[currentFrame]. The draw of every submesh then reads
+    its index count from drawIndirectBuffers[currentFrame]. Same layout as the push constants of c1_meshletCulling.
+    */
+    struct CullingConstants{
+        glm::vec4 planes[6]; // Frustum planes in model space, xyz . p + w < 0 is outside
+        glm::vec4 cameraPosition; // Model space
+        uint32_t firstMeshlet; // Of the selected LOD of the submesh, the dispatch covers its meshlets
+        uint32_t sixteenBitIndices;
+        uint32_t drawIndex; // Submesh, its draw command counts the visible indices
+    };
+    bool gpuCulling = false; // false when the device cannot run the pass, the whole index buffer is then drawn
+    uint32_t meshletCount = 0;
+    VkBuffer meshletBuffer;
+    DeviceAllocation meshletBufferMemory;
+    std::vector<VkBuffer> visibleIndexBuffers;
+    std::vector<DeviceAllocation> visibleIndexBuffersMemory;
+    std::vector<VkBuffer> drawIndirectBuffers;
+    std::vector<DeviceAllocation> drawIndirectBuffersMemory;
+    // Written over the draw commands before every dispatch: no index yet, each submesh at the start of its region.
+    std::vector<VkDrawIndexedIndirectCommand> emptyDraws;
+    VkDescriptorSetLayout cullingDescriptorSetLayout;
+    VkDescriptorPool cullingDescriptorPool;
+    std::vector<VkDescriptorSet> cullingDescriptorSets;
+    VkPipelineLayout cullingPipelineLayout;
+    VkPipeline cullingPipeline;
+    CullingConstants cullingConstants{};
+    #endif
 
-    uint32_t textureMipmaps;
-    VkImage textureImageHandle;
-    VkDeviceMemory textureImageDeviceMemory;
-    VkImageView textureImageView;
+    /*
+    Compute mip generation (downsample.cpp): c2_mipDownsample writes up to 12 levels per dispatch through storage views.
+    Same layout as its push constants.
+    */
+    struct DownsampleConstants{
+        glm::ivec2 baseSize; // Of the first level of the dispatch
+        uint32_t levelCount; // Written below it, at most DOWNSAMPLE_MAX_LEVELS - 1
+        uint32_t srgb;
+        uint32_t workGroupCount;
+    };
+    static constexpr uint32_t DOWNSAMPLE_MAX_LEVELS = 13; // Storage image bindings of c2_mipDownsample
+    bool gpuDownsample = false; // false when the device cannot run the pass, mips are then blitted (or built on the CPU)
+    VkBuffer downsampleCounterBuffer;
+    DeviceAllocation downsampleCounterMemory;
+    VkDescriptorSetLayout downsampleDescriptorSetLayout;
+    VkPipelineLayout downsamplePipelineLayout;
+    VkPipeline downsamplePipeline;
+
+    // One per distinct texture path, shared by every material that uses it (createTextureImages()).
+    struct Texture{
+        VkImage image;
+        DeviceAllocation memory;
+        VkImageView view;
+        uint32_t mipmaps;
+        VkFormat format; // Of the view: R8G8B8A8_SRGB when decoded (the image may be UNORM, see createTexture()), the block format of the cooked file otherwise
+        uint32_t residentLevel; // Most detailed level uploaded, the ones above it are still streaming (streaming.cpp)
+        uint32_t viewLevel; // First level of view, catches up with residentLevel at the start of a frame
+        uint32_t baseLevel; // Level held by level 0 of image, the ones above it were evicted (texture_residency.cpp)
+        uint32_t lastUsedFrame; // Last frame that drew with it
+        uint32_t bindlessSlot; // Index of view in the bindless texture table, when there is one
+    };
+    std::vector<Texture> textures;
+    // Index in textures of every material.
+    std::vector<uint32_t> materialTextureSlots;
+    // textureCompressionBC is enabled: textures with a cooked <texture>.ktx2 (texture_cook) are uploaded from it.
+    bool compressedTextures = false;
+    /*
+    Texture streaming (streaming.cpp): every texture is created with all its levels but only the mip tail is uploaded while
+    loading, its view starts there. The other levels follow during frames through the frame upload budget, smallest first across
+    every texture, and views and descriptor sets move down as they land.
+    */
+    // Levels of a decoded texture packed from level 0 (generateMipChain()), filled on mipChainWorker.
+    struct HostMipChain{
+        std::vector<uint8_t> levels;
+        std::atomic<bool> ready = false; // levels can be read
+    };
+    struct TextureStream{
+        uint32_t width; // Of level 0
+        uint32_t height;
+        uint32_t requestedLevel; // In flight, equal to the resident level of the texture when nothing is
+        // Decoded textures: level 0 as decoded, kept while levels above the tail may be streamed (again).
+        std::shared_ptr<const std::vector<uint8_t>> hostSource;
+        // Decoded textures: built from hostSource when a level above the tail is first needed, released once none is.
+        std::shared_ptr<HostMipChain> hostChain;
+        Ktx2File cooked; // Cooked textures: the levels are read from the mapping
+    };
+    static constexpr uint32_t STREAMING_TAIL_SIZE = 64; // Levels this small are uploaded while loading
+    std::vector<TextureStream> textureStreams; // Parallel to textures, empty with HELIUM_DISABLE_TEXTURE_STREAMING
+    // Builds the host chains of streamed textures one at a time, each spread over ThreadPool::shared().
+    ThreadPool mipChainWorker{1};
+    VkDeviceSize streamedTextureBytes = 0;
+    std::vector<VkImageView> descriptorTextureViews; // View written in each of descriptorSets
+    // Replaced while frames in flight may still sample them, destroyed once frameCounter reaches frame. image is null for views alone.
+    struct RetiredTexture{
+        uint32_t frame;
+        VkImageView view;
+        VkImage image;
+        DeviceAllocation memory;
+    };
+    std::vector<RetiredTexture> retiredTextures;
+    bool texturesStreaming = false;
+    std::chrono::steady_clock::time_point streamingStart;
+    uint32_t streamingStartFrame = 0;
+    /*
+    Texture memory budget (texture_residency.cpp): the images of every texture stay under textureMemoryBudget, lowered to what
+    VK_EXT_memory_budget says the heap has left when the device reports it. Over it the top level of a texture is dropped by moving
+    the others into a smaller image, under it evicted levels come back the same way and are streamed again from their source.
+    */
+    struct TextureMove{
+        VkImage source;
+        uint32_t sourceBaseLevel;
+        VkImage destination;
+        uint32_t destinationBaseLevel;
+        uint32_t firstLevel; // Copied levels, [firstLevel, mipmaps) of the texture
+        uint32_t mipmaps;
+        uint32_t width; // Of level 0 of the texture
+        uint32_t height;
+    };
+    static constexpr VkDeviceSize DEFAULT_TEXTURE_MEMORY_BUDGET = 256ull << 20;
+    static constexpr uint32_t MAX_TEXTURE_MOVES_PER_FRAME = 2;
+    VkDeviceSize textureMemoryBudget = DEFAULT_TEXTURE_MEMORY_BUDGET;
+    std::vector<TextureMove> textureMoves; // Recorded at the start of the frame command buffer
+    bool memoryBudgetSupported = false; // VK_EXT_memory_budget is enabled
+    bool physicalDeviceProperties2Supported = false; // VK_KHR_get_physical_device_properties2 is enabled
+    PFN_vkGetPhysicalDeviceMemoryProperties2KHR getPhysicalDeviceMemoryProperties2 = nullptr;
+    uint32_t evictedTextureLevels = 0;
+    uint32_t restoredTextureLevels = 0;
     VkSampler textureSampler;
 
     VkImage depthPassImage;
-    VkDeviceMemory depthPassMemory;
+    DeviceAllocation depthPassMemory;
     VkImageView depthPassImageView;
 
     VkImage msaaColorImage;
-    VkDeviceMemory msaaColorMemory;
+    DeviceAllocation msaaColorMemory;
     VkImageView msaaColorView;
 
     /*-
@@ -118,12 +308,36 @@ private:
         having only one would cause us to have a delay/run condition and a whole slew of issues.
     -*/
     std::vector<VkBuffer> mvpMatUniformBuffers;
-    std::vector<VkDeviceMemory> mvpMatUniformBuffersMemory;
+    std::vector<DeviceAllocation> mvpMatUniformBuffersMemory;
     std::vector<void*> mvpMatUniformBuffersMapHandles;
 
+    // Every host to device upload goes through here (see flushUploads() and recordCommandBuffer())
+    VkBuffer stagingRingBuffer;
+    DeviceAllocation stagingRingMemory;
+    StagingRing stagingRing;
+    UploadScheduler uploadScheduler;
+
     VkDescriptorPool descriptorPool;
+    // One per frame in flight and material: descriptorSets[frame * materialTextureSlots.size() + material].
+    // One per frame in flight with bindless textures, they only hold the MVP matrix.
     std::vector<VkDescriptorSet> descriptorSets;
 
+    /*
+    Bindless textures (bindless.cpp, VK_EXT_descriptor_indexing): every texture view lives in a slot of one sampled image array,
+    bound once per frame as set 1. Draws pick their texture with BindlessConstants instead of binding a set per material.
+    */
+    struct BindlessConstants{
+        uint32_t textureIndex;
+    };
+    static constexpr uint32_t BINDLESS_TEXTURE_CAPACITY = 4096;
+    bool bindlessTextures = false; // false when the device lacks descriptor indexing, a set per material is used then
+    uint32_t bindlessTextureCapacity = 0; // BINDLESS_TEXTURE_CAPACITY within the device limits
+    VkDescriptorSetLayout bindlessDescriptorSetLayout;
+    VkDescriptorPool bindlessDescriptorPool = VK_NULL_HANDLE; // Only created with vertex buffers
+    VkDescriptorSet bindlessDescriptorSet;
+    SlotAllocator bindlessSlots;
+    std::vector<VkImageView> bindlessSlotViews; // View written in each slot
+
 
     // Each image in the swap chain should have a framebuffer associated to it.
     std::vector<VkFramebuffer> swapchainFramebuffers;
@@ -135,6 +349,10 @@ private:
     // allows for dispatching commands from multiple threads.
     VkCommandPool commandPool;
     std::vector<VkCommandBuffer> graphicsCBuffers;
+    // Only created with a dedicated transfer queue: per frame upload command buffers and the semaphores the frames wait on.
+    VkCommandPool transferCommandPool = VK_NULL_HANDLE;
+    std::vector<VkCommandBuffer> transferCBuffers;
+    std::vector<VkSemaphore> uploadsDoneSemaphores;
 
     std::vector<VkSemaphore> imageWriteableSemaphores;
     std::vector<VkSemaphore> renderingFinishedSemaphores;
@@ -146,6 +364,33 @@ private:
 
     uint32_t frameCounter  = 0;
 
+    FrameTimings lastFrameTimings{};
+
+    DeviceMemoryAllocator deviceAllocator;
+    PipelineCache pipelineCache;
+    // Open between loadModel() and the vertex/index buffer creation when the model came from its cache.
+    MeshCache meshCache;
+    // A big DEVICE_LOCAL | HOST_VISIBLE heap exists (integrated GPUs, ReBAR, CPU devices): buffers are written in place, no staging.
+    bool unifiedMemory = false;
+    GpuProfiler gpuProfiler;
+    std::string gpuProfileOutputPath;
+    uint32_t pendingOneTimeScope = UINT32_MAX; // GPU profiler scope of the one time command buffer being recorded
+
+    /*-
+        Upload batches: while one is open every one time command (layout conversions, uploads, mip generation)
+        is recorded into the same command buffer, submitted once by submitUploadBatch().
+        Tickets increase with each submission, a ticket is complete once its fence retired from the staging ring.
+    -*/
+    using UploadTicket = uint64_t;
+    VkCommandBuffer uploadBatchBuffer = VK_NULL_HANDLE; // VK_NULL_HANDLE when no batch is open
+    VkCommandBuffer uploadBatchTransferBuffer = VK_NULL_HANDLE; // Transfer queue half of the batch, allocated by the first flushUploads()
+    std::vector<VkSemaphore> uploadBatchSemaphores; // Transfer half -> graphics half, recycled when the batch retires
+    std::vector<VkSemaphore> freeUploadBatchSemaphores;
+    bool uploadBatchImplicit = false; // Opened by beginOneTimeCommands, submitted and waited on by endAndSubmitOneTimeCommands
+    std::vector<std::function<void()>> uploadBatchReleases; // Run once the open batch completed (objects its commands use)
+    UploadTicket lastSubmittedUploadTicket = 0;
+    UploadTicket completedUploadTicket = 0;
+
     VkSampleCountFlagBits maxMsaaSupported = VK_SAMPLE_COUNT_1_BIT;
 
 
@@ -162,16 +407,24 @@ private:
     static void framebufferResizeCallback(GLFWwindow* window, int width, int height);
     void resetSwapChain();
     void recordCommandBuffer(VkCommandBuffer buffer, uint32_t swapchainImageIndex);
+    bool submitFrameUploads();
     void updateModelViewProj(uint32_t currentImage);
     
+    //-------------------------------offscreen.cpp
+    void createOffscreenTargets();
+    void destroyOffscreenTargets();
+    VkFormat chooseOffscreenFormat();
+
     //-------------------------------validation.cpp
     
     bool checkValidationLayerSupport();
     
     //-------------------------------setup.cpp
     
-    uint32_t getFirstUsableMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags propertyFlags);
+    uint32_t chooseMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags requiredFlags, VkMemoryPropertyFlags preferredFlags = 0);
+    void selectMemoryPath();
     std::vector<const char*> getRequiredExtensions();
+    std::vector<const char*> getRequiredDeviceExtensions();
     void createInstance();
     void setupDebugMessenger();
     void setPhysicalDevice();
@@ -182,21 +435,26 @@ private:
     void createRenderPass();
     void createPipeline();
     void createFramebuffers();
-    void bufferCopy(VkBuffer src, VkBuffer dst, VkDeviceSize size);
     void createCommandPool();
-    void createAndBindDeviceBuffer( VkDeviceSize bufferSize, VkBufferUsageFlags bufferUsage, VkMemoryPropertyFlags propertyFlags, VkBuffer& buffer, VkDeviceMemory& bufferMemory);
+    void createAndBindDeviceBuffer( VkDeviceSize bufferSize, VkBufferUsageFlags bufferUsage, VkMemoryPropertyFlags propertyFlags, VkBuffer& buffer, DeviceAllocation& bufferMemory, VkMemoryPropertyFlags preferredPropertyFlags = 0);
+    void createAndFillDeviceBuffer(const void* data, VkDeviceSize bufferSize, VkBufferUsageFlags bufferUsage, VkBuffer& buffer, DeviceAllocation& bufferMemory);
     void createCommandBuffers();
     void createSyncObjects();
 
     #ifdef HELIUM_VERTEX_BUFFERS
+    void createStagingRing();
+    void flushUploads();
     void createDeviceVertexBuffer();
     void createDescriptorSetLayout();
     void createDeviceIndexBuffer();
     void createCoherentUniformBuffers();
     void createDescriptorPool();
-    void createAndBindDeviceImage(int width, int height, VkSampleCountFlagBits samples, VkImage& imageDescriptor, VkDeviceMemory& imageMemory, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, VkMemoryPropertyFlags, int mipmaps);
-    void createTextureImage();
-    void createTextureImageView();
+    void createAndBindDeviceImage(int width, int height, VkSampleCountFlagBits samples, VkImage& imageDescriptor, DeviceAllocation& imageMemory, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, VkMemoryPropertyFlags, int mipmaps, VkImageCreateFlags flags = 0);
+    void createTextureImages();
+    Texture createTexture(const unsigned char* pixels, uint32_t width, uint32_t height);
+    Texture createCookedTexture(const Ktx2File& cooked, uint32_t firstLevel = 0);
+    Texture createStreamedTexture(const unsigned char* pixels, uint32_t width, uint32_t height, TextureStream& stream);
+    void createTextureImageViews();
     void createTextureSampler();
     void createDescriptorSets();
     void createDepthPassResources();
@@ -205,10 +463,15 @@ private:
     VkFormat findFirstSupportedDepthFormat(const std::vector<VkFormat>& availableFormats, VkImageTiling depthTiling, VkFormatFeatureFlags features);
     #endif
 
-    void convertImageLayout(VkImage srcImage, int mipmaps, VkFormat format, VkImageLayout srcLayout, VkImageLayout dstLayout);
-    void bufferCopyToImage(VkBuffer srcBuffer, VkImage dstImage, uint32_t w, uint32_t h);
-    VkCommandBuffer beginOneTimeCommands();
+    // Converts levels [baseMipLevel, mipmaps) of srcImage.
+    void convertImageLayout(VkImage srcImage, int mipmaps, VkFormat format, VkImageLayout srcLayout, VkImageLayout dstLayout, int baseMipLevel = 0);
+    VkCommandBuffer beginOneTimeCommands(const char* profilerScope = "one_time_commands");
     void endAndSubmitOneTimeCommands(VkCommandBuffer tempBuffer);
+    VkCommandBuffer uploadBatchTransferCommands();
+    void beginUploadBatch();
+    UploadTicket submitUploadBatch();
+    void waitForUploads(UploadTicket ticket);
+    bool uploadsComplete(UploadTicket ticket);
 
 
 
@@ -226,6 +489,9 @@ private:
         std::optional<uint32_t> graphicsFamilyIndex; // 0 is a valid family index (each index represents a queue family that supports certain commands) so we need a way to discern between null and 0.
         // Queue family for presentation to surface
         std::optional<uint32_t> presentationFamilyIndex; 
+        // Queue family for staging copies, empty when the device has none besides the graphics one (copies then run on the graphics queue).
+        // Not required, has_values() ignores it.
+        std::optional<uint32_t> transferFamilyIndex;
         
         inline bool has_values(){
             return graphicsFamilyIndex.has_value() && presentationFamilyIndex.has_value();
@@ -245,14 +511,50 @@ private:
 
     //-------------------------------image.cpp
     stbi_uc* loadImage(const char* path, int* width, int* height, int* channels);
-    VkImageView createViewFor2DImage(VkImage image, int mipmaps, VkFormat format,VkImageAspectFlags imageAspect);
+    VkImageView createViewFor2DImage(VkImage image, int mipmaps, VkFormat format,VkImageAspectFlags imageAspect, int baseMipLevel = 0);
     void generatateImageMipMaps(VkImage image, VkFormat f, int32_t w, int32_t h, uint32_t levels);
 
     //-------------------------------model.cpp
     #ifdef HELIUM_LOAD_MODEL
     void loadModel();
+    void selectMeshLods(const glm::mat4& world, const glm::mat4& view, const glm::mat4& projection);
     #endif
 
+    //-------------------------------culling.cpp
+    #ifdef HELIUM_GPU_CULLING
+    void createCullingResources();
+    void destroyCullingResources();
+    void recordCulling(VkCommandBuffer buffer);
+    void updateCullingConstants(const glm::mat4& world, const glm::mat4& view, const glm::mat4& projection);
+    #endif
+
+    //-------------------------------streaming.cpp
+    static uint32_t streamingTailLevel(uint32_t width, uint32_t height, uint32_t levels);
+    void streamTextures();
+    void destroyTextureStreams();
+    VkDeviceSize textureLevelBytes(uint32_t texture, uint32_t level) const;
+    bool hostLevelsReady(uint32_t texture);
+
+    //-------------------------------texture_residency.cpp
+    VkDeviceSize textureHeapBudget(uint32_t memoryType);
+    void budgetTextureMemory();
+    void moveTexture(uint32_t texture, uint32_t baseLevel);
+    void recordTextureMoves(VkCommandBuffer buffer);
+
+    //-------------------------------bindless.cpp
+    bool selectBindlessTextures(VkPhysicalDeviceFeatures& features, VkPhysicalDeviceDescriptorIndexingFeaturesEXT& descriptorIndexing);
+    void createBindlessLayout();
+    void createBindlessTable();
+    void writeBindlessTexture(uint32_t texture);
+    void updateBindlessTextures();
+    void destroyBindlessResources();
+
+    //-------------------------------downsample.cpp
+    void createDownsampleResources();
+    void destroyDownsampleResources();
+    VkFormat downsampleStorageFormat(VkFormat format);
+    void generateImageMipMapsCompute(VkImage image, VkFormat storageFormat, bool srgb, uint32_t width, uint32_t height, uint32_t levels);
+
     //-------------------------------shaders.cpp
     VkShaderModule createShaderModule(const std::vector<char> binary);
 };
@@ -264,13 +566,75 @@ struct Vert{
     glm::vec3 pos;
     glm::vec3 col;
     glm::vec2 texCoords;
-    static std::array<VkVertexInputAttributeDescription, 3> getAttributeDescription();
-    static VkVertexInputBindingDescription getBindingDescription();
 };
 
+/*
+Compact vertex for loaded meshes (HELIUM_QUANTIZED_VERTICES), 12 bytes:
+- pos: position as 16 bit unsigned integers over the mesh bounds. The bounds are applied through the model matrix
+       (meshDequantization), so the shader only converts to float.
+- normal: octahedral encoding, x in the low byte and y in the high byte, both snorm8. Read together with pos as one uvec4.
+- texCoords: unorm16 over the texture coordinate bounds of the mesh, so tiled and out of range ones survive. The shader maps
+             them back with ModelViewProjection::uvTransform (meshUvTransform).
+There is no color, loaded meshes are always white.
+*/
+struct QuantizedVert{
+    uint16_t pos[3];
+    uint16_t normal;
+    uint16_t texCoords[2];
+};
+static_assert(sizeof(QuantizedVert) == 12);
+
+/*
+Attribute formats, lots of values, refer to https://registry.khronos.org/vulkan/specs/latest/man/html/VkFormat.html
+Basically it's as if you dedicate X bits to each channel based on the type:
+    vec3 of floats: VK_FORMAT_R32G32B32_SFLOAT, ivec2: VK_FORMAT_R32G32_SINT
+    SINT = signed integer (int), UINT = uint, SFLOAT = signed float
+    UNORM/SNORM = integers read as floats in [0,1]/[-1,1]
+Locations follow the array order (layout(location = i) in the shader).
+*/
+template <>
+struct VertexLayout<Vert>{
+    static constexpr std::array<VertexAttribute, 3> ATTRIBUTES = {{
+        {VK_FORMAT_R32G32B32_SFLOAT, offsetof(Vert, pos)}, // inPosition
+        {VK_FORMAT_R32G32B32_SFLOAT, offsetof(Vert, col)}, // inColor
+        {VK_FORMAT_R32G32_SFLOAT, offsetof(Vert, texCoords)}, // uv
+    }};
+};
+
+template <>
+struct VertexLayout<QuantizedVert>{
+    static constexpr std::array<VertexAttribute, 2> ATTRIBUTES = {{
+        {VK_FORMAT_R16G16B16A16_UINT, offsetof(QuantizedVert, pos)}, // inPosition (xyz) and inNormal (w)
+        {VK_FORMAT_R16G16_UNORM, offsetof(QuantizedVert, texCoords)}, // uv
+    }};
+};
+
+QuantizedVert quantizeVertex(const glm::vec3& pos, const glm::vec3& normal, const glm::vec2& texCoords,
+                             const glm::vec3& boundsMin, const glm::vec3& boundsMax, const glm::vec2& uvMin, const glm::vec2& uvMax);
+// Maps quantized positions ([0, 65535] per axis) back to [boundsMin, boundsMax].
+glm::mat4 dequantizationMatrix(const glm::vec3& boundsMin, const glm::vec3& boundsMax);
+// Maps quantized texture coordinates ([0,1] once normalized) back to [uvMin, uvMax]: xy scale, zw offset.
+glm::vec4 uvDequantization(const glm::vec2& uvMin, const glm::vec2& uvMax);
+
+// Layout of the vertex buffer. The quantized layout needs a loaded mesh to get bounds.
+#if defined(HELIUM_LOAD_MODEL) && defined(HELIUM_QUANTIZED_VERTICES)
+using MeshVertex = QuantizedVert;
+#else
+using MeshVertex = Vert;
+#endif
+
 #ifdef HELIUM_LOAD_MODEL
-extern std::vector<Vert> vertices;
+extern std::vector<MeshVertex> vertices;
 extern std::vector<uint32_t> indices;
+// Only built with HELIUM_GPU_CULLING, empty when the model came from its cache (see meshCache).
+extern std::vector<Meshlet> meshlets;
+/*
+Sorted by material. The full submeshes come first in the index buffer, in submesh order, then the coarser levels.
+Only level 0 with HELIUM_DISABLE_MESH_LODS.
+*/
+extern std::vector<Submesh> submeshes;
+// Texture of every material, submeshes reference them by index. Textures used by several materials are loaded once.
+extern std::vector<std::string> materialTextures;
 #else
 const std::vector<Vert> vertices = {
     {{-0.5f, -0.5f, 0.0f}, {1.0f, 0.0f, 0.0f}, {0.0f, 0.0f}},
@@ -298,4 +662,5 @@ struct ModelViewProjection{
     glm::mat4 model;
     glm::mat4 view;
     glm::mat4 projection;
+    glm::vec4 uvTransform; // meshUvTransform, only read by v4_quantizedVertex
 };
\ No newline at end of file
@@ -0,0 +1,77 @@
+#include "mapped_file.h"
+#include <stdexcept>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::MappedFile(const std::string& path){
+#ifdef _WIN32
+    file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE){
+        throw std::runtime_error("failed to open " + path);
+    }
+    LARGE_INTEGER fileSize;
+    GetFileSizeEx(file, &fileSize);
+    length = static_cast<size_t>(fileSize.QuadPart);
+    if (length == 0){
+        return;
+    }
+    mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    view = mapping != nullptr ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+    if (view == nullptr){
+        if (mapping != nullptr){
+            CloseHandle(mapping);
+        }
+        CloseHandle(file);
+        throw std::runtime_error("failed to map " + path);
+    }
+    bytes = static_cast<const char*>(view);
+#else
+    fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0){
+        throw std::runtime_error("failed to open " + path);
+    }
+    struct stat fileStat;
+    if (fstat(fd, &fileStat) != 0){
+        close(fd);
+        throw std::runtime_error("failed to stat " + path);
+    }
+    length = static_cast<size_t>(fileStat.st_size);
+    if (length == 0){
+        return;
+    }
+    void* mapped = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mapped == MAP_FAILED){
+        close(fd);
+        throw std::runtime_error("failed to map " + path);
+    }
+    // Files are read front to back once, let the kernel read ahead aggressively.
+    madvise(mapped, length, MADV_SEQUENTIAL);
+    bytes = static_cast<const char*>(mapped);
+#endif
+}
+
+MappedFile::~MappedFile(){
+#ifdef _WIN32
+    if (view != nullptr){
+        UnmapViewOfFile(view);
+    }
+    if (mapping != nullptr){
+        CloseHandle(mapping);
+    }
+    if (file != INVALID_HANDLE_VALUE){
+        CloseHandle(file);
+    }
+#else
+    if (bytes != nullptr){
+        munmap(const_cast<char*>(bytes), length);
+    }
+    if (fd >= 0){
+        close(fd);
+    }
+#endif
+}
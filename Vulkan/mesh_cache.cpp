@@ -0,0 +1,253 @@
+#include "mesh_cache.h"
+#include "cpu_profiler.h"
+#include "hash.h"
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+
+static uint64_t hashFile(const std::string& path){
+    MappedFile source(path);
+    return hashBytes(source.data(), source.size());
+}
+
+static int64_t modifiedTime(const std::filesystem::path& path){
+    return static_cast<int64_t>(std::filesystem::last_write_time(path).time_since_epoch().count());
+}
+
+static uint64_t alignUp(uint64_t value, uint64_t alignment){
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+std::string MeshCache::cachePath(const std::string& sourcePath){
+    return sourcePath + ".hmesh";
+}
+
+uint64_t MeshCache::vertexOffset(){
+    return alignUp(sizeof(FileHeader), DATA_ALIGNMENT);
+}
+
+uint64_t MeshCache::indexOffset(uint64_t vertexBytes, uint32_t indexSize){
+    return alignUp(vertexOffset() + vertexBytes, indexSize);
+}
+
+uint64_t MeshCache::meshletOffset(uint64_t indexEnd){
+    return alignUp(indexEnd, DATA_ALIGNMENT);
+}
+
+uint64_t MeshCache::indexEnd(const FileHeader& header){
+    return indexOffset(header.vertexCount * header.vertexStride, header.indexSize) + header.indexCount * header.indexSize;
+}
+
+uint64_t MeshCache::submeshOffset(const FileHeader& header){
+    uint64_t meshletEnd = header.meshletCount == 0
+        ? indexEnd(header)
+        : meshletOffset(indexEnd(header)) + header.meshletCount * header.meshletStride;
+    return alignUp(meshletEnd, DATA_ALIGNMENT);
+}
+
+uint64_t MeshCache::materialOffset(const FileHeader& header){
+    return submeshOffset(header) + static_cast<uint64_t>(header.submeshCount) * sizeof(Submesh);
+}
+
+uint64_t MeshCache::expectedSize(const FileHeader& header){
+    return materialOffset(header) + header.materialBytes;
+}
+
+bool MeshCache::validSubmeshes(const FileHeader& header, const char* data){
+    const Submesh* submeshes = reinterpret_cast<const Submesh*>(data + submeshOffset(header));
+    for (uint32_t s = 0; s < header.submeshCount; s++){
+        const Submesh& submesh = submeshes[s];
+        if (submesh.material >= header.materialCount || submesh.lodCount == 0 || submesh.lodCount > MAX_MESH_LODS){
+            return false;
+        }
+        for (uint32_t l = 0; l < submesh.lodCount; l++){
+            const MeshLod& lod = submesh.lods[l];
+            if (static_cast<uint64_t>(lod.firstIndex) + lod.indexCount > header.indexCount
+                || static_cast<uint64_t>(lod.firstMeshlet) + lod.meshletCount > header.meshletCount){
+                return false;
+            }
+        }
+    }
+    // One NUL per material, the last byte included.
+    const char* textures = data + materialOffset(header);
+    uint64_t terminators = std::count(textures, textures + header.materialBytes, '\0');
+    return terminators == header.materialCount && (header.materialBytes == 0 || textures[header.materialBytes - 1] == '\0');
+}
+
+template<typename Index>
+static bool indicesBelow(const char* data, uint64_t count, uint64_t vertexCount){
+    const Index* indices = reinterpret_cast<const Index*>(data);
+    return std::all_of(indices, indices + count, [vertexCount](Index i){ return i < vertexCount; });
+}
+
+bool MeshCache::validIndices(const FileHeader& header, const char* data){
+    const char* indices = data + indexOffset(header.vertexCount * header.vertexStride, header.indexSize);
+    return header.indexSize == sizeof(uint16_t)
+        ? indicesBelow<uint16_t>(indices, header.indexCount, header.vertexCount)
+        : indicesBelow<uint32_t>(indices, header.indexCount, header.vertexCount);
+}
+
+bool MeshCache::open(const std::string& sourcePath, uint32_t vertexStride, uint32_t meshletStride, uint32_t buildOptions){
+    HELIUM_PROFILE_FUNCTION();
+    close();
+    std::string path = cachePath(sourcePath);
+    std::error_code error;
+    uint64_t sourceSize = std::filesystem::file_size(sourcePath, error);
+    if (error || !std::filesystem::exists(path, error)){
+        std::cout << "mesh cache: no cache at " << path << std::endl;
+        return false;
+    }
+
+    std::unique_ptr<MappedFile> mapped;
+    try{
+        mapped = std::make_unique<MappedFile>(path);
+    }catch (const std::exception& e){
+        std::cout << "mesh cache: " << e.what() << std::endl;
+        return false;
+    }
+    FileHeader candidate{};
+    if (mapped->size() < vertexOffset()){
+        std::cout << "mesh cache: " << path << " is truncated, reparsing" << std::endl;
+        return false;
+    }
+    memcpy(&candidate, mapped->data(), sizeof(candidate));
+
+    const char* reason = nullptr;
+    if (memcmp(candidate.magic, MAGIC, sizeof(MAGIC)) != 0 || candidate.version != FILE_VERSION
+        || candidate.vertexStride != vertexStride || candidate.meshletStride != meshletStride || (candidate.indexSize != sizeof(uint16_t) && candidate.indexSize != sizeof(uint32_t))){
+        reason = "written by another version";
+    }else if (candidate.buildOptions != buildOptions){
+        reason = "written with other build options";
+    }else if (candidate.sourcePathHash != hashBytes(sourcePath.data(), sourcePath.size()) || candidate.sourceSize != sourceSize){
+        reason = "source changed";
+    }else if (candidate.vertexCount > (mapped->size() - vertexOffset()) / vertexStride
+              || candidate.indexCount > mapped->size() / candidate.indexSize
+              || (meshletStride != 0 && candidate.meshletCount > mapped->size() / meshletStride)
+              || candidate.submeshCount > mapped->size() / sizeof(Submesh) || candidate.materialBytes > mapped->size()
+              || expectedSize(candidate) != mapped->size()){
+        reason = "size mismatch";
+    }else if (!validSubmeshes(candidate, mapped->data())){
+        reason = "size mismatch";
+    }else if (!validIndices(candidate, mapped->data())){
+        reason = "index out of range";
+    }else if (candidate.sourceModifiedTime != modifiedTime(sourcePath) && candidate.sourceHash != hashFile(sourcePath)){
+        reason = "source changed";
+    }
+    if (reason != nullptr){
+        std::cout << "mesh cache: ignoring " << path << " (" << reason << "), reparsing" << std::endl;
+        return false;
+    }
+    file = std::move(mapped);
+    header = candidate;
+    std::cout << "mesh cache: loaded " << header.vertexCount << " vertices, " << header.indexCount << " indices, " << header.submeshCount << " submeshes from " << path << std::endl;
+    return true;
+}
+
+void MeshCache::close(){
+    file.reset();
+    header = FileHeader{};
+}
+
+const void* MeshCache::vertexData() const{
+    return file->data() + vertexOffset();
+}
+
+const void* MeshCache::indexData() const{
+    return file->data() + indexOffset(header.vertexCount * header.vertexStride, header.indexSize);
+}
+
+const void* MeshCache::meshletData() const{
+    return file->data() + meshletOffset(indexEnd(header));
+}
+
+const Submesh* MeshCache::submeshData() const{
+    return reinterpret_cast<const Submesh*>(file->data() + submeshOffset(header));
+}
+
+std::vector<std::string> MeshCache::materialTextures() const{
+    std::vector<std::string> textures;
+    const char* p = file->data() + materialOffset(header);
+    for (uint32_t m = 0; m < header.materialCount; m++){
+        textures.emplace_back(p);
+        p += textures.back().size() + 1;
+    }
+    return textures;
+}
+
+void MeshCache::write(const std::string& sourcePath, const Contents& contents){
+    HELIUM_PROFILE_FUNCTION();
+    std::string path = cachePath(sourcePath);
+    FileHeader header{};
+    try{
+        memcpy(header.magic, MAGIC, sizeof(MAGIC));
+        header.version = FILE_VERSION;
+        header.vertexStride = contents.vertexStride;
+        header.indexSize = contents.indexSize;
+        header.meshletStride = contents.meshletStride;
+        header.buildOptions = contents.buildOptions;
+        header.sourcePathHash = hashBytes(sourcePath.data(), sourcePath.size());
+        header.sourceSize = std::filesystem::file_size(sourcePath);
+        header.sourceModifiedTime = modifiedTime(sourcePath);
+        header.sourceHash = hashFile(sourcePath);
+        header.vertexCount = contents.vertexCount;
+        header.indexCount = contents.indexCount;
+        header.meshletCount = contents.meshletCount;
+        memcpy(header.boundsMin, contents.boundsMin, sizeof(header.boundsMin));
+        memcpy(header.boundsMax, contents.boundsMax, sizeof(header.boundsMax));
+        memcpy(header.uvMin, contents.uvMin, sizeof(header.uvMin));
+        memcpy(header.uvMax, contents.uvMax, sizeof(header.uvMax));
+        header.submeshCount = contents.submeshCount;
+        header.materialCount = contents.materialCount;
+        for (uint32_t m = 0; m < contents.materialCount; m++){
+            header.materialBytes += contents.materialTextures[m].size() + 1;
+        }
+    }catch (const std::exception& e){
+        std::cerr << "mesh cache: cannot read " << sourcePath << ": " << e.what() << std::endl;
+        return;
+    }
+
+    // Same scheme as the pipeline cache: a temporary file renamed over the old cache, never a half written one.
+    std::string tmpPath = path + ".tmp";
+    {
+        std::ofstream out(tmpPath, std::ios::binary | std::ios::trunc);
+        if (!out.is_open()){
+            std::cerr << "mesh cache: cannot write " << tmpPath << std::endl;
+            return;
+        }
+        const char padding[DATA_ALIGNMENT] = {};
+        uint64_t vertexBytes = contents.vertexCount * contents.vertexStride;
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.write(padding, static_cast<std::streamsize>(vertexOffset() - sizeof(header)));
+        out.write(static_cast<const char*>(contents.vertices), static_cast<std::streamsize>(vertexBytes));
+        out.write(padding, static_cast<std::streamsize>(indexOffset(vertexBytes, contents.indexSize) - vertexOffset() - vertexBytes));
+        out.write(static_cast<const char*>(contents.indices), static_cast<std::streamsize>(contents.indexCount * contents.indexSize));
+        uint64_t written = indexEnd(header);
+        if (contents.meshletCount > 0){
+            out.write(padding, static_cast<std::streamsize>(meshletOffset(written) - written));
+            out.write(static_cast<const char*>(contents.meshlets), static_cast<std::streamsize>(contents.meshletCount * contents.meshletStride));
+            written = meshletOffset(written) + contents.meshletCount * contents.meshletStride;
+        }
+        out.write(padding, static_cast<std::streamsize>(submeshOffset(header) - written));
+        out.write(reinterpret_cast<const char*>(contents.submeshes), static_cast<std::streamsize>(contents.submeshCount * sizeof(Submesh)));
+        for (uint32_t m = 0; m < contents.materialCount; m++){
+            // With the terminating NUL.
+            out.write(contents.materialTextures[m].c_str(), static_cast<std::streamsize>(contents.materialTextures[m].size() + 1));
+        }
+        if (!out.good()){
+            std::cerr << "mesh cache: failed writing " << tmpPath << std::endl;
+            out.close();
+            std::filesystem::remove(tmpPath);
+            return;
+        }
+    }
+    std::error_code error;
+    std::filesystem::rename(tmpPath, path, error);
+    if (error){
+        std::cerr << "mesh cache: cannot replace " << path << ": " << error.message() << std::endl;
+        std::filesystem::remove(tmpPath, error);
+        return;
+    }
+    std::cout << "mesh cache: saved " << path << std::endl;
+}
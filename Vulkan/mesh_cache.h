@@ -0,0 +1,124 @@
+#pragma once
+
+#include "mapped_file.h"
+#include "mesh_simplifier.h"
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Triangles of a loaded model that share an OBJ object/group and a material, each with its own LOD chain.
+struct Submesh{
+    uint32_t material; // Index in the materials of the model
+    uint32_t lodCount; // At least 1, at most MAX_MESH_LODS
+    MeshLod lods[MAX_MESH_LODS]; // Ranges of the whole index buffer and meshlet list
+};
+
+/*
+Binary cache of a loaded model (deduplicated vertices, indices, position and texture coordinate bounds, meshlets, submeshes and material textures),
+written next to the source as <source>.hmesh.
+
+A cache is used when it was written for the same source path, with the same size and modification time. If only the
+modification time changed (touched, checked out again) the source is hashed and compared with the hash stored at write time.
+The vertex layout is not described by the file, the vertex stride and FILE_VERSION must match: bump FILE_VERSION when a
+vertex layout changes. Indices are stored 16 or 32 bit wide, as they will be uploaded. Meshlets follow the indices, the
+meshlet stride must match too (0 when the build does not use meshlets, the triangle order is not the same with them), and
+so must the build options, bits of the defines that change the contents (see MESH_BUILD_OPTIONS in model.cpp).
+Submeshes and the texture path of every material follow. Only the OBJ is checked: delete the cache after editing its .mtl.
+Every range is checked against the file on open, indices against the vertex count, so a stale or damaged cache is reparsed
+instead of read out of bounds. Hits are memory mapped, vertexData()/indexData()/meshletData() point into the mapping and can be handed to the upload path directly.
+*/
+class MeshCache{
+public:
+    struct Contents{
+        const void* vertices;
+        uint32_t vertexStride;
+        uint64_t vertexCount;
+        const void* indices;
+        uint32_t indexSize; // 2 or 4 bytes
+        uint64_t indexCount;
+        float boundsMin[3];
+        float boundsMax[3];
+        float uvMin[2];
+        float uvMax[2];
+        const void* meshlets;
+        uint32_t meshletStride;
+        uint64_t meshletCount;
+        const Submesh* submeshes;
+        uint32_t submeshCount;
+        const std::string* materialTextures; // Resolved paths, one per material
+        uint32_t materialCount;
+        uint32_t buildOptions;
+    };
+
+    // Maps the cache of sourcePath if there is a valid one, false otherwise (reason is logged).
+    bool open(const std::string& sourcePath, uint32_t vertexStride, uint32_t meshletStride, uint32_t buildOptions);
+    // Unmaps the cache, pointers returned before are no longer valid.
+    void close();
+    bool isOpen() const { return file != nullptr; }
+
+    const void* vertexData() const;
+    const void* indexData() const;
+    const void* meshletData() const;
+    uint64_t vertexCount() const { return header.vertexCount; }
+    uint64_t indexCount() const { return header.indexCount; }
+    uint32_t indexSize() const { return header.indexSize; }
+    uint64_t meshletCount() const { return header.meshletCount; }
+    const Submesh* submeshData() const;
+    uint32_t submeshCount() const { return header.submeshCount; }
+    std::vector<std::string> materialTextures() const;
+    const float* boundsMin() const { return header.boundsMin; }
+    const float* boundsMax() const { return header.boundsMax; }
+    const float* uvMin() const { return header.uvMin; }
+    const float* uvMax() const { return header.uvMax; }
+
+    // Best effort: a cache that cannot be written (read only directory...) is logged and skipped.
+    static void write(const std::string& sourcePath, const Contents& contents);
+    static std::string cachePath(const std::string& sourcePath);
+
+private:
+    static constexpr char MAGIC[4] = {'H', 'L', 'M', 'C'};
+    static constexpr uint32_t FILE_VERSION = 8; // 2: optimized order, 3: bounds and 16 bit indices, 4: meshlets, 5: LODs, 6: submeshes, 7: build options, 8: uv bounds
+    // Vertex data, meshlets and submeshes start aligned to this in the file, indices follow the vertices.
+    static constexpr uint64_t DATA_ALIGNMENT = 16;
+
+    struct FileHeader{
+        char magic[4];
+        uint32_t version;
+        uint32_t vertexStride;
+        uint32_t indexSize;
+        uint32_t meshletStride;
+        uint32_t submeshCount;
+        uint32_t materialCount;
+        uint32_t buildOptions;
+        uint64_t materialBytes; // NUL terminated texture paths, one per material
+        uint64_t sourcePathHash;
+        uint64_t sourceSize;
+        int64_t sourceModifiedTime;
+        uint64_t sourceHash;
+        uint64_t vertexCount;
+        uint64_t indexCount;
+        uint64_t meshletCount;
+        float boundsMin[3];
+        float boundsMax[3];
+        float uvMin[2];
+        float uvMax[2];
+    };
+
+    std::unique_ptr<MappedFile> file;
+    FileHeader header{};
+
+    static uint64_t vertexOffset();
+    static uint64_t indexOffset(uint64_t vertexBytes, uint32_t indexSize);
+    static uint64_t meshletOffset(uint64_t indexEnd);
+    // Sections of a header after the vertices, in file order.
+    static uint64_t indexEnd(const FileHeader& header);
+    static uint64_t submeshOffset(const FileHeader& header);
+    static uint64_t materialOffset(const FileHeader& header);
+    // File size implied by the counts of a header.
+    static uint64_t expectedSize(const FileHeader& header);
+    // Submesh ranges inside the indices and meshlets, materials inside the texture list.
+    static bool validSubmeshes(const FileHeader& header, const char* data);
+    // Every index below the vertex count.
+    static bool validIndices(const FileHeader& header, const char* data);
+};
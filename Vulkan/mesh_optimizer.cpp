@@ -0,0 +1,252 @@
+#include "mesh_optimizer.h"
+#include "cpu_profiler.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <numeric>
+#include <tuple>
+
+VertexCacheStats analyzeVertexCache(const uint32_t* indices, size_t indexCount, size_t vertexCount, uint32_t cacheSize){
+    // FIFO: a vertex is in the cache while fewer than cacheSize misses happened since it was loaded.
+    std::vector<uint64_t> loadedAt(vertexCount, 0);
+    std::vector<uint8_t> used(vertexCount, 0);
+    uint64_t misses = 0;
+    for (size_t i = 0; i < indexCount; i++){
+        uint32_t v = indices[i];
+        if (!used[v] || misses - loadedAt[v] >= cacheSize){
+            loadedAt[v] = misses;
+            misses++;
+        }
+        used[v] = 1;
+    }
+    size_t usedCount = std::count(used.begin(), used.end(), 1);
+    VertexCacheStats stats{};
+    stats.acmr = indexCount > 0 ? static_cast<float>(misses) / static_cast<float>(indexCount / 3) : 0.0f;
+    stats.atvr = usedCount > 0 ? static_cast<float>(misses) / static_cast<float>(usedCount) : 0.0f;
+    return stats;
+}
+
+void optimizeVertexCache(uint32_t* indices, size_t indexCount, size_t vertexCount, uint32_t cacheSize,
+                         std::vector<uint32_t>* clusters){
+    HELIUM_PROFILE_FUNCTION();
+    const size_t triangleCount = indexCount / 3;
+    if (clusters != nullptr){
+        clusters->clear();
+    }
+    if (triangleCount == 0){
+        return;
+    }
+
+    // Triangles around every vertex, as offsets into one flat array.
+    std::vector<uint32_t> liveTriangles(vertexCount, 0);
+    for (size_t i = 0; i < indexCount; i++){
+        liveTriangles[indices[i]]++;
+    }
+    std::vector<uint32_t> adjacencyOffsets(vertexCount + 1, 0);
+    std::partial_sum(liveTriangles.begin(), liveTriangles.end(), adjacencyOffsets.begin() + 1);
+    std::vector<uint32_t> adjacency(indexCount);
+    {
+        std::vector<uint32_t> fill(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+        for (size_t i = 0; i < indexCount; i++){
+            adjacency[fill[indices[i]]++] = static_cast<uint32_t>(i / 3);
+        }
+    }
+
+    std::vector<uint32_t> cacheTime(vertexCount, 0);
+    std::vector<uint8_t> emitted(triangleCount, 0);
+    std::vector<uint32_t> deadEnds;
+    std::vector<uint32_t> candidates;
+    std::vector<uint32_t> output;
+    output.reserve(indexCount);
+    uint32_t time = cacheSize + 1;
+    size_t cursor = 0;
+
+    // Next vertex to fan around once the candidates are exhausted: the most recent one with live triangles, else the next in input order.
+    auto skipDeadEnd = [&]() -> int64_t{
+        while (!deadEnds.empty()){
+            uint32_t v = deadEnds.back();
+            deadEnds.pop_back();
+            if (liveTriangles[v] > 0){
+                return v;
+            }
+        }
+        while (cursor < vertexCount){
+            if (liveTriangles[cursor] > 0){
+                return static_cast<int64_t>(cursor);
+            }
+            cursor++;
+        }
+        return -1;
+    };
+
+    int64_t fanning = skipDeadEnd();
+    while (fanning >= 0){
+        candidates.clear();
+        for (uint32_t a = adjacencyOffsets[fanning]; a < adjacencyOffsets[fanning + 1]; a++){
+            uint32_t t = adjacency[a];
+            if (emitted[t]){
+                continue;
+            }
+            emitted[t] = 1;
+            for (int c = 0; c < 3; c++){
+                uint32_t v = indices[t * 3 + c];
+                output.push_back(v);
+                deadEnds.push_back(v);
+                candidates.push_back(v);
+                liveTriangles[v]--;
+                if (time - cacheTime[v] > cacheSize){
+                    cacheTime[v] = time++;
+                }
+            }
+        }
+
+        // Prefer the candidate that stays in cache the longest while all its triangles are emitted.
+        int64_t next = -1;
+        int64_t bestPriority = -1;
+        for (uint32_t v : candidates){
+            if (liveTriangles[v] == 0){
+                continue;
+            }
+            int64_t priority = 0;
+            if (time - cacheTime[v] + 2 * liveTriangles[v] <= cacheSize){
+                priority = time - cacheTime[v];
+            }
+            if (priority > bestPriority){
+                bestPriority = priority;
+                next = v;
+            }
+        }
+        if (next < 0){
+            next = skipDeadEnd();
+            // Fanning restarts away from the cache contents: a cluster boundary for optimizeOverdraw().
+            if (clusters != nullptr && next >= 0){
+                clusters->push_back(static_cast<uint32_t>(output.size() / 3));
+            }
+        }
+        fanning = next;
+    }
+    if (clusters != nullptr){
+        clusters->insert(clusters->begin(), 0);
+    }
+    memcpy(indices, output.data(), indexCount * sizeof(uint32_t));
+}
+
+void optimizeOverdraw(uint32_t* indices, size_t indexCount, const void* positions, size_t positionStride, size_t vertexCount,
+                      const std::vector<uint32_t>& clusters){
+    HELIUM_PROFILE_FUNCTION();
+    const size_t triangleCount = indexCount / 3;
+    if (clusters.size() < 2 || vertexCount == 0){
+        return;
+    }
+    auto position = [&](uint32_t v){
+        return reinterpret_cast<const float*>(static_cast<const char*>(positions) + v * positionStride);
+    };
+
+    // Area weighted centroid of the mesh, the reference point for "outward".
+    struct Cluster{
+        uint32_t first;
+        uint32_t end;
+        float centroid[3];
+        float normal[3];
+        float area;
+        float sortKey;
+    };
+    std::vector<Cluster> sorted(clusters.size());
+    float meshCentroid[3] = {0.0f, 0.0f, 0.0f};
+    float meshArea = 0.0f;
+    for (size_t c = 0; c < clusters.size(); c++){
+        Cluster& cluster = sorted[c];
+        cluster = Cluster{clusters[c], c + 1 < clusters.size() ? clusters[c + 1] : static_cast<uint32_t>(triangleCount), {}, {}, 0.0f, 0.0f};
+        for (uint32_t t = cluster.first; t < cluster.end; t++){
+            const float* p0 = position(indices[t * 3 + 0]);
+            const float* p1 = position(indices[t * 3 + 1]);
+            const float* p2 = position(indices[t * 3 + 2]);
+            float e1[3] = {p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2]};
+            float e2[3] = {p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2]};
+            // Cross product, its length is twice the triangle area.
+            float n[3] = {e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2], e1[0] * e2[1] - e1[1] * e2[0]};
+            float area = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+            for (int k = 0; k < 3; k++){
+                cluster.centroid[k] += (p0[k] + p1[k] + p2[k]) / 3.0f * area;
+                cluster.normal[k] += n[k];
+            }
+            cluster.area += area;
+        }
+        for (int k = 0; k < 3; k++){
+            meshCentroid[k] += cluster.centroid[k];
+            cluster.centroid[k] = cluster.area > 0.0f ? cluster.centroid[k] / cluster.area : 0.0f;
+        }
+        meshArea += cluster.area;
+    }
+    for (int k = 0; k < 3; k++){
+        meshCentroid[k] = meshArea > 0.0f ? meshCentroid[k] / meshArea : 0.0f;
+    }
+
+    // Clusters facing away from the center are on the outside of the mesh and occlude the rest: draw them first.
+    for (Cluster& cluster : sorted){
+        float length = std::sqrt(cluster.normal[0] * cluster.normal[0] + cluster.normal[1] * cluster.normal[1] + cluster.normal[2] * cluster.normal[2]);
+        cluster.sortKey = 0.0f;
+        if (length > 0.0f){
+            for (int k = 0; k < 3; k++){
+                cluster.sortKey += (cluster.centroid[k] - meshCentroid[k]) * cluster.normal[k] / length;
+            }
+        }
+    }
+    std::stable_sort(sorted.begin(), sorted.end(), [](const Cluster& a, const Cluster& b){ return a.sortKey > b.sortKey; });
+
+    std::vector<uint32_t> output;
+    output.reserve(indexCount);
+    for (const Cluster& cluster : sorted){
+        output.insert(output.end(), indices + cluster.first * 3, indices + cluster.end * 3);
+    }
+    memcpy(indices, output.data(), output.size() * sizeof(uint32_t));
+}
+
+size_t optimizeVertexFetch(void* vertices, size_t vertexCount, size_t vertexStride, uint32_t* indices, size_t indexCount){
+    HELIUM_PROFILE_FUNCTION();
+    const uint32_t unused = ~0u;
+    std::vector<uint32_t> remap(vertexCount, unused);
+    uint32_t next = 0;
+    for (size_t i = 0; i < indexCount; i++){
+        uint32_t& target = remap[indices[i]];
+        if (target == unused){
+            target = next++;
+        }
+        indices[i] = target;
+    }
+    std::vector<char> reordered(static_cast<size_t>(next) * vertexStride);
+    const char* source = static_cast<const char*>(vertices);
+    for (size_t v = 0; v < vertexCount; v++){
+        if (remap[v] != unused){
+            memcpy(reordered.data() + remap[v] * vertexStride, source + v * vertexStride, vertexStride);
+        }
+    }
+    if (!reordered.empty()){
+        memcpy(vertices, reordered.data(), reordered.size());
+    }
+    return next;
+}
+
+std::vector<uint16_t> narrowIndices(const uint32_t* indices, size_t indexCount){
+    std::vector<uint16_t> narrowed(indexCount);
+    for (size_t i = 0; i < indexCount; i++){
+        narrowed[i] = static_cast<uint16_t>(indices[i]);
+    }
+    return narrowed;
+}
+
+std::vector<uint32_t> weldVertexPositions(const void* positions, size_t positionStride, size_t vertexCount){
+    HELIUM_PROFILE_FUNCTION();
+    auto key = [&](uint32_t v){
+        const float* p = reinterpret_cast<const float*>(static_cast<const char*>(positions) + v * positionStride);
+        return std::make_tuple(p[0], p[1], p[2]);
+    };
+    std::vector<uint32_t> order(vertexCount);
+    std::iota(order.begin(), order.end(), 0u);
+    std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b){ return key(a) < key(b); });
+    std::vector<uint32_t> welded(vertexCount);
+    for (size_t i = 0; i < order.size(); i++){
+        welded[order[i]] = i > 0 && key(order[i]) == key(order[i - 1]) ? welded[order[i - 1]] : order[i];
+    }
+    return welded;
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/*
+Post load reordering of indexed triangle lists, run in this order:
+1. optimizeVertexCache(): Tipsify (Sander, Nehab, Barczak 2007). Fans around recently used vertices so the post transform
+   cache hits more often, linear in the number of indices.
+2. optimizeOverdraw(): moves whole Tipsify clusters so outward facing ones (likely occluders) are drawn first. Triangles
+   inside a cluster keep their order, so the cache gains mostly survive.
+3. optimizeVertexFetch(): renumbers vertices in first use order so vertex fetches walk memory forward.
+analyzeVertexCache() simulates a FIFO cache to report ACMR (misses per triangle, 0.5 is the ideal for big regular meshes)
+and ATVR (misses per vertex, 1.0 is ideal).
+*/
+struct VertexCacheStats{
+    float acmr;
+    float atvr;
+};
+
+VertexCacheStats analyzeVertexCache(const uint32_t* indices, size_t indexCount, size_t vertexCount, uint32_t cacheSize = 16);
+
+// clusters (optional) receives the first triangle of every cluster, the input of optimizeOverdraw().
+void optimizeVertexCache(uint32_t* indices, size_t indexCount, size_t vertexCount, uint32_t cacheSize = 16,
+                         std::vector<uint32_t>* clusters = nullptr);
+
+// positions: xyz floats at the start of each vertex, positionStride bytes apart.
+void optimizeOverdraw(uint32_t* indices, size_t indexCount, const void* positions, size_t positionStride, size_t vertexCount,
+                      const std::vector<uint32_t>& clusters);
+
+// Reorders vertices (vertexStride bytes each) in place and remaps indices. Returns the new vertex count, unreferenced vertices are dropped.
+size_t optimizeVertexFetch(void* vertices, size_t vertexCount, size_t vertexStride, uint32_t* indices, size_t indexCount);
+
+// 16 bit indices address every vertex (primitive restart is off, so 0xFFFF is a regular index).
+inline bool fitsUint16Indices(size_t vertexCount){
+    return vertexCount <= 65536;
+}
+
+std::vector<uint16_t> narrowIndices(const uint32_t* indices, size_t indexCount);
+
+/*
+Maps every vertex to one representative of all the vertices at the same position (bitwise equal floats), so that
+adjacency can cross UV seams and normal creases. Representatives map to themselves.
+*/
+std::vector<uint32_t> weldVertexPositions(const void* positions, size_t positionStride, size_t vertexCount);
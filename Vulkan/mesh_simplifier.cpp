@@ -0,0 +1,378 @@
+#include "mesh_simplifier.h"
+#include "cpu_profiler.h"
+#include "mesh_optimizer.h"
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+
+namespace {
+
+struct Vec3{
+    float x, y, z;
+};
+
+Vec3 sub(const Vec3& a, const Vec3& b){ return {a.x - b.x, a.y - b.y, a.z - b.z}; }
+Vec3 cross(const Vec3& a, const Vec3& b){ return {a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x}; }
+float dot(const Vec3& a, const Vec3& b){ return a.x * b.x + a.y * b.y + a.z * b.z; }
+float length(const Vec3& a){ return std::sqrt(dot(a, a)); }
+
+// Sum of squared distances to planes (symmetric 4x4, upper half) and the sum of their weights.
+struct Quadric{
+    double a00, a01, a02, a03;
+    double a11, a12, a13;
+    double a22, a23;
+    double a33;
+    double weight;
+};
+
+void addPlane(Quadric& q, double a, double b, double c, double d, double w){
+    q.a00 += w * a * a; q.a01 += w * a * b; q.a02 += w * a * c; q.a03 += w * a * d;
+    q.a11 += w * b * b; q.a12 += w * b * c; q.a13 += w * b * d;
+    q.a22 += w * c * c; q.a23 += w * c * d;
+    q.a33 += w * d * d;
+    q.weight += w;
+}
+
+Quadric add(const Quadric& q, const Quadric& r){
+    return {
+        q.a00 + r.a00, q.a01 + r.a01, q.a02 + r.a02, q.a03 + r.a03,
+        q.a11 + r.a11, q.a12 + r.a12, q.a13 + r.a13,
+        q.a22 + r.a22, q.a23 + r.a23,
+        q.a33 + r.a33,
+        q.weight + r.weight
+    };
+}
+
+// Mean squared distance of p to the planes.
+double evaluate(const Quadric& q, const Vec3& p){
+    if (q.weight <= 0.0){
+        return 0.0;
+    }
+    double x = p.x, y = p.y, z = p.z;
+    double v = q.a00 * x * x + 2.0 * q.a01 * x * y + 2.0 * q.a02 * x * z + 2.0 * q.a03 * x
+             + q.a11 * y * y + 2.0 * q.a12 * y * z + 2.0 * q.a13 * y
+             + q.a22 * z * z + 2.0 * q.a23 * z
+             + q.a33;
+    return std::max(v, 0.0) / q.weight;
+}
+
+struct Collapse{
+    uint32_t from;
+    uint32_t to;
+    double cost;
+};
+
+enum VertexKind : uint8_t{
+    MANIFOLD,
+    BORDER, // On exactly two border edges, slides along them
+    LOCKED,
+};
+
+// Border planes weigh this much per squared edge length, the surface planes weigh their area.
+const double BORDER_WEIGHT = 10.0;
+
+struct WeldedEdge{
+    uint64_t key; // min << 32 | max of the welded ends
+    uint32_t uses; // Triangles using the edge
+};
+
+uint64_t edgeKey(uint32_t a, uint32_t b){
+    return static_cast<uint64_t>(std::min(a, b)) << 32 | std::max(a, b);
+}
+
+// Sorted welded edges of a triangle list, with the number of triangles on each.
+void collectEdges(const std::vector<uint32_t>& indices, const std::vector<uint32_t>& welded, std::vector<WeldedEdge>& edges){
+    std::vector<uint64_t> keys;
+    keys.reserve(indices.size());
+    for (size_t i = 0; i < indices.size(); i += 3){
+        for (int e = 0; e < 3; e++){
+            keys.push_back(edgeKey(welded[indices[i + e]], welded[indices[i + (e + 1) % 3]]));
+        }
+    }
+    std::sort(keys.begin(), keys.end());
+    edges.clear();
+    for (uint64_t key : keys){
+        if (edges.empty() || edges.back().key != key){
+            edges.push_back({key, 0});
+        }
+        edges.back().uses++;
+    }
+}
+
+uint32_t edgeUses(const std::vector<WeldedEdge>& edges, uint32_t a, uint32_t b){
+    uint64_t key = edgeKey(a, b);
+    auto it = std::lower_bound(edges.begin(), edges.end(), key, [](const WeldedEdge& edge, uint64_t k){ return edge.key < k; });
+    return it != edges.end() && it->key == key ? it->uses : 0;
+}
+
+} // namespace
+
+std::vector<uint32_t> simplifyMesh(const uint32_t* indices, size_t indexCount, const void* positions, size_t positionStride,
+                                   size_t vertexCount, size_t targetIndexCount, float* resultError){
+    HELIUM_PROFILE_FUNCTION();
+    auto position = [&](uint32_t v) -> const Vec3&{
+        return *reinterpret_cast<const Vec3*>(static_cast<const char*>(positions) + v * positionStride);
+    };
+    std::vector<uint32_t> result(indices, indices + indexCount - indexCount % 3);
+
+    // Seam copies are grouped under their welded representative and always move together.
+    std::vector<uint32_t> welded = weldVertexPositions(positions, positionStride, vertexCount);
+    std::vector<uint32_t> groupOffsets(vertexCount + 1, 0);
+    for (size_t v = 0; v < vertexCount; v++){
+        groupOffsets[welded[v] + 1]++;
+    }
+    std::partial_sum(groupOffsets.begin(), groupOffsets.end(), groupOffsets.begin());
+    std::vector<uint32_t> groupMembers(vertexCount);
+    {
+        std::vector<uint32_t> fill(groupOffsets.begin(), groupOffsets.end() - 1);
+        for (uint32_t v = 0; v < vertexCount; v++){
+            groupMembers[fill[welded[v]]++] = v;
+        }
+    }
+
+    std::vector<Quadric> quadrics(vertexCount, Quadric{});
+    for (size_t i = 0; i < result.size(); i += 3){
+        const Vec3& p0 = position(result[i]);
+        Vec3 n = cross(sub(position(result[i + 1]), p0), sub(position(result[i + 2]), p0));
+        float l = length(n);
+        if (l == 0.0f){
+            continue;
+        }
+        n = {n.x / l, n.y / l, n.z / l};
+        double d = -dot(n, p0);
+        for (int c = 0; c < 3; c++){
+            addPlane(quadrics[welded[result[i + c]]], n.x, n.y, n.z, d, 0.5 * l);
+        }
+    }
+
+    // Border edges add a plane through the edge, perpendicular to its triangle, so open borders keep their outline.
+    std::vector<WeldedEdge> edges;
+    collectEdges(result, welded, edges);
+    for (size_t i = 0; i < result.size(); i += 3){
+        const Vec3& p0 = position(result[i]);
+        Vec3 n = cross(sub(position(result[i + 1]), p0), sub(position(result[i + 2]), p0));
+        for (int e = 0; e < 3; e++){
+            uint32_t a = result[i + e];
+            uint32_t b = result[i + (e + 1) % 3];
+            if (welded[a] == welded[b] || edgeUses(edges, welded[a], welded[b]) != 1){
+                continue;
+            }
+            Vec3 edge = sub(position(b), position(a));
+            Vec3 perpendicular = cross(edge, n);
+            float l = length(perpendicular);
+            if (l == 0.0f){
+                continue;
+            }
+            perpendicular = {perpendicular.x / l, perpendicular.y / l, perpendicular.z / l};
+            double d = -dot(perpendicular, position(a));
+            double weight = BORDER_WEIGHT * dot(edge, edge);
+            addPlane(quadrics[welded[a]], perpendicular.x, perpendicular.y, perpendicular.z, d, weight);
+            addPlane(quadrics[welded[b]], perpendicular.x, perpendicular.y, perpendicular.z, d, weight);
+        }
+    }
+
+    double maxError = 0.0;
+    std::vector<uint32_t> remap(vertexCount);
+    std::vector<uint8_t> touched(vertexCount);
+    std::vector<uint8_t> kind(vertexCount);
+    std::vector<uint8_t> borderEdges(vertexCount);
+    std::vector<uint32_t> adjacencyOffsets(vertexCount + 1);
+    std::vector<uint32_t> adjacency;
+    std::vector<Collapse> collapses;
+    std::vector<std::pair<uint32_t, uint32_t>> moves;
+    std::vector<uint32_t> fromNeighbours;
+    std::vector<uint32_t> toNeighbours;
+    std::vector<uint32_t> opposite;
+    while (result.size() > targetIndexCount){
+        // Vertex -> triangles of the current result.
+        std::fill(adjacencyOffsets.begin(), adjacencyOffsets.end(), 0);
+        for (uint32_t v : result){
+            adjacencyOffsets[v + 1]++;
+        }
+        std::partial_sum(adjacencyOffsets.begin(), adjacencyOffsets.end(), adjacencyOffsets.begin());
+        adjacency.resize(result.size());
+        {
+            std::vector<uint32_t> fill(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+            for (size_t i = 0; i < result.size(); i++){
+                adjacency[fill[result[i]]++] = static_cast<uint32_t>(i / 3);
+            }
+        }
+
+        /*
+        Manifold vertices move along any edge. A vertex on exactly two border edges only slides along one of them,
+        anything else (border corners, ends of non manifold edges) stays.
+        */
+        collectEdges(result, welded, edges);
+        std::fill(kind.begin(), kind.end(), MANIFOLD);
+        std::fill(borderEdges.begin(), borderEdges.end(), 0);
+        for (const WeldedEdge& edge : edges){
+            uint32_t a = static_cast<uint32_t>(edge.key >> 32);
+            uint32_t b = static_cast<uint32_t>(edge.key);
+            if (edge.uses > 2){
+                kind[a] = LOCKED;
+                kind[b] = LOCKED;
+            }else if (edge.uses == 1){
+                borderEdges[a] = static_cast<uint8_t>(std::min(borderEdges[a] + 1, 3));
+                borderEdges[b] = static_cast<uint8_t>(std::min(borderEdges[b] + 1, 3));
+            }
+        }
+        for (size_t v = 0; v < vertexCount; v++){
+            if (kind[v] != LOCKED && borderEdges[v] != 0){
+                kind[v] = borderEdges[v] == 2 ? BORDER : LOCKED;
+            }
+        }
+
+        collapses.clear();
+        for (size_t i = 0; i < result.size(); i += 3){
+            for (int e = 0; e < 3; e++){
+                uint32_t a = result[i + e];
+                uint32_t b = result[i + (e + 1) % 3];
+                for (int direction = 0; direction < 2; direction++){
+                    uint32_t from = direction == 0 ? a : b;
+                    uint32_t to = direction == 0 ? b : a;
+                    uint32_t fromGroup = welded[from];
+                    uint32_t toGroup = welded[to];
+                    if (fromGroup == toGroup || kind[fromGroup] == LOCKED
+                        || (kind[fromGroup] == BORDER && edgeUses(edges, fromGroup, toGroup) != 1)){
+                        continue;
+                    }
+                    double cost = evaluate(add(quadrics[fromGroup], quadrics[toGroup]), position(to));
+                    collapses.push_back({from, to, cost});
+                }
+            }
+        }
+        std::sort(collapses.begin(), collapses.end(), [](const Collapse& a, const Collapse& b){ return a.cost < b.cost; });
+
+        // Welded neighbours of a group, through the remap of the collapses applied so far in this pass.
+        auto collectNeighbours = [&](uint32_t group, std::vector<uint32_t>& neighbours){
+            neighbours.clear();
+            for (uint32_t g = groupOffsets[group]; g < groupOffsets[group + 1]; g++){
+                uint32_t u = groupMembers[g];
+                for (uint32_t a = adjacencyOffsets[u]; a < adjacencyOffsets[u + 1]; a++){
+                    for (int c = 0; c < 3; c++){
+                        uint32_t neighbour = welded[remap[result[adjacency[a] * 3 + c]]];
+                        if (neighbour != group){
+                            neighbours.push_back(neighbour);
+                        }
+                    }
+                }
+            }
+            std::sort(neighbours.begin(), neighbours.end());
+            neighbours.erase(std::unique(neighbours.begin(), neighbours.end()), neighbours.end());
+        };
+
+        std::iota(remap.begin(), remap.end(), 0u);
+        std::fill(touched.begin(), touched.end(), 0);
+        const size_t trianglesToRemove = (result.size() - targetIndexCount + 2) / 3;
+        size_t removed = 0;
+        size_t applied = 0;
+        for (const Collapse& collapse : collapses){
+            if (removed >= trianglesToRemove){
+                break;
+            }
+            const uint32_t fromGroup = welded[collapse.from];
+            const uint32_t toGroup = welded[collapse.to];
+            if (touched[fromGroup] || touched[toGroup]){
+                continue;
+            }
+            // Every copy of the source needs an edge to a copy of the target, otherwise the seam would tear.
+            moves.clear();
+            bool valid = true;
+            for (uint32_t g = groupOffsets[fromGroup]; g < groupOffsets[fromGroup + 1] && valid; g++){
+                uint32_t u = groupMembers[g];
+                uint32_t target = ~0u;
+                for (uint32_t a = adjacencyOffsets[u]; a < adjacencyOffsets[u + 1] && target == ~0u; a++){
+                    const uint32_t* triangle = &result[adjacency[a] * 3];
+                    for (int c = 0; c < 3; c++){
+                        if (welded[triangle[c]] == toGroup){
+                            target = triangle[c];
+                        }
+                    }
+                }
+                if (adjacencyOffsets[u] != adjacencyOffsets[u + 1]){
+                    valid = target != ~0u;
+                    moves.push_back({u, target});
+                }
+            }
+            if (!valid){
+                continue;
+            }
+
+            // Triangles that keep their area must keep facing the same way.
+            size_t collapsedTriangles = 0;
+            opposite.clear();
+            for (const auto& [u, target] : moves){
+                for (uint32_t a = adjacencyOffsets[u]; a < adjacencyOffsets[u + 1] && valid; a++){
+                    const uint32_t* triangle = &result[adjacency[a] * 3];
+                    Vec3 before[3];
+                    Vec3 after[3];
+                    bool degenerate = false;
+                    for (int c = 0; c < 3; c++){
+                        uint32_t corner = remap[triangle[c]];
+                        degenerate = degenerate || welded[corner] == toGroup;
+                        before[c] = position(corner);
+                        after[c] = corner == u ? position(target) : before[c];
+                    }
+                    if (degenerate){
+                        collapsedTriangles++;
+                        for (int c = 0; c < 3; c++){
+                            uint32_t corner = welded[remap[triangle[c]]];
+                            if (corner != fromGroup && corner != toGroup){
+                                opposite.push_back(corner);
+                            }
+                        }
+                        continue;
+                    }
+                    Vec3 normalBefore = cross(sub(before[1], before[0]), sub(before[2], before[0]));
+                    Vec3 normalAfter = cross(sub(after[1], after[0]), sub(after[2], after[0]));
+                    valid = dot(normalBefore, normalAfter) > 0.0f;
+                }
+            }
+            if (!valid){
+                continue;
+            }
+            // Link condition: only the third corners of the removed triangles may neighbour both ends, otherwise the
+            // collapse folds two parts of the surface onto one edge.
+            collectNeighbours(fromGroup, fromNeighbours);
+            collectNeighbours(toGroup, toNeighbours);
+            std::sort(opposite.begin(), opposite.end());
+            opposite.erase(std::unique(opposite.begin(), opposite.end()), opposite.end());
+            size_t shared = 0;
+            for (uint32_t neighbour : fromNeighbours){
+                shared += std::binary_search(toNeighbours.begin(), toNeighbours.end(), neighbour) ? 1 : 0;
+            }
+            if (shared != opposite.size()){
+                continue;
+            }
+
+            for (const auto& [u, target] : moves){
+                remap[u] = target;
+            }
+            touched[fromGroup] = 1;
+            touched[toGroup] = 1;
+            quadrics[toGroup] = add(quadrics[toGroup], quadrics[fromGroup]);
+            maxError = std::max(maxError, collapse.cost);
+            removed += collapsedTriangles;
+            applied++;
+        }
+        if (applied == 0){
+            break;
+        }
+
+        size_t kept = 0;
+        for (size_t i = 0; i < result.size(); i += 3){
+            uint32_t a = remap[result[i]];
+            uint32_t b = remap[result[i + 1]];
+            uint32_t c = remap[result[i + 2]];
+            if (welded[a] == welded[b] || welded[b] == welded[c] || welded[a] == welded[c]){
+                continue;
+            }
+            result[kept++] = a;
+            result[kept++] = b;
+            result[kept++] = c;
+        }
+        result.resize(kept);
+    }
+    *resultError = static_cast<float>(std::sqrt(maxError));
+    return result;
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/*
+Mesh simplification for LOD chains, quadric error metrics (Garland, Heckbert 1997) with half edge collapses: a vertex is
+merged into one of its neighbours, so simplified index lists reuse the vertex buffer of the full mesh as is.
+
+Every vertex accumulates the planes of its triangles (area weighted) and a collapse costs the mean squared distance of
+the target to the planes of both ends. Collapses are applied cheapest first, in passes where each vertex moves at most
+once, until the target index count is reached or nothing can collapse anymore.
+- Copies of a vertex split by a UV seam collapse together along the seam, so the seam does not tear.
+- Vertices on open borders only slide along the border, against planes that keep its outline. Border corners and
+  vertices on non manifold edges never move.
+- A collapse that would join two parts of the surface (link condition) is skipped.
+- A collapse that would flip a triangle is skipped.
+*/
+
+// Up to this many levels per mesh, level 0 being the full mesh.
+constexpr uint32_t MAX_MESH_LODS = 5;
+
+// One level of the chain: a range of the index buffer and, with meshlet culling, a range of the meshlets.
+struct MeshLod{
+    uint32_t firstIndex;
+    uint32_t indexCount;
+    uint32_t firstMeshlet;
+    uint32_t meshletCount;
+    float error; // Distance to the full mesh in model space, 0 for level 0
+};
+
+/*
+positions: xyz floats at the start of each vertex, positionStride bytes apart.
+Returns the simplified triangle list, which may stay above targetIndexCount when nothing else can collapse.
+resultError receives the error of the costliest collapse (square root of the quadric error, so a distance).
+*/
+std::vector<uint32_t> simplifyMesh(const uint32_t* indices, size_t indexCount, const void* positions, size_t positionStride,
+                                   size_t vertexCount, size_t targetIndexCount, float* resultError);
@@ -0,0 +1,200 @@
+#include "meshlet.h"
+#include "cpu_profiler.h"
+#include "mesh_optimizer.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <numeric>
+
+namespace {
+
+struct Vec3{
+    float x, y, z;
+};
+
+Vec3 sub(const Vec3& a, const Vec3& b){ return {a.x - b.x, a.y - b.y, a.z - b.z}; }
+Vec3 cross(const Vec3& a, const Vec3& b){ return {a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x}; }
+float dot(const Vec3& a, const Vec3& b){ return a.x * b.x + a.y * b.y + a.z * b.z; }
+float length(const Vec3& a){ return std::sqrt(dot(a, a)); }
+
+// Below this the normals of a meshlet spread over more than a hemisphere (roughly), the cone would never cull anything.
+const float MIN_CONE_DOT = 0.1f;
+
+void computeBounds(Meshlet& meshlet, const Vec3* const* corners){
+    // Sphere around the box of the corners, cheap and within a few percent of the minimal one for compact meshlets.
+    Vec3 boxMin = *corners[0];
+    Vec3 boxMax = *corners[0];
+    for (uint32_t i = 1; i < meshlet.indexCount; i++){
+        const Vec3& p = *corners[i];
+        boxMin = {std::min(boxMin.x, p.x), std::min(boxMin.y, p.y), std::min(boxMin.z, p.z)};
+        boxMax = {std::max(boxMax.x, p.x), std::max(boxMax.y, p.y), std::max(boxMax.z, p.z)};
+    }
+    Vec3 center = {(boxMin.x + boxMax.x) * 0.5f, (boxMin.y + boxMax.y) * 0.5f, (boxMin.z + boxMax.z) * 0.5f};
+    float radius = 0.0f;
+    for (uint32_t i = 0; i < meshlet.indexCount; i++){
+        radius = std::max(radius, length(sub(*corners[i], center)));
+    }
+
+    // Normal cone: average direction, then the widest angle from it.
+    std::vector<Vec3> normals;
+    normals.reserve(meshlet.indexCount / 3);
+    Vec3 axis = {0.0f, 0.0f, 0.0f};
+    for (uint32_t t = 0; t < meshlet.indexCount; t += 3){
+        Vec3 n = cross(sub(*corners[t + 1], *corners[t]), sub(*corners[t + 2], *corners[t]));
+        float l = length(n);
+        if (l == 0.0f){
+            continue; // Degenerate, faces nowhere
+        }
+        n = {n.x / l, n.y / l, n.z / l};
+        normals.push_back(n);
+        axis = {axis.x + n.x, axis.y + n.y, axis.z + n.z};
+    }
+    float axisLength = length(axis);
+    float cutoff = 1.0f;
+    if (axisLength > 0.0f){
+        axis = {axis.x / axisLength, axis.y / axisLength, axis.z / axisLength};
+        float minDot = 1.0f;
+        for (const Vec3& n : normals){
+            minDot = std::min(minDot, dot(axis, n));
+        }
+        cutoff = minDot <= MIN_CONE_DOT ? 1.0f : std::sqrt(1.0f - minDot * minDot);
+    }else{
+        axis = {0.0f, 0.0f, 1.0f};
+    }
+
+    meshlet.center[0] = center.x;
+    meshlet.center[1] = center.y;
+    meshlet.center[2] = center.z;
+    meshlet.radius = radius;
+    meshlet.coneAxis[0] = axis.x;
+    meshlet.coneAxis[1] = axis.y;
+    meshlet.coneAxis[2] = axis.z;
+    meshlet.coneCutoff = cutoff;
+}
+
+} // namespace
+
+std::vector<Meshlet> buildMeshlets(uint32_t* indices, size_t indexCount, const void* positions, size_t positionStride,
+                                   size_t vertexCount){
+    HELIUM_PROFILE_FUNCTION();
+    auto position = [&](uint32_t v) -> const Vec3&{
+        return *reinterpret_cast<const Vec3*>(static_cast<const char*>(positions) + v * positionStride);
+    };
+    const uint32_t triangleCount = static_cast<uint32_t>(indexCount / 3);
+
+    // Vertices split by UV seams share their position: weld them so adjacency crosses seams.
+    std::vector<uint32_t> welded = weldVertexPositions(positions, positionStride, vertexCount);
+
+    // Triangles around every welded vertex.
+    std::vector<uint32_t> adjacencyOffsets(vertexCount + 1, 0);
+    for (size_t i = 0; i < triangleCount * 3; i++){
+        adjacencyOffsets[welded[indices[i]] + 1]++;
+    }
+    std::partial_sum(adjacencyOffsets.begin(), adjacencyOffsets.end(), adjacencyOffsets.begin());
+    std::vector<uint32_t> adjacency(triangleCount * 3);
+    {
+        std::vector<uint32_t> fill(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+        for (size_t i = 0; i < triangleCount * 3; i++){
+            adjacency[fill[welded[indices[i]]]++] = static_cast<uint32_t>(i / 3);
+        }
+    }
+
+    std::vector<Vec3> triangleNormals(triangleCount);
+    for (uint32_t t = 0; t < triangleCount; t++){
+        const Vec3& p0 = position(indices[t * 3]);
+        Vec3 n = cross(sub(position(indices[t * 3 + 1]), p0), sub(position(indices[t * 3 + 2]), p0));
+        float l = length(n);
+        triangleNormals[t] = l > 0.0f ? Vec3{n.x / l, n.y / l, n.z / l} : Vec3{0.0f, 0.0f, 0.0f};
+    }
+
+    std::vector<uint8_t> emitted(triangleCount, 0);
+    // Meshlet that last used each (unwelded) vertex, to count distinct vertices without clearing a set per meshlet.
+    std::vector<uint32_t> lastMeshlet(vertexCount, ~0u);
+    std::vector<uint32_t> output;
+    output.reserve(triangleCount * 3);
+    std::vector<uint32_t> candidates;
+    std::vector<const Vec3*> corners;
+    corners.reserve(MESHLET_MAX_TRIANGLES * 3);
+    std::vector<Meshlet> meshlets;
+    uint32_t seedCursor = 0;
+
+    while (true){
+        while (seedCursor < triangleCount && emitted[seedCursor]){
+            seedCursor++;
+        }
+        if (seedCursor == triangleCount){
+            break;
+        }
+        const uint32_t id = static_cast<uint32_t>(meshlets.size());
+        Meshlet meshlet{};
+        meshlet.firstIndex = static_cast<uint32_t>(output.size());
+        uint32_t meshletVertices = 0;
+        Vec3 normalSum = {0.0f, 0.0f, 0.0f};
+        candidates.clear();
+        corners.clear();
+
+        auto newVertices = [&](uint32_t t){
+            uint32_t count = 0;
+            for (int c = 0; c < 3; c++){
+                // A corner repeated within a degenerate triangle is counted twice, which only closes a meshlet early.
+                count += lastMeshlet[indices[t * 3 + c]] != id ? 1 : 0;
+            }
+            return count;
+        };
+        auto add = [&](uint32_t t){
+            emitted[t] = 1;
+            for (int c = 0; c < 3; c++){
+                uint32_t v = indices[t * 3 + c];
+                if (lastMeshlet[v] != id){
+                    lastMeshlet[v] = id;
+                    meshletVertices++;
+                }
+                output.push_back(v);
+                corners.push_back(&position(v));
+                uint32_t w = welded[v];
+                for (uint32_t a = adjacencyOffsets[w]; a < adjacencyOffsets[w + 1]; a++){
+                    if (!emitted[adjacency[a]]){
+                        candidates.push_back(adjacency[a]);
+                    }
+                }
+            }
+            normalSum = {normalSum.x + triangleNormals[t].x, normalSum.y + triangleNormals[t].y, normalSum.z + triangleNormals[t].z};
+            meshlet.indexCount += 3;
+        };
+
+        add(seedCursor);
+        while (meshlet.indexCount / 3 < MESHLET_MAX_TRIANGLES){
+            // Fewest new vertices first, then the triangle facing most like the meshlet so far.
+            int64_t best = -1;
+            uint32_t bestNew = 4;
+            float bestFacing = -2.0f;
+            size_t kept = 0;
+            for (size_t i = 0; i < candidates.size(); i++){
+                uint32_t t = candidates[i];
+                if (emitted[t]){
+                    continue;
+                }
+                candidates[kept++] = t;
+                uint32_t added = newVertices(t);
+                if (meshletVertices + added > MESHLET_MAX_VERTICES){
+                    continue;
+                }
+                float facing = dot(triangleNormals[t], normalSum);
+                if (added < bestNew || (added == bestNew && facing > bestFacing)){
+                    best = t;
+                    bestNew = added;
+                    bestFacing = facing;
+                }
+            }
+            candidates.resize(kept);
+            if (best < 0){
+                break; // Nothing connected fits, the next seed starts a new meshlet
+            }
+            add(static_cast<uint32_t>(best));
+        }
+        computeBounds(meshlet, corners.data());
+        meshlets.push_back(meshlet);
+    }
+    memcpy(indices, output.data(), output.size() * sizeof(uint32_t));
+    return meshlets;
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/*
+Meshlets: groups of at most MESHLET_MAX_VERTICES distinct vertices and MESHLET_MAX_TRIANGLES triangles.
+buildMeshlets() grows each one from a seed triangle (taken in the current index order) through its neighbours, preferring
+triangles that add no new vertex and then the ones facing like the meshlet so far, which keeps both bounds tight.
+Neighbours are found through positions, so UV seams do not cut meshlets. The index buffer is reordered so every meshlet is
+a [firstIndex, firstIndex + indexCount) range of it; run it after the vertex cache/overdraw passes, before the vertex fetch one.
+
+Each meshlet gets bounds for culling (c1_meshletCulling):
+- a bounding sphere, tested against the frustum planes
+- a normal cone: every triangle normal is within the cone around coneAxis. The meshlet is back facing from every point of
+  its sphere when dot(center - camera, coneAxis) >= coneCutoff * length(center - camera) + radius.
+  Meshlets whose normals spread too much get coneCutoff = 1, which never culls.
+*/
+constexpr uint32_t MESHLET_MAX_VERTICES = 64;
+constexpr uint32_t MESHLET_MAX_TRIANGLES = 124;
+
+// Same layout as Meshlet in c1_meshletCulling (std430).
+struct Meshlet{
+    float center[3];
+    float radius;
+    float coneAxis[3];
+    float coneCutoff;
+    uint32_t firstIndex;
+    uint32_t indexCount;
+    uint32_t padding[2];
+};
+static_assert(sizeof(Meshlet) == 48);
+
+// positions: xyz floats at the start of each vertex, positionStride bytes apart. Reorders indices in place.
+std::vector<Meshlet> buildMeshlets(uint32_t* indices, size_t indexCount, const void* positions, size_t positionStride,
+                                   size_t vertexCount);
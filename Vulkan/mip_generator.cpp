@@ -0,0 +1,275 @@
+#include "mip_generator.h"
+#include "cpu_profiler.h"
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+namespace{
+// One linear RGBA texel.
+#if defined(__SSE2__) || defined(_M_X64)
+using Float4 = __m128;
+inline Float4 load4(const float* p){ return _mm_loadu_ps(p); }
+inline void store4(float* p, Float4 v){ _mm_storeu_ps(p, v); }
+inline Float4 zero4(){ return _mm_setzero_ps(); }
+inline Float4 multiplyAdd4(Float4 acc, Float4 v, float w){ return _mm_add_ps(acc, _mm_mul_ps(v, _mm_set1_ps(w))); }
+inline Float4 saturate4(Float4 v){ return _mm_min_ps(_mm_max_ps(v, _mm_setzero_ps()), _mm_set1_ps(1.0f)); }
+#elif defined(__ARM_NEON)
+using Float4 = float32x4_t;
+inline Float4 load4(const float* p){ return vld1q_f32(p); }
+inline void store4(float* p, Float4 v){ vst1q_f32(p, v); }
+inline Float4 zero4(){ return vdupq_n_f32(0.0f); }
+inline Float4 multiplyAdd4(Float4 acc, Float4 v, float w){ return vmlaq_n_f32(acc, v, w); }
+inline Float4 saturate4(Float4 v){ return vminq_f32(vmaxq_f32(v, vdupq_n_f32(0.0f)), vdupq_n_f32(1.0f)); }
+#else
+struct Float4{ float v[4]; };
+inline Float4 load4(const float* p){ return {{p[0], p[1], p[2], p[3]}}; }
+inline void store4(float* p, Float4 v){ memcpy(p, v.v, sizeof(v.v)); }
+inline Float4 zero4(){ return {}; }
+inline Float4 multiplyAdd4(Float4 acc, Float4 v, float w){
+    for (int c = 0; c < 4; c++){
+        acc.v[c] += v.v[c] * w;
+    }
+    return acc;
+}
+inline Float4 saturate4(Float4 v){
+    for (float& c : v.v){
+        c = std::clamp(c, 0.0f, 1.0f);
+    }
+    return v;
+}
+#endif
+
+constexpr float KAISER_RADIUS = 2.0f; // In destination texels
+constexpr float KAISER_ALPHA = 4.0f;
+
+/*
+Source texels and weights of every destination texel along one axis, tapCount each (padded with zero weights).
+Indices are clamped to the edge.
+*/
+struct AxisTaps{
+    uint32_t tapCount = 0;
+    std::vector<uint32_t> index;
+    std::vector<float> weight;
+};
+
+// Zeroth order modified Bessel function of the first kind, for the Kaiser window.
+float besselI0(float x){
+    float sum = 1.0f;
+    float term = 1.0f;
+    for (int k = 1; k < 16; k++){
+        term *= (x / (2.0f * k)) * (x / (2.0f * k));
+        sum += term;
+    }
+    return sum;
+}
+
+// t is the distance to the destination texel center, in destination texels.
+float filterWeight(MipFilter filter, float t){
+    t = std::abs(t);
+    if (filter == MipFilter::BOX){
+        return t < 0.5f - 1e-4f ? 1.0f : (t <= 0.5f + 1e-4f ? 0.5f : 0.0f);
+    }
+    if (t >= KAISER_RADIUS){
+        return 0.0f;
+    }
+    float sinc = t < 1e-5f ? 1.0f : std::sin(3.14159265f * t) / (3.14159265f * t);
+    float window = t / KAISER_RADIUS;
+    return sinc * besselI0(KAISER_ALPHA * std::sqrt(1.0f - window * window)) / besselI0(KAISER_ALPHA);
+}
+
+AxisTaps buildTaps(MipFilter filter, uint32_t sourceSize, uint32_t destinationSize){
+    AxisTaps taps;
+    float scale = static_cast<float>(sourceSize) / destinationSize;
+    float radius = (filter == MipFilter::BOX ? 0.5f : KAISER_RADIUS) * scale;
+    taps.tapCount = static_cast<uint32_t>(std::ceil(2.0f * radius)) + 1;
+    taps.index.assign(static_cast<size_t>(destinationSize) * taps.tapCount, 0);
+    taps.weight.assign(static_cast<size_t>(destinationSize) * taps.tapCount, 0.0f);
+    for (uint32_t d = 0; d < destinationSize; d++){
+        float center = (d + 0.5f) * scale;
+        int32_t first = static_cast<int32_t>(std::floor(center - radius));
+        float total = 0.0f;
+        for (uint32_t k = 0; k < taps.tapCount; k++){
+            int32_t s = first + static_cast<int32_t>(k);
+            float w = filterWeight(filter, (s + 0.5f - center) / scale);
+            taps.index[d * taps.tapCount + k] = static_cast<uint32_t>(std::clamp<int32_t>(s, 0, static_cast<int32_t>(sourceSize) - 1));
+            taps.weight[d * taps.tapCount + k] = w;
+            total += w;
+        }
+        for (uint32_t k = 0; k < taps.tapCount; k++){
+            taps.weight[d * taps.tapCount + k] /= total;
+        }
+    }
+    return taps;
+}
+
+float srgbToLinear(uint8_t value){
+    static const std::array<float, 256> table = []{
+        std::array<float, 256> t{};
+        for (int i = 0; i < 256; i++){
+            float c = i / 255.0f;
+            t[i] = c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+        }
+        return t;
+    }();
+    return table[value];
+}
+
+// Fine enough that rounding through the table is off by at most one step, near black.
+constexpr uint32_t LINEAR_TO_SRGB_STEPS = 16384;
+
+uint8_t linearToSrgb(float value){
+    static const std::vector<uint8_t> table = []{
+        std::vector<uint8_t> t(LINEAR_TO_SRGB_STEPS + 1);
+        for (uint32_t i = 0; i <= LINEAR_TO_SRGB_STEPS; i++){
+            float l = static_cast<float>(i) / LINEAR_TO_SRGB_STEPS;
+            float c = l <= 0.0031308f ? l * 12.92f : 1.055f * std::pow(l, 1.0f / 2.4f) - 0.055f;
+            t[i] = static_cast<uint8_t>(std::clamp(std::lround(c * 255.0f), 0l, 255l));
+        }
+        return t;
+    }();
+    return table[static_cast<uint32_t>(value * LINEAR_TO_SRGB_STEPS + 0.5f)];
+}
+
+// Splits rows into a few batches per thread instead of one job per row, small levels are cheaper than a job each.
+template <typename F>
+void parallelRows(ThreadPool& pool, uint32_t rows, F&& rowRange){
+    uint32_t batchRows = std::max(1u, rows / (pool.concurrency() * 4));
+    uint32_t batches = (rows + batchRows - 1) / batchRows;
+    pool.parallelFor(batches, [&](uint32_t b){
+        rowRange(b * batchRows, std::min(rows, (b + 1) * batchRows));
+    });
+}
+}
+
+uint32_t mipLevelCount(uint32_t width, uint32_t height){
+    return static_cast<uint32_t>(std::floor(std::log2(std::max(width, height)))) + 1;
+}
+
+size_t mipChainBytes(uint32_t width, uint32_t height, uint32_t levels){
+    size_t bytes = 0;
+    for (uint32_t l = 0; l < levels; l++){
+        bytes += static_cast<size_t>(std::max(1u, width >> l)) * std::max(1u, height >> l) * 4;
+    }
+    return bytes;
+}
+
+namespace{
+// Converts level 0 to linear floats, alpha is stored linearly.
+void toLinear(const uint8_t* rgba, uint32_t width, uint32_t height, std::vector<float>& linear, ThreadPool& pool){
+    linear.resize(static_cast<size_t>(width) * height * 4);
+    parallelRows(pool, height, [&](uint32_t begin, uint32_t end){
+        for (size_t i = static_cast<size_t>(begin) * width * 4; i < static_cast<size_t>(end) * width * 4; i++){
+            linear[i] = i % 4 == 3 ? rgba[i] / 255.0f : srgbToLinear(rgba[i]);
+        }
+    });
+}
+
+/*
+Filters previous (linear, sourceWidth x sourceHeight) down to levelWidth x levelHeight into current (linear) and level (sRGB
+bytes). horizontal holds the horizontally filtered rows in between.
+*/
+void filterLevel(MipFilter filter, const std::vector<float>& previous, uint32_t sourceWidth, uint32_t sourceHeight,
+                 uint32_t levelWidth, uint32_t levelHeight, std::vector<float>& horizontal, std::vector<float>& current,
+                 uint8_t* level, ThreadPool& pool){
+    AxisTaps columns = buildTaps(filter, sourceWidth, levelWidth);
+    AxisTaps rows = buildTaps(filter, sourceHeight, levelHeight);
+
+    horizontal.resize(static_cast<size_t>(levelWidth) * sourceHeight * 4);
+    parallelRows(pool, sourceHeight, [&](uint32_t begin, uint32_t end){
+        for (uint32_t y = begin; y < end; y++){
+            const float* sourceRow = previous.data() + static_cast<size_t>(y) * sourceWidth * 4;
+            float* row = horizontal.data() + static_cast<size_t>(y) * levelWidth * 4;
+            for (uint32_t x = 0; x < levelWidth; x++){
+                Float4 acc = zero4();
+                const uint32_t* index = columns.index.data() + x * columns.tapCount;
+                const float* weight = columns.weight.data() + x * columns.tapCount;
+                for (uint32_t k = 0; k < columns.tapCount; k++){
+                    acc = multiplyAdd4(acc, load4(sourceRow + index[k] * 4), weight[k]);
+                }
+                store4(row + x * 4, acc);
+            }
+        }
+    });
+
+    current.resize(static_cast<size_t>(levelWidth) * levelHeight * 4);
+    parallelRows(pool, levelHeight, [&](uint32_t begin, uint32_t end){
+        for (uint32_t y = begin; y < end; y++){
+            const uint32_t* index = rows.index.data() + y * rows.tapCount;
+            const float* weight = rows.weight.data() + y * rows.tapCount;
+            float* row = current.data() + static_cast<size_t>(y) * levelWidth * 4;
+            uint8_t* bytes = level + static_cast<size_t>(y) * levelWidth * 4;
+            for (uint32_t x = 0; x < levelWidth; x++){
+                Float4 acc = zero4();
+                for (uint32_t k = 0; k < rows.tapCount; k++){
+                    acc = multiplyAdd4(acc, load4(horizontal.data() + (static_cast<size_t>(index[k]) * levelWidth + x) * 4), weight[k]);
+                }
+                acc = saturate4(acc);
+                store4(row + x * 4, acc);
+                for (int c = 0; c < 3; c++){
+                    bytes[x * 4 + c] = linearToSrgb(row[x * 4 + c]);
+                }
+                bytes[x * 4 + 3] = static_cast<uint8_t>(row[x * 4 + 3] * 255.0f + 0.5f);
+            }
+        }
+    });
+}
+
+// Filters levels [firstLevel + 1, levels) one from the other, previous holds firstLevel and level points past it.
+void filterChain(MipFilter filter, std::vector<float>& previous, uint32_t width, uint32_t height, uint32_t firstLevel,
+                 uint32_t levels, uint8_t* level, ThreadPool& pool){
+    std::vector<float> horizontal;
+    std::vector<float> current;
+    uint32_t sourceWidth = std::max(1u, width >> firstLevel);
+    uint32_t sourceHeight = std::max(1u, height >> firstLevel);
+    for (uint32_t l = firstLevel + 1; l < levels; l++){
+        uint32_t levelWidth = std::max(1u, width >> l);
+        uint32_t levelHeight = std::max(1u, height >> l);
+        filterLevel(filter, previous, sourceWidth, sourceHeight, levelWidth, levelHeight, horizontal, current, level, pool);
+        level += static_cast<size_t>(levelWidth) * levelHeight * 4;
+        std::swap(previous, current);
+        sourceWidth = levelWidth;
+        sourceHeight = levelHeight;
+    }
+}
+}
+
+void generateMipChain(const uint8_t* rgba, uint32_t width, uint32_t height, uint32_t levels, MipFilter filter, uint8_t* out,
+                      ThreadPool& pool){
+    HELIUM_PROFILE_FUNCTION();
+    memcpy(out, rgba, static_cast<size_t>(width) * height * 4);
+    if (levels <= 1){
+        return;
+    }
+    // Previous level in linear floats.
+    std::vector<float> previous;
+    toLinear(rgba, width, height, previous, pool);
+    filterChain(filter, previous, width, height, 0, levels, out + static_cast<size_t>(width) * height * 4, pool);
+}
+
+void generateMipTail(const uint8_t* rgba, uint32_t width, uint32_t height, uint32_t levels, uint32_t firstLevel, MipFilter filter,
+                     uint8_t* out, ThreadPool& pool){
+    if (firstLevel == 0){
+        generateMipChain(rgba, width, height, levels, filter, out, pool);
+        return;
+    }
+    HELIUM_PROFILE_FUNCTION();
+    std::vector<float> level0;
+    toLinear(rgba, width, height, level0, pool);
+    // Straight to firstLevel: one wide box instead of filtering every level above it.
+    std::vector<float> horizontal;
+    std::vector<float> previous;
+    filterLevel(
+        MipFilter::BOX, level0, width, height, std::max(1u, width >> firstLevel), std::max(1u, height >> firstLevel),
+        horizontal, previous, out, pool
+    );
+    std::vector<float>().swap(level0);
+    filterChain(filter, previous, width, height, firstLevel, levels, out + mipChainBytes(width >> firstLevel, height >> firstLevel, 1), pool);
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include "thread_pool.h"
+#include <cstddef>
+#include <cstdint>
+
+/*
+CPU mip generation for sRGB RGBA8 images, used when the device cannot blit the format with linear filtering (and by
+texture_cook). Every level is filtered from the previous one in linear space, kept as floats between levels so the
+chain is converted to sRGB only once per texel. Rows are spread over the ThreadPool and each texel is one 4 wide vector
+(SSE2 or NEON, scalar elsewhere).
+
+- BOX: 2x2 average (odd sizes blend the third row/column in).
+- KAISER: Kaiser windowed sinc over 2 destination texels each side (8 source taps per axis for a 2x reduction, alpha 4),
+  sharper than the box without visible ringing. Results are clamped, the negative lobes could push texels out of range.
+
+Levels are tightly packed one after the other, level 0 first, each max(1, size >> level). Level 0 is copied as is.
+*/
+
+enum class MipFilter{
+    BOX,
+    KAISER,
+};
+
+// Levels of a full chain down to 1x1.
+uint32_t mipLevelCount(uint32_t width, uint32_t height);
+// Bytes of levels [0, levels) of an RGBA8 chain.
+size_t mipChainBytes(uint32_t width, uint32_t height, uint32_t levels);
+// Fills out (mipChainBytes(width, height, levels) bytes) with level 0 (rgba) followed by the generated levels.
+void generateMipChain(const uint8_t* rgba, uint32_t width, uint32_t height, uint32_t levels, MipFilter filter, uint8_t* out,
+                      ThreadPool& pool);
+/*
+Fills out (mipChainBytes(width, height, levels) - mipChainBytes(width, height, firstLevel) bytes) with levels [firstLevel, levels)
+only. firstLevel is box filtered straight from rgba, the levels below it with filter: much cheaper than the whole chain when
+only the mip tail is needed (texture streaming).
+*/
+void generateMipTail(const uint8_t* rgba, uint32_t width, uint32_t height, uint32_t levels, uint32_t firstLevel, MipFilter filter,
+                     uint8_t* out, ThreadPool& pool);
@@ -1,76 +1,405 @@
 #include "main.h"
 #ifdef HELIUM_LOAD_MODEL
 
-#define TINYOBJLOADER_IMPLEMENTATION
-#include <tiny_obj_loader.h>
-#include <unordered_map>
+#include "mesh_optimizer.h"
+#include "mesh_simplifier.h"
+#include "obj_parser.h"
+#include "thread_pool.h"
+#include "vertex_dedup.h"
+#include <filesystem>
+#include <type_traits>
 
-std::vector<Vert> vertices;
+std::vector<MeshVertex> vertices;
 std::vector<uint32_t> indices;
+std::vector<Meshlet> meshlets;
+std::vector<Submesh> submeshes;
+std::vector<std::string> materialTextures;
 
-void HelloTriangleApplication::loadModel(){
-    tinyobj::attrib_t attributes;
-    std::vector<tinyobj::shape_t> shapes;
-    std::vector<tinyobj::material_t> materials;
-    std::unordered_map<int, std::unordered_map<int,int>> indexToUVToVertCache;
-    std::string msgErr;
-
-    if(!tinyobj::LoadObj( // LoadObj automatically transforms all n-gons to tris. 
-        &attributes, 
-        &shapes,
-        &materials,
-        &msgErr,
-        MODEL_PATH.c_str()
-    )){
-        throw std::runtime_error("failed to load obj:" + msgErr);
-    }
-    int pushed = 0;
-    for (const auto& s : shapes){
-        for(const auto& i : s.mesh.indices){
-            /*
-            A bit less readable but much faster. 
-            Compared to having an unordered_map<Vert, int>. 
-            First of all, instead of having to compare identity with 5 float comparisons (v.x,v.y.v.z , v.uv.x, v.uv.y), 
-            we only need to do 2 integer comparisons (vertex_index, texcoord_index).
-            Moreover, if we use Vert as key we are forced to allocate memory for all the indices we receive. Which at load time 
-            is the same as just not deduplicating the vertices (on the CPU side that is). 
-            Using the indices' two indicies allows us to avoid allocation if the vertex has already been created once. :)
-            if n = number of distinct vertex_index and texcoord_index pairs, k = number of vertices.
-            A unordered_map<Vert, int> 
-                yields a time complexity of O(2n) // Always allocate per each vertex (O(1) * n), then check map access (O(1) *n)
-            B std::unordered_map<int,int>
-                yields a time complexity of O(k) // Check map (O(1)*n) and if absent allocate (O(1) * k since it's only for absent vertices)
-            considering K is at most 1/2 of N (usually much less given how many tris share a vertex with the same UVs)
-            O(B) = 3/4 O(A)
-            In the example model the number of vertices is a sixth of the indices => k = n/6
-            O(B) = O(n) + O(k) = O(n) + O(n/6) = O(7/6n) = 7/12 O(A) => almost 50% faster
-            */
-            if (indexToUVToVertCache.contains(i.vertex_index)){
-                std::unordered_map<int,int> UVToVert = indexToUVToVertCache[i.vertex_index];
-                if (UVToVert.contains(i.texcoord_index)){
-                    int vertIndex = UVToVert[i.texcoord_index];
-                    indices.push_back(vertIndex);
-                    continue;
+// Attributes of a deduplicated corner at full precision, packed into MeshVertex once the mesh is optimized and bounded.
+struct LoadedVertex{
+    glm::vec3 pos;
+    glm::vec3 normal;
+    glm::vec2 texCoords;
+};
+
+// QuantizedVert carries normals and positions relative to the mesh bounds, Vert neither.
+static constexpr bool MESH_VERTEX_QUANTIZED = std::is_same_v<MeshVertex, QuantizedVert>;
+
+#ifdef HELIUM_GPU_CULLING
+static constexpr uint32_t MESHLET_STRIDE = sizeof(Meshlet);
+#else
+static constexpr uint32_t MESHLET_STRIDE = 0;
+#endif
+
+// Defines that change the cached contents without changing a stride, a cache written with other ones is reparsed.
+static constexpr uint32_t MESH_BUILD_OPTIONS = 0
+#ifdef HELIUM_DISABLE_MESH_OPTIMIZATION
+    | (1u << 0)
+#endif
+#ifdef HELIUM_DISABLE_MESH_LODS
+    | (1u << 1)
+#endif
+    ;
+
+// A level is drawn once its error covers less than this many pixels.
+static constexpr float LOD_SCREEN_ERROR_PIXELS = 1.0f;
+
+// Position and texture coordinate bounds of the loaded vertices, quantized vertices are stored relative to them.
+struct LoadedBounds{
+    glm::vec3 min = glm::vec3(0.0f);
+    glm::vec3 max = glm::vec3(0.0f);
+    glm::vec2 uvMin = glm::vec2(0.0f);
+    glm::vec2 uvMax = glm::vec2(0.0f);
+};
+
+static void packVertex(const LoadedVertex& v, const LoadedBounds&, Vert& packed){
+    packed = Vert{v.pos, {1.0f, 1.0f, 1.0f}, v.texCoords};
+}
+
+static void packVertex(const LoadedVertex& v, const LoadedBounds& bounds, QuantizedVert& packed){
+    packed = quantizeVertex(v.pos, v.normal, v.texCoords, bounds.min, bounds.max, bounds.uvMin, bounds.uvMax);
+}
+
+// Sphere around the bounds, for LOD selection (see selectMeshLods()).
+static glm::vec4 boundingSphere(const glm::vec3& boundsMin, const glm::vec3& boundsMax){
+    return glm::vec4((boundsMin + boundsMax) * 0.5f, glm::length(boundsMax - boundsMin) * 0.5f);
+}
+
+/*
+Texture of every OBJ material, then the default one (TEX_PATH) for faces without usemtl. Materials without a diffuse
+map, or whose map or library cannot be read, fall back to the default texture too.
+*/
+static std::vector<std::string> resolveMaterialTextures(const ObjMesh& mesh, const std::string& defaultTexture){
+    std::filesystem::path directory = std::filesystem::path(MODEL_PATH).parent_path();
+    std::map<std::string, std::string> diffuseMaps;
+    for (const std::string& library : mesh.materialLibraries){
+        std::filesystem::path libraryPath = directory / library;
+        try{
+            for (const ObjMaterial& material : parseMtl(libraryPath.string())){
+                if (!material.diffuseTexture.empty()){
+                    diffuseMaps.try_emplace(material.name, (libraryPath.parent_path() / material.diffuseTexture).string());
                 }
-            } 
-            Vert v{};
-            indexToUVToVertCache[i.vertex_index][i.texcoord_index] = vertices.size(); 
-            indices.push_back(vertices.size());
-            v.pos = {
-                attributes.vertices[3 * i.vertex_index],        //x
-                attributes.vertices[3 * i.vertex_index + 1],    //y
-                attributes.vertices[3 * i.vertex_index + 2],    //z
+            }
+        }catch (const std::exception& e){
+            std::cout << "material library " << libraryPath << " skipped: " << e.what() << std::endl;
+        }
+    }
+    std::vector<std::string> textures;
+    for (const std::string& name : mesh.materials){
+        auto it = diffuseMaps.find(name);
+        std::error_code error;
+        if (it != diffuseMaps.end() && std::filesystem::exists(it->second, error)){
+            textures.push_back(it->second);
+        }else{
+            std::cout << "material " << name << " uses the default texture" << std::endl;
+            textures.push_back(defaultTexture);
+        }
+    }
+    textures.push_back(defaultTexture);
+    return textures;
+}
+
+/*
+Sorts the triangles by material, then by OBJ object/group, and makes a submesh of every (material, group) pair, so
+submeshes that share a material are next to each other and drawn without rebinding. Only level 0 is set.
+*/
+static void buildLoadedSubmeshes(const ObjMesh& mesh, std::vector<uint32_t>& meshIndices){
+    HELIUM_PROFILE_FUNCTION();
+    struct Range{
+        uint32_t material;
+        uint32_t shape;
+        uint32_t firstTriangle;
+        uint32_t triangleCount;
+    };
+    const uint32_t defaultMaterial = static_cast<uint32_t>(mesh.materials.size());
+    const uint32_t triangleCount = static_cast<uint32_t>(meshIndices.size() / 3);
+    std::vector<Range> ranges;
+    for (size_t g = 0; g < mesh.groups.size(); g++){
+        const ObjGroup& group = mesh.groups[g];
+        uint32_t end = g + 1 < mesh.groups.size() ? mesh.groups[g + 1].firstTriangle : triangleCount;
+        ranges.push_back({
+            group.material < 0 ? defaultMaterial : static_cast<uint32_t>(group.material),
+            group.shape < 0 ? static_cast<uint32_t>(mesh.shapes.size()) : static_cast<uint32_t>(group.shape),
+            group.firstTriangle,
+            end - group.firstTriangle
+        });
+    }
+    std::stable_sort(ranges.begin(), ranges.end(), [](const Range& a, const Range& b){
+        return a.material != b.material ? a.material < b.material : a.shape < b.shape;
+    });
+
+    std::vector<uint32_t> sorted;
+    sorted.reserve(meshIndices.size());
+    submeshes.clear();
+    for (size_t r = 0; r < ranges.size(); r++){
+        const Range& range = ranges[r];
+        if (r == 0 || range.material != ranges[r - 1].material || range.shape != ranges[r - 1].shape){
+            Submesh submesh{};
+            submesh.material = range.material;
+            submesh.lodCount = 1;
+            submesh.lods[0].firstIndex = static_cast<uint32_t>(sorted.size());
+            submeshes.push_back(submesh);
+        }
+        sorted.insert(sorted.end(), meshIndices.begin() + range.firstTriangle * 3, meshIndices.begin() + (range.firstTriangle + range.triangleCount) * 3);
+        submeshes.back().lods[0].indexCount += range.triangleCount * 3;
+    }
+    meshIndices = std::move(sorted);
+    std::cout << "submeshes: " << submeshes.size() << " over " << materialTextures.size() << " materials" << std::endl;
+}
+
+/*
+Appends the simplified levels of every submesh after all the full ones, each level simplified from the previous to half
+its triangles. A chain stops early when a level removes less than a quarter of them (open borders that cannot move, see
+mesh_simplifier.h). Submeshes are simplified apart, their shared borders only slide along themselves.
+*/
+static void buildLoadedLods(const std::vector<LoadedVertex>& loaded, std::vector<uint32_t>& meshIndices){
+    #ifndef HELIUM_DISABLE_MESH_LODS
+    HELIUM_PROFILE_FUNCTION();
+    const char* positions = reinterpret_cast<const char*>(loaded.data()) + offsetof(LoadedVertex, pos);
+    size_t levels = 0;
+    for (Submesh& submesh : submeshes){
+        while (submesh.lodCount < MAX_MESH_LODS){
+            const MeshLod previous = submesh.lods[submesh.lodCount - 1];
+            float levelError = 0.0f;
+            std::vector<uint32_t> level = simplifyMesh(
+                meshIndices.data() + previous.firstIndex,
+                previous.indexCount,
+                positions,
+                sizeof(LoadedVertex),
+                loaded.size(),
+                previous.indexCount / 2,
+                &levelError
+            );
+            if (level.empty() || level.size() > previous.indexCount / 4 * 3){
+                break;
+            }
+            #ifndef HELIUM_DISABLE_MESH_OPTIMIZATION
+            optimizeVertexCache(level.data(), level.size(), loaded.size());
+            #endif
+            // Errors add up along the chain, each level only knows its distance to the previous one.
+            submesh.lods[submesh.lodCount++] = {
+                static_cast<uint32_t>(meshIndices.size()), static_cast<uint32_t>(level.size()), 0, 0, previous.error + levelError
             };
-            v.texCoords = {
-                attributes.texcoords[2 * i.texcoord_index + 0],
-                1.0f - attributes.texcoords[2 * i.texcoord_index + 1]
+            meshIndices.insert(meshIndices.end(), level.begin(), level.end());
+            levels++;
+        }
+    }
+    std::cout << "mesh lods: " << levels << " simplified levels for " << submeshes.size() << " submeshes" << std::endl;
+    #endif
+}
+
+// Bounds are computed on the full precision positions, the culling pass works in that space (see updateCullingConstants()).
+// Meshlets of a level only cover its own index range, so they never mix submeshes or levels.
+static void buildLoadedMeshlets(const std::vector<LoadedVertex>& loaded, std::vector<uint32_t>& meshIndices){
+    #ifdef HELIUM_GPU_CULLING
+    meshlets.clear();
+    for (Submesh& submesh : submeshes){
+        for (uint32_t l = 0; l < submesh.lodCount; l++){
+            MeshLod& lod = submesh.lods[l];
+            std::vector<Meshlet> levelMeshlets = buildMeshlets(
+                meshIndices.data() + lod.firstIndex,
+                lod.indexCount,
+                reinterpret_cast<const char*>(loaded.data()) + offsetof(LoadedVertex, pos),
+                sizeof(LoadedVertex),
+                loaded.size()
+            );
+            for (Meshlet& meshlet : levelMeshlets){
+                meshlet.firstIndex += lod.firstIndex;
+            }
+            lod.firstMeshlet = static_cast<uint32_t>(meshlets.size());
+            lod.meshletCount = static_cast<uint32_t>(levelMeshlets.size());
+            meshlets.insert(meshlets.end(), levelMeshlets.begin(), levelMeshlets.end());
+        }
+    }
+    std::cout << "meshlets: " << meshlets.size() << " for " << meshIndices.size() / 3 << " triangles" << std::endl;
+    #endif
+}
+
+/*
+OBJ face order is whatever the exporter produced. Reorders the triangles of every submesh for the post transform cache,
+then clusters them for overdraw, then appends the LOD levels (cache order only), then groups every level into meshlets
+(when culling), then vertices in first use order (see mesh_optimizer.h). Stats are for the full mesh and a 16 entry FIFO cache.
+*/
+static void optimizeLoadedMesh(std::vector<LoadedVertex>& loaded, std::vector<uint32_t>& meshIndices){
+    HELIUM_PROFILE_FUNCTION();
+    const size_t fullIndexCount = meshIndices.size();
+    VertexCacheStats before = analyzeVertexCache(meshIndices.data(), fullIndexCount, loaded.size());
+    size_t clusterCount = 0;
+    for (const Submesh& submesh : submeshes){
+        uint32_t* submeshIndices = meshIndices.data() + submesh.lods[0].firstIndex;
+        std::vector<uint32_t> clusters;
+        optimizeVertexCache(submeshIndices, submesh.lods[0].indexCount, loaded.size(), 16, &clusters);
+        optimizeOverdraw(
+            submeshIndices,
+            submesh.lods[0].indexCount,
+            reinterpret_cast<const char*>(loaded.data()) + offsetof(LoadedVertex, pos),
+            sizeof(LoadedVertex),
+            loaded.size(),
+            clusters
+        );
+        clusterCount += clusters.size();
+    }
+    buildLoadedLods(loaded, meshIndices);
+    // Meshlets are grown from the triangles in cache order, so most of the cache locality survives.
+    buildLoadedMeshlets(loaded, meshIndices);
+    // Vertices used by the full mesh come first, coarser levels only use a subset of them.
+    loaded.resize(optimizeVertexFetch(loaded.data(), loaded.size(), sizeof(LoadedVertex), meshIndices.data(), meshIndices.size()));
+    VertexCacheStats after = analyzeVertexCache(meshIndices.data(), fullIndexCount, loaded.size());
+    std::cout << "mesh optimization: ACMR " << before.acmr << " -> " << after.acmr
+        << ", ATVR " << before.atvr << " -> " << after.atvr << " (" << clusterCount << " clusters)" << std::endl;
+}
+
+void HelloTriangleApplication::loadModel(){
+    HELIUM_PROFILE_FUNCTION();
+    #ifndef HELIUM_DISABLE_MESH_CACHE
+    // Vertex and index buffers are then filled straight from the mapped cache, see createDeviceVertexBuffer().
+    if (meshCache.open(MODEL_PATH, sizeof(MeshVertex), MESHLET_STRIDE, MESH_BUILD_OPTIONS)){
+        submeshes.assign(meshCache.submeshData(), meshCache.submeshData() + meshCache.submeshCount());
+        materialTextures = meshCache.materialTextures();
+        const float* cachedMin = meshCache.boundsMin();
+        const float* cachedMax = meshCache.boundsMax();
+        glm::vec3 boundsMin(cachedMin[0], cachedMin[1], cachedMin[2]);
+        glm::vec3 boundsMax(cachedMax[0], cachedMax[1], cachedMax[2]);
+        meshBoundingSphere = boundingSphere(boundsMin, boundsMax);
+        if (MESH_VERTEX_QUANTIZED){
+            meshDequantization = dequantizationMatrix(boundsMin, boundsMax);
+            const float* uvMin = meshCache.uvMin();
+            const float* uvMax = meshCache.uvMax();
+            meshUvTransform = uvDequantization(glm::vec2(uvMin[0], uvMin[1]), glm::vec2(uvMax[0], uvMax[1]));
+        }
+        return;
+    }
+    #endif
+    // Faces come out already triangulated, see obj_parser.h.
+    ObjMesh mesh = parseObj(MODEL_PATH, ThreadPool::shared());
+    std::vector<LoadedVertex> loaded;
+    {
+        HELIUM_PROFILE_SCOPE("dedup_vertices");
+        /*
+        Corners are deduplicated on their attribute indices instead of the resulting vertex: comparing one packed integer is
+        cheaper than 5 floats, and nothing is built for a corner that was already seen.
+        Vert has no normal, with it corners that only differ by normal are merged (normal count 0, every normal -1).
+        */
+        const size_t normalCount = MESH_VERTEX_QUANTIZED ? mesh.normals.size() / 3 : 0;
+        VertexDedupTable dedup(mesh.indices.size(), mesh.positions.size() / 3, mesh.texcoords.size() / 2, normalCount);
+        indices.reserve(indices.size() + mesh.indices.size());
+        for(ObjIndex i : mesh.indices){
+            if (!MESH_VERTEX_QUANTIZED){
+                i.normal = -1;
+            }
+            uint32_t vertIndex;
+            if (!dedup.findOrInsert(i, static_cast<uint32_t>(loaded.size()), vertIndex)){
+                indices.push_back(vertIndex);
+                continue;
+            }
+            LoadedVertex v{};
+            indices.push_back(vertIndex);
+            v.pos = {
+                mesh.positions[3 * i.vertex],        //x
+                mesh.positions[3 * i.vertex + 1],    //y
+                mesh.positions[3 * i.vertex + 2],    //z
             };
-            v.col = {1.0f, 1.0f, 1.0f};
-            vertices.push_back(v);
-            pushed++;
+            // Faces without texcoords (v or v//vn) get the texture's corner.
+            if (i.texcoord >= 0){
+                v.texCoords = {
+                    mesh.texcoords[2 * i.texcoord + 0],
+                    1.0f - mesh.texcoords[2 * i.texcoord + 1]
+                };
+            }
+            // Faces without normals get +Z, there is nothing better to guess without adjacency.
+            v.normal = {0.0f, 0.0f, 1.0f};
+            if (i.normal >= 0){
+                v.normal = {mesh.normals[3 * i.normal], mesh.normals[3 * i.normal + 1], mesh.normals[3 * i.normal + 2]};
+            }
+            loaded.push_back(v);
         }
     }
-    std::cout<< "added "<< pushed << " vertices: " << vertices.size() << std::endl;
+    std::cout<< "added "<< loaded.size() << " vertices" << std::endl;
+    materialTextures = resolveMaterialTextures(mesh, TEX_PATH);
+    buildLoadedSubmeshes(mesh, indices);
+    #ifndef HELIUM_DISABLE_MESH_OPTIMIZATION
+    // Before caching, so later runs load the optimized order directly.
+    optimizeLoadedMesh(loaded, indices);
+    #else
+    buildLoadedLods(loaded, indices);
+    buildLoadedMeshlets(loaded, indices);
+    #endif
 
+    LoadedBounds bounds;
+    if (!loaded.empty()){
+        bounds.min = bounds.max = loaded[0].pos;
+        bounds.uvMin = bounds.uvMax = loaded[0].texCoords;
+    }
+    for (const LoadedVertex& v : loaded){
+        bounds.min = glm::min(bounds.min, v.pos);
+        bounds.max = glm::max(bounds.max, v.pos);
+        bounds.uvMin = glm::min(bounds.uvMin, v.texCoords);
+        bounds.uvMax = glm::max(bounds.uvMax, v.texCoords);
+    }
+    meshBoundingSphere = boundingSphere(bounds.min, bounds.max);
+    vertices.resize(loaded.size());
+    for (size_t v = 0; v < loaded.size(); v++){
+        packVertex(loaded[v], bounds, vertices[v]);
+    }
+    if (MESH_VERTEX_QUANTIZED){
+        meshDequantization = dequantizationMatrix(bounds.min, bounds.max);
+        meshUvTransform = uvDequantization(bounds.uvMin, bounds.uvMax);
+    }
+    std::cout << "mesh vertices: " << vertices.size() << " x " << sizeof(MeshVertex) << " bytes" << std::endl;
+
+    #ifndef HELIUM_DISABLE_MESH_CACHE
+    // Stored the way createDeviceIndexBuffer() uploads them, 16 bit when they fit.
+    std::vector<uint16_t> narrowed;
+    if (fitsUint16Indices(vertices.size())){
+        narrowed = narrowIndices(indices.data(), indices.size());
+    }
+    MeshCache::Contents contents{};
+    contents.vertices = vertices.data();
+    contents.vertexStride = sizeof(MeshVertex);
+    contents.vertexCount = vertices.size();
+    contents.indices = narrowed.empty() ? static_cast<const void*>(indices.data()) : narrowed.data();
+    contents.indexSize = narrowed.empty() ? sizeof(uint32_t) : sizeof(uint16_t);
+    contents.indexCount = indices.size();
+    for (int k = 0; k < 3; k++){
+        contents.boundsMin[k] = bounds.min[k];
+        contents.boundsMax[k] = bounds.max[k];
+    }
+    for (int k = 0; k < 2; k++){
+        contents.uvMin[k] = bounds.uvMin[k];
+        contents.uvMax[k] = bounds.uvMax[k];
+    }
+    contents.meshlets = meshlets.data();
+    contents.meshletStride = MESHLET_STRIDE;
+    contents.meshletCount = meshlets.size();
+    contents.submeshes = submeshes.data();
+    contents.submeshCount = static_cast<uint32_t>(submeshes.size());
+    contents.materialTextures = materialTextures.data();
+    contents.materialCount = static_cast<uint32_t>(materialTextures.size());
+    contents.buildOptions = MESH_BUILD_OPTIONS;
+    MeshCache::write(MODEL_PATH, contents);
+    #endif
+}
+
+/*
+Picks, for every submesh, the coarsest level whose error projected at the distance of the mesh bounding sphere covers
+at most LOD_SCREEN_ERROR_PIXELS. The camera is brought into the space of the loaded positions, where the errors are, so a
+uniform scale in world cancels out. From inside the sphere the full mesh is drawn.
+*/
+void HelloTriangleApplication::selectMeshLods(const glm::mat4& world, const glm::mat4& view, const glm::mat4& projection){
+    glm::vec3 camera = glm::inverse(view * world) * glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+    float distance = glm::length(camera - glm::vec3(meshBoundingSphere)) - meshBoundingSphere.w;
+    // projection[1][1] is cot(fovy / 2) (negated for the flipped y), half the viewport height covers that over distance 1.
+    float pixelsPerUnit = distance > 0.0f
+        ? std::abs(projection[1][1]) * 0.5f * selectedSwapChainWindowSize.height / distance
+        : std::numeric_limits<float>::infinity();
+    submeshLods.resize(submeshes.size());
+    for (size_t s = 0; s < submeshes.size(); s++){
+        const Submesh& submesh = submeshes[s];
+        uint32_t lod = 0;
+        while (lod + 1 < submesh.lodCount && submesh.lods[lod + 1].error * pixelsPerUnit <= LOD_SCREEN_ERROR_PIXELS){
+            lod++;
+        }
+        submeshLods[s] = lod;
+    }
 }
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,452 @@
+#include "obj_parser.h"
+#include "cpu_profiler.h"
+#include "mapped_file.h"
+#include "thread_pool.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <unordered_map>
+
+namespace {
+
+// Group value of a chunk that has not set it yet, it continues the one of the chunk before.
+const int32_t INHERIT = -2;
+
+/*
+Result of one chunk before merging. Indices are global unless listed in relativeSlots.
+Groups reference the chunk's own shapes and materials, and triangles from the start of the chunk.
+*/
+struct ChunkResult{
+    ObjMesh mesh;
+    // Components (index * 3 + 0/1/2 for vertex/texcoord/normal) written relative to the first attribute of this chunk.
+    std::vector<size_t> relativeSlots;
+    std::unordered_map<std::string, int32_t> shapeIds;
+    std::unordered_map<std::string, int32_t> materialIds;
+};
+
+inline bool isSpace(char c){
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+inline void skipSpaces(const char*& p, const char* end){
+    while (p < end && isSpace(*p)){
+        p++;
+    }
+}
+
+/*
+Decimal float parser for the usual OBJ number shapes ([-]digits[.digits][e[-]digits]).
+Mantissa digits are accumulated in a 64 bit integer and scaled once, which is exact for the 7-9 significant digits
+exporters write. Anything unusual (inf, nan, hex floats, very long mantissas) goes through strtod.
+*/
+const double POW10[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+float parseFloatSlow(const char*& p, const char* end){
+    char buffer[64];
+    size_t length = 0;
+    while (p + length < end && !isSpace(p[length]) && p[length] != '\n' && length < sizeof(buffer) - 1){
+        buffer[length] = p[length];
+        length++;
+    }
+    buffer[length] = '\0';
+    char* parsedEnd = nullptr;
+    double value = strtod(buffer, &parsedEnd);
+    p += (parsedEnd - buffer);
+    if (parsedEnd == buffer){
+        // Not a number at all, skip the token so the line parser keeps going.
+        p += length;
+    }
+    return static_cast<float>(value);
+}
+
+float parseFloat(const char*& p, const char* end){
+    const char* start = p;
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+')){
+        negative = *p == '-';
+        p++;
+    }
+    uint64_t mantissa = 0;
+    int digits = 0;
+    int exponent = 0;
+    while (p < end && *p >= '0' && *p <= '9'){
+        if (digits < 19){
+            mantissa = mantissa * 10 + static_cast<uint64_t>(*p - '0');
+            digits += mantissa != 0;
+        }else{
+            exponent++;
+        }
+        p++;
+    }
+    if (p < end && *p == '.'){
+        p++;
+        while (p < end && *p >= '0' && *p <= '9'){
+            if (digits < 19){
+                mantissa = mantissa * 10 + static_cast<uint64_t>(*p - '0');
+                digits += mantissa != 0;
+                exponent--;
+            }
+            p++;
+        }
+    }
+    if (p == start || (p == start + 1 && (*start == '-' || *start == '+' || *start == '.'))){
+        p = start;
+        return parseFloatSlow(p, end);
+    }
+    if (p < end && (*p == 'e' || *p == 'E')){
+        const char* exponentStart = p;
+        p++;
+        bool negativeExponent = false;
+        if (p < end && (*p == '-' || *p == '+')){
+            negativeExponent = *p == '-';
+            p++;
+        }
+        if (p == end || *p < '0' || *p > '9'){
+            p = exponentStart; // "1e" is 1 followed by garbage
+        }else{
+            int value = 0;
+            while (p < end && *p >= '0' && *p <= '9'){
+                value = std::min(value * 10 + (*p - '0'), 10000);
+                p++;
+            }
+            exponent += negativeExponent ? -value : value;
+        }
+    }
+    if (p < end && !isSpace(*p) && *p != '\n'){
+        // Trailing characters we do not understand (e.g. "1.#INF"), let the C library decide.
+        p = start;
+        return parseFloatSlow(p, end);
+    }
+    double value = static_cast<double>(mantissa);
+    if (exponent < 0){
+        value = -exponent <= 22 ? value / POW10[-exponent] : value * std::pow(10.0, exponent);
+    }else if (exponent > 0){
+        value = exponent <= 22 ? value * POW10[exponent] : value * std::pow(10.0, exponent);
+    }
+    return static_cast<float>(negative ? -value : value);
+}
+
+// Reads up to count floats of the rest of the line, missing ones are left as is.
+void parseFloats(const char*& p, const char* end, float* out, int count){
+    for (int i = 0; i < count; i++){
+        skipSpaces(p, end);
+        if (p == end || *p == '\n'){
+            return;
+        }
+        out[i] = parseFloat(p, end);
+    }
+}
+
+bool parseInt(const char*& p, const char* end, int64_t& value){
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+')){
+        negative = *p == '-';
+        p++;
+    }
+    if (p == end || *p < '0' || *p > '9'){
+        return false;
+    }
+    int64_t v = 0;
+    while (p < end && *p >= '0' && *p <= '9'){
+        v = v * 10 + (*p - '0');
+        p++;
+    }
+    value = negative ? -v : v;
+    return true;
+}
+
+/*
+OBJ indices are 1 based from the start of the file, or negative from the last attribute defined so far.
+Negative ones are resolved against the chunk's own count here and fixed up with the chunk offset on merge. 0 is never valid.
+*/
+int32_t resolveIndex(int64_t raw, size_t localCount, bool& relative){
+    if (raw == 0){
+        throw std::runtime_error("obj: malformed face");
+    }
+    if (raw > 0){
+        relative = false;
+        return static_cast<int32_t>(raw - 1);
+    }
+    relative = true;
+    return static_cast<int32_t>(static_cast<int64_t>(localCount) + raw);
+}
+
+void parseFace(const char*& p, const char* end, ChunkResult& chunk, std::vector<ObjIndex>& polygon, std::vector<uint8_t>& polygonRelative){
+    polygon.clear();
+    polygonRelative.clear();
+    size_t counts[3] = {chunk.mesh.positions.size() / 3, chunk.mesh.texcoords.size() / 2, chunk.mesh.normals.size() / 3};
+    while (true){
+        skipSpaces(p, end);
+        if (p == end || *p == '\n'){
+            break;
+        }
+        // v, v/vt, v//vn or v/vt/vn
+        int32_t components[3] = {-1, -1, -1};
+        uint8_t relativeMask = 0;
+        for (int c = 0; c < 3; c++){
+            int64_t raw;
+            if (parseInt(p, end, raw)){
+                bool relative;
+                components[c] = resolveIndex(raw, counts[c], relative);
+                relativeMask |= relative ? (1u << c) : 0u;
+            }else if (c == 0){
+                throw std::runtime_error("obj: malformed face");
+            }
+            if (p == end || *p != '/'){
+                break;
+            }
+            p++;
+        }
+        polygon.push_back({components[0], components[1], components[2]});
+        polygonRelative.push_back(relativeMask);
+    }
+    // Fan triangulation around the first corner.
+    for (size_t i = 2; i < polygon.size(); i++){
+        const size_t corners[3] = {0, i - 1, i};
+        for (size_t corner : corners){
+            size_t slot = chunk.mesh.indices.size();
+            chunk.mesh.indices.push_back(polygon[corner]);
+            for (int c = 0; c < 3; c++){
+                if ((polygonRelative[corner] & (1u << c)) != 0){
+                    chunk.relativeSlots.push_back(slot * 3 + c);
+                }
+            }
+        }
+    }
+}
+
+bool startsRecord(const char* p, const char* end, const char* record, size_t length){
+    return static_cast<size_t>(end - p) > length && memcmp(p, record, length) == 0 && isSpace(p[length]);
+}
+
+// Rest of the line without surrounding spaces, p is left at the end of the line.
+std::string restOfLine(const char*& p, const char* end){
+    skipSpaces(p, end);
+    const char* newline = static_cast<const char*>(memchr(p, '\n', static_cast<size_t>(end - p)));
+    const char* last = newline != nullptr ? newline : end;
+    const char* lineEnd = last;
+    while (last > p && isSpace(last[-1])){
+        last--;
+    }
+    std::string rest(p, last);
+    p = lineEnd;
+    return rest;
+}
+
+int32_t nameId(std::unordered_map<std::string, int32_t>& ids, std::vector<std::string>& names, const std::string& name){
+    auto [it, inserted] = ids.try_emplace(name, static_cast<int32_t>(names.size()));
+    if (inserted){
+        names.push_back(name);
+    }
+    return it->second;
+}
+
+// Starts a group at firstTriangle, merged into the last one when nothing changes or when that one has no triangle.
+void pushGroup(std::vector<ObjGroup>& groups, uint32_t firstTriangle, int32_t shape, int32_t material){
+    if (!groups.empty() && groups.back().shape == shape && groups.back().material == material){
+        return;
+    }
+    if (!groups.empty() && groups.back().firstTriangle == firstTriangle){
+        groups.pop_back();
+        if (!groups.empty() && groups.back().shape == shape && groups.back().material == material){
+            return;
+        }
+    }
+    groups.push_back({firstTriangle, shape, material});
+}
+
+void parseChunk(const char* begin, const char* end, ChunkResult& chunk){
+    HELIUM_PROFILE_SCOPE("obj_parse_chunk");
+    std::vector<ObjIndex> polygon;
+    std::vector<uint8_t> polygonRelative;
+    int32_t shape = INHERIT;
+    int32_t material = INHERIT;
+    const char* p = begin;
+    while (p < end){
+        skipSpaces(p, end);
+        if (p + 1 < end && p[0] == 'v' && isSpace(p[1])){
+            p += 2;
+            float xyz[3] = {0.0f, 0.0f, 0.0f};
+            parseFloats(p, end, xyz, 3);
+            chunk.mesh.positions.insert(chunk.mesh.positions.end(), xyz, xyz + 3);
+        }else if (p + 2 < end && p[0] == 'v' && p[1] == 't' && isSpace(p[2])){
+            p += 3;
+            float uv[2] = {0.0f, 0.0f};
+            parseFloats(p, end, uv, 2);
+            chunk.mesh.texcoords.insert(chunk.mesh.texcoords.end(), uv, uv + 2);
+        }else if (p + 2 < end && p[0] == 'v' && p[1] == 'n' && isSpace(p[2])){
+            p += 3;
+            float n[3] = {0.0f, 0.0f, 0.0f};
+            parseFloats(p, end, n, 3);
+            chunk.mesh.normals.insert(chunk.mesh.normals.end(), n, n + 3);
+        }else if (p + 1 < end && p[0] == 'f' && isSpace(p[1])){
+            p += 2;
+            parseFace(p, end, chunk, polygon, polygonRelative);
+        }else if (startsRecord(p, end, "o", 1) || startsRecord(p, end, "g", 1)){
+            p += 2;
+            shape = nameId(chunk.shapeIds, chunk.mesh.shapes, restOfLine(p, end));
+            pushGroup(chunk.mesh.groups, static_cast<uint32_t>(chunk.mesh.indices.size() / 3), shape, material);
+        }else if (startsRecord(p, end, "usemtl", 6)){
+            p += 7;
+            material = nameId(chunk.materialIds, chunk.mesh.materials, restOfLine(p, end));
+            pushGroup(chunk.mesh.groups, static_cast<uint32_t>(chunk.mesh.indices.size() / 3), shape, material);
+        }else if (startsRecord(p, end, "mtllib", 6)){
+            p += 7;
+            // Several libraries can follow, file names with spaces are not supported.
+            while (true){
+                skipSpaces(p, end);
+                const char* nameStart = p;
+                while (p < end && !isSpace(*p) && *p != '\n'){
+                    p++;
+                }
+                if (p == nameStart){
+                    break;
+                }
+                chunk.mesh.materialLibraries.emplace_back(nameStart, p);
+            }
+        }
+        // Rest of the line (comments, unknown records, extra values such as vertex colors).
+        const char* newline = static_cast<const char*>(memchr(p, '\n', static_cast<size_t>(end - p)));
+        p = newline != nullptr ? newline + 1 : end;
+    }
+}
+
+} // namespace
+
+ObjMesh parseObj(const char* data, size_t size, ThreadPool& pool){
+    HELIUM_PROFILE_FUNCTION();
+    // Chunks below 1MiB are not worth a thread.
+    const size_t minChunkSize = 1u << 20;
+    uint32_t chunkCount = static_cast<uint32_t>(std::clamp<size_t>(size / minChunkSize, 1, pool.concurrency()));
+
+    // Chunk boundaries, moved forward to the next line start.
+    std::vector<const char*> bounds(chunkCount + 1);
+    bounds[0] = data;
+    bounds[chunkCount] = data + size;
+    for (uint32_t i = 1; i < chunkCount; i++){
+        const char* guess = std::max(data + size / chunkCount * i, bounds[i - 1]);
+        const char* newline = static_cast<const char*>(memchr(guess, '\n', static_cast<size_t>(data + size - guess)));
+        bounds[i] = newline != nullptr ? newline + 1 : data + size;
+    }
+
+    std::vector<ChunkResult> chunks(chunkCount);
+    pool.parallelFor(chunkCount, [&](uint32_t i){
+        parseChunk(bounds[i], bounds[i + 1], chunks[i]);
+    });
+
+    // Attribute offsets of every chunk, in file order.
+    struct Offsets{
+        size_t positions = 0;
+        size_t texcoords = 0;
+        size_t normals = 0;
+        size_t indices = 0;
+    };
+    std::vector<Offsets> offsets(chunkCount + 1);
+    for (uint32_t i = 0; i < chunkCount; i++){
+        offsets[i + 1].positions = offsets[i].positions + chunks[i].mesh.positions.size();
+        offsets[i + 1].texcoords = offsets[i].texcoords + chunks[i].mesh.texcoords.size();
+        offsets[i + 1].normals = offsets[i].normals + chunks[i].mesh.normals.size();
+        offsets[i + 1].indices = offsets[i].indices + chunks[i].mesh.indices.size();
+    }
+    const Offsets& totals = offsets[chunkCount];
+
+    ObjMesh mesh;
+    {
+        // Serial, names are renumbered in first use order and each chunk continues the group of the one before it.
+        std::unordered_map<std::string, int32_t> shapeIds;
+        std::unordered_map<std::string, int32_t> materialIds;
+        int32_t shape = -1;
+        int32_t material = -1;
+        pushGroup(mesh.groups, 0, shape, material);
+        for (uint32_t i = 0; i < chunkCount; i++){
+            const ObjMesh& local = chunks[i].mesh;
+            for (const std::string& library : local.materialLibraries){
+                if (std::find(mesh.materialLibraries.begin(), mesh.materialLibraries.end(), library) == mesh.materialLibraries.end()){
+                    mesh.materialLibraries.push_back(library);
+                }
+            }
+            for (const ObjGroup& group : local.groups){
+                if (group.shape != INHERIT){
+                    shape = nameId(shapeIds, mesh.shapes, local.shapes[group.shape]);
+                }
+                if (group.material != INHERIT){
+                    material = nameId(materialIds, mesh.materials, local.materials[group.material]);
+                }
+                pushGroup(mesh.groups, static_cast<uint32_t>(offsets[i].indices / 3) + group.firstTriangle, shape, material);
+            }
+        }
+        // Groups set after the last face hold nothing.
+        while (!mesh.groups.empty() && mesh.groups.back().firstTriangle >= totals.indices / 3){
+            mesh.groups.pop_back();
+        }
+    }
+    mesh.positions.resize(totals.positions);
+    mesh.texcoords.resize(totals.texcoords);
+    mesh.normals.resize(totals.normals);
+    mesh.indices.resize(totals.indices);
+    const int64_t vertexCount = static_cast<int64_t>(totals.positions / 3);
+    const int64_t texcoordCount = static_cast<int64_t>(totals.texcoords / 2);
+    const int64_t normalCount = static_cast<int64_t>(totals.normals / 3);
+
+    pool.parallelFor(chunkCount, [&](uint32_t i){
+        HELIUM_PROFILE_SCOPE("obj_merge_chunk");
+        ChunkResult& chunk = chunks[i];
+        const Offsets& o = offsets[i];
+        std::copy(chunk.mesh.positions.begin(), chunk.mesh.positions.end(), mesh.positions.begin() + o.positions);
+        std::copy(chunk.mesh.texcoords.begin(), chunk.mesh.texcoords.end(), mesh.texcoords.begin() + o.texcoords);
+        std::copy(chunk.mesh.normals.begin(), chunk.mesh.normals.end(), mesh.normals.begin() + o.normals);
+
+        int32_t* components = reinterpret_cast<int32_t*>(chunk.mesh.indices.data());
+        const int32_t chunkBase[3] = {
+            static_cast<int32_t>(o.positions / 3), static_cast<int32_t>(o.texcoords / 2), static_cast<int32_t>(o.normals / 3)
+        };
+        // Only relative components can end up negative: checked here, where they are known to be present. Absent ones stay -1.
+        for (size_t slot : chunk.relativeSlots){
+            components[slot] += chunkBase[slot % 3];
+            if (components[slot] < 0){
+                throw std::runtime_error("obj: face references an attribute that does not exist");
+            }
+        }
+        for (const ObjIndex& index : chunk.mesh.indices){
+            if (index.vertex < 0 || index.vertex >= vertexCount || index.texcoord >= texcoordCount || index.normal >= normalCount){
+                throw std::runtime_error("obj: face references an attribute that does not exist");
+            }
+        }
+        std::copy(chunk.mesh.indices.begin(), chunk.mesh.indices.end(), mesh.indices.begin() + o.indices);
+        chunk = ChunkResult{}; // Free as we go, the merged copy doubles the peak otherwise
+    });
+    return mesh;
+}
+
+ObjMesh parseObj(const std::string& path, ThreadPool& pool){
+    MappedFile file(path);
+    return parseObj(file.data(), file.size(), pool);
+}
+
+std::vector<ObjMaterial> parseMtl(const std::string& path){
+    HELIUM_PROFILE_FUNCTION();
+    MappedFile file(path);
+    std::vector<ObjMaterial> materials;
+    const char* p = file.data();
+    const char* end = file.data() + file.size();
+    while (p < end){
+        skipSpaces(p, end);
+        if (startsRecord(p, end, "newmtl", 6)){
+            p += 7;
+            materials.push_back({restOfLine(p, end), {}});
+        }else if (startsRecord(p, end, "map_Kd", 6) && !materials.empty()){
+            p += 7;
+            // Options (-s, -o, -bm...) come first, the file name is the last token.
+            std::string rest = restOfLine(p, end);
+            size_t nameStart = rest.find_last_of(" \t");
+            materials.back().diffuseTexture = nameStart == std::string::npos ? rest : rest.substr(nameStart + 1);
+        }
+        const char* newline = static_cast<const char*>(memchr(p, '\n', static_cast<size_t>(end - p)));
+        p = newline != nullptr ? newline + 1 : end;
+    }
+    return materials;
+}
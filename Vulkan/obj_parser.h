@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class ThreadPool;
+
+/*
+Native Wavefront OBJ reader for the geometry records (v, vt, vn, f) and the grouping ones (o, g, usemtl, mtllib),
+replacing tinyobj::LoadObj.
+
+The file is memory mapped and cut at line boundaries into one chunk per worker. Chunks are parsed in parallel into local
+arrays, then merged in file order: attribute arrays are concatenated and face indices, which are global (or relative to the
+end of the attribute list for negative ones) are resolved against the attribute counts of the chunks before them.
+Groups and materials are tracked per chunk and resolved on merge too: a chunk that starts in the middle of a group
+continues the group of the chunk before it. Everything else (smoothing, lines, points) is skipped.
+Polygons are triangulated as fans, like LoadObj does.
+*/
+struct ObjIndex{
+    // 0 based, -1 when the face does not reference that attribute.
+    int32_t vertex;
+    int32_t texcoord;
+    int32_t normal;
+};
+
+// Triangles from firstTriangle up to the next group share an object/group name and a material.
+struct ObjGroup{
+    uint32_t firstTriangle;
+    int32_t shape; // Index in ObjMesh::shapes, -1 before the first o/g
+    int32_t material; // Index in ObjMesh::materials, -1 before the first usemtl
+};
+
+struct ObjMesh{
+    std::vector<float> positions; // x,y,z per vertex
+    std::vector<float> texcoords; // u,v per texcoord
+    std::vector<float> normals; // x,y,z per normal
+    std::vector<ObjIndex> indices; // 3 per triangle
+    std::vector<std::string> shapes; // o and g names, in first use order
+    std::vector<std::string> materials; // usemtl names, in first use order
+    std::vector<std::string> materialLibraries; // mtllib files as written, relative to the OBJ
+    std::vector<ObjGroup> groups; // In triangle order, the first one starts at 0 when there are triangles
+};
+
+// A newmtl record of a .mtl file, only the diffuse map is kept.
+struct ObjMaterial{
+    std::string name;
+    std::string diffuseTexture; // map_Kd file as written (relative to the .mtl), empty without one
+};
+
+// Throws std::runtime_error if the file cannot be read or references attributes it does not define.
+ObjMesh parseObj(const std::string& path, ThreadPool& pool);
+// Same, from memory. Exposed for tools and benchmarks.
+ObjMesh parseObj(const char* data, size_t size, ThreadPool& pool);
+// Reads the newmtl and map_Kd records of a material library, throws std::runtime_error if it cannot be read.
+std::vector<ObjMaterial> parseMtl(const std::string& path);
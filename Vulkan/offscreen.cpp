@@ -0,0 +1,55 @@
+#include "main.h"
+
+/*
+Headless replacement for the swapchain.
+Instead of asking the presentation engine for images we allocate our own ring of color images, one per frame in flight.
+They are stored in swapChainImages so that views, framebuffers and recordCommandBuffer do not need to know the difference.
+*/
+void HelloTriangleApplication::createOffscreenTargets(){
+    HELIUM_PROFILE_FUNCTION();
+    selectedSwapChainFormat = chooseOffscreenFormat();
+    selectedSwapChainWindowSize = {WIDTH, HEIGHT};
+
+    swapChainImages.resize(MAX_FRAMES_IN_FLIGHT);
+    offscreenImagesMemory.resize(MAX_FRAMES_IN_FLIGHT);
+    for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; i++){
+        createAndBindDeviceImage(
+            selectedSwapChainWindowSize.width,
+            selectedSwapChainWindowSize.height,
+            VK_SAMPLE_COUNT_1_BIT, // MSAA resolve target, same as a swapchain image
+            swapChainImages[i],
+            offscreenImagesMemory[i],
+            selectedSwapChainFormat,
+            VK_IMAGE_TILING_OPTIMAL,
+            // TRANSFER_SRC so frames can be read back (e.g. for image comparison in CI)
+            VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+            1
+        );
+    }
+    std::cout << "offscreen ring of " << swapChainImages.size() << " images (" << WIDTH << "x" << HEIGHT << ")" << std::endl;
+}
+
+void HelloTriangleApplication::destroyOffscreenTargets(){
+    for (size_t i = 0; i < swapChainImages.size(); i++){
+        vkDestroyImage(logiDevice, swapChainImages[i], nullptr);
+        deviceAllocator.free(offscreenImagesMemory[i]);
+    }
+    swapChainImages.clear();
+    offscreenImagesMemory.clear();
+}
+
+// Same preference as chooseImageFormat, but checked against the device since there is no surface to ask.
+VkFormat HelloTriangleApplication::chooseOffscreenFormat(){
+    std::vector<VkFormat> candidates = {
+        VK_FORMAT_B8G8R8A8_SRGB, VK_FORMAT_R8G8B8A8_SRGB, VK_FORMAT_B8G8R8A8_UNORM, VK_FORMAT_R8G8B8A8_UNORM
+    };
+    for (VkFormat f : candidates){
+        VkFormatProperties formatProperties;
+        vkGetPhysicalDeviceFormatProperties(physGraphicDevice, f, &formatProperties);
+        if ((formatProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_COLOR_ATTACHMENT_BIT) != 0){
+            return f;
+        }
+    }
+    throw std::runtime_error("no color attachment format available for offscreen rendering");
+}
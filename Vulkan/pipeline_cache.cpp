@@ -0,0 +1,156 @@
+#include "pipeline_cache.h"
+#include "cpu_profiler.h"
+#include "hash.h"
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
+
+void PipelineCache::init(VkPhysicalDevice physicalDevice, VkDevice logicalDevice, const std::string& directory){
+    HELIUM_PROFILE_FUNCTION();
+    device = logicalDevice;
+    vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+
+    std::ostringstream name;
+    name << "pipeline_cache_";
+    for (uint32_t i = 0; i < VK_UUID_SIZE; i++){
+        name << std::hex << std::setw(2) << std::setfill('0') << static_cast<uint32_t>(properties.pipelineCacheUUID[i]);
+    }
+    name << "_" << std::dec << properties.driverVersion << ".bin";
+    path = (std::filesystem::path(directory) / name.str()).string();
+
+    std::vector<char> initialData = loadValidated();
+    loadedHash = initialData.empty() ? 0 : hashBytes(initialData.data(), initialData.size());
+
+    VkPipelineCacheCreateInfo cacheCreationInfo{};
+    cacheCreationInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+    cacheCreationInfo.initialDataSize = initialData.size();
+    cacheCreationInfo.pInitialData = initialData.empty() ? nullptr : initialData.data();
+    if (vkCreatePipelineCache(device, &cacheCreationInfo, nullptr, &cache) != VK_SUCCESS){
+        throw std::runtime_error("failed to create pipeline cache");
+    }
+}
+
+// Contents of the cache file, or nothing if it is missing or was written for another device/driver.
+std::vector<char> PipelineCache::loadValidated() const{
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    if (!file.is_open()){
+        std::cout << "pipeline cache: no cache at " << path << ", starting empty" << std::endl;
+        return {};
+    }
+    size_t fileSize = static_cast<size_t>(file.tellg());
+    file.seekg(0);
+
+    FileHeader header{};
+    if (fileSize < sizeof(header) || !file.read(reinterpret_cast<char*>(&header), sizeof(header))){
+        std::cout << "pipeline cache: " << path << " is truncated, starting empty" << std::endl;
+        return {};
+    }
+    const char* reason = nullptr;
+    if (memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 || header.version != FILE_VERSION){
+        reason = "unknown format";
+    }else if (header.vendorID != properties.vendorID || header.deviceID != properties.deviceID
+              || header.driverVersion != properties.driverVersion
+              || memcmp(header.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE) != 0){
+        reason = "written for another device or driver";
+    }else if (header.dataSize != fileSize - sizeof(header)){
+        reason = "size mismatch";
+    }
+    if (reason != nullptr){
+        std::cout << "pipeline cache: ignoring " << path << " (" << reason << ")" << std::endl;
+        return {};
+    }
+
+    std::vector<char> data(static_cast<size_t>(header.dataSize));
+    if (!file.read(data.data(), data.size()) || hashBytes(data.data(), data.size()) != header.dataHash){
+        std::cout << "pipeline cache: ignoring " << path << " (checksum mismatch)" << std::endl;
+        return {};
+    }
+    if (!isValidVulkanHeader(data)){
+        std::cout << "pipeline cache: ignoring " << path << " (driver header mismatch)" << std::endl;
+        return {};
+    }
+    std::cout << "pipeline cache: loaded " << data.size() << " bytes from " << path << std::endl;
+    return data;
+}
+
+// The blob starts with VkPipelineCacheHeaderVersionOne, which must match the device it is loaded on.
+bool PipelineCache::isValidVulkanHeader(const std::vector<char>& data) const{
+    VkPipelineCacheHeaderVersionOne vulkanHeader{};
+    if (data.size() < sizeof(vulkanHeader)){
+        return false;
+    }
+    memcpy(&vulkanHeader, data.data(), sizeof(vulkanHeader));
+    return vulkanHeader.headerSize >= sizeof(vulkanHeader)
+        && vulkanHeader.headerVersion == VK_PIPELINE_CACHE_HEADER_VERSION_ONE
+        && vulkanHeader.vendorID == properties.vendorID
+        && vulkanHeader.deviceID == properties.deviceID
+        && memcmp(vulkanHeader.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE) == 0;
+}
+
+void PipelineCache::save(){
+    HELIUM_PROFILE_FUNCTION();
+    if (cache == VK_NULL_HANDLE){
+        return;
+    }
+    size_t dataSize = 0;
+    if (vkGetPipelineCacheData(device, cache, &dataSize, nullptr) != VK_SUCCESS || dataSize == 0){
+        return;
+    }
+    std::vector<char> data(dataSize);
+    if (vkGetPipelineCacheData(device, cache, &dataSize, data.data()) != VK_SUCCESS){
+        std::cerr << "pipeline cache: failed to read cache data" << std::endl;
+        return;
+    }
+    data.resize(dataSize);
+    uint64_t hash = hashBytes(data.data(), data.size());
+    if (hash == loadedHash){
+        return;
+    }
+
+    FileHeader header{};
+    memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = FILE_VERSION;
+    header.vendorID = properties.vendorID;
+    header.deviceID = properties.deviceID;
+    header.driverVersion = properties.driverVersion;
+    memcpy(header.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE);
+    header.dataSize = data.size();
+    header.dataHash = hash;
+
+    // Write next to the destination so the rename stays on the same filesystem and replaces it atomically.
+    std::string tmpPath = path + ".tmp";
+    {
+        std::ofstream file(tmpPath, std::ios::binary | std::ios::trunc);
+        if (!file.is_open()){
+            std::cerr << "pipeline cache: cannot write " << tmpPath << std::endl;
+            return;
+        }
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.write(data.data(), data.size());
+        if (!file.good()){
+            std::cerr << "pipeline cache: failed writing " << tmpPath << std::endl;
+            file.close();
+            std::filesystem::remove(tmpPath);
+            return;
+        }
+    }
+    std::error_code error;
+    std::filesystem::rename(tmpPath, path, error);
+    if (error){
+        std::cerr << "pipeline cache: cannot replace " << path << ": " << error.message() << std::endl;
+        std::filesystem::remove(tmpPath, error);
+        return;
+    }
+    loadedHash = hash;
+    std::cout << "pipeline cache: saved " << data.size() << " bytes to " << path << std::endl;
+}
+
+void PipelineCache::destroy(){
+    if (cache != VK_NULL_HANDLE){
+        vkDestroyPipelineCache(device, cache, nullptr);
+        cache = VK_NULL_HANDLE;
+    }
+}
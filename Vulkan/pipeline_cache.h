@@ -0,0 +1,50 @@
+#pragma once
+
+#include "heliumutils.h"
+#include <string>
+#include <vector>
+
+/*
+VkPipelineCache persisted between runs.
+
+The file is named after the device pipeline cache UUID and the driver version, so switching GPU or updating the driver starts
+from an empty cache instead of feeding the driver data it cannot use. The blob is wrapped in a small header of our own
+(magic, sizes, checksum) and the Vulkan header inside it is checked against the device as well: some drivers crash on
+truncated or foreign cache data instead of rejecting it.
+
+save() writes a temporary file and renames it over the old one, a crash while saving never leaves a half written cache behind.
+*/
+class PipelineCache{
+public:
+    // Loads the cache for physicalDevice from directory if there is a valid one, starts empty otherwise.
+    void init(VkPhysicalDevice physicalDevice, VkDevice device, const std::string& directory);
+    // Writes the cache back, skipped when the driver reports the same data that was loaded.
+    void save();
+    void destroy();
+
+    VkPipelineCache get() const { return cache; }
+    const std::string& getPath() const { return path; }
+
+private:
+    struct FileHeader{
+        char magic[4];
+        uint32_t version;
+        uint32_t vendorID;
+        uint32_t deviceID;
+        uint32_t driverVersion;
+        uint8_t pipelineCacheUUID[VK_UUID_SIZE];
+        uint64_t dataSize;
+        uint64_t dataHash;
+    };
+    static constexpr char MAGIC[4] = {'H', 'L', 'P', 'C'};
+    static constexpr uint32_t FILE_VERSION = 1;
+
+    VkDevice device = VK_NULL_HANDLE;
+    VkPhysicalDeviceProperties properties{};
+    VkPipelineCache cache = VK_NULL_HANDLE;
+    std::string path;
+    uint64_t loadedHash = 0; // Hash of the data the cache was seeded with, 0 if it started empty
+
+    std::vector<char> loadValidated() const;
+    bool isValidVulkanHeader(const std::vector<char>& data) const;
+};
@@ -1,7 +1,13 @@
 #include "main.h"
+#include "mesh_optimizer.h"
+#include "texture_cooker.h"
+#include "mip_generator.h"
+#include <filesystem>
+#include <bit>
 
 #define HELIUM_PRINT_EXTENSIONS
 void HelloTriangleApplication::createInstance(){
+    HELIUM_PROFILE_FUNCTION();
     #ifdef NDEBUG
         std::cout<< "Non Debug mode" << std::endl; 
     #endif
@@ -55,6 +61,17 @@ void HelloTriangleApplication::createInstance(){
         std::cout << xt.extensionName << std::endl;
     }
     #endif
+    #if !defined(HELIUM_DISABLE_TEXTURE_EVICTION) || !defined(HELIUM_DISABLE_BINDLESS_TEXTURES)
+    // VK_EXT_memory_budget (texture_residency.cpp) and VK_EXT_descriptor_indexing (bindless.cpp) need it on a 1.0 instance.
+    for (const auto& xt: supportedExtensions){
+        if (std::string(xt.extensionName) == VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME){
+            requiredExtNames.emplace_back(VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME);
+            physicalDeviceProperties2Supported = true;
+        }
+    }
+    iInfo.enabledExtensionCount = static_cast<uint32_t>(requiredExtNames.size());
+    iInfo.ppEnabledExtensionNames = requiredExtNames.data();
+    #endif
 
     VkDebugUtilsMessengerCreateInfoEXT createInstanceDebuggerCI{};
     if(validationLayerEnabled){
@@ -88,12 +105,15 @@ void HelloTriangleApplication::setupDebugMessenger(){
 
 
 std::vector<const char*> HelloTriangleApplication::getRequiredExtensions(){
-    uint32_t glfwRequiredExtCount = 0;
-    const char** glfwRequiredExtNames;
-    glfwRequiredExtNames = glfwGetRequiredInstanceExtensions(&glfwRequiredExtCount); 
     std::vector<const char*> requiredExtNames;
-    for(int i =0; i<glfwRequiredExtCount; i++){
-        requiredExtNames.emplace_back(glfwRequiredExtNames[i]);
+    // Headless never initializes GLFW, and it needs no surface extensions anyway.
+    if (!headless){
+        uint32_t glfwRequiredExtCount = 0;
+        const char** glfwRequiredExtNames;
+        glfwRequiredExtNames = glfwGetRequiredInstanceExtensions(&glfwRequiredExtCount); 
+        for(int i =0; i<glfwRequiredExtCount; i++){
+            requiredExtNames.emplace_back(glfwRequiredExtNames[i]);
+        }
     }
 
     if (validationLayerEnabled){
@@ -104,9 +124,18 @@ std::vector<const char*> HelloTriangleApplication::getRequiredExtensions(){
     return requiredExtNames;
 }
 
+// The swapchain extension is only needed when presenting, headless devices (e.g. lavapipe on a display-less box) might not even expose it.
+std::vector<const char*> HelloTriangleApplication::getRequiredDeviceExtensions(){
+    if (headless){
+        return {};
+    }
+    return requiredDeviceExtensionNames;
+}
+
 
 // Builds the vulkan representation of the used GPU
 void HelloTriangleApplication::setPhysicalDevice(){
+    HELIUM_PROFILE_FUNCTION();
     uint32_t deviceCount = 0;
     vkEnumeratePhysicalDevices(instance, &deviceCount, nullptr);
     if (deviceCount == 0) {
@@ -133,6 +162,7 @@ void HelloTriangleApplication::setPhysicalDevice(){
 }
 
 void HelloTriangleApplication::createLogicalDevice(){
+    HELIUM_PROFILE_FUNCTION();
     QueueFamilyIndices qfi = findRequiredQueueFamily(physGraphicDevice);
     if(!qfi.has_values()){
         throw std::runtime_error("Selected physical device should have required queues but some are missing.");
@@ -143,6 +173,9 @@ void HelloTriangleApplication::createLogicalDevice(){
         qfi.presentationFamilyIndex.value()
     }; // Allows to set creation info (and thus create a queue) only once per index in the family indices.
     // e.g. is the same family can support both graphics and presentation commands, no need to create two queues, just create one that will receive both.
+    if (qfi.transferFamilyIndex.has_value()){
+        familySet.insert(qfi.transferFamilyIndex.value());
+    }
 
     float priority = 1.0; // always required, needed to give priority weight to each queue during scheduling. (e.g. We want graphics commands to always have priority over compute commands)
     for (uint32_t queueFamilyIndex : familySet){
@@ -159,6 +192,13 @@ void HelloTriangleApplication::createLogicalDevice(){
     usedPhysicalDeviceFeatures.samplerAnisotropy = VK_TRUE; // We need anisotropic filtering for the main texture.
     usedPhysicalDeviceFeatures.sampleRateShading = VK_TRUE; // Small optimization to improve antialiasing, by shading per sample instead of per fragment.
     // Given MSAA's nature, this will multiplicate effectively the amount of fragment shader runs.
+    #ifndef HELIUM_DISABLE_COOKED_TEXTURES
+    // Cooked textures are BC compressed, without the feature they are decoded from their source like the others.
+    VkPhysicalDeviceFeatures supportedFeatures{};
+    vkGetPhysicalDeviceFeatures(physGraphicDevice, &supportedFeatures);
+    compressedTextures = supportedFeatures.textureCompressionBC == VK_TRUE;
+    usedPhysicalDeviceFeatures.textureCompressionBC = supportedFeatures.textureCompressionBC;
+    #endif
 
     VkDeviceCreateInfo logicalDeviceCreationInfo{};
     logicalDeviceCreationInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
@@ -167,8 +207,42 @@ void HelloTriangleApplication::createLogicalDevice(){
     logicalDeviceCreationInfo.pEnabledFeatures = &usedPhysicalDeviceFeatures;
     
 
-    logicalDeviceCreationInfo.enabledExtensionCount =static_cast<uint32_t>(requiredDeviceExtensionNames.size()); // No extensions needed atm.
-    logicalDeviceCreationInfo.ppEnabledExtensionNames = requiredDeviceExtensionNames.data();
+    std::vector<const char*> deviceExtensionNames = getRequiredDeviceExtensions();
+    // Optional extensions, their features and properties are queried through VK_KHR_get_physical_device_properties2.
+    std::set<std::string> optionalExtensions;
+    if (physicalDeviceProperties2Supported){
+        uint32_t extensionCount = 0;
+        vkEnumerateDeviceExtensionProperties(physGraphicDevice, nullptr, &extensionCount, nullptr);
+        std::vector<VkExtensionProperties> extensionProperties(extensionCount);
+        vkEnumerateDeviceExtensionProperties(physGraphicDevice, nullptr, &extensionCount, extensionProperties.data());
+        for (const auto& ext: extensionProperties){
+            optionalExtensions.insert(ext.extensionName);
+        }
+    }
+    #ifndef HELIUM_DISABLE_TEXTURE_EVICTION
+    getPhysicalDeviceMemoryProperties2 = (PFN_vkGetPhysicalDeviceMemoryProperties2KHR) vkGetInstanceProcAddr(instance, "vkGetPhysicalDeviceMemoryProperties2KHR");
+    if (optionalExtensions.count(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME) && getPhysicalDeviceMemoryProperties2 != nullptr){
+        deviceExtensionNames.push_back(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+        memoryBudgetSupported = true;
+    }
+    std::cout << (memoryBudgetSupported ? "texture memory budget follows VK_EXT_memory_budget" : "no VK_EXT_memory_budget, fixed texture memory budget") << std::endl;
+    #endif
+    #ifndef HELIUM_DISABLE_BINDLESS_TEXTURES
+    // Chained to the creation info, has to outlive vkCreateDevice.
+    VkPhysicalDeviceDescriptorIndexingFeaturesEXT descriptorIndexingFeatures{};
+    if (optionalExtensions.count(VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME) && optionalExtensions.count(VK_KHR_MAINTENANCE3_EXTENSION_NAME)
+        && selectBindlessTextures(usedPhysicalDeviceFeatures, descriptorIndexingFeatures)){
+        deviceExtensionNames.push_back(VK_KHR_MAINTENANCE3_EXTENSION_NAME);
+        deviceExtensionNames.push_back(VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME);
+        logicalDeviceCreationInfo.pNext = &descriptorIndexingFeatures;
+        bindlessTextures = true;
+        std::cout << "bindless textures, " << bindlessTextureCapacity << " slots" << std::endl;
+    }else{
+        std::cout << "no descriptor indexing, one descriptor set per material" << std::endl;
+    }
+    #endif
+    logicalDeviceCreationInfo.enabledExtensionCount =static_cast<uint32_t>(deviceExtensionNames.size());
+    logicalDeviceCreationInfo.ppEnabledExtensionNames = deviceExtensionNames.data();
 
     // Actually this is ignored by most recent vulkan (https://docs.vulkan.org/spec/latest/chapters/extensions.html#extendingvulkan-layers-devicelayerdeprecation)
     // This is being filled in just for retrocompatibility.
@@ -189,6 +263,14 @@ void HelloTriangleApplication::createLogicalDevice(){
         0, // Each queue family contains multiple queues in it, all those that support the features needed. This index referes to the position in the family of the queue to retrieve.
         &graphicsCommandQueue);
     vkGetDeviceQueue(logiDevice, qfi.presentationFamilyIndex.value(), 0, &presentCommandQueue);
+    dedicatedTransferQueue = qfi.transferFamilyIndex.has_value();
+    if (dedicatedTransferQueue){
+        vkGetDeviceQueue(logiDevice, qfi.transferFamilyIndex.value(), 0, &transferCommandQueue);
+        std::cout << "staging copies on transfer queue family " << qfi.transferFamilyIndex.value() << std::endl;
+    }else{
+        transferCommandQueue = graphicsCommandQueue;
+        std::cout << "no dedicated transfer queue family, staging copies on the graphics queue" << std::endl;
+    }
 
 }
 
@@ -200,6 +282,7 @@ void HelloTriangleApplication::setupRenderSurface(){
 }
 
 void HelloTriangleApplication::createSwapChain(){
+    HELIUM_PROFILE_FUNCTION();
     SwapChainSpecifications swapChainSpecs = checkSwapChainSpecifications(physGraphicDevice);
 
     VkSurfaceFormatKHR imageFormat = chooseImageFormat(swapChainSpecs.imageFormats);
@@ -266,6 +349,7 @@ void HelloTriangleApplication::createSwapChainViews(){
 }
 
 void HelloTriangleApplication::createRenderPass(){
+    HELIUM_PROFILE_FUNCTION();
     VkAttachmentDescription mainColorAttachmentDescription{}; 
     mainColorAttachmentDescription.format = selectedSwapChainFormat; // Image format i.e. bits per channel and linear/gamma etc...
     mainColorAttachmentDescription.samples = maxMsaaSupported; // Max supported samples
@@ -327,6 +411,10 @@ void HelloTriangleApplication::createRenderPass(){
     msaaResultColorAttachmentDescription.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
     msaaResultColorAttachmentDescription.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
     msaaResultColorAttachmentDescription.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR; // Actually the color attachment presented to screen.
+    if (headless){
+        // PRESENT_SRC is only valid with the swapchain extension, offscreen images are left ready to be read back instead.
+        msaaResultColorAttachmentDescription.finalLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    }
 
     VkAttachmentReference msaaResultAttachmentRef{};
     msaaResultAttachmentRef.attachment = 2;
@@ -396,16 +484,23 @@ void HelloTriangleApplication::createRenderPass(){
 }
 
 void HelloTriangleApplication::createPipeline(){
+    HELIUM_PROFILE_FUNCTION();
     #ifndef HELIUM_VERTEX_BUFFERS
     std::vector<char> vShaderBinary = readFile("/Users/kambo/Helium/GameDev/Projects/CGSamples/Vulkan/shaders/v1_helloTriangle.spv");
     std::vector<char> fShaderBinary = readFile("/Users/kambo/Helium/GameDev/Projects/CGSamples/Vulkan/shaders/f1_helloTriangle.spv");
     #else
 
-    VkVertexInputBindingDescription bindingDescription = Vert::getBindingDescription();
-    std::array<VkVertexInputAttributeDescription, 3> attributeDescription = Vert::getAttributeDescription();
+    const VkVertexInputBindingDescription bindingDescription = vertexBindingDescription<MeshVertex>();
+    const auto attributeDescription = vertexAttributeDescriptions<MeshVertex>();
 
+    #if defined(HELIUM_LOAD_MODEL) && defined(HELIUM_QUANTIZED_VERTICES)
+    std::vector<char> vShaderBinary = readFile("/Users/kambo/Helium/GameDev/Projects/CGSamples/Vulkan/shaders/v4_quantizedVertex.spv");
+    #else
     std::vector<char> vShaderBinary = readFile("/Users/kambo/Helium/GameDev/Projects/CGSamples/Vulkan/shaders/v3_mvpVertex.spv");
-    std::vector<char> fShaderBinary = readFile("/Users/kambo/Helium/GameDev/Projects/CGSamples/Vulkan/shaders/f3_gammaCorrection.spv");
+    #endif
+    std::vector<char> fShaderBinary = readFile(bindlessTextures
+        ? "/Users/kambo/Helium/GameDev/Projects/CGSamples/Vulkan/shaders/f4_bindlessTextures.spv"
+        : "/Users/kambo/Helium/GameDev/Projects/CGSamples/Vulkan/shaders/f3_gammaCorrection.spv");
     #endif 
 
     VkShaderModule vShader = createShaderModule(vShaderBinary);
@@ -623,6 +718,15 @@ void HelloTriangleApplication::createPipeline(){
     pipelineLayoutCreationInfo.pSetLayouts = &mainDescriptorSetLayout;
     pipelineLayoutCreationInfo.pushConstantRangeCount = 0; // Number of push constant, an element that can be used to pass dynamic values to the shaders
     pipelineLayoutCreationInfo.pPushConstantRanges = nullptr;
+    // Bindless textures: the texture table is set 1, each draw selects its texture with a push constant.
+    std::array<VkDescriptorSetLayout, 2> bindlessSetLayouts = {mainDescriptorSetLayout, bindlessDescriptorSetLayout};
+    VkPushConstantRange bindlessRange{VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(BindlessConstants)};
+    if (bindlessTextures){
+        pipelineLayoutCreationInfo.setLayoutCount = static_cast<uint32_t>(bindlessSetLayouts.size());
+        pipelineLayoutCreationInfo.pSetLayouts = bindlessSetLayouts.data();
+        pipelineLayoutCreationInfo.pushConstantRangeCount = 1;
+        pipelineLayoutCreationInfo.pPushConstantRanges = &bindlessRange;
+    }
     if(vkCreatePipelineLayout(logiDevice, &pipelineLayoutCreationInfo, nullptr, &pipelineLayout) != VK_SUCCESS){
         throw std::runtime_error("error when creating the pipeline layout");
     }
@@ -648,7 +752,8 @@ void HelloTriangleApplication::createPipeline(){
     pipelineCreationInfo.basePipelineHandle = VK_NULL_HANDLE;
     pipelineCreationInfo.basePipelineIndex = -1;
 
-    if(vkCreateGraphicsPipelines(logiDevice, VK_NULL_HANDLE, 1, &pipelineCreationInfo, nullptr, &gPipeline) != VK_SUCCESS){
+    // VK_NULL_HANDLE when the cache is disabled, the driver then compiles from scratch.
+    if(vkCreateGraphicsPipelines(logiDevice, pipelineCache.get(), 1, &pipelineCreationInfo, nullptr, &gPipeline) != VK_SUCCESS){
         throw std::runtime_error("failed to create graphics pipeline");
     }
 
@@ -663,7 +768,8 @@ void HelloTriangleApplication::createAndBindDeviceBuffer(
     VkBufferUsageFlags bufferUsage,
     VkMemoryPropertyFlags propertyFlags,
     VkBuffer& buffer, 
-    VkDeviceMemory& bufferMemory
+    DeviceAllocation& bufferMemory,
+    VkMemoryPropertyFlags preferredPropertyFlags
 ){
     #ifndef HELIUM_VERTEX_BUFFERS
     return;
@@ -687,18 +793,17 @@ void HelloTriangleApplication::createAndBindDeviceBuffer(
     VkMemoryRequirements memReqs;
     vkGetBufferMemoryRequirements(logiDevice, buffer, &memReqs);
     
-    VkMemoryAllocateInfo allocationInfo{};
-    allocationInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    allocationInfo.allocationSize = memReqs.size;
-    allocationInfo.memoryTypeIndex = getFirstUsableMemoryType(
-        memReqs.memoryTypeBits, propertyFlags);
-        
-    if(vkAllocateMemory(logiDevice, &allocationInfo, nullptr, &bufferMemory) != VK_SUCCESS){
-        throw std::runtime_error("failed to allocate buffer device memory for buffer object being created");
-    }
+    // Placed inside one of the allocator's blocks, buffers are always linear resources.
+    bufferMemory = deviceAllocator.allocate(
+        memReqs,
+        chooseMemoryType(memReqs.memoryTypeBits, propertyFlags, preferredPropertyFlags),
+        true
+    );
     
     /*----- Bind allocated memory to vertex buffer object -----*/
-    vkBindBufferMemory(logiDevice, buffer, bufferMemory, 0);
+    if (vkBindBufferMemory(logiDevice, buffer, bufferMemory.memory, bufferMemory.offset) != VK_SUCCESS){
+        throw std::runtime_error("failed to bind buffer memory");
+    }
     #endif
 }
 
@@ -708,88 +813,129 @@ bool hasStencilComponent(VkFormat format){
     return format == VK_FORMAT_D32_SFLOAT_S8_UINT || format == VK_FORMAT_D24_UNORM_S8_UINT;
 }
 
-void HelloTriangleApplication::createDeviceIndexBuffer(){
-    VkDeviceSize indexBufferSize = 
-        sizeof(indices[0]) * indices.size();
-
-    VkBuffer stagingBuffer;
-    VkDeviceMemory stagingBufferMemory;
-
-    VkMemoryPropertyFlags stagingBufferMemProperties = 
-        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
-
+void HelloTriangleApplication::createStagingRing(){
     createAndBindDeviceBuffer(
-        indexBufferSize,
+        StagingRing::DEFAULT_CAPACITY,
         VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-        stagingBufferMemProperties,
-        stagingBuffer,
-        stagingBufferMemory
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+        stagingRingBuffer,
+        stagingRingMemory
     );
+    stagingRing.init(logiDevice, stagingRingBuffer, stagingRingMemory.mapped, StagingRing::DEFAULT_CAPACITY);
+    uploadScheduler.init(&stagingRing);
+    if (dedicatedTransferQueue){
+        QueueFamilyIndices qfi = findRequiredQueueFamily(physGraphicDevice);
+        uploadScheduler.setQueueFamilies(qfi.transferFamilyIndex.value(), qfi.graphicsFamilyIndex.value());
+    }
+}
 
-    void* bufferData;
-
-    vkMapMemory(logiDevice, stagingBufferMemory, 0, indexBufferSize, 0, &bufferData);
-    memcpy(bufferData, indices.data(), (size_t) indexBufferSize);
-    vkUnmapMemory(logiDevice, stagingBufferMemory);
+/*
+Records everything queued in the scheduler, ignoring the frame budget. Used while loading, when there is no frame to protect.
+Source data is copied to staging memory before this returns, so it can be freed right after.
+Inside an upload batch the copies only run when the batch is submitted, outside of one this waits for them.
+*/
+void HelloTriangleApplication::flushUploads(){
+    HELIUM_PROFILE_FUNCTION();
+    while (uploadScheduler.hasPending()){
+        VkCommandBuffer oneTimeBuffer = beginOneTimeCommands("upload");
+        uploadScheduler.record(uploadBatchTransferCommands(), UploadScheduler::UNLIMITED_BUDGET);
+        // Ownership of what finished goes back to the graphics queue (no-op without a transfer queue).
+        uploadScheduler.recordAcquires(oneTimeBuffer);
+        bool ringFull = uploadScheduler.hasPending();
+        endAndSubmitOneTimeCommands(oneTimeBuffer);
+        if (ringFull && uploadBatchBuffer != VK_NULL_HANDLE){
+            // The open batch filled the staging ring by itself: submit it early and start a new one to make room.
+            waitForUploads(submitUploadBatch());
+            beginUploadBatch();
+        }
+    }
+}
 
-    createAndBindDeviceBuffer(indexBufferSize,
-        VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
+/*
+Creates a device local buffer holding bufferSize bytes of data. With unified memory the data is written straight into it,
+otherwise it goes through the staging ring (flushUploads()). Either way data can be freed once this returns.
+*/
+void HelloTriangleApplication::createAndFillDeviceBuffer(const void* data, VkDeviceSize bufferSize, VkBufferUsageFlags bufferUsage, VkBuffer& buffer, DeviceAllocation& bufferMemory){
+    if (unifiedMemory){
+        createAndBindDeviceBuffer(
+            bufferSize,
+            bufferUsage,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+            buffer,
+            bufferMemory
+        );
+        // Coherent, and submitting the command buffers that read it makes host writes visible to the device.
+        memcpy(bufferMemory.mapped, data, static_cast<size_t>(bufferSize));
+        return;
+    }
+    createAndBindDeviceBuffer(
+        bufferSize,
+        bufferUsage | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
         VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-        indexBuffer,
-        indexBufferMemory
+        buffer,
+        bufferMemory
     );
+    // Goes through the staging ring, the copy to device local memory is recorded by the scheduler.
+    uploadScheduler.enqueueBuffer(buffer, 0, data, bufferSize);
+    flushUploads();
+}
 
-    bufferCopy(stagingBuffer, indexBuffer, indexBufferSize);
-
-    vkDestroyBuffer(logiDevice, stagingBuffer, nullptr);
-    vkFreeMemory(logiDevice, stagingBufferMemory, nullptr);
-
-
+void HelloTriangleApplication::createDeviceIndexBuffer(){
+    HELIUM_PROFILE_FUNCTION();
+    const void* indexData = indices.data();
+    uint32_t indexSize = sizeof(uint32_t);
+    indexCount = static_cast<uint32_t>(indices.size());
+    // 16 bit indices halve the index buffer whenever the vertex count allows it.
+    std::vector<uint16_t> narrowed;
+    bool cached = false;
+    #ifdef HELIUM_LOAD_MODEL
+    if (meshCache.isOpen()){
+        // Straight from the mapped cache file into the buffer/staging ring, already at the right width.
+        indexData = meshCache.indexData();
+        indexSize = meshCache.indexSize();
+        indexCount = static_cast<uint32_t>(meshCache.indexCount());
+        cached = true;
+    }
+    #endif
+    if (!cached && fitsUint16Indices(vertices.size())){
+        narrowed = narrowIndices(indices.data(), indices.size());
+        indexData = narrowed.data();
+        indexSize = sizeof(uint16_t);
+    }
+    indexType = indexSize == sizeof(uint16_t) ? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32;
+    VkDeviceSize indexBufferSize = 
+        static_cast<VkDeviceSize>(indexSize) * indexCount;
+    VkBufferUsageFlags indexBufferUsage = VK_BUFFER_USAGE_INDEX_BUFFER_BIT;
+
+    #ifdef HELIUM_GPU_CULLING
+    // Also read by the culling pass, in 32 bit words: an odd number of 16 bit indices gets one more to fill the last word.
+    indexBufferUsage |= VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+    std::vector<uint16_t> padded;
+    if (indexBufferSize % sizeof(uint32_t) != 0){
+        padded.assign(static_cast<const uint16_t*>(indexData), static_cast<const uint16_t*>(indexData) + indexCount);
+        padded.push_back(0);
+        indexData = padded.data();
+        indexBufferSize += sizeof(uint16_t);
+    }
+    #endif
+    createAndFillDeviceBuffer(indexData, indexBufferSize, indexBufferUsage, indexBuffer, indexBufferMemory);
 }
 
 void HelloTriangleApplication::createDeviceVertexBuffer(){
+    HELIUM_PROFILE_FUNCTION();
+    const void* vertexData = vertices.data();
+    size_t vertexCount = vertices.size();
+    #ifdef HELIUM_LOAD_MODEL
+    if (meshCache.isOpen()){
+        vertexData = meshCache.vertexData();
+        vertexCount = static_cast<size_t>(meshCache.vertexCount());
+    }
+    #endif
     VkDeviceSize vertexBufferSize = 
-        sizeof(vertices[0]) * vertices.size();
+        sizeof(vertices[0]) * vertexCount;
     std::cout << "size of vbuffer is " << vertexBufferSize  << "(" << sizeof(vertices[0]) << ")" << std::endl;
-    VkBuffer stagingBuffer;
-    VkDeviceMemory stagingBufferMemory;
-
-    VkMemoryPropertyFlags stagingBufferMemProperties = 
-        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
-
-    createAndBindDeviceBuffer(
-        vertexBufferSize,
-        VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-        stagingBufferMemProperties,
-        stagingBuffer,
-        stagingBufferMemory
-    );
-    
-
-    /*----- Write to device buffer -----*/
-    void* bufferData;
-    // Get virtual address pointer to the device buffer
-    vkMapMemory(logiDevice, stagingBufferMemory, 0, vertexBufferSize, 0, &bufferData);
-    // Write to the memory via memcpy, copying the vertex buffer content into the device memory
-    memcpy(bufferData, vertices.data(), (size_t) vertexBufferSize);
-    vkUnmapMemory(logiDevice, stagingBufferMemory);
-
-
-    VkMemoryPropertyFlags vertexBufferMemProperties = 
-        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
-    createAndBindDeviceBuffer(
-        vertexBufferSize,
-        VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, 
-        vertexBufferMemProperties,
-        vertexBuffer, 
-        vertexBufferMemory
-    );
-
-    bufferCopy(stagingBuffer, vertexBuffer, vertexBufferSize);
-
-    vkDestroyBuffer(logiDevice, stagingBuffer, nullptr);
-    vkFreeMemory(logiDevice, stagingBufferMemory, nullptr);
 
+    createAndFillDeviceBuffer(vertexData, vertexBufferSize, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, vertexBuffer, vertexBufferMemory);
 }
 
 void HelloTriangleApplication::createDescriptorSetLayout(){
@@ -821,12 +967,16 @@ void HelloTriangleApplication::createDescriptorSetLayout(){
 
     VkDescriptorSetLayoutCreateInfo descriptorSetMemLayoutCreationInfo{};
     descriptorSetMemLayoutCreationInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
-    descriptorSetMemLayoutCreationInfo.bindingCount = bindings.size();
+    // With bindless textures the texture comes from set 1 (bindless.cpp), this set only holds the MVP matrix.
+    descriptorSetMemLayoutCreationInfo.bindingCount = bindlessTextures ? 1 : bindings.size();
     descriptorSetMemLayoutCreationInfo.pBindings = bindings.data();
 
     if(vkCreateDescriptorSetLayout(logiDevice, &descriptorSetMemLayoutCreationInfo, nullptr, &mainDescriptorSetLayout) != VK_SUCCESS){
         throw std::runtime_error("failed to create main descriptor set layout. (MVP Mat and texture)");
     }
+    if (bindlessTextures){
+        createBindlessLayout();
+    }
 
 }
 
@@ -843,21 +993,25 @@ void HelloTriangleApplication::createCoherentUniformBuffers(){
             VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
             VK_MEMORY_PROPERTY_HOST_COHERENT_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT,
             mvpMatUniformBuffers[i],
-            mvpMatUniformBuffersMemory[i]
+            mvpMatUniformBuffersMemory[i],
+            // Read by every vertex, worth a slot of the BAR window even without unified memory.
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT
         );
 
-        vkMapMemory(logiDevice, mvpMatUniformBuffersMemory[i], 0, mvpMatSize, 0, &mvpMatUniformBuffersMapHandles[i]);
+        mvpMatUniformBuffersMapHandles[i] = mvpMatUniformBuffersMemory[i].mapped;
     }
 }
 
 void HelloTriangleApplication::createDescriptorPool(){
+    // A set per frame and material, see descriptorSets. Just one per frame with bindless textures.
+    const uint32_t setCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT * (bindlessTextures ? 1 : materialTextureSlots.size()));
     VkDescriptorPoolSize poolSizeMVP{};
     poolSizeMVP.type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-    poolSizeMVP.descriptorCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
+    poolSizeMVP.descriptorCount = setCount;
 
     VkDescriptorPoolSize poolSizeMainTex{};
     poolSizeMainTex.type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-    poolSizeMainTex.descriptorCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
+    poolSizeMainTex.descriptorCount = setCount;
 
     std::array<VkDescriptorPoolSize, 2> poolSizes = {
         poolSizeMVP, poolSizeMainTex
@@ -865,10 +1019,10 @@ void HelloTriangleApplication::createDescriptorPool(){
     
     VkDescriptorPoolCreateInfo poolInfo{};
     poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
-    poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+    poolInfo.poolSizeCount = bindlessTextures ? 1 : static_cast<uint32_t>(poolSizes.size());
     poolInfo.pPoolSizes = poolSizes.data();
     /* Maximum allocations expected by the program. Allows for optimization */
-    poolInfo.maxSets = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
+    poolInfo.maxSets = setCount;
 
     if(vkCreateDescriptorPool(logiDevice, &poolInfo, nullptr, &descriptorPool) != VK_SUCCESS){
         throw std::runtime_error("failed to create descriptor pool");
@@ -876,30 +1030,36 @@ void HelloTriangleApplication::createDescriptorPool(){
 }
 
 void HelloTriangleApplication::createDescriptorSets(){
-    std::vector<VkDescriptorSetLayout> layouts(MAX_FRAMES_IN_FLIGHT, mainDescriptorSetLayout);
+    HELIUM_PROFILE_FUNCTION();
+    const size_t materialCount = bindlessTextures ? 1 : materialTextureSlots.size();
+    std::vector<VkDescriptorSetLayout> layouts(MAX_FRAMES_IN_FLIGHT * materialCount, mainDescriptorSetLayout);
     VkDescriptorSetAllocateInfo descriptorSetAllocationInfo{};
     
     descriptorSetAllocationInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
     descriptorSetAllocationInfo.descriptorPool = descriptorPool;
-    descriptorSetAllocationInfo.descriptorSetCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
+    descriptorSetAllocationInfo.descriptorSetCount = static_cast<uint32_t>(layouts.size());
     descriptorSetAllocationInfo.pSetLayouts = layouts.data();
 
-    descriptorSets.resize(MAX_FRAMES_IN_FLIGHT);
+    descriptorSets.resize(layouts.size());
+    descriptorTextureViews.resize(layouts.size());
 
     if(vkAllocateDescriptorSets(logiDevice, &descriptorSetAllocationInfo, descriptorSets.data()) != VK_SUCCESS ){
         throw std::runtime_error("failed to allocate descriptor sets");
     }
 
     for(size_t i = 0; i < descriptorSets.size(); i++){
+        const size_t frame = i / materialCount;
+        const Texture& texture = textures[materialTextureSlots[i % materialCount]];
         VkDescriptorBufferInfo bufferInfo;
-        bufferInfo.buffer = mvpMatUniformBuffers[i];
+        bufferInfo.buffer = mvpMatUniformBuffers[frame];
         bufferInfo.offset = 0;
         bufferInfo.range = sizeof(ModelViewProjection);
 
         VkDescriptorImageInfo mainTexInfo{};
         mainTexInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-        mainTexInfo.imageView = textureImageView;
+        mainTexInfo.imageView = texture.view;
         mainTexInfo.sampler = textureSampler;
+        descriptorTextureViews[i] = texture.view;
         
 
         VkWriteDescriptorSet writeMvpMatOp{};
@@ -928,7 +1088,10 @@ void HelloTriangleApplication::createDescriptorSets(){
             writeMvpMatOp, writeMainTexOp
         };
 
-        vkUpdateDescriptorSets(logiDevice, static_cast<uint32_t>(writeDescriptorOps.size()), writeDescriptorOps.data(), 0, nullptr);
+        vkUpdateDescriptorSets(logiDevice, bindlessTextures ? 1 : static_cast<uint32_t>(writeDescriptorOps.size()), writeDescriptorOps.data(), 0, nullptr);
+    }
+    if (bindlessTextures){
+        createBindlessTable();
     }
 }
 
@@ -936,12 +1099,13 @@ void HelloTriangleApplication::createAndBindDeviceImage(int width,
                                                         int height, 
                                                         VkSampleCountFlagBits samples,
                                                         VkImage& imageDescriptor, 
-                                                        VkDeviceMemory& imageMemory, 
+                                                        DeviceAllocation& imageMemory, 
                                                         VkFormat format,
                                                         VkImageTiling tiling, 
                                                         VkImageUsageFlags usage, 
                                                         VkMemoryPropertyFlags memProperties, 
-                                                        int mipmapLevels){
+                                                        int mipmapLevels,
+                                                        VkImageCreateFlags flags){
 
     VkImageCreateInfo imageCreationInfo{};
     imageCreationInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
@@ -972,7 +1136,7 @@ void HelloTriangleApplication::createAndBindDeviceImage(int width,
     imageCreationInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
     imageCreationInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE; /* Only used by graphics queue */
     imageCreationInfo.samples = samples;
-    imageCreationInfo.flags = 0;
+    imageCreationInfo.flags = flags; // e.g. MUTABLE_FORMAT for views in another format of the same class
 
     if(vkCreateImage(logiDevice, &imageCreationInfo, nullptr, &imageDescriptor) != VK_SUCCESS){
         throw std::runtime_error("failed to create texture on the device");
@@ -981,99 +1145,314 @@ void HelloTriangleApplication::createAndBindDeviceImage(int width,
     VkMemoryRequirements memReq;
     vkGetImageMemoryRequirements(logiDevice, imageDescriptor, &memReq);
 
-    VkMemoryAllocateInfo textureAllocationInfo{};
-    textureAllocationInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    textureAllocationInfo.allocationSize = memReq.size;
-    textureAllocationInfo.memoryTypeIndex = getFirstUsableMemoryType(
-        memReq.memoryTypeBits, 
-        memProperties
+    imageMemory = deviceAllocator.allocate(
+        memReq,
+        chooseMemoryType(memReq.memoryTypeBits, memProperties),
+        tiling == VK_IMAGE_TILING_LINEAR // Optimal images may need to live apart from linear resources (bufferImageGranularity)
     );
 
-    if (vkAllocateMemory(logiDevice, &textureAllocationInfo, nullptr, &imageMemory) != VK_SUCCESS){
-        throw std::runtime_error("could not allocate memory for the texture");
-    }
-
-    if(vkBindImageMemory(logiDevice, imageDescriptor, imageMemory, 0) != VK_SUCCESS){
+    if(vkBindImageMemory(logiDevice, imageDescriptor, imageMemory.memory, imageMemory.offset) != VK_SUCCESS){
         throw std::runtime_error("failed to bind the image to the handle");
     }
 }
 
 
-void HelloTriangleApplication::createTextureImage(){
-    int texWidth, texHeight, texChannels;
-
-    /*
-    stbi_uc* points to the first pixel in an array of pixels of the image. Each pixels occupies 4 bytes.
-    Order is row by row, so if an image is 100 wide and 200 high we will have:
-    [pixels 0...99]
-    [row 2] 
-    [row 199] 
-    */
+/*
+Loads every distinct texture of the materials once, materials that share a path share the texture. Without a loaded model
+there is a single material using tex.jpg.
+A path with a cooked <path>.ktx2 (texture_cook) newer than itself, in a format the device samples, has its blocks and mips
+uploaded as they are. The other paths are decoded in parallel on the shared thread pool (TextureLoader) while the cooked ones
+upload, their images are created and filled in the order the decodes finish. With streaming only the mip tail of each is
+uploaded here, streamTextures() does the rest.
+The log reports, per texture, the decode time on its worker, how long the main thread waited for it and the time spent
+creating, uploading and recording its mips.
+*/
+void HelloTriangleApplication::createTextureImages(){
+    HELIUM_PROFILE_FUNCTION();
     #ifdef HELIUM_LOAD_MODEL
-    stbi_uc* firstPixelPointer = loadImage(TEX_PATH.c_str(), &texWidth, &texHeight, &texChannels);
+    const std::vector<std::string>& paths = materialTextures;
     #else
-    stbi_uc* firstPixelPointer = loadImage("/Users/kambo/Helium/GameDev/Projects/CGSamples/Vulkan/textures/tex.jpg", &texWidth, &texHeight, &texChannels);
+    const std::vector<std::string> paths = {"/Users/kambo/Helium/GameDev/Projects/CGSamples/Vulkan/textures/tex.jpg"};
     #endif
-    textureMipmaps = static_cast<uint32_t>(std::floor(
-        std::log2(std::max(texWidth, texHeight)))
-    ) + 1; // +1 because of level 0
-    VkDeviceSize imageSize = texWidth * texHeight * 4;
-    if (!firstPixelPointer) {
-        throw std::runtime_error("failed to load texture");
+    std::map<std::string, uint32_t> slots;
+    std::vector<std::string> uniquePaths;
+    materialTextureSlots.clear();
+    for (const std::string& path : paths){
+        auto [it, inserted] = slots.try_emplace(path, static_cast<uint32_t>(uniquePaths.size()));
+        if (inserted){
+            uniquePaths.push_back(path);
+        }
+        materialTextureSlots.push_back(it->second);
     }
 
-    VkBuffer stagingBuffer;
-    VkDeviceMemory stagingMemory;
+    auto start = std::chrono::steady_clock::now();
+    double decodeMs = 0.0;
+    double waitMs = 0.0;
+    textures.assign(uniquePaths.size(), Texture{});
+    textureStreams.clear();
+    #ifndef HELIUM_DISABLE_TEXTURE_STREAMING
+    textureStreams.resize(uniquePaths.size());
+    #endif
+    std::vector<Ktx2File> cooked(uniquePaths.size());
+    std::vector<std::string> decodedPaths;
+    std::vector<uint32_t> decodedSlots;
+    for (uint32_t t = 0; t < uniquePaths.size(); t++){
+        std::string cookedPath = cookedTexturePath(uniquePaths[t]);
+        std::error_code cookedError;
+        std::error_code sourceError;
+        auto cookedTime = std::filesystem::last_write_time(cookedPath, cookedError);
+        auto sourceTime = std::filesystem::last_write_time(uniquePaths[t], sourceError);
+        bool current = !cookedError && !sourceError && cookedTime >= sourceTime;
+        if (compressedTextures && current && cooked[t].open(cookedPath)){
+            VkFormatProperties properties{};
+            vkGetPhysicalDeviceFormatProperties(physGraphicDevice, static_cast<VkFormat>(cooked[t].vkFormat()), &properties);
+            if (properties.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT){
+                continue;
+            }
+            std::cout << "texture " << uniquePaths[t] << ": cooked format " << cooked[t].vkFormat() << " not supported, decoding" << std::endl;
+            cooked[t].close();
+        }
+        decodedPaths.push_back(uniquePaths[t]);
+        decodedSlots.push_back(t);
+    }
 
-    createAndBindDeviceBuffer(imageSize,
-        VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-        VK_MEMORY_PROPERTY_HOST_COHERENT_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT,
-    stagingBuffer,
-    stagingMemory);
+    // Decodes start right away, the cooked textures are uploaded meanwhile.
+    TextureLoader loader(decodedPaths);
+    for (uint32_t t = 0; t < uniquePaths.size(); t++){
+        if (!cooked[t].isOpen()){
+            continue;
+        }
+        auto uploadStart = std::chrono::steady_clock::now();
+        uint32_t firstLevel = 0;
+        if (!textureStreams.empty()){
+            firstLevel = streamingTailLevel(cooked[t].width(), cooked[t].height(), cooked[t].levelCount());
+            textureStreams[t].width = cooked[t].width();
+            textureStreams[t].height = cooked[t].height();
+            textureStreams[t].requestedLevel = firstLevel;
+        }
+        textures[t] = createCookedTexture(cooked[t], firstLevel);
+        if (firstLevel > 0){
+            // The other levels are read from the mapping as they stream.
+            textureStreams[t].cooked = std::move(cooked[t]);
+        }
+        cooked[t].close();
+        double uploadMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - uploadStart).count();
+        std::cout << "texture " << uniquePaths[t] << ": cooked " << textures[t].mipmaps << " levels (" << firstLevel
+                  << " streamed), upload " << uploadMs << "ms" << std::endl;
+    }
+
+    TextureLoader::DecodedImage image;
+    double imageWaitMs = 0.0;
+    while (loader.next(image, &imageWaitMs)){
+        const std::string& path = decodedPaths[image.index];
+        if (!image.pixels){
+            throw std::runtime_error("failed to load texture " + path);
+        }
+        auto uploadStart = std::chrono::steady_clock::now();
+        uint32_t slot = decodedSlots[image.index];
+        if (textureStreams.empty()){
+            textures[slot] = createTexture(image.pixels, image.width, image.height);
+        }else{
+            textures[slot] = createStreamedTexture(image.pixels, image.width, image.height, textureStreams[slot]);
+        }
+        TextureLoader::free(image.pixels);
+        double uploadMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - uploadStart).count();
+        std::cout << "texture " << path << ": " << image.width << "x" << image.height
+                  << ", decode " << image.decodeMs << "ms, waited " << imageWaitMs << "ms, upload " << uploadMs << "ms" << std::endl;
+        decodeMs += image.decodeMs;
+        waitMs += imageWaitMs;
+    }
+    double totalMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "textures: " << textures.size() << " for " << materialTextureSlots.size() << " materials ("
+              << textures.size() - decodedPaths.size() << " cooked) in " << totalMs << "ms (" << decodeMs << "ms of decoding on "
+              << ThreadPool::shared().concurrency() - 1 << " workers, " << waitMs << "ms waiting for it)" << std::endl;
+    texturesStreaming = false;
+    for (const Texture& texture : textures){
+        texturesStreaming = texturesStreaming || texture.residentLevel > 0;
+    }
+    streamingStart = std::chrono::steady_clock::now();
+    streamingStartFrame = frameCounter;
+}
 
-    void *data;
-    vkMapMemory(logiDevice, stagingMemory, 0, imageSize, 0, &data);
-    memcpy(data, firstPixelPointer, static_cast<size_t>(imageSize));
-    vkUnmapMemory(logiDevice, stagingMemory);
+/*
+Creates an image in the block format of a cooked texture and uploads levels [firstLevel, levelCount) through the staging ring,
+no mip generation. The others are left to streamTextures(). Those levels are copied out of the file once this returns.
+*/
+HelloTriangleApplication::Texture HelloTriangleApplication::createCookedTexture(const Ktx2File& cooked, uint32_t firstLevel){
+    HELIUM_PROFILE_FUNCTION();
+    Texture texture{};
+    texture.mipmaps = cooked.levelCount();
+    texture.residentLevel = firstLevel;
+    texture.viewLevel = firstLevel;
+    texture.format = static_cast<VkFormat>(cooked.vkFormat());
+    createAndBindDeviceImage(
+        cooked.width(),
+        cooked.height(),
+        VK_SAMPLE_COUNT_1_BIT,
+        texture.image,
+        texture.memory,
+        texture.format,
+        VK_IMAGE_TILING_OPTIMAL,
+        // Transfer source for the moves of texture_residency.cpp.
+        VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+        texture.mipmaps
+    );
+    for (uint32_t level = firstLevel; level < cooked.levelCount(); level++){
+        uploadScheduler.enqueueCompressedImage(
+            texture.image, level, std::max(1u, cooked.width() >> level), std::max(1u, cooked.height() >> level),
+            ktx2BlockBytes(cooked.vkFormat()), cooked.levelData(level),
+            VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL
+        );
+    }
+    // Copies the levels out of the mapping.
+    flushUploads();
+    return texture;
+}
 
-    stbi_image_free(firstPixelPointer);
+/*
+Creates a mipmapped image from RGBA8 pixels. Level 0 goes through the staging ring and the other levels are generated from it
+by compute (c2_mipDownsample) when the format has a storage view, blitted when it can be, and built on the CPU otherwise.
+Everything is recorded into the open upload batch. pixels can be freed once this returns.
+Pixels are 4 bytes each and stored row by row, so if an image is 100 wide and 200 high we will have:
+[pixels 0...99]
+[row 2] 
+[row 199] 
+*/
+HelloTriangleApplication::Texture HelloTriangleApplication::createTexture(const unsigned char* pixels, uint32_t texWidth, uint32_t texHeight){
+    HELIUM_PROFILE_FUNCTION();
+    Texture texture{};
+    texture.format = VK_FORMAT_R8G8B8A8_SRGB;
+    texture.mipmaps = static_cast<uint32_t>(std::floor(
+        std::log2(std::max(texWidth, texHeight)))
+    ) + 1; // +1 because of level 0
 
-    VkFormat selectedFormat = VK_FORMAT_R8G8B8A8_SRGB; // 8b * 4 = 32bits = 4 bytes per pixel from before
+    VkFormat selectedFormat = VK_FORMAT_R8G8B8A8_SRGB; // 8b * 4 = 32bits = 4 bytes per pixel
+    VkFormatProperties formatProps;
+    vkGetPhysicalDeviceFormatProperties(physGraphicDevice, selectedFormat, &formatProps);
+    const VkFormatFeatureFlags blitFeatures = VK_FORMAT_FEATURE_BLIT_SRC_BIT | VK_FORMAT_FEATURE_BLIT_DST_BIT
+                                            | VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+    VkFormat storageFormat = texture.mipmaps > 1 ? downsampleStorageFormat(selectedFormat) : VK_FORMAT_UNDEFINED;
+    bool cpuMipmaps = storageFormat == VK_FORMAT_UNDEFINED && (formatProps.optimalTilingFeatures & blitFeatures) != blitFeatures;
+#ifdef HELIUM_CPU_MIPMAPS
+    storageFormat = VK_FORMAT_UNDEFINED;
+    cpuMipmaps = true;
+#endif
+    bool computeMipmaps = storageFormat != VK_FORMAT_UNDEFINED;
+
+    // The compute path writes through storage views: the image takes their format and is sampled through an sRGB view.
     createAndBindDeviceImage(
         texWidth,
         texHeight, 
         VK_SAMPLE_COUNT_1_BIT,
-        textureImageHandle, 
-        textureImageDeviceMemory, 
-        selectedFormat, 
+        texture.image, 
+        texture.memory, 
+        computeMipmaps ? storageFormat : selectedFormat, 
         VK_IMAGE_TILING_OPTIMAL, 
-        VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, 
+        VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT
+            | (computeMipmaps ? VK_IMAGE_USAGE_STORAGE_BIT : 0), 
         VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-        textureMipmaps
+        texture.mipmaps,
+        computeMipmaps && storageFormat != selectedFormat ? VK_IMAGE_CREATE_MUTABLE_FORMAT_BIT : 0
     );
 
-    std::cout << "creating first image layout conversion" << std::endl;
-    convertImageLayout(textureImageHandle, textureMipmaps, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
-    bufferCopyToImage(
-        stagingBuffer,
-        textureImageHandle, static_cast<uint32_t>(texWidth), static_cast<uint32_t>(texHeight)
+    if (cpuMipmaps){
+        std::vector<uint8_t> chain(mipChainBytes(texWidth, texHeight, texture.mipmaps));
+        generateMipChain(pixels, texWidth, texHeight, texture.mipmaps, MipFilter::KAISER, chain.data(), ThreadPool::shared());
+        // One transition for the whole chain, straight to the sampled layout.
+        uploadScheduler.enqueueImageChain(
+            texture.image, 0, texWidth, texHeight, texture.mipmaps, 4, chain.data(),
+            VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL
+        );
+        // The chain only has to live until it is in the staging ring.
+        flushUploads();
+        return texture;
+    }
+
+    if (computeMipmaps){
+        // Level 0 is read as a storage image, the pass transitions the other levels itself.
+        uploadScheduler.enqueueImage(
+            texture.image, 0, texWidth, texHeight, 4, pixels,
+            VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL
+        );
+        flushUploads();
+        generateImageMipMapsCompute(texture.image, storageFormat, selectedFormat == VK_FORMAT_R8G8B8A8_SRGB, texWidth, texHeight, texture.mipmaps);
+        return texture;
+    }
+
+    // Every level goes to TRANSFER_DST, level 0 is uploaded and the others are blitted into by the mip generation.
+    // Level 0 is converted by the upload itself: with a transfer queue it runs there, before anything on the graphics queue.
+    if (texture.mipmaps > 1){
+        convertImageLayout(texture.image, texture.mipmaps, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1);
+    }
+    uploadScheduler.enqueueImage(
+        texture.image, 0, texWidth, texHeight, 4, pixels,
+        VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL
     );
-    std::cout << "creating second image layout conversion" << std::endl;
+    // Copies the pixels into the staging ring.
+    flushUploads();
+
     generatateImageMipMaps(
-        textureImageHandle, VK_FORMAT_R8G8B8A8_SRGB, texWidth, texHeight, textureMipmaps
+        texture.image, VK_FORMAT_R8G8B8A8_SRGB, texWidth, texHeight, texture.mipmaps
     );
-
-    vkDestroyBuffer(logiDevice, stagingBuffer, nullptr);
-    vkFreeMemory(logiDevice, stagingMemory, nullptr);
+    return texture;
 }
 
-void HelloTriangleApplication::createTextureImageView(){
-    textureImageView = createViewFor2DImage(
-        textureImageHandle, 
-        textureMipmaps,
-        VK_FORMAT_R8G8B8A8_SRGB,
-        VK_IMAGE_ASPECT_COLOR_BIT
+/*
+Creates a mipmapped image from RGBA8 pixels for streaming. Only the mip tail (streamingTailLevel()) is generated, on the CPU
+(generateMipTail()), and uploaded here. Level 0 is kept in stream.hostSource, the levels above the tail are filtered from it
+once streamTextures() needs them. pixels can be freed once this returns.
+*/
+HelloTriangleApplication::Texture HelloTriangleApplication::createStreamedTexture(const unsigned char* pixels, uint32_t texWidth, uint32_t texHeight, TextureStream& stream){
+    HELIUM_PROFILE_FUNCTION();
+    Texture texture{};
+    texture.format = VK_FORMAT_R8G8B8A8_SRGB;
+    texture.mipmaps = mipLevelCount(texWidth, texHeight);
+
+    createAndBindDeviceImage(
+        texWidth,
+        texHeight, 
+        VK_SAMPLE_COUNT_1_BIT,
+        texture.image, 
+        texture.memory, 
+        texture.format, 
+        VK_IMAGE_TILING_OPTIMAL, 
+        VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, 
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+        texture.mipmaps
+    );
+
+    stream.width = texWidth;
+    stream.height = texHeight;
+    const uint32_t tail = streamingTailLevel(texWidth, texHeight, texture.mipmaps);
+    std::vector<uint8_t> tailLevels(mipChainBytes(texWidth, texHeight, texture.mipmaps) - mipChainBytes(texWidth, texHeight, tail));
+    generateMipTail(pixels, texWidth, texHeight, texture.mipmaps, tail, MipFilter::KAISER, tailLevels.data(), ThreadPool::shared());
+    uploadScheduler.enqueueImageChain(
+        texture.image, tail, std::max(1u, texWidth >> tail), std::max(1u, texHeight >> tail), texture.mipmaps - tail, 4,
+        tailLevels.data(), VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL
     );
+    // The tail only has to live until it is in the staging ring.
+    flushUploads();
+    texture.residentLevel = tail;
+    texture.viewLevel = tail;
+    stream.requestedLevel = tail;
+    if (tail > 0){
+        stream.hostSource = std::make_shared<const std::vector<uint8_t>>(pixels, pixels + static_cast<size_t>(texWidth) * texHeight * 4);
+    }
+    return texture;
+}
+
+void HelloTriangleApplication::createTextureImageViews(){
+    for (Texture& texture : textures){
+        // Streamed textures are only sampled from their resident levels.
+        texture.view = createViewFor2DImage(
+            texture.image, 
+            texture.mipmaps - texture.viewLevel,
+            texture.format,
+            VK_IMAGE_ASPECT_COLOR_BIT,
+            texture.viewLevel - texture.baseLevel
+        );
+    }
 }
 
 void HelloTriangleApplication::createTextureSampler(){
@@ -1094,7 +1473,8 @@ void HelloTriangleApplication::createTextureSampler(){
     samplerCreationInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
     samplerCreationInfo.mipLodBias = 0.0f;
     samplerCreationInfo.minLod = 0.0f;
-    samplerCreationInfo.maxLod = static_cast<float>(textureMipmaps);
+    // Shared by every texture, the views limit the levels of the smaller ones.
+    samplerCreationInfo.maxLod = VK_LOD_CLAMP_NONE;
     
     VkPhysicalDeviceProperties physicalDeviceProperties{};
     vkGetPhysicalDeviceProperties(physGraphicDevice, &physicalDeviceProperties);
@@ -1109,8 +1489,8 @@ void HelloTriangleApplication::createTextureSampler(){
 
 }
 
-void HelloTriangleApplication::convertImageLayout(VkImage srcImage, int mipmapLevels, VkFormat format, VkImageLayout srcLayout, VkImageLayout dstLayout){
-    VkCommandBuffer oneTimeBuffer = beginOneTimeCommands();
+void HelloTriangleApplication::convertImageLayout(VkImage srcImage, int mipmapLevels, VkFormat format, VkImageLayout srcLayout, VkImageLayout dstLayout, int baseMipLevel){
+    VkCommandBuffer oneTimeBuffer = beginOneTimeCommands("layout_transition");
 
     /* Memory barriers not only act as synchronizers in the pipeline, but
         also act as checkpoints for memory ownership transfers (e.g. from graphics queue to presentation queue)
@@ -1132,8 +1512,8 @@ void HelloTriangleApplication::convertImageLayout(VkImage srcImage, int mipmapLe
     }else{
         layoutConversionBarrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
     }
-    layoutConversionBarrier.subresourceRange.baseMipLevel = 0;
-    layoutConversionBarrier.subresourceRange.levelCount = std::max(1, mipmapLevels);
+    layoutConversionBarrier.subresourceRange.baseMipLevel = baseMipLevel;
+    layoutConversionBarrier.subresourceRange.levelCount = std::max(1, mipmapLevels) - baseMipLevel;
     layoutConversionBarrier.subresourceRange.baseArrayLayer = 0;
     layoutConversionBarrier.subresourceRange.layerCount = 1;
 
@@ -1277,95 +1657,249 @@ void HelloTriangleApplication::createMsaaColorResources(){
     );
 }
 
-void HelloTriangleApplication::bufferCopyToImage(VkBuffer srcBuffer, VkImage dstImage, uint32_t w, uint32_t h){
-    VkCommandBuffer oneTimeBuffer = beginOneTimeCommands();
-    
-    VkBufferImageCopy imageCopyOp{};
-    imageCopyOp.bufferOffset = 0;
-    imageCopyOp.bufferRowLength = 0;
-    imageCopyOp.bufferImageHeight = 0;
-    
-    imageCopyOp.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-    imageCopyOp.imageSubresource.mipLevel = 0;
-    imageCopyOp.imageSubresource.baseArrayLayer = 0;
-    imageCopyOp.imageSubresource.layerCount = 1;
-    imageCopyOp.imageOffset = {0,0,0};
-    imageCopyOp.imageExtent= {
-        w,
-        h,
-        1
-    };
-
-    vkCmdCopyBufferToImage(
-        oneTimeBuffer, srcBuffer, dstImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &imageCopyOp
-    );
+/*
+One time commands go into the open upload batch. Without one they get a batch of their own
+which endAndSubmitOneTimeCommands submits and waits on, like before batches existed (e.g. swapchain recreation).
+*/
+VkCommandBuffer HelloTriangleApplication::beginOneTimeCommands(const char* profilerScope){
+    if (uploadBatchBuffer == VK_NULL_HANDLE){
+        beginUploadBatch();
+        uploadBatchImplicit = true;
+    }
+    pendingOneTimeScope = gpuProfiler.beginOneTimeScope(uploadBatchBuffer, profilerScope);
+    return uploadBatchBuffer;
+}
 
-    endAndSubmitOneTimeCommands(oneTimeBuffer);
+void HelloTriangleApplication::endAndSubmitOneTimeCommands(VkCommandBuffer buffer){
+    gpuProfiler.endOneTimeScope(buffer, pendingOneTimeScope);
+    pendingOneTimeScope = UINT32_MAX;
+    if (uploadBatchImplicit){
+        uploadBatchImplicit = false;
+        waitForUploads(submitUploadBatch());
+    }
 }
 
-VkCommandBuffer HelloTriangleApplication::beginOneTimeCommands(){
-    VkCommandBufferAllocateInfo tempBufferCreationInfo{};
-    tempBufferCreationInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-    tempBufferCreationInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-    tempBufferCreationInfo.commandPool = commandPool;
-    tempBufferCreationInfo.commandBufferCount = 1;
+static VkCommandBuffer allocateAndBeginOneTimeBuffer(VkDevice device, VkCommandPool pool){
+    VkCommandBufferAllocateInfo batchBufferCreationInfo{};
+    batchBufferCreationInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    batchBufferCreationInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    batchBufferCreationInfo.commandPool = pool;
+    batchBufferCreationInfo.commandBufferCount = 1;
 
-    VkCommandBuffer tempBuffer;
-    vkAllocateCommandBuffers(logiDevice, &tempBufferCreationInfo, &tempBuffer);
+    VkCommandBuffer buffer;
+    if (vkAllocateCommandBuffers(device, &batchBufferCreationInfo, &buffer) != VK_SUCCESS){
+        throw std::runtime_error("failed to allocate upload batch command buffer");
+    }
 
     /*----- Record the buffer -----*/
     VkCommandBufferBeginInfo beginInfo{};
     beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
     beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
 
-    vkBeginCommandBuffer(tempBuffer, &beginInfo);
+    vkBeginCommandBuffer(buffer, &beginInfo);
+    return buffer;
+}
 
-    return tempBuffer;
+void HelloTriangleApplication::beginUploadBatch(){
+    if (uploadBatchBuffer != VK_NULL_HANDLE){
+        throw std::runtime_error("an upload batch is already open");
+    }
+    uploadBatchBuffer = allocateAndBeginOneTimeBuffer(logiDevice, commandPool);
 }
 
-void HelloTriangleApplication::endAndSubmitOneTimeCommands(VkCommandBuffer buffer){
-    vkEndCommandBuffer(buffer);
+// Command buffer the staging copies of the open batch go to, the batch graphics buffer itself without a transfer queue.
+VkCommandBuffer HelloTriangleApplication::uploadBatchTransferCommands(){
+    if (uploadBatchBuffer == VK_NULL_HANDLE){
+        throw std::runtime_error("no upload batch open");
+    }
+    if (!dedicatedTransferQueue){
+        return uploadBatchBuffer;
+    }
+    if (uploadBatchTransferBuffer == VK_NULL_HANDLE){
+        uploadBatchTransferBuffer = allocateAndBeginOneTimeBuffer(logiDevice, transferCommandPool);
+    }
+    return uploadBatchTransferBuffer;
+}
+
+/*
+Submits the open batch without waiting for it. Work submitted later on the graphics queue (frames, other batches)
+is ordered after it by the barriers recorded with the uploads, so the CPU only needs to wait on the ticket
+before touching what the batch wrote or freeing what it reads.
+With a transfer queue the copies are submitted there first and the graphics half waits on them with a semaphore,
+so the fence of the graphics half covers both.
+*/
+HelloTriangleApplication::UploadTicket HelloTriangleApplication::submitUploadBatch(){
+    HELIUM_PROFILE_FUNCTION();
+    if (uploadBatchBuffer == VK_NULL_HANDLE){
+        throw std::runtime_error("no upload batch to submit");
+    }
+    VkCommandBuffer buffer = uploadBatchBuffer;
+    VkCommandBuffer transferBuffer = uploadBatchTransferBuffer;
+    uploadBatchBuffer = VK_NULL_HANDLE;
+    uploadBatchTransferBuffer = VK_NULL_HANDLE;
+
+    VkSemaphore transferDone = VK_NULL_HANDLE;
+    VkPipelineStageFlags transferDoneStage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT; // Same as the source stage of the acquire barriers
+    if (transferBuffer != VK_NULL_HANDLE){
+        if (vkEndCommandBuffer(transferBuffer) != VK_SUCCESS){
+            throw std::runtime_error("failed to record upload batch transfers");
+        }
+        if (freeUploadBatchSemaphores.empty()){
+            VkSemaphoreCreateInfo semaphoreCreateInfo{};
+            semaphoreCreateInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+            VkSemaphore created;
+            if (vkCreateSemaphore(logiDevice, &semaphoreCreateInfo, nullptr, &created) != VK_SUCCESS){
+                throw std::runtime_error("failed to create upload batch semaphore");
+            }
+            uploadBatchSemaphores.push_back(created);
+            freeUploadBatchSemaphores.push_back(created);
+        }
+        transferDone = freeUploadBatchSemaphores.back();
+        freeUploadBatchSemaphores.pop_back();
+
+        VkSubmitInfo transferSubmitInfo{};
+        transferSubmitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        transferSubmitInfo.commandBufferCount = 1;
+        transferSubmitInfo.pCommandBuffers = &transferBuffer;
+        transferSubmitInfo.signalSemaphoreCount = 1;
+        transferSubmitInfo.pSignalSemaphores = &transferDone;
+        if (vkQueueSubmit(transferCommandQueue, 1, &transferSubmitInfo, VK_NULL_HANDLE) != VK_SUCCESS){
+            throw std::runtime_error("failed to submit upload batch transfers");
+        }
+    }
+
+    if (vkEndCommandBuffer(buffer) != VK_SUCCESS){
+        throw std::runtime_error("failed to record upload batch");
+    }
 
     VkSubmitInfo submitInfo{};
     submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
     submitInfo.commandBufferCount = 1;
     submitInfo.pCommandBuffers = &buffer;
+    submitInfo.waitSemaphoreCount = transferDone != VK_NULL_HANDLE ? 1 : 0;
+    submitInfo.pWaitSemaphores = &transferDone;
+    submitInfo.pWaitDstStageMask = &transferDoneStage;
+
+    // The fence retires whatever staging memory was recorded into this batch.
+    VkFence fence = stagingRing.acquireFence();
+    if (vkQueueSubmit(graphicsCommandQueue, 1, &submitInfo, fence) != VK_SUCCESS){
+        throw std::runtime_error("failed to submit upload batch");
+    }
+    UploadTicket ticket = ++lastSubmittedUploadTicket;
+    std::vector<std::function<void()>> releases = std::move(uploadBatchReleases);
+    uploadBatchReleases.clear();
+    uploadScheduler.submitted(fence, [this, ticket, buffer, transferBuffer, transferDone, releases](){
+        vkFreeCommandBuffers(logiDevice, commandPool, 1, &buffer);
+        for (const std::function<void()>& release : releases){
+            release();
+        }
+        if (transferBuffer != VK_NULL_HANDLE){
+            vkFreeCommandBuffers(logiDevice, transferCommandPool, 1, &transferBuffer);
+            freeUploadBatchSemaphores.push_back(transferDone);
+        }
+        completedUploadTicket = std::max(completedUploadTicket, ticket);
+        // One time scopes share one query slice, only read it back once every command buffer writing to it completed.
+        if (completedUploadTicket == lastSubmittedUploadTicket && uploadBatchBuffer == VK_NULL_HANDLE){
+            gpuProfiler.collectOneTimeScopes();
+        }
+    });
+    return ticket;
+}
 
-    vkQueueSubmit(graphicsCommandQueue, 1, &submitInfo, VK_NULL_HANDLE);
-    // Wait for queue to be empty before continuing. Makes sure the full buffer is copied.
-    vkQueueWaitIdle(graphicsCommandQueue);
-
-    vkFreeCommandBuffers(logiDevice, commandPool, 1, &buffer);
+void HelloTriangleApplication::waitForUploads(UploadTicket ticket){
+    HELIUM_PROFILE_FUNCTION();
+    stagingRing.reclaim();
+    while (completedUploadTicket < ticket){
+        if (!stagingRing.waitOldest()){
+            throw std::runtime_error("waiting on an upload ticket that was never submitted");
+        }
+    }
 }
 
+bool HelloTriangleApplication::uploadsComplete(UploadTicket ticket){
+    stagingRing.reclaim();
+    return completedUploadTicket >= ticket;
+}
 
-// Copies from src to dst a {size} amount of bytes. It uses the graphics command queue and waits for it to be idle.
-// Not the best perf. wise.
-void HelloTriangleApplication::bufferCopy(VkBuffer src, VkBuffer dst, VkDeviceSize size){
-    VkCommandBuffer oneTimeCommandBuffer = beginOneTimeCommands();
-    /* Describes the region to copy by it's start index on both buffers and the amount of bytes */
-    VkBufferCopy copyOpDesc{};
-    copyOpDesc.srcOffset = 0;
-    copyOpDesc.dstOffset = 0;
-    copyOpDesc.size = size;
 
-    vkCmdCopyBuffer(oneTimeCommandBuffer, src, dst, 1, &copyOpDesc);
+/*
+Picks the memory type for a resource among the ones in typeFilter: every required flag must be there, then the best score wins.
+Each preferred flag is worth more than any penalty. Host access nobody asked for costs a little, because host visible device memory
+is a scarce BAR window on discrete GPUs without ReBAR. The AMD coherent/uncached types cost more, they are slow for everything else.
+Ties go to the biggest heap.
+*/
+uint32_t HelloTriangleApplication::chooseMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags requiredFlags, VkMemoryPropertyFlags preferredFlags){
+    VkPhysicalDeviceMemoryProperties memProps;
+    vkGetPhysicalDeviceMemoryProperties(physGraphicDevice, &memProps);
 
-    endAndSubmitOneTimeCommands(oneTimeCommandBuffer);
+    const VkMemoryPropertyFlags onlyIfRequired = VK_MEMORY_PROPERTY_PROTECTED_BIT | VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT;
+    const VkMemoryPropertyFlags hostAccess = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT | VK_MEMORY_PROPERTY_HOST_CACHED_BIT;
+    const VkMemoryPropertyFlags amdSpecific = VK_MEMORY_PROPERTY_DEVICE_COHERENT_BIT_AMD | VK_MEMORY_PROPERTY_DEVICE_UNCACHED_BIT_AMD;
 
+    std::optional<uint32_t> best;
+    int bestScore = 0;
+    VkDeviceSize bestHeapSize = 0;
+    for (uint32_t i = 0 ; i < memProps.memoryTypeCount; i++){
+        VkMemoryPropertyFlags flags = memProps.memoryTypes[i].propertyFlags;
+        if ((typeFilter & (1u << i)) == 0 || (flags & requiredFlags) != requiredFlags){
+            continue;
+        }
+        VkMemoryPropertyFlags unrequested = flags & ~(requiredFlags | preferredFlags);
+        if ((unrequested & onlyIfRequired) != 0){
+            continue;
+        }
+        int score = 8 * std::popcount(flags & preferredFlags);
+        score -= std::popcount(unrequested & hostAccess);
+        score -= (unrequested & amdSpecific) != 0 ? 6 : 0;
+        VkDeviceSize heapSize = memProps.memoryHeaps[memProps.memoryTypes[i].heapIndex].size;
+        if (!best.has_value() || score > bestScore || (score == bestScore && heapSize > bestHeapSize)){
+            best = i;
+            bestScore = score;
+            bestHeapSize = heapSize;
+        }
+    }
+    if (!best.has_value()){
+        throw std::runtime_error("cannot adapt memory to underlying hardware");
+    }
+    return best.value();
 }
 
-uint32_t HelloTriangleApplication::getFirstUsableMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags requiredPropertyFlags){
+/*
+Decides whether vertex and index data can skip the staging ring. That needs a DEVICE_LOCAL | HOST_VISIBLE | HOST_COHERENT type
+whose heap is about as big as the device local memory: integrated GPUs, lavapipe and ReBAR. The 256MiB BAR window of discrete GPUs
+without ReBAR does not count, it is too small to hold meshes and would only push them out of VRAM.
+*/
+void HelloTriangleApplication::selectMemoryPath(){
     VkPhysicalDeviceMemoryProperties memProps;
     vkGetPhysicalDeviceMemoryProperties(physGraphicDevice, &memProps);
 
-    for (uint32_t i = 0 ; i < memProps.memoryTypeCount; i++){
-        if (typeFilter & (1 << i) && (memProps.memoryTypes[i].propertyFlags & requiredPropertyFlags) == requiredPropertyFlags){
-            return i;
+    VkDeviceSize largestDeviceLocalHeap = 0;
+    for (uint32_t i = 0; i < memProps.memoryHeapCount; i++){
+        if ((memProps.memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) != 0){
+            largestDeviceLocalHeap = std::max(largestDeviceLocalHeap, memProps.memoryHeaps[i].size);
         }
     }
 
-    throw std::runtime_error("cannot adapt memory to underlying hardware");
+    const VkMemoryPropertyFlags unifiedFlags =
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+    VkDeviceSize unifiedHeap = 0;
+    for (uint32_t i = 0; i < memProps.memoryTypeCount; i++){
+        if ((memProps.memoryTypes[i].propertyFlags & unifiedFlags) == unifiedFlags){
+            unifiedHeap = std::max(unifiedHeap, memProps.memoryHeaps[memProps.memoryTypes[i].heapIndex].size);
+        }
+    }
+    unifiedMemory = unifiedHeap > 0 && unifiedHeap >= largestDeviceLocalHeap / 2;
+    #ifdef HELIUM_DISABLE_UNIFIED_MEMORY
+    unifiedMemory = false;
+    #endif
+
+    if (unifiedMemory){
+        std::cout << "memory path: unified, vertex/index/uniform data written in place ("
+                  << unifiedHeap / (1024 * 1024) << "MiB host visible device local heap)" << std::endl;
+    }else{
+        std::cout << "memory path: staged, vertex/index data copied through the staging ring (host visible device local heap: "
+                  << unifiedHeap / (1024 * 1024) << "MiB of " << largestDeviceLocalHeap / (1024 * 1024) << "MiB)" << std::endl;
+    }
 }
 
 void HelloTriangleApplication::createFramebuffers(){
@@ -1427,6 +1961,13 @@ void HelloTriangleApplication::createCommandPool(){
     if(vkCreateCommandPool(logiDevice, &poolCreationInfo, nullptr, &commandPool) != VK_SUCCESS){
         throw std::runtime_error("failed to create graphics command pool");
     }
+    if (dedicatedTransferQueue){
+        // Command buffers can only be submitted to queues of the family of their pool.
+        poolCreationInfo.queueFamilyIndex = qfi.transferFamilyIndex.value();
+        if(vkCreateCommandPool(logiDevice, &poolCreationInfo, nullptr, &transferCommandPool) != VK_SUCCESS){
+            throw std::runtime_error("failed to create transfer command pool");
+        }
+    }
 }
 
 void HelloTriangleApplication::createSyncObjects(){
@@ -1452,6 +1993,15 @@ void HelloTriangleApplication::createSyncObjects(){
             throw std::runtime_error("failed to create fence for signaling the frame is in flight");
         }
     }
+    if (!dedicatedTransferQueue){
+        return;
+    }
+    uploadsDoneSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
+    for (int i = 0 ; i < MAX_FRAMES_IN_FLIGHT; i++){
+        if(vkCreateSemaphore(logiDevice, &semaphoreCreateInfo, nullptr, &uploadsDoneSemaphores[i]) != VK_SUCCESS){
+            throw std::runtime_error("failed to create semaphore for signaling frame uploads are done");
+        }
+    }
 }
 
 void HelloTriangleApplication::createCommandBuffers(){
@@ -1471,4 +2021,13 @@ void HelloTriangleApplication::createCommandBuffers(){
     if (allocationResult!= VK_SUCCESS){
         throw std::runtime_error("failed to allocate graphics command buffer");
     }
+    if (!dedicatedTransferQueue){
+        return;
+    }
+    transferCBuffers.resize(MAX_FRAMES_IN_FLIGHT);
+    graphicsCBufferAllocationInfo.commandPool = transferCommandPool;
+    graphicsCBufferAllocationInfo.commandBufferCount = (uint32_t) transferCBuffers.size();
+    if (vkAllocateCommandBuffers(logiDevice, &graphicsCBufferAllocationInfo, transferCBuffers.data()) != VK_SUCCESS){
+        throw std::runtime_error("failed to allocate transfer command buffer");
+    }
 }
\ No newline at end of file
@@ -0,0 +1,80 @@
+#version 450
+
+// One workgroup per meshlet: the first invocation tests it, then the whole group copies its indices if it is visible.
+layout(local_size_x = 64) in;
+
+// Meshlet in meshlet.h
+struct Meshlet{
+    vec4 sphere; // xyz center, w radius
+    vec4 cone; // xyz axis, w cutoff
+    uint firstIndex;
+    uint indexCount;
+    uint padding0;
+    uint padding1;
+};
+
+layout(std430, set = 0, binding = 0) readonly buffer Meshlets{
+    Meshlet meshlets[];
+};
+
+// The index buffer, two 16 bit indices per word when sixteenBitIndices is set.
+layout(std430, set = 0, binding = 1) readonly buffer SourceIndices{
+    uint sourceIndices[];
+};
+
+layout(std430, set = 0, binding = 2) writeonly buffer VisibleIndices{
+    uint visibleIndices[];
+};
+
+// VkDrawIndexedIndirectCommand, reset to an empty draw at the start of the submesh region before the dispatches.
+struct DrawCommand{
+    uint indexCount;
+    uint instanceCount;
+    uint firstIndex;
+    int vertexOffset;
+    uint firstInstance;
+};
+
+layout(std430, set = 0, binding = 3) buffer DrawCommands{
+    DrawCommand draws[];
+};
+
+// CullingConstants in main.h, everything in model space.
+layout(push_constant) uniform CullingConstants{
+    vec4 planes[6];
+    vec4 cameraPosition;
+    uint firstMeshlet; // One workgroup per meshlet of the selected LOD of the submesh
+    uint sixteenBitIndices;
+    uint drawIndex; // Submesh
+} culling;
+
+shared bool visible;
+shared uint outputOffset;
+
+void main(){
+    Meshlet meshlet = meshlets[culling.firstMeshlet + gl_WorkGroupID.x];
+    if (gl_LocalInvocationIndex == 0){
+        bool insideFrustum = true;
+        for (int i = 0; i < 6; i++){
+            insideFrustum = insideFrustum && dot(culling.planes[i].xyz, meshlet.sphere.xyz) + culling.planes[i].w >= -meshlet.sphere.w;
+        }
+        // Back facing from anywhere in the sphere, see meshlet.h.
+        vec3 toCenter = meshlet.sphere.xyz - culling.cameraPosition.xyz;
+        bool backFacing = dot(toCenter, meshlet.cone.xyz) >= meshlet.cone.w * length(toCenter) + meshlet.sphere.w;
+        visible = insideFrustum && !backFacing;
+        if (visible){
+            outputOffset = draws[culling.drawIndex].firstIndex + atomicAdd(draws[culling.drawIndex].indexCount, meshlet.indexCount);
+        }
+    }
+    barrier();
+    if (!visible){
+        return;
+    }
+    for (uint i = gl_LocalInvocationIndex; i < meshlet.indexCount; i += gl_WorkGroupSize.x){
+        uint source = meshlet.firstIndex + i;
+        uint index = culling.sixteenBitIndices != 0
+            ? (sourceIndices[source >> 1] >> ((source & 1) * 16)) & 0xFFFF
+            : sourceIndices[source];
+        visibleIndices[outputOffset + i] = index;
+    }
+}
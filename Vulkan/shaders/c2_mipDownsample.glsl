@@ -0,0 +1,151 @@
+#version 450
+
+/*
+Single pass mip generation, in the style of AMD FidelityFX SPD.
+Every workgroup reduces a 64x64 tile of level 0 into the (up to) 6 levels below it, through shared memory.
+The last workgroup to finish (global atomic counter) reduces level 6, at most 64x64 then, into the remaining ones.
+Levels are relative to the dispatch: binding i is level base + i of the image, chains longer than 13 levels take several.
+Each texel is the 2x2 box of the level above it. Coordinates past the edge of a level are clamped, like a blit of odd sizes.
+*/
+layout(local_size_x = 256) in;
+
+// Every level as an rgba8 storage view, bindings past the end of the chain repeat the last level and are never touched.
+// coherent: the last workgroup reads what the others wrote to level 6.
+layout(set = 0, binding = 0, rgba8) uniform coherent image2D levels[13];
+
+// Reset to 0 by the last workgroup, ready for the next dispatch.
+layout(std430, set = 0, binding = 1) coherent buffer Counter{
+    uint finishedGroups;
+};
+
+// DownsampleConstants in main.h
+layout(push_constant) uniform DownsampleConstants{
+    ivec2 baseSize; // Of level 0
+    uint levelCount; // Written by this dispatch below level 0, at most 12
+    uint srgb; // Texels are sRGB encoded, filtering happens in linear space
+    uint workGroupCount;
+} constants;
+
+shared vec4 tileA[32 * 32];
+shared vec4 tileB[16 * 16];
+shared bool lastGroup;
+
+// Image arrays are only indexed with constants, dynamic indexing of storage images is an optional feature.
+#define LOAD_CASE(i) case i: return imageLoad(levels[i], p);
+#define STORE_CASE(i) case i: imageStore(levels[i], p, value); break;
+
+vec4 loadLevel(uint level, ivec2 p){
+    switch (level){
+        LOAD_CASE(0) LOAD_CASE(1) LOAD_CASE(2) LOAD_CASE(3) LOAD_CASE(4) LOAD_CASE(5) LOAD_CASE(6)
+        LOAD_CASE(7) LOAD_CASE(8) LOAD_CASE(9) LOAD_CASE(10) LOAD_CASE(11) LOAD_CASE(12)
+    }
+    return vec4(0.0);
+}
+
+void storeLevel(uint level, ivec2 p, vec4 value){
+    switch (level){
+        STORE_CASE(0) STORE_CASE(1) STORE_CASE(2) STORE_CASE(3) STORE_CASE(4) STORE_CASE(5) STORE_CASE(6)
+        STORE_CASE(7) STORE_CASE(8) STORE_CASE(9) STORE_CASE(10) STORE_CASE(11) STORE_CASE(12)
+    }
+}
+
+ivec2 levelSize(uint level){
+    return max(ivec2(1), constants.baseSize >> int(level));
+}
+
+vec4 toLinear(vec4 c){
+    if (constants.srgb == 0){
+        return c;
+    }
+    vec3 low = c.rgb / 12.92;
+    vec3 high = pow((c.rgb + 0.055) / 1.055, vec3(2.4));
+    return vec4(mix(high, low, lessThanEqual(c.rgb, vec3(0.04045))), c.a);
+}
+
+vec4 fromLinear(vec4 c){
+    if (constants.srgb == 0){
+        return c;
+    }
+    vec3 low = c.rgb * 12.92;
+    vec3 high = 1.055 * pow(c.rgb, vec3(1.0 / 2.4)) - 0.055;
+    return vec4(mix(high, low, lessThanEqual(c.rgb, vec3(0.0031308))), c.a);
+}
+
+vec4 loadLinear(uint level, ivec2 p){
+    return toLinear(loadLevel(level, min(p, levelSize(level) - 1)));
+}
+
+vec4 readTile(bool fromA, uint index){
+    return fromA ? tileA[index] : tileB[index];
+}
+
+/*
+Reduces the 64x64 texels of sourceLevel starting at tile * 64 into levels sourceLevel + 1 ... sourceLevel + count.
+The first level is read from the image, four texels per invocation, every following one from the previous one in shared memory.
+Shared values are linear, only stored levels are encoded.
+*/
+void reduceTile(ivec2 tile, uint sourceLevel, uint count){
+    uint t = gl_LocalInvocationIndex;
+    ivec2 size = levelSize(sourceLevel + 1);
+    for (uint i = 0; i < 4; i++){
+        uint o = t + i * 256;
+        ivec2 p = tile * 32 + ivec2(o % 32, o / 32);
+        vec4 value = 0.25 * (loadLinear(sourceLevel, p * 2) + loadLinear(sourceLevel, p * 2 + ivec2(1, 0))
+                           + loadLinear(sourceLevel, p * 2 + ivec2(0, 1)) + loadLinear(sourceLevel, p * 2 + ivec2(1, 1)));
+        tileA[o] = value;
+        if (all(lessThan(p, size))){
+            storeLevel(sourceLevel + 1, p, fromLinear(value));
+        }
+    }
+
+    uint width = 32; // Of the tile in the previous level
+    for (uint l = 2; l <= count; l++){
+        barrier();
+        bool fromA = l % 2 == 0; // Ping-pong between the two tiles
+        ivec2 previousSize = levelSize(sourceLevel + l - 1);
+        ivec2 previousOrigin = tile * int(width);
+        width /= 2;
+        if (t < width * width){
+            ivec2 local = ivec2(t % width, t / width);
+            vec4 value = vec4(0.0);
+            for (int d = 0; d < 4; d++){
+                // Clamped in level coordinates like the image loads. Tiles past the edge of small levels read garbage
+                // they never store, clamping to the tile keeps it in bounds.
+                ivec2 s = min(previousOrigin + local * 2 + ivec2(d % 2, d / 2), previousSize - 1) - previousOrigin;
+                s = clamp(s, ivec2(0), ivec2(int(width) * 2 - 1));
+                value += 0.25 * readTile(fromA, uint(s.y) * width * 2 + uint(s.x));
+            }
+            if (fromA){
+                tileB[t] = value;
+            }else{
+                tileA[t] = value;
+            }
+            ivec2 p = tile * int(width) + local;
+            if (all(lessThan(p, levelSize(sourceLevel + l)))){
+                storeLevel(sourceLevel + l, p, fromLinear(value));
+            }
+        }
+    }
+}
+
+void main(){
+    reduceTile(ivec2(gl_WorkGroupID.xy), 0, min(constants.levelCount, 6u));
+    if (constants.levelCount <= 6){
+        return;
+    }
+
+    // The texel of level 6 written above has to be visible before this group counts as finished.
+    memoryBarrierImage();
+    barrier();
+    if (gl_LocalInvocationIndex == 0){
+        lastGroup = atomicAdd(finishedGroups, 1) == constants.workGroupCount - 1;
+    }
+    barrier();
+    if (!lastGroup){
+        return;
+    }
+    if (gl_LocalInvocationIndex == 0){
+        finishedGroups = 0;
+    }
+    reduceTile(ivec2(0), 6, constants.levelCount - 6);
+}
@@ -0,0 +1,28 @@
+#version 450
+#extension GL_EXT_nonuniform_qualifier : require // Runtime sized texture array
+
+// IN
+layout(location = 0) in vec3 inColor;
+layout(location = 1) in vec2 uvMainTex;
+
+// OUT
+layout(location = 0) out vec4 outColor;
+
+
+// Bindless texture table (bindless.cpp), every texture in one array, partially bound.
+layout(set = 1, binding = 0) uniform texture2D textures[];
+layout(set = 1, binding = 1) uniform sampler textureSampler;
+
+// BindlessConstants in main.h, the same for a whole draw: the index is dynamically uniform.
+layout(push_constant) uniform BindlessConstants{
+    uint textureIndex;
+} draw;
+
+
+#define GAMMA_FACTOR 0.4545454545454 // 1/2.2
+
+void main() {
+    vec4 c = texture(sampler2D(textures[draw.textureIndex], textureSampler), uvMainTex);
+    c = pow(c, vec4(GAMMA_FACTOR,GAMMA_FACTOR,GAMMA_FACTOR,GAMMA_FACTOR));
+    outColor = c;
+}
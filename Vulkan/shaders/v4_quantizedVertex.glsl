@@ -0,0 +1,25 @@
+#version 450
+
+// QuantizedVert (main.h): xyz is the position in [0, 65535] over the mesh bounds, the model matrix maps it back.
+// w is the octahedral normal, x in the low byte and y in the high byte as snorm8, unused until something is lit.
+layout(location = 0) in uvec4 inPosition;
+// In [0,1] over the texture coordinate bounds of the mesh, mvp.uvTransform maps it back.
+layout(location = 1) in vec2 uv;
+
+layout(location = 0) out vec3 outColor;
+layout(location = 1) out vec2 uvMainTex;
+
+
+layout(set = 0, binding = 0) uniform UniformBufferObject {
+    mat4 model;
+    mat4 view;
+    mat4 projection;
+    vec4 uvTransform; // xy scale, zw offset
+} mvp;
+
+
+void main(){
+    gl_Position = mvp.projection * mvp.view * mvp.model * vec4(vec3(inPosition.xyz), 1.0);
+    outColor = vec3(1.0);
+    uvMainTex = uv * mvp.uvTransform.xy + mvp.uvTransform.zw;
+}
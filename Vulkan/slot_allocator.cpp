@@ -0,0 +1,31 @@
+#include "slot_allocator.h"
+
+void SlotAllocator::init(uint32_t slotCount){
+    capacity = slotCount;
+    nextUnused = 0;
+    freeSlots.clear();
+    pendingSlots.clear();
+}
+
+uint32_t SlotAllocator::allocate(){
+    if (!freeSlots.empty()){
+        uint32_t slot = freeSlots.back();
+        freeSlots.pop_back();
+        return slot;
+    }
+    if (nextUnused < capacity){
+        return nextUnused++;
+    }
+    return INVALID_SLOT;
+}
+
+void SlotAllocator::free(uint32_t slot, uint32_t reusableFrame){
+    pendingSlots.emplace_back(reusableFrame, slot);
+}
+
+void SlotAllocator::reclaim(uint32_t frame){
+    while (!pendingSlots.empty() && pendingSlots.front().first <= frame){
+        freeSlots.push_back(pendingSlots.front().second);
+        pendingSlots.pop_front();
+    }
+}
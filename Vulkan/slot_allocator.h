@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <utility>
+#include <vector>
+
+/*
+Free list of the slots of a fixed size table (e.g. the bindless texture array).
+
+Slots are handed out lowest first until the table has been walked once, then from the free list, most recently freed first.
+Freed slots may still be read by work in flight: free() takes the frame from which nothing can use the slot anymore, and
+reclaim() puts the slots whose frame has come back in the free list. Frames must not go backwards between calls.
+*/
+class SlotAllocator{
+public:
+    static constexpr uint32_t INVALID_SLOT = UINT32_MAX;
+
+    void init(uint32_t slotCount);
+
+    // INVALID_SLOT when every slot is taken or waiting for its frame.
+    uint32_t allocate();
+    void free(uint32_t slot, uint32_t reusableFrame);
+    void reclaim(uint32_t frame);
+
+    uint32_t getCapacity() const { return capacity; }
+    // Slots handed out and not freed, or freed and not reclaimed yet.
+    uint32_t getUsed() const { return nextUnused - static_cast<uint32_t>(freeSlots.size()); }
+
+private:
+    uint32_t capacity = 0;
+    uint32_t nextUnused = 0; // Slots from here on were never handed out
+    std::vector<uint32_t> freeSlots;
+    std::deque<std::pair<uint32_t, uint32_t>> pendingSlots; // (reusable frame, slot), in free order
+};
@@ -0,0 +1,158 @@
+#include "staging_ring.h"
+#include <algorithm>
+#include <stdexcept>
+
+static VkDeviceSize alignUp(VkDeviceSize value, VkDeviceSize alignment){
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+void StagingRing::init(VkDevice logicalDevice, VkBuffer stagingBuffer, void* mappedMemory, VkDeviceSize bufferCapacity){
+    device = logicalDevice;
+    buffer = stagingBuffer;
+    mapped = static_cast<uint8_t*>(mappedMemory);
+    capacity = bufferCapacity;
+    head = 0;
+    tail = 0;
+    if (mapped == nullptr){
+        throw std::runtime_error("staging ring memory must be host visible and mapped");
+    }
+}
+
+void StagingRing::destroy(){
+    for (VkFence f : ownedFences){
+        vkDestroyFence(device, f, nullptr);
+    }
+    ownedFences.clear();
+    freeFences.clear();
+    inFlight.clear();
+    openAllocations = 0;
+    outstandingAllocations = 0;
+}
+
+bool StagingRing::tryAllocate(VkDeviceSize size, VkDeviceSize alignment, Region& region){
+    if (size == 0 || size > capacity){
+        return false;
+    }
+    alignment = std::max<VkDeviceSize>(alignment, 1);
+    if (isEmpty()){
+        head = 0;
+        tail = 0;
+    }
+
+    VkDeviceSize offset;
+    if (isEmpty() || head > tail){
+        // Used range is [tail, head), free space is [head, capacity) and then [0, tail) after wrapping around.
+        offset = alignUp(head, alignment);
+        if (offset + size > capacity){
+            // The end of the buffer is skipped, it becomes free again when tail passes it.
+            offset = 0;
+            if (size > tail){
+                return false;
+            }
+        }
+    }else{
+        // Wrapped (or full when head == tail): free space is [head, tail).
+        offset = alignUp(head, alignment);
+        if (offset + size > tail){
+            return false;
+        }
+    }
+
+    head = offset + size;
+    openAllocations++;
+    outstandingAllocations++;
+    region.buffer = buffer;
+    region.offset = offset;
+    region.size = size;
+    region.mapped = mapped + offset;
+    return true;
+}
+
+StagingRing::Region StagingRing::allocate(VkDeviceSize size, VkDeviceSize alignment){
+    if (size > capacity){
+        throw std::runtime_error("staging ring: upload bigger than the ring, split it");
+    }
+    Region region;
+    reclaim();
+    while (!tryAllocate(size, alignment, region)){
+        // Oldest submission first, it frees the tail.
+        if (!waitOldest()){
+            throw std::runtime_error("staging ring: full of allocations that were never submitted");
+        }
+    }
+    return region;
+}
+
+VkFence StagingRing::acquireFence(){
+    if (!freeFences.empty()){
+        VkFence f = freeFences.back();
+        freeFences.pop_back();
+        return f;
+    }
+    VkFenceCreateInfo fenceCreationInfo{};
+    fenceCreationInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+    VkFence f;
+    if (vkCreateFence(device, &fenceCreationInfo, nullptr, &f) != VK_SUCCESS){
+        throw std::runtime_error("staging ring: failed to create fence");
+    }
+    ownedFences.push_back(f);
+    return f;
+}
+
+void StagingRing::closeSubmission(VkFence fence, std::function<void()> onRetired){
+    inFlight.push_back({fence, head, openAllocations, std::move(onRetired)});
+    openAllocations = 0;
+}
+
+bool StagingRing::isOwned(VkFence fence) const{
+    return std::find(ownedFences.begin(), ownedFences.end(), fence) != ownedFences.end();
+}
+
+void StagingRing::retireUpTo(size_t count){
+    for (size_t i = 0; i < count; i++){
+        Submission s = std::move(inFlight.front());
+        inFlight.pop_front();
+        if (s.allocations > 0){
+            tail = s.end;
+            outstandingAllocations -= s.allocations;
+        }
+        if (isOwned(s.fence)){
+            vkResetFences(device, 1, &s.fence);
+            freeFences.push_back(s.fence);
+        }
+        if (s.onRetired){
+            s.onRetired();
+        }
+    }
+}
+
+void StagingRing::reclaim(){
+    // Find the most recent signaled submission, everything submitted before it is complete as well.
+    size_t retired = 0;
+    for (size_t i = inFlight.size(); i > 0; i--){
+        if (vkGetFenceStatus(device, inFlight[i - 1].fence) == VK_SUCCESS){
+            retired = i;
+            break;
+        }
+    }
+    retireUpTo(retired);
+}
+
+bool StagingRing::waitOldest(){
+    if (inFlight.empty()){
+        return false;
+    }
+    VkFence oldest = inFlight.front().fence;
+    vkWaitForFences(device, 1, &oldest, VK_TRUE, UINT64_MAX);
+    reclaim();
+    return true;
+}
+
+void StagingRing::waitIdle(){
+    if (inFlight.empty()){
+        return;
+    }
+    VkFence newest = inFlight.back().fence;
+    vkWaitForFences(device, 1, &newest, VK_TRUE, UINT64_MAX);
+    retireUpTo(inFlight.size());
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include "heliumutils.h"
+#include <deque>
+#include <functional>
+#include <vector>
+
+/*
+Persistently mapped ring of staging memory shared by every host to device upload.
+
+Allocations are handed out in FIFO order from one HOST_VISIBLE buffer. Everything allocated between two closeSubmission()
+calls belongs to the same submission and is reclaimed together once the fence passed to closeSubmission is seen signaled.
+Any fence works, including ones owned by someone else (e.g. the frame fences): a signaled fence means every submission
+made before it on the queue has completed, so the ring never needs to reset foreign fences, at worst it reclaims late.
+
+The ring does not own the buffer memory, only the fences it hands out with acquireFence().
+*/
+class StagingRing{
+public:
+    static constexpr VkDeviceSize DEFAULT_CAPACITY = 32ull * 1024 * 1024;
+
+    struct Region{
+        VkBuffer buffer = VK_NULL_HANDLE;
+        VkDeviceSize offset = 0; // Offset in buffer, use as srcOffset/bufferOffset of the copy
+        VkDeviceSize size = 0;
+        void* mapped = nullptr;
+    };
+
+    void init(VkDevice device, VkBuffer buffer, void* mapped, VkDeviceSize capacity);
+    // The device must be idle.
+    void destroy();
+
+    VkDeviceSize getCapacity() const { return capacity; }
+    // Biggest single request that can always be satisfied once the ring drains.
+    VkDeviceSize getMaxAllocation() const { return capacity; }
+
+    // Non blocking, false if there is no room until some submission retires.
+    bool tryAllocate(VkDeviceSize size, VkDeviceSize alignment, Region& region);
+    // Blocks on in flight submissions if needed. Throws if the ring is full of allocations that were never submitted.
+    Region allocate(VkDeviceSize size, VkDeviceSize alignment);
+
+    // Unsignaled fence owned by the ring, recycled when the submission it is passed to retires.
+    VkFence acquireFence();
+    // Ties every allocation made since the previous call to fence. onRetired runs from reclaim() once it is signaled.
+    void closeSubmission(VkFence fence, std::function<void()> onRetired = {});
+    // Retires every submission whose fence (or a later one) is signaled.
+    void reclaim();
+    // Blocks on the oldest closed submission and retires it. False when nothing is in flight.
+    bool waitOldest();
+    // Blocks until all closed submissions retired.
+    void waitIdle();
+
+    bool hasOpenAllocations() const { return openAllocations > 0; }
+
+private:
+    struct Submission{
+        VkFence fence;
+        VkDeviceSize end; // head when the submission was closed, tail moves here on retirement
+        uint32_t allocations; // Submissions without staging memory (e.g. layout transitions) leave the tail alone
+        std::function<void()> onRetired;
+    };
+
+    VkDevice device = VK_NULL_HANDLE;
+    VkBuffer buffer = VK_NULL_HANDLE;
+    uint8_t* mapped = nullptr;
+    VkDeviceSize capacity = 0;
+
+    VkDeviceSize head = 0; // Next free byte
+    VkDeviceSize tail = 0; // First byte still in use
+    uint32_t openAllocations = 0; // Allocations not closed into a submission yet
+    uint32_t outstandingAllocations = 0; // Open + in flight, the ring is empty when this is 0
+    std::deque<Submission> inFlight;
+
+    std::vector<VkFence> ownedFences;
+    std::vector<VkFence> freeFences;
+
+    bool isEmpty() const { return outstandingAllocations == 0; }
+    void retireUpTo(size_t count);
+    bool isOwned(VkFence fence) const;
+};
@@ -0,0 +1,192 @@
+#include "main.h"
+#include "mip_generator.h"
+
+/*
+Texture streaming. createTextureImages() allocates every level but only uploads the mip tail (levels up to STREAMING_TAIL_SIZE)
+into the load batch, so the first frame only waits for those. Each frame then:
+- moves the view of every texture that received a level down to it, the old view is destroyed once no frame can use it,
+- rewrites the texture descriptors of the frame being recorded whose view changed (its previous submission completed), or gives
+  the texture a new bindless slot (bindless.cpp),
+- requests the next levels, smallest first across every texture so they all sharpen together, keeping about one frame budget
+  queued in the upload scheduler (transfer queue when there is one).
+Levels land one at a time per texture, a texture is always sampled from a contiguous resident range. Only the levels its image
+holds are streamed, budgetTextureMemory() (texture_residency.cpp) decides which.
+Decoded textures only have their tail on the host after loading. The first time a level above it is needed, their whole chain
+is filtered from level 0 on mipChainWorker, and they are left out of the requests until it is ready. The chain is released once
+every level of the image is resident, an eviction followed by a restore builds it again.
+*/
+
+// First level of the tail uploaded while loading: the biggest one no larger than STREAMING_TAIL_SIZE, the last one at worst.
+uint32_t HelloTriangleApplication::streamingTailLevel(uint32_t width, uint32_t height, uint32_t levels){
+    uint32_t level = 0;
+    while (level + 1 < levels && std::max(width >> level, height >> level) > STREAMING_TAIL_SIZE){
+        level++;
+    }
+    return level;
+}
+
+// Cooked levels are always readable. The chain of a decoded texture is started on the first call and read once built.
+bool HelloTriangleApplication::hostLevelsReady(uint32_t texture){
+    TextureStream& stream = textureStreams[texture];
+    if (stream.cooked.isOpen()){
+        return true;
+    }
+    if (!stream.hostChain){
+        auto chain = std::make_shared<HostMipChain>();
+        stream.hostChain = chain;
+        uint32_t width = stream.width;
+        uint32_t height = stream.height;
+        uint32_t levels = textures[texture].mipmaps;
+        // Owns what it reads and writes, textureStreams may be cleared while it runs.
+        mipChainWorker.submit([chain, source = stream.hostSource, width, height, levels](){
+            chain->levels.resize(mipChainBytes(width, height, levels));
+            generateMipChain(source->data(), width, height, levels, MipFilter::KAISER, chain->levels.data(), ThreadPool::shared());
+            chain->ready.store(true, std::memory_order_release);
+        });
+        return false;
+    }
+    return stream.hostChain->ready.load(std::memory_order_acquire);
+}
+
+// Bytes of a level as uploaded from the source of the stream.
+VkDeviceSize HelloTriangleApplication::textureLevelBytes(uint32_t texture, uint32_t level) const{
+    const TextureStream& stream = textureStreams[texture];
+    uint32_t width = std::max(1u, stream.width >> level);
+    uint32_t height = std::max(1u, stream.height >> level);
+    return stream.cooked.isOpen() ? ktx2LevelBytes(stream.cooked.vkFormat(), width, height) : static_cast<VkDeviceSize>(width) * height * 4;
+}
+
+void HelloTriangleApplication::streamTextures(){
+    if (textureStreams.empty()){
+        return;
+    }
+    HELIUM_PROFILE_FUNCTION();
+    while (!retiredTextures.empty() && retiredTextures.front().frame <= frameCounter){
+        RetiredTexture& retired = retiredTextures.front();
+        vkDestroyImageView(logiDevice, retired.view, nullptr);
+        if (retired.image != VK_NULL_HANDLE){
+            vkDestroyImage(logiDevice, retired.image, nullptr);
+            deviceAllocator.free(retired.memory);
+        }
+        retiredTextures.erase(retiredTextures.begin());
+    }
+
+    bool streaming = false;
+    for (uint32_t t = 0; t < textures.size(); t++){
+        Texture& texture = textures[t];
+        TextureStream& stream = textureStreams[t];
+        if (texture.residentLevel < texture.viewLevel){
+            // Every frame in flight may still sample the old view, the last of them completes MAX_FRAMES_IN_FLIGHT frames from now.
+            retiredTextures.push_back({frameCounter + MAX_FRAMES_IN_FLIGHT, texture.view, VK_NULL_HANDLE, {}});
+            texture.view = createViewFor2DImage(
+                texture.image, static_cast<int>(texture.mipmaps - texture.residentLevel), texture.format, VK_IMAGE_ASPECT_COLOR_BIT,
+                static_cast<int>(texture.residentLevel - texture.baseLevel)
+            );
+            texture.viewLevel = texture.residentLevel;
+            #ifdef HELIUM_DISABLE_TEXTURE_EVICTION
+            // Evicted levels are streamed again from the source, without eviction it is only needed until level 0 lands.
+            if (texture.residentLevel == 0){
+                stream.hostSource.reset();
+                stream.cooked.close();
+            }
+            #endif
+        }
+        if (stream.hostChain && texture.residentLevel == texture.baseLevel){
+            // Nothing left to stream, uploads in flight hold the chain until they land.
+            stream.hostChain.reset();
+        }
+        streaming = streaming || texture.viewLevel > texture.baseLevel;
+    }
+
+    if (bindlessTextures){
+        updateBindlessTextures();
+    }
+    const size_t materialCount = bindlessTextures ? 0 : materialTextureSlots.size();
+    for (size_t m = 0; m < materialCount; m++){
+        size_t set = currentFrame * materialCount + m;
+        const Texture& texture = textures[materialTextureSlots[m]];
+        if (descriptorTextureViews[set] == texture.view){
+            continue;
+        }
+        VkDescriptorImageInfo textureInfo{};
+        textureInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+        textureInfo.imageView = texture.view;
+        textureInfo.sampler = textureSampler;
+        VkWriteDescriptorSet writeTextureOp{};
+        writeTextureOp.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        writeTextureOp.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+        writeTextureOp.dstSet = descriptorSets[set];
+        writeTextureOp.dstBinding = 1;
+        writeTextureOp.dstArrayElement = 0;
+        writeTextureOp.descriptorCount = 1;
+        writeTextureOp.pImageInfo = &textureInfo;
+        vkUpdateDescriptorSets(logiDevice, 1, &writeTextureOp, 0, nullptr);
+        descriptorTextureViews[set] = texture.view;
+    }
+
+    // Keeps about one frame of uploads queued, other uploads are not stuck behind the whole backlog.
+    while (uploadScheduler.pendingBytes() < uploadScheduler.getFrameBudget()){
+        uint32_t best = UINT32_MAX;
+        VkDeviceSize bestBytes = 0;
+        for (uint32_t t = 0; t < textures.size(); t++){
+            uint32_t level = textures[t].residentLevel;
+            if (level == textures[t].baseLevel || textureStreams[t].requestedLevel != level || !hostLevelsReady(t)){
+                continue;
+            }
+            VkDeviceSize bytes = textureLevelBytes(t, level - 1);
+            if (best == UINT32_MAX || bytes < bestBytes){
+                best = t;
+                bestBytes = bytes;
+            }
+        }
+        if (best == UINT32_MAX){
+            break;
+        }
+        Texture& texture = textures[best];
+        TextureStream& stream = textureStreams[best];
+        uint32_t level = texture.residentLevel - 1;
+        uint32_t width = std::max(1u, stream.width >> level);
+        uint32_t height = std::max(1u, stream.height >> level);
+        auto landed = [this, best, level, chain = stream.hostChain](){
+            textures[best].residentLevel = level;
+        };
+        if (stream.cooked.isOpen()){
+            uploadScheduler.enqueueCompressedImage(
+                texture.image, level - texture.baseLevel, width, height, ktx2BlockBytes(stream.cooked.vkFormat()), stream.cooked.levelData(level),
+                VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, landed
+            );
+        }else{
+            uploadScheduler.enqueueImage(
+                texture.image, level - texture.baseLevel, width, height, 4, stream.hostChain->levels.data() + mipChainBytes(stream.width, stream.height, level),
+                VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, landed
+            );
+        }
+        stream.requestedLevel = level;
+        streamedTextureBytes += bestBytes;
+    }
+
+    if (!texturesStreaming && streaming){
+        // Restored levels (texture_residency.cpp) stream again.
+        streamingStart = std::chrono::steady_clock::now();
+        streamingStartFrame = frameCounter;
+    }
+    if (texturesStreaming && !streaming){
+        double streamingMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - streamingStart).count();
+        std::cout << "textures: fully streamed in " << streamingMs << "ms, " << frameCounter - streamingStartFrame << " frames ("
+                  << streamedTextureBytes / (1024 * 1024) << "MiB streamed)" << std::endl;
+    }
+    texturesStreaming = streaming;
+}
+
+void HelloTriangleApplication::destroyTextureStreams(){
+    for (RetiredTexture& retired : retiredTextures){
+        vkDestroyImageView(logiDevice, retired.view, nullptr);
+        if (retired.image != VK_NULL_HANDLE){
+            vkDestroyImage(logiDevice, retired.image, nullptr);
+            deviceAllocator.free(retired.memory);
+        }
+    }
+    retiredTextures.clear();
+    textureMoves.clear();
+    textureStreams.clear();
+}
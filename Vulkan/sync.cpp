@@ -4,7 +4,7 @@
 void HelloTriangleApplication::destroySwapChain(){
     vkDestroyImageView(logiDevice, msaaColorView, nullptr);
     vkDestroyImage(logiDevice, msaaColorImage, nullptr);
-    vkFreeMemory(logiDevice, msaaColorMemory, nullptr);
+    deviceAllocator.free(msaaColorMemory);
     for(size_t i =0 ;  i < swapchainFramebuffers.size(); i++){
         vkDestroyFramebuffer(logiDevice, swapchainFramebuffers[i], nullptr);
     }
@@ -12,6 +12,10 @@ void HelloTriangleApplication::destroySwapChain(){
         vkDestroyImageView(logiDevice, swapChainImageViews[i], nullptr);
     }
     
+    if (headless){
+        destroyOffscreenTargets();
+        return;
+    }
     vkDestroySwapchainKHR(logiDevice, swapChain, nullptr);
 }
 
@@ -31,6 +35,10 @@ void HelloTriangleApplication::resetSwapChain(){
     createSwapChainViews();
     createMsaaColorResources();
     #ifdef HELIUM_VERTEX_BUFFERS
+    // Depth resources are not owned by destroySwapChain (cleanup frees them separately) but depend on the extent.
+    vkDestroyImageView(logiDevice, depthPassImageView, nullptr);
+    vkDestroyImage(logiDevice, depthPassImage, nullptr);
+    deviceAllocator.free(depthPassMemory);
     createDepthPassResources();
     #endif
     createFramebuffers();
@@ -43,6 +51,47 @@ void HelloTriangleApplication::framebufferResizeCallback(GLFWwindow* window, int
 }
 
 
+/*
+Records the uploads of this frame into its transfer command buffer and submits it on the transfer queue, so the copies
+run next to the frames still in flight on the graphics queue instead of in front of this one.
+Returns true if something was submitted, the frame then has to wait on uploadsDoneSemaphores[currentFrame].
+The buffer is free to reuse: the fence of the frame that last used it was waited on and that frame waited on its transfers.
+*/
+bool HelloTriangleApplication::submitFrameUploads(){
+    if (!dedicatedTransferQueue || !uploadScheduler.hasPending()){
+        return false;
+    }
+    VkCommandBuffer transferBuffer = transferCBuffers[currentFrame];
+    if (vkResetCommandBuffer(transferBuffer, 0) != VK_SUCCESS){
+        throw std::runtime_error("failed to reset transfer command buffer");
+    }
+    VkCommandBufferBeginInfo bufferBeginInfo{};
+    bufferBeginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    bufferBeginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    if (vkBeginCommandBuffer(transferBuffer, &bufferBeginInfo) != VK_SUCCESS){
+        throw std::runtime_error("failed to begin recording the transfer command buffer");
+    }
+    VkDeviceSize recorded = uploadScheduler.record(transferBuffer, uploadScheduler.getFrameBudget());
+    if (vkEndCommandBuffer(transferBuffer) != VK_SUCCESS){
+        throw std::runtime_error("failed to record transfer command buffer");
+    }
+    if (recorded == 0){
+        // Staging ring full of earlier uploads, nothing to wait on.
+        return false;
+    }
+
+    VkSubmitInfo submitInfo{};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &transferBuffer;
+    submitInfo.signalSemaphoreCount = 1;
+    submitInfo.pSignalSemaphores = &uploadsDoneSemaphores[currentFrame];
+    if (vkQueueSubmit(transferCommandQueue, 1, &submitInfo, VK_NULL_HANDLE) != VK_SUCCESS){
+        throw std::runtime_error("failed to submit uploads to the transfer queue");
+    }
+    return true;
+}
+
 void HelloTriangleApplication::recordCommandBuffer(VkCommandBuffer buffer, uint32_t swapchainImageIndex){
     VkCommandBufferBeginInfo bufferBeginInfo{};
     bufferBeginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
@@ -58,6 +107,34 @@ void HelloTriangleApplication::recordCommandBuffer(VkCommandBuffer buffer, uint3
     if (vkBeginCommandBuffer(buffer, &bufferBeginInfo) != VK_SUCCESS){
         throw std::runtime_error("failed to begin recording the command buffer");
     }
+    /*
+    GPU scopes:
+    frame       : the whole command buffer
+    culling     : meshlet culling pass (HELIUM_GPU_CULLING)
+    render_pass : clears, draws, MSAA resolve and store
+    draw        : only the draw calls, so render_pass - draw is roughly the cost of clearing and resolving.
+    */
+    gpuProfiler.beginFrame(buffer, currentFrame);
+    gpuProfiler.beginScope(buffer, "frame");
+
+    #ifdef HELIUM_VERTEX_BUFFERS
+    // Texture images replaced by budgetTextureMemory() this frame, before the draws that sample the new ones.
+    recordTextureMoves(buffer);
+    // Uploads issued after startup, capped by the frame budget so that big ones are spread over several frames instead of hitching.
+    // With a transfer queue they were submitted by submitFrameUploads() and only the ownership acquires are left for this buffer.
+    if (dedicatedTransferQueue ? uploadScheduler.hasPendingAcquires() : uploadScheduler.hasPending()){
+        gpuProfiler.beginScope(buffer, "uploads");
+        if (dedicatedTransferQueue){
+            uploadScheduler.recordAcquires(buffer);
+        }else{
+            uploadScheduler.record(buffer, uploadScheduler.getFrameBudget());
+        }
+        gpuProfiler.endScope(buffer);
+    }
+    #endif
+    #ifdef HELIUM_GPU_CULLING
+    recordCulling(buffer);
+    #endif
 
     /*-------------------------Render Pass Setup-----------------------------*/
     VkRenderPassBeginInfo renderPassBeginInfo{};
@@ -72,7 +149,9 @@ void HelloTriangleApplication::recordCommandBuffer(VkCommandBuffer buffer, uint3
     renderPassBeginInfo.clearValueCount = static_cast<uint32_t>(clearColorAndStencil.size());
     renderPassBeginInfo.pClearValues = clearColorAndStencil.data();
 
+    gpuProfiler.beginScope(buffer, "render_pass");
     vkCmdBeginRenderPass(buffer, &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
+    gpuProfiler.beginScope(buffer, "draw");
 
     /*-------------------------Graphics Pipeline Binding-----------------------------*/
     vkCmdBindPipeline(buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, gPipeline);
@@ -96,7 +175,57 @@ void HelloTriangleApplication::recordCommandBuffer(VkCommandBuffer buffer, uint3
     VkBuffer vertBuffers[]= {vertexBuffer};
     VkDeviceSize memoryOffsets[] = {0};
     vkCmdBindVertexBuffers(buffer, 0, 1, vertBuffers, memoryOffsets);
-    vkCmdBindIndexBuffer(buffer, indexBuffer, 0, VK_INDEX_TYPE_UINT32);
+    VkBuffer drawIndexBuffer = indexBuffer;
+    VkIndexType drawIndexType = indexType;
+    #ifdef HELIUM_GPU_CULLING
+    if (gpuCulling){
+        // Compacted by the culling pass, always 32 bit.
+        drawIndexBuffer = visibleIndexBuffers[currentFrame];
+        drawIndexType = VK_INDEX_TYPE_UINT32;
+    }
+    #endif
+    vkCmdBindIndexBuffer(buffer, drawIndexBuffer, 0, drawIndexType);
+    #ifdef HELIUM_LOAD_MODEL
+    // Submeshes are sorted by material, the material set only changes between runs of them.
+    // With bindless textures both sets are bound once and a material change is a push constant (bindless.cpp).
+    const size_t materialCount = bindlessTextures ? 1 : materialTextureSlots.size();
+    if (bindlessTextures){
+        std::array<VkDescriptorSet, 2> sets = {descriptorSets[currentFrame], bindlessDescriptorSet};
+        vkCmdBindDescriptorSets(buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, static_cast<uint32_t>(sets.size()), sets.data(), 0, nullptr);
+    }
+    uint32_t boundMaterial = UINT32_MAX;
+    for (uint32_t s = 0; s < submeshes.size(); s++){
+        const Submesh& submesh = submeshes[s];
+        if (submesh.material != boundMaterial && bindlessTextures){
+            BindlessConstants constants{textures[materialTextureSlots[submesh.material]].bindlessSlot};
+            vkCmdPushConstants(buffer, pipelineLayout, VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(BindlessConstants), &constants);
+            boundMaterial = submesh.material;
+            textures[materialTextureSlots[submesh.material]].lastUsedFrame = frameCounter;
+        }
+        if (submesh.material != boundMaterial){
+            vkCmdBindDescriptorSets(
+                buffer, 
+                VK_PIPELINE_BIND_POINT_GRAPHICS, 
+                pipelineLayout, 
+                0, 
+                1, 
+                &descriptorSets[currentFrame * materialCount + submesh.material], 
+                0, 
+                nullptr);
+            boundMaterial = submesh.material;
+            textures[materialTextureSlots[submesh.material]].lastUsedFrame = frameCounter;
+        }
+        #ifdef HELIUM_GPU_CULLING
+        if (gpuCulling){
+            // Index count written by the culling pass, from the meshlets of the selected LOD only.
+            vkCmdDrawIndexedIndirect(buffer, drawIndirectBuffers[currentFrame], s * sizeof(VkDrawIndexedIndirectCommand), 1, sizeof(VkDrawIndexedIndirectCommand));
+            continue;
+        }
+        #endif
+        const MeshLod& lod = submesh.lods[submeshLods[s]];
+        vkCmdDrawIndexed(buffer, lod.indexCount, 1, lod.firstIndex, 0, 0);
+    }
+    #else
     vkCmdBindDescriptorSets(
         buffer, 
         VK_PIPELINE_BIND_POINT_GRAPHICS, 
@@ -106,13 +235,22 @@ void HelloTriangleApplication::recordCommandBuffer(VkCommandBuffer buffer, uint3
         &descriptorSets[currentFrame], 
         0, 
         nullptr);
-
-    vkCmdDrawIndexed(buffer, static_cast<uint32_t>(indices.size()), 1, 0, 0, 0);
+    if (bindlessTextures){
+        BindlessConstants constants{textures[materialTextureSlots.front()].bindlessSlot};
+        vkCmdBindDescriptorSets(buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 1, 1, &bindlessDescriptorSet, 0, nullptr);
+        vkCmdPushConstants(buffer, pipelineLayout, VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(BindlessConstants), &constants);
+    }
+    textures[materialTextureSlots.front()].lastUsedFrame = frameCounter;
+    vkCmdDrawIndexed(buffer, indexCount, 1, 0, 0, 0);
+    #endif
     #else
     vkCmdDraw(buffer, 3, 1, 0, 0);
     #endif
 
+    gpuProfiler.endScope(buffer); // draw
     vkCmdEndRenderPass(buffer);
+    gpuProfiler.endScope(buffer); // render_pass
+    gpuProfiler.endScope(buffer); // frame
 
     if (vkEndCommandBuffer(buffer) != VK_SUCCESS){
         throw std::runtime_error("failed to record the graphics command buffer");
@@ -126,10 +264,18 @@ void HelloTriangleApplication::updateModelViewProj(uint32_t curFrameIndex){
     float timePassed = std::chrono::duration<float, std::chrono::seconds::period>(currentTime - startTime).count();
 
     ModelViewProjection mvp{};
-    mvp.model = glm::rotate(glm::mat4(1.0f), timePassed * glm::radians(90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
+    glm::mat4 world = glm::rotate(glm::mat4(1.0f), timePassed * glm::radians(90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
+    mvp.model = world * meshDequantization;
+    mvp.uvTransform = meshUvTransform;
     mvp.view = glm::lookAt(glm::vec3(2.0f, 2.0f, 2.0f), glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f));
     mvp.projection = glm::perspective(glm::radians(45.0f), selectedSwapChainWindowSize.width / (float) selectedSwapChainWindowSize.height, 0.1f, 10.0f);
     mvp.projection[1][1] *= -1; // clip coordinates are wrong in GLM. GLM uses y-up clip coordinates. 
 
     memcpy(mvpMatUniformBuffersMapHandles[curFrameIndex], &mvp, sizeof(mvp));
+    #ifdef HELIUM_LOAD_MODEL
+    selectMeshLods(world, mvp.view, mvp.projection);
+    #endif
+    #ifdef HELIUM_GPU_CULLING
+    updateCullingConstants(world, mvp.view, mvp.projection);
+    #endif
 }
\ No newline at end of file
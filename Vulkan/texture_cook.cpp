@@ -0,0 +1,84 @@
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+#include "ktx2.h"
+#include "texture_cooker.h"
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <vector>
+
+/*
+Offline texture cooker, CPU only (no Vulkan/GLFW): writes <image>.ktx2 next to every image given, with BC1 or BC7 blocks
+and every mip level. The renderer uploads those instead of decoding the image (see createTextureImages()).
+Images whose cooked file is newer than the image are skipped, unless --force is given.
+
+usage: texture_cook [--format auto|bc1|bc7] [--filter kaiser|box] [--force] image...
+*/
+
+int main(int argc, char** argv){
+    CookedFormat format = CookedFormat::AUTO;
+    MipFilter filter = MipFilter::KAISER;
+    bool force = false;
+    std::vector<std::string> paths;
+    for (int i = 1; i < argc; i++){
+        if (strcmp(argv[i], "--format") == 0 && i + 1 < argc){
+            std::string name = argv[++i];
+            if (name == "auto"){
+                format = CookedFormat::AUTO;
+            }else if (name == "bc1"){
+                format = CookedFormat::BC1;
+            }else if (name == "bc7"){
+                format = CookedFormat::BC7;
+            }else{
+                std::cerr << "unknown format " << name << std::endl;
+                return EXIT_FAILURE;
+            }
+        }else if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc){
+            std::string name = argv[++i];
+            if (name == "kaiser"){
+                filter = MipFilter::KAISER;
+            }else if (name == "box"){
+                filter = MipFilter::BOX;
+            }else{
+                std::cerr << "unknown filter " << name << std::endl;
+                return EXIT_FAILURE;
+            }
+        }else if (strcmp(argv[i], "--force") == 0){
+            force = true;
+        }else if (argv[i][0] != '-'){
+            paths.emplace_back(argv[i]);
+        }else{
+            paths.clear();
+            break;
+        }
+    }
+    if (paths.empty()){
+        std::cerr << "usage: texture_cook [--format auto|bc1|bc7] [--filter kaiser|box] [--force] image..." << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    int failures = 0;
+    for (const std::string& path : paths){
+        std::string cookedPath = cookedTexturePath(path);
+        std::error_code error;
+        if (!force && std::filesystem::exists(cookedPath, error)
+            && std::filesystem::last_write_time(cookedPath, error) >= std::filesystem::last_write_time(path, error) && !error){
+            std::cout << path << ": up to date" << std::endl;
+            continue;
+        }
+        try{
+            auto start = std::chrono::steady_clock::now();
+            CookResult result = cookTexture(path, format, filter, ThreadPool::shared());
+            double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            std::cout << path << " -> " << cookedPath << ": " << (result.vkFormat == KTX2_FORMAT_BC7_SRGB ? "BC7" : "BC1") << " "
+                      << result.width << "x" << result.height << ", " << result.levelCount << " levels, " << result.bytes / 1024
+                      << "KiB (RGBA8 " << result.uncompressedBytes / 1024 << "KiB), " << ms << "ms" << std::endl;
+        }catch (const std::exception& e){
+            std::cerr << e.what() << std::endl;
+            failures++;
+        }
+    }
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,421 @@
+#include "texture_cooker.h"
+#include "cpu_profiler.h"
+#include "ktx2.h"
+#include "mip_generator.h"
+#include "stb_image.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+
+/*
+Principal axis of the texels of a block (power iteration on their covariance), through their mean.
+Stays 0 for a block of a single color.
+*/
+template <int C>
+static void fitAxis(const float (&texels)[16][C], float (&mean)[C], float (&axis)[C]){
+    for (int c = 0; c < C; c++){
+        mean[c] = 0.0f;
+    }
+    for (int t = 0; t < 16; t++){
+        for (int c = 0; c < C; c++){
+            mean[c] += texels[t][c] / 16.0f;
+        }
+    }
+    float covariance[C][C] = {};
+    for (int t = 0; t < 16; t++){
+        for (int i = 0; i < C; i++){
+            for (int j = 0; j < C; j++){
+                covariance[i][j] += (texels[t][i] - mean[i]) * (texels[t][j] - mean[j]);
+            }
+        }
+    }
+    // Start from the column of the channel that varies the most: never orthogonal to the axis, unlike the bounds diagonal
+    // when channels are anticorrelated. The iteration converges in a few steps from there.
+    int widest = 0;
+    for (int c = 1; c < C; c++){
+        if (covariance[c][c] > covariance[widest][widest]){
+            widest = c;
+        }
+    }
+    for (int c = 0; c < C; c++){
+        axis[c] = covariance[c][widest];
+    }
+    for (int iteration = 0; iteration < 8; iteration++){
+        float next[C] = {};
+        float length = 0.0f;
+        for (int i = 0; i < C; i++){
+            for (int j = 0; j < C; j++){
+                next[i] += covariance[i][j] * axis[j];
+            }
+            length += next[i] * next[i];
+        }
+        if (length < 1e-12f){
+            break;
+        }
+        length = std::sqrt(length);
+        for (int c = 0; c < C; c++){
+            axis[c] = next[c] / length;
+        }
+    }
+    float length = 0.0f;
+    for (int c = 0; c < C; c++){
+        length += axis[c] * axis[c];
+    }
+    if (length > 1e-12f){
+        length = std::sqrt(length);
+        for (int c = 0; c < C; c++){
+            axis[c] /= length;
+        }
+    }
+}
+
+// Ends of the span of the texels along the axis.
+template <int C>
+static void axisEndpoints(const float (&texels)[16][C], const float (&mean)[C], const float (&axis)[C], float (&e0)[C], float (&e1)[C]){
+    float tMin = 0.0f;
+    float tMax = 0.0f;
+    for (int t = 0; t < 16; t++){
+        float d = 0.0f;
+        for (int c = 0; c < C; c++){
+            d += (texels[t][c] - mean[c]) * axis[c];
+        }
+        tMin = std::min(tMin, d);
+        tMax = std::max(tMax, d);
+    }
+    for (int c = 0; c < C; c++){
+        e0[c] = std::clamp(mean[c] + axis[c] * tMax, 0.0f, 255.0f);
+        e1[c] = std::clamp(mean[c] + axis[c] * tMin, 0.0f, 255.0f);
+    }
+}
+
+/*
+Endpoints minimizing the squared error for fixed indices: texel t is w0[t] * e0 + (1 - w0[t]) * e1.
+False when every texel uses the same weight (the system is singular).
+*/
+template <int C>
+static bool leastSquaresEndpoints(const float (&texels)[16][C], const float (&w0)[16], float (&e0)[C], float (&e1)[C]){
+    float aa = 0.0f, ab = 0.0f, bb = 0.0f;
+    float ax[C] = {};
+    float bx[C] = {};
+    for (int t = 0; t < 16; t++){
+        float a = w0[t];
+        float b = 1.0f - a;
+        aa += a * a;
+        ab += a * b;
+        bb += b * b;
+        for (int c = 0; c < C; c++){
+            ax[c] += a * texels[t][c];
+            bx[c] += b * texels[t][c];
+        }
+    }
+    float determinant = aa * bb - ab * ab;
+    if (std::abs(determinant) < 1e-6f){
+        return false;
+    }
+    for (int c = 0; c < C; c++){
+        e0[c] = std::clamp((ax[c] * bb - bx[c] * ab) / determinant, 0.0f, 255.0f);
+        e1[c] = std::clamp((bx[c] * aa - ax[c] * ab) / determinant, 0.0f, 255.0f);
+    }
+    return true;
+}
+
+//-------------------------------BC1
+
+static uint16_t pack565(const float (&color)[3]){
+    uint32_t r = static_cast<uint32_t>(std::lround(color[0] * 31.0f / 255.0f));
+    uint32_t g = static_cast<uint32_t>(std::lround(color[1] * 63.0f / 255.0f));
+    uint32_t b = static_cast<uint32_t>(std::lround(color[2] * 31.0f / 255.0f));
+    return static_cast<uint16_t>((r << 11) | (g << 5) | b);
+}
+
+static void unpack565(uint16_t packed, float (&color)[3]){
+    uint32_t r = (packed >> 11) & 31;
+    uint32_t g = (packed >> 5) & 63;
+    uint32_t b = packed & 31;
+    color[0] = static_cast<float>((r << 3) | (r >> 2));
+    color[1] = static_cast<float>((g << 2) | (g >> 4));
+    color[2] = static_cast<float>((b << 3) | (b >> 2));
+}
+
+struct Bc1Candidate{
+    uint16_t c0;
+    uint16_t c1;
+    uint8_t indices[16];
+    float error;
+};
+
+// Picks the closest of the 4 colors for every texel. c0 > c1 selects the 4 color mode, equal ends only use c0.
+static Bc1Candidate evaluateBc1(const float (&texels)[16][3], uint16_t c0, uint16_t c1){
+    if (c0 < c1){
+        std::swap(c0, c1);
+    }
+    Bc1Candidate candidate{c0, c1, {}, 0.0f};
+    float palette[4][3];
+    unpack565(c0, palette[0]);
+    unpack565(c1, palette[1]);
+    for (int c = 0; c < 3; c++){
+        palette[2][c] = (2.0f * palette[0][c] + palette[1][c]) / 3.0f;
+        palette[3][c] = (palette[0][c] + 2.0f * palette[1][c]) / 3.0f;
+    }
+    const int colors = c0 == c1 ? 1 : 4;
+    for (int t = 0; t < 16; t++){
+        float best = std::numeric_limits<float>::max();
+        for (int i = 0; i < colors; i++){
+            float d = 0.0f;
+            for (int c = 0; c < 3; c++){
+                float delta = texels[t][c] - palette[i][c];
+                d += delta * delta;
+            }
+            if (d < best){
+                best = d;
+                candidate.indices[t] = static_cast<uint8_t>(i);
+            }
+        }
+        candidate.error += best;
+    }
+    return candidate;
+}
+
+void encodeBc1Block(const uint8_t* rgba, uint8_t* block){
+    float texels[16][3];
+    for (int t = 0; t < 16; t++){
+        for (int c = 0; c < 3; c++){
+            texels[t][c] = rgba[t * 4 + c];
+        }
+    }
+    float mean[3];
+    float axis[3];
+    float e0[3];
+    float e1[3];
+    fitAxis(texels, mean, axis);
+    axisEndpoints(texels, mean, axis, e0, e1);
+    Bc1Candidate best = evaluateBc1(texels, pack565(e0), pack565(e1));
+    // Refit the ends to the chosen indices, rounding to 565 can move the best ends away from the axis bounds.
+    static constexpr float WEIGHTS[4] = {1.0f, 0.0f, 2.0f / 3.0f, 1.0f / 3.0f};
+    for (int iteration = 0; iteration < 2 && best.error > 0.0f; iteration++){
+        float w0[16];
+        for (int t = 0; t < 16; t++){
+            w0[t] = WEIGHTS[best.indices[t]];
+        }
+        if (!leastSquaresEndpoints(texels, w0, e0, e1)){
+            break;
+        }
+        Bc1Candidate refined = evaluateBc1(texels, pack565(e0), pack565(e1));
+        if (refined.error >= best.error){
+            break;
+        }
+        best = refined;
+    }
+    uint32_t indexBits = 0;
+    for (int t = 0; t < 16; t++){
+        indexBits |= static_cast<uint32_t>(best.indices[t]) << (2 * t);
+    }
+    memcpy(block, &best.c0, 2);
+    memcpy(block + 2, &best.c1, 2);
+    memcpy(block + 4, &indexBits, 4);
+}
+
+//-------------------------------BC7 mode 6
+
+static constexpr uint32_t BC7_WEIGHTS[16] = {0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64};
+
+// 7 bit RGBA end point and its shared p bit, the decoder sees (value << 1) | pBit.
+struct Bc7Endpoint{
+    uint8_t value[4];
+    uint8_t pBit;
+};
+
+static Bc7Endpoint quantizeBc7(const float (&color)[4]){
+    Bc7Endpoint best{};
+    float bestError = std::numeric_limits<float>::max();
+    for (uint8_t p = 0; p < 2; p++){
+        Bc7Endpoint candidate{};
+        candidate.pBit = p;
+        float error = 0.0f;
+        for (int c = 0; c < 4; c++){
+            long q = std::clamp(std::lround((color[c] - p) / 2.0f), 0l, 127l);
+            candidate.value[c] = static_cast<uint8_t>(q);
+            float delta = color[c] - static_cast<float>((q << 1) | p);
+            error += delta * delta;
+        }
+        if (error < bestError){
+            bestError = error;
+            best = candidate;
+        }
+    }
+    return best;
+}
+
+struct Bc7Candidate{
+    Bc7Endpoint e0;
+    Bc7Endpoint e1;
+    uint8_t indices[16];
+    float error;
+};
+
+static Bc7Candidate evaluateBc7(const float (&texels)[16][4], const Bc7Endpoint& e0, const Bc7Endpoint& e1){
+    Bc7Candidate candidate{e0, e1, {}, 0.0f};
+    float palette[16][4];
+    for (int i = 0; i < 16; i++){
+        for (int c = 0; c < 4; c++){
+            uint32_t a = (e0.value[c] << 1) | e0.pBit;
+            uint32_t b = (e1.value[c] << 1) | e1.pBit;
+            palette[i][c] = static_cast<float>(((64 - BC7_WEIGHTS[i]) * a + BC7_WEIGHTS[i] * b + 32) >> 6);
+        }
+    }
+    for (int t = 0; t < 16; t++){
+        float best = std::numeric_limits<float>::max();
+        for (int i = 0; i < 16; i++){
+            float d = 0.0f;
+            for (int c = 0; c < 4; c++){
+                float delta = texels[t][c] - palette[i][c];
+                d += delta * delta;
+            }
+            if (d < best){
+                best = d;
+                candidate.indices[t] = static_cast<uint8_t>(i);
+            }
+        }
+        candidate.error += best;
+    }
+    return candidate;
+}
+
+namespace{
+// Fills a block LSB first, as BC7 fields are laid out.
+struct BitWriter{
+    uint8_t* out;
+    uint32_t position = 0;
+
+    void write(uint32_t value, uint32_t bits){
+        for (uint32_t b = 0; b < bits; b++, position++){
+            if ((value >> b) & 1){
+                out[position / 8] |= static_cast<uint8_t>(1u << (position % 8));
+            }
+        }
+    }
+};
+}
+
+void encodeBc7Block(const uint8_t* rgba, uint8_t* block){
+    float texels[16][4];
+    for (int t = 0; t < 16; t++){
+        for (int c = 0; c < 4; c++){
+            texels[t][c] = rgba[t * 4 + c];
+        }
+    }
+    float mean[4];
+    float axis[4];
+    float e0[4];
+    float e1[4];
+    fitAxis(texels, mean, axis);
+    axisEndpoints(texels, mean, axis, e0, e1);
+    Bc7Candidate best = evaluateBc7(texels, quantizeBc7(e0), quantizeBc7(e1));
+    for (int iteration = 0; iteration < 2 && best.error > 0.0f; iteration++){
+        float w0[16];
+        for (int t = 0; t < 16; t++){
+            w0[t] = (64.0f - BC7_WEIGHTS[best.indices[t]]) / 64.0f;
+        }
+        if (!leastSquaresEndpoints(texels, w0, e0, e1)){
+            break;
+        }
+        Bc7Candidate refined = evaluateBc7(texels, quantizeBc7(e0), quantizeBc7(e1));
+        if (refined.error >= best.error){
+            break;
+        }
+        best = refined;
+    }
+    // The top bit of the first index is implicitly 0: swap the ends when it would be set.
+    if (best.indices[0] >= 8){
+        std::swap(best.e0, best.e1);
+        for (uint8_t& index : best.indices){
+            index = static_cast<uint8_t>(15 - index);
+        }
+    }
+    memset(block, 0, 16);
+    BitWriter writer{block};
+    writer.write(1u << 6, 7); // Mode 6
+    for (int c = 0; c < 4; c++){
+        writer.write(best.e0.value[c], 7);
+        writer.write(best.e1.value[c], 7);
+    }
+    writer.write(best.e0.pBit, 1);
+    writer.write(best.e1.pBit, 1);
+    writer.write(best.indices[0], 3);
+    for (int t = 1; t < 16; t++){
+        writer.write(best.indices[t], 4);
+    }
+}
+
+//-------------------------------Levels
+
+std::vector<uint8_t> compressLevel(uint32_t vkFormat, const uint8_t* rgba, uint32_t width, uint32_t height, ThreadPool& pool){
+    HELIUM_PROFILE_FUNCTION();
+    const uint32_t blockBytes = ktx2BlockBytes(vkFormat);
+    if (blockBytes == 0){
+        throw std::runtime_error("texture cooker: unsupported format " + std::to_string(vkFormat));
+    }
+    const uint32_t blocksWide = (width + 3) / 4;
+    const uint32_t blocksHigh = (height + 3) / 4;
+    std::vector<uint8_t> blocks(static_cast<size_t>(blocksWide) * blocksHigh * blockBytes);
+    pool.parallelFor(blocksHigh, [&](uint32_t by){
+        uint8_t texels[16 * 4];
+        for (uint32_t bx = 0; bx < blocksWide; bx++){
+            for (uint32_t t = 0; t < 16; t++){
+                uint32_t x = std::min(bx * 4 + t % 4, width - 1);
+                uint32_t y = std::min(by * 4 + t / 4, height - 1);
+                memcpy(texels + t * 4, rgba + (static_cast<size_t>(y) * width + x) * 4, 4);
+            }
+            uint8_t* block = blocks.data() + (static_cast<size_t>(by) * blocksWide + bx) * blockBytes;
+            if (vkFormat == KTX2_FORMAT_BC7_SRGB){
+                encodeBc7Block(texels, block);
+            }else{
+                encodeBc1Block(texels, block);
+            }
+        }
+    });
+    return blocks;
+}
+
+CookResult cookTexture(const std::string& sourcePath, CookedFormat format, MipFilter filter, ThreadPool& pool){
+    HELIUM_PROFILE_FUNCTION();
+    int width = 0, height = 0, channels = 0;
+    stbi_uc* pixels = stbi_load(sourcePath.c_str(), &width, &height, &channels, STBI_rgb_alpha);
+    if (!pixels){
+        throw std::runtime_error("texture cooker: failed to load " + sourcePath);
+    }
+    CookResult result{};
+    result.width = static_cast<uint32_t>(width);
+    result.height = static_cast<uint32_t>(height);
+    // Full chain down to 1x1, like the mips generated at runtime.
+    result.levelCount = mipLevelCount(result.width, result.height);
+    std::vector<uint8_t> chain(mipChainBytes(result.width, result.height, result.levelCount));
+    generateMipChain(pixels, result.width, result.height, result.levelCount, filter, chain.data(), pool);
+    stbi_image_free(pixels);
+
+    if (format == CookedFormat::AUTO){
+        bool opaque = true;
+        for (size_t i = 3; i < static_cast<size_t>(width) * height * 4 && opaque; i += 4){
+            opaque = chain[i] == 255;
+        }
+        format = opaque ? CookedFormat::BC1 : CookedFormat::BC7;
+    }
+    result.vkFormat = format == CookedFormat::BC7 ? KTX2_FORMAT_BC7_SRGB : KTX2_FORMAT_BC1_RGB_SRGB;
+
+    std::vector<std::vector<uint8_t>> levels;
+    const uint8_t* level = chain.data();
+    for (uint32_t l = 0; l < result.levelCount; l++){
+        uint32_t levelWidth = std::max(1u, result.width >> l);
+        uint32_t levelHeight = std::max(1u, result.height >> l);
+        levels.push_back(compressLevel(result.vkFormat, level, levelWidth, levelHeight, pool));
+        result.bytes += levels.back().size();
+        result.uncompressedBytes += static_cast<uint64_t>(levelWidth) * levelHeight * 4;
+        level += static_cast<size_t>(levelWidth) * levelHeight * 4;
+    }
+    if (!Ktx2File::write(cookedTexturePath(sourcePath), result.vkFormat, result.width, result.height, levels)){
+        throw std::runtime_error("texture cooker: failed to write " + cookedTexturePath(sourcePath));
+    }
+    return result;
+}
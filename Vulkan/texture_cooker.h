@@ -0,0 +1,44 @@
+#pragma once
+
+#include "mip_generator.h"
+#include "thread_pool.h"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/*
+Offline texture cooking (texture_cook): sRGB RGBA8 images are turned into block compressed levels, mips included, and
+written as KTX2 (ktx2.h) next to the source as <source>.ktx2. The renderer uploads those levels as they are.
+
+- BC1 (4 bits per texel) for opaque images: endpoints along the principal axis of the block colors, refined by least squares.
+- BC7 mode 6 (8 bits per texel) for images with alpha: one RGBA endpoint pair with 16 interpolation steps, fitted the same way.
+Mips come from generateMipChain() (mip_generator.h), filtered in linear space so they do not darken like averaging sRGB
+values would.
+*/
+
+enum class CookedFormat{
+    AUTO, // BC1 when every texel is opaque, BC7 otherwise
+    BC1,
+    BC7,
+};
+
+// 4x4 RGBA8 texels, row major. BC1 ignores alpha.
+void encodeBc1Block(const uint8_t* rgba, uint8_t* block);
+void encodeBc7Block(const uint8_t* rgba, uint8_t* block);
+
+// Compresses width x height RGBA8 texels into rows of blocks, partial edge blocks repeat the last row/column.
+std::vector<uint8_t> compressLevel(uint32_t vkFormat, const uint8_t* rgba, uint32_t width, uint32_t height, ThreadPool& pool);
+
+inline std::string cookedTexturePath(const std::string& sourcePath){ return sourcePath + ".ktx2"; }
+
+struct CookResult{
+    uint32_t vkFormat;
+    uint32_t width;
+    uint32_t height;
+    uint32_t levelCount;
+    uint64_t bytes; // Every level, as uploaded
+    uint64_t uncompressedBytes; // Same levels as RGBA8
+};
+
+// Decodes sourcePath and writes cookedTexturePath(sourcePath). Throws std::runtime_error when decoding or writing fails.
+CookResult cookTexture(const std::string& sourcePath, CookedFormat format, MipFilter filter, ThreadPool& pool);
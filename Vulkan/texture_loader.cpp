@@ -0,0 +1,59 @@
+#include "texture_loader.h"
+#include "cpu_profiler.h"
+#include "stb_image.h"
+#include <chrono>
+
+TextureLoader::TextureLoader(const std::vector<std::string>& paths, ThreadPool& pool){
+    running = static_cast<uint32_t>(paths.size());
+    remaining = running;
+    for (uint32_t i = 0; i < paths.size(); i++){
+        pool.submit([this, i, path = paths[i]](){
+            DecodedImage image{};
+            image.index = i;
+            {
+                HELIUM_PROFILE_SCOPE("decodeImage");
+                auto start = std::chrono::steady_clock::now();
+                int width = 0, height = 0, channels = 0;
+                image.pixels = stbi_load(path.c_str(), &width, &height, &channels, STBI_rgb_alpha);
+                image.width = static_cast<uint32_t>(width);
+                image.height = static_cast<uint32_t>(height);
+                image.decodeMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            }
+            // Notified under the lock: the destructor may free this loader as soon as running reaches 0.
+            std::lock_guard<std::mutex> lock(mutex);
+            decoded.push_back(image);
+            running--;
+            imageDecoded.notify_all();
+        });
+    }
+}
+
+TextureLoader::~TextureLoader(){
+    std::unique_lock<std::mutex> lock(mutex);
+    imageDecoded.wait(lock, [this]{ return running == 0; });
+    for (DecodedImage& image : decoded){
+        free(image.pixels);
+    }
+}
+
+bool TextureLoader::next(DecodedImage& image, double* waitMs){
+    auto start = std::chrono::steady_clock::now();
+    std::unique_lock<std::mutex> lock(mutex);
+    if (remaining == 0){
+        return false;
+    }
+    imageDecoded.wait(lock, [this]{ return !decoded.empty(); });
+    image = decoded.front();
+    decoded.pop_front();
+    remaining--;
+    if (waitMs){
+        *waitMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+    return true;
+}
+
+void TextureLoader::free(unsigned char* pixels){
+    if (pixels){
+        stbi_image_free(pixels);
+    }
+}
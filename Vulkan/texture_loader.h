@@ -0,0 +1,44 @@
+#pragma once
+
+#include "thread_pool.h"
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/*
+Decodes a set of images in parallel on a ThreadPool and hands them back in the order they finish, so the caller can create
+and upload one while the others are still being decoded.
+
+Every image is decoded to tightly packed RGBA8 (stb_image). The caller owns the pixels of the images returned by next() and
+frees them with free(); the destructor waits for the decodes still running and frees whatever was never taken.
+*/
+class TextureLoader{
+public:
+    struct DecodedImage{
+        uint32_t index = 0; // In the paths given to the constructor
+        unsigned char* pixels = nullptr; // nullptr when the file could not be decoded
+        uint32_t width = 0;
+        uint32_t height = 0;
+        double decodeMs = 0.0; // Spent on the worker, reading the file included
+    };
+
+    // Starts decoding every path right away.
+    explicit TextureLoader(const std::vector<std::string>& paths, ThreadPool& pool = ThreadPool::shared());
+    ~TextureLoader();
+    TextureLoader(const TextureLoader&) = delete;
+    TextureLoader& operator=(const TextureLoader&) = delete;
+
+    // Blocks until another image is decoded. False once every image was returned. waitMs receives the time spent blocked.
+    bool next(DecodedImage& image, double* waitMs = nullptr);
+    static void free(unsigned char* pixels);
+
+private:
+    std::mutex mutex;
+    std::condition_variable imageDecoded;
+    std::deque<DecodedImage> decoded;
+    uint32_t running = 0; // Decodes not finished yet
+    uint32_t remaining = 0; // Images not returned by next() yet
+};
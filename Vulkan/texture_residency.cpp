@@ -0,0 +1,242 @@
+#include "main.h"
+
+/*
+Texture memory budget. Every frame budgetTextureMemory() compares the memory of the texture images with the budget:
+- over it, the texture drawn the longest ago (the one with the biggest top level among those drawn as recently) loses levels:
+  the ones allocated but not streamed yet when it has some, its top level otherwise,
+- under it by a margin, the texture drawn last (the one with the smallest top level among those drawn as recently) gets its
+  next level back, streamTextures() then uploads it again from the source of the stream.
+Either way the resident levels are copied into a new image holding only the kept levels, so the memory is really released.
+The copies are recorded at the start of the frame command buffer (recordTextureMoves()), view and descriptor sets of the frame
+switch to the new image, the old one is retired like a replaced view. The mip tail (streamingTailLevel()) is never evicted,
+textures are only moved between two uploads, and at most MAX_TEXTURE_MOVES_PER_FRAME per frame as each is an allocation and a copy.
+*/
+
+/*
+Bytes the textures may take in the heap of memoryType according to VK_EXT_memory_budget: its budget with 10% headroom, minus
+what is used by anything else. Free space in the blocks of the allocator and retired images count as available, textures get
+them back. No limit without the extension.
+*/
+VkDeviceSize HelloTriangleApplication::textureHeapBudget(uint32_t memoryType){
+    if (!memoryBudgetSupported){
+        return std::numeric_limits<VkDeviceSize>::max();
+    }
+    VkPhysicalDeviceMemoryBudgetPropertiesEXT budget{};
+    budget.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT;
+    VkPhysicalDeviceMemoryProperties2KHR properties{};
+    properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2_KHR;
+    properties.pNext = &budget;
+    getPhysicalDeviceMemoryProperties2(physGraphicDevice, &properties);
+    const uint32_t heap = properties.memoryProperties.memoryTypes[memoryType].heapIndex;
+
+    VkDeviceSize reclaimable = deviceAllocator.freeBytesOnHeap(heap);
+    for (const Texture& texture : textures){
+        reclaimable += texture.memory.size;
+    }
+    for (const RetiredTexture& retired : retiredTextures){
+        reclaimable += retired.memory.size;
+    }
+    VkDeviceSize available = budget.heapBudget[heap] - budget.heapBudget[heap] / 10 + reclaimable;
+    return available > budget.heapUsage[heap] ? available - budget.heapUsage[heap] : 0;
+}
+
+void HelloTriangleApplication::budgetTextureMemory(){
+    #ifndef HELIUM_DISABLE_TEXTURE_EVICTION
+    if (textureStreams.empty()){
+        return;
+    }
+    HELIUM_PROFILE_FUNCTION();
+    VkDeviceSize textureBytes = 0;
+    for (const Texture& texture : textures){
+        textureBytes += texture.memory.size;
+    }
+    const VkDeviceSize budget = std::min(textureMemoryBudget, textureHeapBudget(textures.front().memory.memoryType));
+    // Restores stop short of the budget, a restored level does not get evicted again right away.
+    const VkDeviceSize restoreMargin = budget / 16;
+
+    // A texture can move when nothing is being uploaded to it and it was not moved this frame already.
+    auto movable = [this](uint32_t t){
+        const Texture& texture = textures[t];
+        return textureStreams[t].requestedLevel == texture.residentLevel
+            && std::none_of(textureMoves.begin(), textureMoves.end(), [&](const TextureMove& move){ return move.destination == texture.image; });
+    };
+
+    for (uint32_t moves = 0; moves < MAX_TEXTURE_MOVES_PER_FRAME; moves++){
+        uint32_t best = UINT32_MAX;
+        uint32_t bestBase = 0;
+        if (textureBytes > budget){
+            bool bestEmpty = false;
+            for (uint32_t t = 0; t < textures.size(); t++){
+                const Texture& texture = textures[t];
+                const TextureStream& stream = textureStreams[t];
+                bool empty = texture.residentLevel > texture.baseLevel;
+                uint32_t base = empty ? texture.residentLevel : texture.baseLevel + 1;
+                if (!movable(t) || base > streamingTailLevel(stream.width, stream.height, texture.mipmaps)){
+                    continue;
+                }
+                // Levels nobody has seen yet go first, then the least recently drawn, then the sharpest.
+                bool better = best == UINT32_MAX;
+                if (!better && empty != bestEmpty){
+                    better = empty;
+                }else if (!better && texture.lastUsedFrame != textures[best].lastUsedFrame){
+                    better = texture.lastUsedFrame < textures[best].lastUsedFrame;
+                }else if (!better){
+                    better = textureLevelBytes(t, texture.baseLevel) > textureLevelBytes(best, textures[best].baseLevel);
+                }
+                if (better){
+                    best = t;
+                    bestBase = base;
+                    bestEmpty = empty;
+                }
+            }
+            if (best != UINT32_MAX){
+                evictedTextureLevels += bestBase - textures[best].baseLevel;
+            }
+        }else{
+            for (uint32_t t = 0; t < textures.size(); t++){
+                const Texture& texture = textures[t];
+                // Only textures drawn by the frames in flight are wanted back.
+                if (texture.baseLevel == 0 || texture.residentLevel != texture.baseLevel || !movable(t)
+                    || texture.lastUsedFrame + MAX_FRAMES_IN_FLIGHT < frameCounter
+                    || textureBytes + textureLevelBytes(t, texture.baseLevel - 1) + restoreMargin > budget){
+                    continue;
+                }
+                // The most recently drawn first, then the blurriest.
+                bool better = best == UINT32_MAX;
+                if (!better && texture.lastUsedFrame != textures[best].lastUsedFrame){
+                    better = texture.lastUsedFrame > textures[best].lastUsedFrame;
+                }else if (!better){
+                    better = textureLevelBytes(t, texture.baseLevel - 1) < textureLevelBytes(best, textures[best].baseLevel - 1);
+                }
+                if (better){
+                    best = t;
+                    bestBase = texture.baseLevel - 1;
+                }
+            }
+            if (best != UINT32_MAX){
+                restoredTextureLevels++;
+            }
+        }
+        if (best == UINT32_MAX){
+            break;
+        }
+        textureBytes -= textures[best].memory.size;
+        moveTexture(best, bestBase);
+        textureBytes += textures[best].memory.size;
+    }
+    #endif
+}
+
+/*
+Replaces the image of a texture with one holding levels [baseLevel, mipmaps). Its resident levels in that range are copied by
+recordTextureMoves(), the ones above stay undefined until streamTextures() uploads them.
+*/
+void HelloTriangleApplication::moveTexture(uint32_t t, uint32_t baseLevel){
+    HELIUM_PROFILE_FUNCTION();
+    Texture& texture = textures[t];
+    TextureStream& stream = textureStreams[t];
+    const uint32_t firstLevel = std::max(texture.residentLevel, baseLevel);
+
+    TextureMove move{};
+    move.source = texture.image;
+    move.sourceBaseLevel = texture.baseLevel;
+    move.destinationBaseLevel = baseLevel;
+    move.firstLevel = firstLevel;
+    move.mipmaps = texture.mipmaps;
+    move.width = stream.width;
+    move.height = stream.height;
+    // Frames in flight still sample the old image, the copy reads it before this frame's draws.
+    retiredTextures.push_back({frameCounter + MAX_FRAMES_IN_FLIGHT, texture.view, texture.image, texture.memory});
+
+    createAndBindDeviceImage(
+        std::max(1u, stream.width >> baseLevel),
+        std::max(1u, stream.height >> baseLevel),
+        VK_SAMPLE_COUNT_1_BIT,
+        texture.image,
+        texture.memory,
+        texture.format,
+        VK_IMAGE_TILING_OPTIMAL,
+        VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+        texture.mipmaps - baseLevel
+    );
+    move.destination = texture.image;
+    textureMoves.push_back(move);
+
+    texture.baseLevel = baseLevel;
+    texture.residentLevel = firstLevel;
+    texture.viewLevel = firstLevel;
+    stream.requestedLevel = firstLevel;
+    texture.view = createViewFor2DImage(
+        texture.image, static_cast<int>(texture.mipmaps - firstLevel), texture.format, VK_IMAGE_ASPECT_COLOR_BIT,
+        static_cast<int>(firstLevel - baseLevel)
+    );
+}
+
+void HelloTriangleApplication::recordTextureMoves(VkCommandBuffer buffer){
+    if (textureMoves.empty()){
+        return;
+    }
+    gpuProfiler.beginScope(buffer, "texture_moves");
+    std::vector<VkImageMemoryBarrier> toTransfer;
+    std::vector<VkImageMemoryBarrier> toShader;
+    for (const TextureMove& move : textureMoves){
+        VkImageMemoryBarrier barrier{};
+        barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        barrier.subresourceRange.levelCount = move.mipmaps - move.firstLevel;
+        barrier.subresourceRange.baseArrayLayer = 0;
+        barrier.subresourceRange.layerCount = 1;
+
+        // Sampled by the previous frames, only an execution dependency is needed before reading it.
+        barrier.image = move.source;
+        barrier.subresourceRange.baseMipLevel = move.firstLevel - move.sourceBaseLevel;
+        barrier.oldLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+        barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+        barrier.srcAccessMask = 0;
+        barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+        toTransfer.push_back(barrier);
+
+        barrier.image = move.destination;
+        barrier.subresourceRange.baseMipLevel = move.firstLevel - move.destinationBaseLevel;
+        barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        toTransfer.push_back(barrier);
+
+        barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+        toShader.push_back(barrier);
+    }
+    vkCmdPipelineBarrier(
+        buffer, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+        0, nullptr, 0, nullptr, static_cast<uint32_t>(toTransfer.size()), toTransfer.data()
+    );
+
+    std::vector<VkImageCopy> regions;
+    for (const TextureMove& move : textureMoves){
+        regions.clear();
+        for (uint32_t level = move.firstLevel; level < move.mipmaps; level++){
+            VkImageCopy region{};
+            region.srcSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, level - move.sourceBaseLevel, 0, 1};
+            region.dstSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, level - move.destinationBaseLevel, 0, 1};
+            region.extent = {std::max(1u, move.width >> level), std::max(1u, move.height >> level), 1};
+            regions.push_back(region);
+        }
+        vkCmdCopyImage(
+            buffer, move.source, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, move.destination, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+            static_cast<uint32_t>(regions.size()), regions.data()
+        );
+    }
+
+    vkCmdPipelineBarrier(
+        buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0,
+        0, nullptr, 0, nullptr, static_cast<uint32_t>(toShader.size()), toShader.data()
+    );
+    gpuProfiler.endScope(buffer);
+    textureMoves.clear();
+}
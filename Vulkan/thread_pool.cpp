@@ -0,0 +1,126 @@
+#include "thread_pool.h"
+#include "cpu_profiler.h"
+#include <algorithm>
+#include <atomic>
+#include <exception>
+
+ThreadPool::ThreadPool(uint32_t threadCount){
+    if (threadCount == 0){
+        uint32_t hardware = std::max(1u, std::thread::hardware_concurrency());
+        threadCount = hardware > 1 ? hardware - 1 : 1;
+    }
+    workerNames.reserve(threadCount);
+    for (uint32_t i = 0; i < threadCount; i++){
+        workerNames.push_back("worker " + std::to_string(i));
+    }
+    workers.reserve(threadCount);
+    for (uint32_t i = 0; i < threadCount; i++){
+        workers.emplace_back(&ThreadPool::workerLoop, this, i);
+    }
+}
+
+ThreadPool::~ThreadPool(){
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    jobAvailable.notify_all();
+    for (std::thread& t : workers){
+        t.join();
+    }
+}
+
+ThreadPool& ThreadPool::shared(){
+    static ThreadPool pool;
+    return pool;
+}
+
+void ThreadPool::workerLoop(uint32_t index){
+    CpuProfiler::setThreadName(workerNames[index].c_str());
+    while (true){
+        std::function<void()> job;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            jobAvailable.wait(lock, [this]{ return stopping || !jobs.empty(); });
+            if (jobs.empty()){
+                return; // Stopping and drained
+            }
+            job = std::move(jobs.front());
+            jobs.pop_front();
+        }
+        job();
+    }
+}
+
+bool ThreadPool::runOne(){
+    std::function<void()> job;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (jobs.empty()){
+            return false;
+        }
+        job = std::move(jobs.front());
+        jobs.pop_front();
+    }
+    job();
+    return true;
+}
+
+void ThreadPool::submit(std::function<void()> job){
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        jobs.push_back(std::move(job));
+    }
+    jobAvailable.notify_one();
+}
+
+void ThreadPool::parallelFor(uint32_t count, const std::function<void(uint32_t)>& job){
+    if (count == 0){
+        return;
+    }
+    if (count == 1){
+        job(0);
+        return;
+    }
+    struct Batch{
+        std::atomic<uint32_t> remaining;
+        std::mutex mutex;
+        std::condition_variable done;
+        std::exception_ptr error;
+    } batch;
+    batch.remaining = count;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (uint32_t i = 0; i < count; i++){
+            jobs.emplace_back([&batch, &job, i](){
+                std::exception_ptr error;
+                try{
+                    job(i);
+                }catch (...){
+                    error = std::current_exception();
+                }
+                // Under the lock: batch lives on the stack of parallelFor, it must not return before we are done with it.
+                std::lock_guard<std::mutex> lock(batch.mutex);
+                if (error && !batch.error){
+                    batch.error = error;
+                }
+                if (batch.remaining.fetch_sub(1, std::memory_order_acq_rel) == 1){
+                    batch.done.notify_all();
+                }
+            });
+        }
+    }
+    jobAvailable.notify_all();
+
+    // Help instead of sleeping, then wait for the jobs other threads picked up.
+    while (batch.remaining.load(std::memory_order_acquire) > 0 && runOne()){
+    }
+    {
+        std::unique_lock<std::mutex> lock(batch.mutex);
+        batch.done.wait(lock, [&batch]{ return batch.remaining.load(std::memory_order_acquire) == 0; });
+    }
+    if (batch.error){
+        std::rethrow_exception(batch.error);
+    }
+}
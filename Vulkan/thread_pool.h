@@ -0,0 +1,50 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <deque>
+
+/*
+Fixed set of worker threads for CPU heavy loading work (parsing, decoding, mip generation).
+
+parallelFor() is the main entry point: it splits [0, count) over the workers and the calling thread and returns once every
+index ran. The first exception thrown by a job is rethrown on the caller once all jobs finished.
+Jobs must not call parallelFor() on the same pool, the workers would end up waiting on themselves.
+submit() queues a single job and returns right away, for work whose results are collected by the caller (TextureLoader).
+*/
+class ThreadPool{
+public:
+    // 0 threads means one per hardware thread minus the caller, which also works during parallelFor().
+    explicit ThreadPool(uint32_t threadCount = 0);
+    ~ThreadPool();
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // Workers plus the calling thread.
+    uint32_t concurrency() const { return static_cast<uint32_t>(workers.size()) + 1; }
+
+    // Runs job(i) for every i in [0, count), blocks until all of them completed.
+    void parallelFor(uint32_t count, const std::function<void(uint32_t)>& job);
+    // Runs job on a worker later. It must not throw, nothing is there to catch it.
+    void submit(std::function<void()> job);
+
+    // Shared pool for loading work, created on first use.
+    static ThreadPool& shared();
+
+private:
+    std::vector<std::thread> workers;
+    std::vector<std::string> workerNames; // Referenced by the CPU profiler, must outlive the threads
+    std::deque<std::function<void()>> jobs;
+    std::mutex mutex;
+    std::condition_variable jobAvailable;
+    bool stopping = false;
+
+    void workerLoop(uint32_t index);
+    // Runs one queued job on the calling thread, false if the queue was empty.
+    bool runOne();
+};
@@ -0,0 +1,324 @@
+#include "upload_scheduler.h"
+#include "cpu_profiler.h"
+#include <algorithm>
+#include <cstring>
+#include <numeric>
+#include <stdexcept>
+
+void UploadScheduler::init(StagingRing* stagingRing){
+    ring = stagingRing;
+}
+
+void UploadScheduler::setQueueFamilies(uint32_t transfer, uint32_t graphics){
+    transferFamily = transfer;
+    graphicsFamily = graphics;
+}
+
+void UploadScheduler::enqueueBuffer(VkBuffer dst, VkDeviceSize dstOffset, const void* data, VkDeviceSize size, std::function<void()> onComplete){
+    if (size == 0){
+        if (onComplete){
+            recordedCallbacks.push_back(std::move(onComplete));
+        }
+        return;
+    }
+    Upload upload{};
+    upload.data = static_cast<const uint8_t*>(data);
+    upload.size = size;
+    upload.buffer = dst;
+    upload.bufferOffset = dstOffset;
+    upload.image = VK_NULL_HANDLE;
+    upload.onComplete = std::move(onComplete);
+    queue.push_back(std::move(upload));
+}
+
+void UploadScheduler::enqueueImage(VkImage dst, uint32_t mipLevel, uint32_t width, uint32_t height, uint32_t bytesPerTexel, const void* data,
+                                   VkImageLayout oldLayout, VkImageLayout newLayout, std::function<void()> onComplete){
+    enqueueImageRows(dst, mipLevel, 1, width, height, 1, bytesPerTexel, data, oldLayout, newLayout, std::move(onComplete));
+}
+
+void UploadScheduler::enqueueImageChain(VkImage dst, uint32_t mipLevel, uint32_t width, uint32_t height, uint32_t levelCount, uint32_t bytesPerTexel,
+                                        const void* data, VkImageLayout oldLayout, VkImageLayout newLayout, std::function<void()> onComplete){
+    enqueueImageRows(dst, mipLevel, levelCount, width, height, 1, bytesPerTexel, data, oldLayout, newLayout, std::move(onComplete));
+}
+
+void UploadScheduler::enqueueCompressedImage(VkImage dst, uint32_t mipLevel, uint32_t width, uint32_t height, uint32_t blockBytes, const void* data,
+                                             VkImageLayout oldLayout, VkImageLayout newLayout, std::function<void()> onComplete){
+    enqueueImageRows(dst, mipLevel, 1, width, height, 4, blockBytes, data, oldLayout, newLayout, std::move(onComplete));
+}
+
+void UploadScheduler::enqueueImageRows(VkImage dst, uint32_t mipLevel, uint32_t levelCount, uint32_t width, uint32_t height, uint32_t blockDim,
+                                       uint32_t bytesPerBlock, const void* data, VkImageLayout oldLayout, VkImageLayout newLayout,
+                                       std::function<void()> onComplete){
+    Upload upload{};
+    upload.data = static_cast<const uint8_t*>(data);
+    upload.buffer = VK_NULL_HANDLE;
+    upload.image = dst;
+    upload.mipLevel = mipLevel;
+    upload.levelCount = levelCount;
+    upload.width = width;
+    upload.height = height;
+    upload.bytesPerTexel = bytesPerBlock;
+    upload.blockDim = blockDim;
+    upload.oldLayout = oldLayout;
+    upload.newLayout = newLayout;
+    upload.onComplete = std::move(onComplete);
+    for (uint32_t l = 0; l < levelCount; l++){
+        upload.size += levelBytes(upload, l);
+    }
+    if (rowBytes(upload, 0) > maxChunk()){
+        throw std::runtime_error("upload scheduler: image row bigger than a staging chunk");
+    }
+    queue.push_back(std::move(upload));
+}
+
+VkDeviceSize UploadScheduler::rowBytes(const Upload& upload, uint32_t level){
+    uint32_t width = std::max(1u, upload.width >> level);
+    return static_cast<VkDeviceSize>((width + upload.blockDim - 1) / upload.blockDim) * upload.bytesPerTexel;
+}
+
+VkDeviceSize UploadScheduler::levelBytes(const Upload& upload, uint32_t level){
+    uint32_t height = std::max(1u, upload.height >> level);
+    return rowBytes(upload, level) * ((height + upload.blockDim - 1) / upload.blockDim);
+}
+
+VkDeviceSize UploadScheduler::imageChunk(const Upload& upload, VkDeviceSize limit, std::vector<VkBufferImageCopy>& regions){
+    VkDeviceSize chunk = 0;
+    VkDeviceSize levelStart = 0;
+    for (uint32_t l = 0; l < upload.levelCount; l++){
+        VkDeviceSize bytes = levelBytes(upload, l);
+        VkDeviceSize position = upload.done + chunk;
+        if (position >= levelStart + bytes){
+            levelStart += bytes;
+            continue;
+        }
+        VkDeviceSize row = rowBytes(upload, l);
+        VkDeviceSize rows = std::min((levelStart + bytes - position) / row, (limit - std::min(limit, chunk)) / row);
+        if (rows == 0 && chunk == 0){
+            rows = 1;
+        }
+        if (rows > 0){
+            // Rows of blocks cover blockDim texel rows, the last one may stop at the edge of the level.
+            uint32_t height = std::max(1u, upload.height >> l);
+            uint32_t firstRow = static_cast<uint32_t>((position - levelStart) / row) * upload.blockDim;
+            VkBufferImageCopy imageCopyOp{};
+            imageCopyOp.bufferOffset = chunk;
+            imageCopyOp.bufferRowLength = 0; // Tightly packed
+            imageCopyOp.bufferImageHeight = 0;
+            imageCopyOp.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+            imageCopyOp.imageSubresource.mipLevel = upload.mipLevel + l;
+            imageCopyOp.imageSubresource.baseArrayLayer = 0;
+            imageCopyOp.imageSubresource.layerCount = 1;
+            imageCopyOp.imageOffset = {0, static_cast<int32_t>(firstRow), 0};
+            imageCopyOp.imageExtent = {
+                std::max(1u, upload.width >> l),
+                std::min(static_cast<uint32_t>(rows) * upload.blockDim, height - firstRow),
+                1
+            };
+            regions.push_back(imageCopyOp);
+            chunk += rows * row;
+        }
+        if (position + rows * row < levelStart + bytes){
+            break; // The limit stops inside this level
+        }
+        levelStart += bytes;
+    }
+    return chunk;
+}
+
+VkDeviceSize UploadScheduler::pendingBytes() const{
+    VkDeviceSize total = 0;
+    for (const Upload& u : queue){
+        total += u.size - u.done;
+    }
+    return total;
+}
+
+void UploadScheduler::transitionLevel(VkCommandBuffer cb, const Upload& upload, VkImageLayout from, VkImageLayout to){
+    VkImageMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.oldLayout = from;
+    barrier.newLayout = to;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = upload.image;
+    barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    barrier.subresourceRange.baseMipLevel = upload.mipLevel;
+    barrier.subresourceRange.levelCount = upload.levelCount;
+    barrier.subresourceRange.baseArrayLayer = 0;
+    barrier.subresourceRange.layerCount = 1;
+
+    VkPipelineStageFlags srcStage;
+    VkPipelineStageFlags dstStage;
+    if (from == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL){
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        srcStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
+    }else{
+        // Previous contents are either undefined or only read, an execution dependency is enough.
+        barrier.srcAccessMask = 0;
+        srcStage = from == VK_IMAGE_LAYOUT_UNDEFINED ? VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT : VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+    }
+    if (to == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL){
+        barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        dstStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
+    }else{
+        barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+        dstStage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+    }
+    vkCmdPipelineBarrier(cb, srcStage, dstStage, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+}
+
+/*
+Release half of the queue family ownership transfer of a finished upload, the acquire half is queued for recordAcquires().
+Both halves carry the same layout transition, it happens once between the two.
+*/
+void UploadScheduler::release(VkCommandBuffer cb, const Upload& upload){
+    if (upload.image == VK_NULL_HANDLE){
+        VkBufferMemoryBarrier barrier{};
+        barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = 0; // Ignored by the release
+        barrier.srcQueueFamilyIndex = transferFamily;
+        barrier.dstQueueFamilyIndex = graphicsFamily;
+        barrier.buffer = upload.buffer;
+        barrier.offset = upload.bufferOffset;
+        barrier.size = upload.size;
+        vkCmdPipelineBarrier(cb, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 1, &barrier, 0, nullptr);
+
+        barrier.srcAccessMask = 0; // Ignored by the acquire
+        barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+        pendingBufferAcquires.push_back(barrier);
+        return;
+    }
+    VkImageMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = 0;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.newLayout = upload.newLayout;
+    barrier.srcQueueFamilyIndex = transferFamily;
+    barrier.dstQueueFamilyIndex = graphicsFamily;
+    barrier.image = upload.image;
+    barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    barrier.subresourceRange.baseMipLevel = upload.mipLevel;
+    barrier.subresourceRange.levelCount = upload.levelCount;
+    barrier.subresourceRange.baseArrayLayer = 0;
+    barrier.subresourceRange.layerCount = 1;
+    vkCmdPipelineBarrier(cb, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+    barrier.srcAccessMask = 0;
+    barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+    pendingImageAcquires.push_back(barrier);
+}
+
+bool UploadScheduler::recordAcquires(VkCommandBuffer cb){
+    if (pendingBufferAcquires.empty() && pendingImageAcquires.empty()){
+        return false;
+    }
+    // ALL_COMMANDS on the source side chains with the semaphore wait of the submission (same stage mask).
+    vkCmdPipelineBarrier(
+        cb, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0,
+        0, nullptr,
+        static_cast<uint32_t>(pendingBufferAcquires.size()), pendingBufferAcquires.data(),
+        static_cast<uint32_t>(pendingImageAcquires.size()), pendingImageAcquires.data()
+    );
+    pendingBufferAcquires.clear();
+    pendingImageAcquires.clear();
+    return true;
+}
+
+bool UploadScheduler::recordChunk(VkCommandBuffer cb, Upload& upload, VkDeviceSize budget, VkDeviceSize& recorded){
+    VkDeviceSize budgetLeft = budget == UNLIMITED_BUDGET ? UNLIMITED_BUDGET : budget - std::min(budget, recorded);
+    if (budgetLeft == 0){
+        return false;
+    }
+    VkDeviceSize chunk;
+    VkDeviceSize alignment;
+    std::vector<VkBufferImageCopy> regions;
+    if (upload.image == VK_NULL_HANDLE){
+        chunk = std::min({upload.size - upload.done, maxChunk(), budgetLeft});
+        alignment = 16;
+    }else{
+        // Whole rows (of blocks) only, at least one per frame so that a tiny budget still makes progress.
+        chunk = imageChunk(upload, std::min(maxChunk(), budgetLeft), regions);
+        if (chunk > budgetLeft && recorded > 0){
+            return false;
+        }
+        // bufferOffset must be a multiple of the texel (block) size and of 4.
+        alignment = std::lcm<VkDeviceSize>(16, upload.bytesPerTexel);
+    }
+
+    StagingRing::Region region;
+    if (!ring->tryAllocate(chunk, alignment, region)){
+        return false;
+    }
+    memcpy(region.mapped, upload.data + upload.done, static_cast<size_t>(chunk));
+
+    if (upload.image == VK_NULL_HANDLE){
+        VkBufferCopy copyOpDesc{};
+        copyOpDesc.srcOffset = region.offset;
+        copyOpDesc.dstOffset = upload.bufferOffset + upload.done;
+        copyOpDesc.size = chunk;
+        vkCmdCopyBuffer(cb, region.buffer, upload.buffer, 1, &copyOpDesc);
+    }else{
+        if (upload.done == 0 && upload.oldLayout != VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL){
+            transitionLevel(cb, upload, upload.oldLayout, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+        }
+        for (VkBufferImageCopy& imageCopyOp : regions){
+            imageCopyOp.bufferOffset += region.offset;
+        }
+        vkCmdCopyBufferToImage(cb, region.buffer, upload.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, static_cast<uint32_t>(regions.size()), regions.data());
+    }
+    upload.done += chunk;
+    recorded += chunk;
+    return true;
+}
+
+VkDeviceSize UploadScheduler::record(VkCommandBuffer cb, VkDeviceSize budget){
+    HELIUM_PROFILE_FUNCTION();
+    VkDeviceSize recorded = 0;
+    while (!queue.empty()){
+        Upload& upload = queue.front();
+        if (!recordChunk(cb, upload, budget, recorded)){
+            break;
+        }
+        if (upload.done < upload.size){
+            continue;
+        }
+        if (transfersOwnership()){
+            release(cb, upload);
+        }else if (upload.image != VK_NULL_HANDLE && upload.newLayout != VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL){
+            transitionLevel(cb, upload, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, upload.newLayout);
+        }
+        if (upload.onComplete){
+            recordedCallbacks.push_back(std::move(upload.onComplete));
+        }
+        queue.pop_front();
+    }
+
+    if (recorded > 0){
+        // Buffer copies have no layout transition carrying their dependency, make them visible to anything later on the queue
+        // (vertex input, shaders, further transfers). Barriers also cover later submissions, so this works across command buffers.
+        VkMemoryBarrier barrier{};
+        barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+        vkCmdPipelineBarrier(cb, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+    }
+    return recorded;
+}
+
+void UploadScheduler::submitted(VkFence fence, std::function<void()> onRetired){
+    if (recordedCallbacks.empty()){
+        ring->closeSubmission(fence, std::move(onRetired));
+        return;
+    }
+    ring->closeSubmission(fence, [callbacks = std::move(recordedCallbacks), onRetired = std::move(onRetired)](){
+        for (const std::function<void()>& c : callbacks){
+            c();
+        }
+        if (onRetired){
+            onRetired();
+        }
+    });
+    recordedCallbacks.clear();
+}
@@ -0,0 +1,114 @@
+#pragma once
+
+#include "staging_ring.h"
+#include <deque>
+#include <functional>
+#include <vector>
+
+/*
+Queue of host to device uploads going through the StagingRing.
+
+record() copies as much queued data as allowed into the staging ring and records the transfers into the given command buffer,
+splitting big uploads into chunks (buffer ranges, image rows) so that one huge texture cannot stall a frame.
+After submitting that command buffer call submitted() with the fence of the submission: staging memory and the
+onComplete callbacks of the uploads that finished are retired with it (callbacks run from StagingRing::reclaim()).
+
+The source data is not copied on enqueue, it must stay alive until onComplete runs (or until the flush that uploads it returns).
+
+With a dedicated transfer queue (setQueueFamilies() with two different families) record() targets a transfer command buffer and
+every finished upload is released to the graphics family there. recordAcquires() records the matching acquire barriers into a
+graphics command buffer, whose submission must wait on a semaphore signaled by the transfer one.
+*/
+class UploadScheduler{
+public:
+    // Per frame budget used by the renderer for uploads issued after startup, ~1ms of PCIe 3 bandwidth.
+    static constexpr VkDeviceSize DEFAULT_FRAME_BUDGET = 8ull * 1024 * 1024;
+    static constexpr VkDeviceSize UNLIMITED_BUDGET = ~0ull;
+
+    void init(StagingRing* ring);
+    // Families of the command buffers given to record() and recordAcquires(). Equal families (the default) need no ownership transfer.
+    void setQueueFamilies(uint32_t transferFamily, uint32_t graphicsFamily);
+
+    // Copies size bytes from data to dst at dstOffset.
+    void enqueueBuffer(VkBuffer dst, VkDeviceSize dstOffset, const void* data, VkDeviceSize size, std::function<void()> onComplete = {});
+    /*
+    Uploads a whole mip level of an uncompressed color image, tightly packed rows of width * bytesPerTexel.
+    The level is moved from oldLayout to TRANSFER_DST before the first chunk and to newLayout after the last one
+    (no transition when they are TRANSFER_DST already).
+    With a transfer queue the first transition runs there: oldLayout should be UNDEFINED, a level owned by the graphics family
+    cannot be read from the transfer queue and its contents are overwritten anyway.
+    */
+    void enqueueImage(VkImage dst, uint32_t mipLevel, uint32_t width, uint32_t height, uint32_t bytesPerTexel, const void* data,
+                      VkImageLayout oldLayout, VkImageLayout newLayout, std::function<void()> onComplete = {});
+    /*
+    Same for levels [mipLevel, mipLevel + levelCount) of an uncompressed image, width x height being the size of mipLevel.
+    data packs them one after the other from mipLevel, each max(1, size >> level).
+    Every chunk is one copy with a region per level it covers, and the layout transitions cover the whole chain at once.
+    */
+    void enqueueImageChain(VkImage dst, uint32_t mipLevel, uint32_t width, uint32_t height, uint32_t levelCount, uint32_t bytesPerTexel,
+                           const void* data, VkImageLayout oldLayout, VkImageLayout newLayout, std::function<void()> onComplete = {});
+    // Same for a level of a block compressed image (BCn): rows of ceil(width / 4) blocks of blockBytes, ceil(height / 4) rows.
+    void enqueueCompressedImage(VkImage dst, uint32_t mipLevel, uint32_t width, uint32_t height, uint32_t blockBytes, const void* data,
+                                VkImageLayout oldLayout, VkImageLayout newLayout, std::function<void()> onComplete = {});
+
+    // Records up to budget bytes of uploads into cb (it must be recording and outside of a render pass). Returns the bytes recorded.
+    VkDeviceSize record(VkCommandBuffer cb, VkDeviceSize budget);
+    // Acquire half of every release recorded by record() since the last call. False when there was nothing to acquire.
+    bool recordAcquires(VkCommandBuffer cb);
+    // Must follow every submission of a command buffer record() wrote to, fence must be the fence of that submission.
+    // onRetired runs after the callbacks of the uploads, once the submission retired.
+    void submitted(VkFence fence, std::function<void()> onRetired = {});
+
+    bool hasPending() const { return !queue.empty(); }
+    bool transfersOwnership() const { return transferFamily != graphicsFamily; }
+    bool hasPendingAcquires() const { return !pendingBufferAcquires.empty() || !pendingImageAcquires.empty(); }
+    VkDeviceSize pendingBytes() const;
+    VkDeviceSize getFrameBudget() const { return frameBudget; }
+    void setFrameBudget(VkDeviceSize bytes) { frameBudget = bytes; }
+
+private:
+    struct Upload{
+        const uint8_t* data;
+        VkDeviceSize size;
+        VkDeviceSize done; // Bytes already recorded
+
+        VkBuffer buffer;
+        VkDeviceSize bufferOffset;
+
+        VkImage image;
+        uint32_t mipLevel; // First level
+        uint32_t levelCount; // Levels packed one after the other in data
+        uint32_t width; // Of the first level
+        uint32_t height;
+        uint32_t bytesPerTexel; // Per block for compressed images
+        uint32_t blockDim; // Texels per block side, 1 for uncompressed images
+        VkImageLayout oldLayout;
+        VkImageLayout newLayout;
+
+        std::function<void()> onComplete;
+    };
+
+    StagingRing* ring = nullptr;
+    VkDeviceSize frameBudget = DEFAULT_FRAME_BUDGET;
+    uint32_t transferFamily = VK_QUEUE_FAMILY_IGNORED;
+    uint32_t graphicsFamily = VK_QUEUE_FAMILY_IGNORED;
+    // Acquire barriers of the uploads released but not acquired yet.
+    std::vector<VkBufferMemoryBarrier> pendingBufferAcquires;
+    std::vector<VkImageMemoryBarrier> pendingImageAcquires;
+    std::deque<Upload> queue;
+    // Callbacks of uploads fully recorded but not submitted yet.
+    std::vector<std::function<void()>> recordedCallbacks;
+
+    VkDeviceSize maxChunk() const { return ring->getCapacity() / 4; }
+    void enqueueImageRows(VkImage dst, uint32_t mipLevel, uint32_t levelCount, uint32_t width, uint32_t height, uint32_t blockDim,
+                          uint32_t bytesPerBlock, const void* data, VkImageLayout oldLayout, VkImageLayout newLayout,
+                          std::function<void()> onComplete);
+    // Bytes of one row of texels (or of blocks) and of the whole level, level counted from upload.mipLevel.
+    static VkDeviceSize rowBytes(const Upload& upload, uint32_t level);
+    static VkDeviceSize levelBytes(const Upload& upload, uint32_t level);
+    // Whole rows of consecutive levels starting at upload.done, at most limit bytes but at least one row. Offsets relative to the chunk.
+    static VkDeviceSize imageChunk(const Upload& upload, VkDeviceSize limit, std::vector<VkBufferImageCopy>& regions);
+    bool recordChunk(VkCommandBuffer cb, Upload& upload, VkDeviceSize budget, VkDeviceSize& recorded);
+    void transitionLevel(VkCommandBuffer cb, const Upload& upload, VkImageLayout from, VkImageLayout to);
+    void release(VkCommandBuffer cb, const Upload& upload);
+};
@@ -1,51 +1,52 @@
 #include "main.h"
+#include <cmath>
 
-VkVertexInputBindingDescription Vert::getBindingDescription(){
-    VkVertexInputBindingDescription bindingDescription{};
-    bindingDescription.binding = 0;
-    bindingDescription.stride = sizeof(Vert);
-    /*
-    VK_VERTEX_INPUT_RATE_VERTEX = 0, // Binding is constant for each vertex
-    VK_VERTEX_INPUT_RATE_INSTANCE = 1, // Binding is constant for each instance (multiple vertices will read the same bound data)
-    */
-    bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
-    return bindingDescription;
+static uint16_t quantizeUnorm16(float value){
+    return static_cast<uint16_t>(std::lround(std::clamp(value, 0.0f, 1.0f) * 65535.0f));
 }
 
-/* We have three bindings:
- location 0 (inPosition)
- color 1 (inColor)
- texCoords 2 (uv) */
-std::array<VkVertexInputAttributeDescription, 3> Vert::getAttributeDescription(){
-    std::array<VkVertexInputAttributeDescription, 3> attributeDescriptions{};
-    // The binding for Vert is defined at index 0 so 0.
-    attributeDescriptions[0].binding = 0; // Binding index  from where the attribute takes data from ( the .binding from the binding descriptor)
-    attributeDescriptions[0].location = 0; // number in the layout of the shader (layout(location =....))
-    // Lots of values, refer to https://registry.khronos.org/vulkan/specs/latest/man/html/VkFormat.html
-    /*
-    Most important ones:
-        float: VK_FORMAT_R32_SFLOAT
-        vec2: VK_FORMAT_R32G32_SFLOAT
-        vec3: VK_FORMAT_R32G32B32_SFLOAT
-        vec4: VK_FORMAT_R32G32B32A32_SFLOAT
-    But basically it's as if you dedicate X bits to each color channel based on the type.
-    a vector of integer (ivec2) would be VK_FORMAT_R32G32_SINT. 
-        SINT = signed integer (int)
-        UINT = uint
-        SFLOAT = Signed float (both double and float)
-    */
-    attributeDescriptions[0].format = VK_FORMAT_R32G32B32_SFLOAT; // Type of data
-    attributeDescriptions[0].offset = offsetof(Vert, pos); // Byte offset of the field in the struct
+static uint8_t quantizeSnorm8(float value){
+    return static_cast<uint8_t>(static_cast<int8_t>(std::lround(std::clamp(value, -1.0f, 1.0f) * 127.0f)));
+}
+
+/*
+Octahedral normal encoding: the unit sphere is projected on the octahedron |x| + |y| + |z| = 1, whose lower half is
+folded over the upper one, giving a square where every direction has a 2D coordinate.
+*/
+static uint16_t encodeOctahedral(const glm::vec3& normal){
+    float l1 = std::abs(normal.x) + std::abs(normal.y) + std::abs(normal.z);
+    if (l1 == 0.0f){
+        return static_cast<uint16_t>(quantizeSnorm8(0.0f) | (quantizeSnorm8(0.0f) << 8)); // +Z
+    }
+    glm::vec2 e = glm::vec2(normal.x, normal.y) / l1;
+    if (normal.z < 0.0f){
+        e = glm::vec2(
+            (1.0f - std::abs(e.y)) * (e.x >= 0.0f ? 1.0f : -1.0f),
+            (1.0f - std::abs(e.x)) * (e.y >= 0.0f ? 1.0f : -1.0f)
+        );
+    }
+    return static_cast<uint16_t>(quantizeSnorm8(e.x) | (quantizeSnorm8(e.y) << 8));
+}
 
-    attributeDescriptions[1].binding = 0; // Vert is still bound at 0
-    attributeDescriptions[1].location = 1; // inColor is at 1
-    attributeDescriptions[1].format = VK_FORMAT_R32G32B32_SFLOAT; // vec3 of floats
-    attributeDescriptions[1].offset = offsetof(Vert, col);
+QuantizedVert quantizeVertex(const glm::vec3& pos, const glm::vec3& normal, const glm::vec2& texCoords,
+                             const glm::vec3& boundsMin, const glm::vec3& boundsMax, const glm::vec2& uvMin, const glm::vec2& uvMax){
+    QuantizedVert v{};
+    glm::vec3 extent = boundsMax - boundsMin;
+    for (int k = 0; k < 3; k++){
+        v.pos[k] = extent[k] > 0.0f ? quantizeUnorm16((pos[k] - boundsMin[k]) / extent[k]) : 0;
+    }
+    v.normal = encodeOctahedral(normal);
+    glm::vec2 uvExtent = uvMax - uvMin;
+    for (int k = 0; k < 2; k++){
+        v.texCoords[k] = uvExtent[k] > 0.0f ? quantizeUnorm16((texCoords[k] - uvMin[k]) / uvExtent[k]) : 0;
+    }
+    return v;
+}
+
+glm::mat4 dequantizationMatrix(const glm::vec3& boundsMin, const glm::vec3& boundsMax){
+    return glm::scale(glm::translate(glm::mat4(1.0f), boundsMin), (boundsMax - boundsMin) / 65535.0f);
+}
 
-    /*-----main tex-----*/
-    attributeDescriptions[2].binding = 0;
-    attributeDescriptions[2].location = 2;
-    attributeDescriptions[2].format = VK_FORMAT_R32G32_SFLOAT;
-    attributeDescriptions[2].offset = offsetof(Vert, texCoords);
-    return attributeDescriptions;
+glm::vec4 uvDequantization(const glm::vec2& uvMin, const glm::vec2& uvMax){
+    return glm::vec4(uvMax - uvMin, uvMin);
 }
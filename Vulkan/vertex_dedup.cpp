@@ -0,0 +1,41 @@
+#include "vertex_dedup.h"
+#include <bit>
+#include <limits>
+#include <stdexcept>
+
+VertexDedupTable::VertexDedupTable(size_t indexCount, size_t vertexCount, size_t texcoordCount, size_t normalCount)
+    : texcoordRadix(texcoordCount + 1), normalRadix(normalCount + 1){
+    // The largest key is vertexCount * texcoordRadix * normalRadix - 1, and must stay below EMPTY.
+    const uint64_t limit = std::numeric_limits<uint64_t>::max();
+    if (texcoordRadix > limit / normalRadix || vertexCount > (limit - 1) / (texcoordRadix * normalRadix)){
+        throw std::runtime_error("vertex dedup: attribute counts too large to pack");
+    }
+    // Every face index can at most introduce one new vertex. Meshes typically share most corners (the viking room has
+    // about 6 indices per vertex), so half of the index count keeps the load factor low without doubling the memory.
+    allocate(std::bit_ceil(std::max<size_t>(indexCount / 2, 16)));
+}
+
+void VertexDedupTable::allocate(size_t slots){
+    keys.assign(slots, EMPTY);
+    values.resize(slots);
+    mask = slots - 1;
+    growThreshold = slots / 10 * 7;
+}
+
+// Only reached when almost every corner is distinct.
+void VertexDedupTable::grow(){
+    std::vector<uint64_t> oldKeys = std::move(keys);
+    std::vector<uint32_t> oldValues = std::move(values);
+    allocate(oldKeys.size() * 2);
+    for (size_t i = 0; i < oldKeys.size(); i++){
+        if (oldKeys[i] == EMPTY){
+            continue;
+        }
+        size_t slot = hash(oldKeys[i]) & mask;
+        while (keys[slot] != EMPTY){
+            slot = (slot + 1) & mask;
+        }
+        keys[slot] = oldKeys[i];
+        values[slot] = oldValues[i];
+    }
+}
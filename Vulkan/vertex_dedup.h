@@ -0,0 +1,70 @@
+#pragma once
+
+#include "obj_parser.h"
+#include <cstdint>
+#include <vector>
+
+/*
+Maps OBJ face corners (vertex, texcoord, normal) to the index of the deduplicated vertex built for them.
+
+Flat open addressing table (linear probing) over a packed 64 bit key, keys and values live in two contiguous arrays so a
+lookup is a hash and, most of the time, a single cache line. It is sized from the face index count up front, which is an
+upper bound on the distinct corners, so loading a mesh normally never rehashes.
+Keys are packed in mixed radix (vertex * (texcoords + 1) + texcoord + 1) * (normals + 1) + normal + 1, which is exact for
+any attribute counts whose product fits in 64 bits, -1 (absent) included.
+*/
+class VertexDedupTable{
+public:
+    // Counts of the mesh attributes the corners index into, throws std::runtime_error if they cannot be packed.
+    VertexDedupTable(size_t indexCount, size_t vertexCount, size_t texcoordCount, size_t normalCount);
+
+    // True if the corner was not seen yet: it is now mapped to candidate. Otherwise vertex is set to the existing mapping.
+    bool findOrInsert(const ObjIndex& index, uint32_t candidate, uint32_t& vertex){
+        uint64_t key = pack(index);
+        size_t slot = hash(key) & mask;
+        while (keys[slot] != EMPTY){
+            if (keys[slot] == key){
+                vertex = values[slot];
+                return false;
+            }
+            slot = (slot + 1) & mask;
+        }
+        keys[slot] = key;
+        values[slot] = candidate;
+        vertex = candidate;
+        if (++count > growThreshold){
+            grow();
+        }
+        return true;
+    }
+
+    size_t size() const { return count; }
+    size_t capacity() const { return keys.size(); }
+
+private:
+    static constexpr uint64_t EMPTY = ~0ull;
+
+    std::vector<uint64_t> keys;
+    std::vector<uint32_t> values;
+    size_t mask = 0;
+    size_t count = 0;
+    size_t growThreshold = 0;
+    uint64_t texcoordRadix;
+    uint64_t normalRadix;
+
+    uint64_t pack(const ObjIndex& index) const{
+        return (static_cast<uint64_t>(index.vertex) * texcoordRadix + static_cast<uint64_t>(index.texcoord + 1)) * normalRadix
+            + static_cast<uint64_t>(index.normal + 1);
+    }
+    // splitmix64 finalizer, packed keys of neighbouring corners differ only in the low bits.
+    static uint64_t hash(uint64_t key){
+        key ^= key >> 30;
+        key *= 0xbf58476d1ce4e5b9ull;
+        key ^= key >> 27;
+        key *= 0x94d049bb133111ebull;
+        key ^= key >> 31;
+        return key;
+    }
+    void allocate(size_t slots);
+    void grow();
+};
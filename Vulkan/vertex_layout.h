@@ -0,0 +1,40 @@
+#pragma once
+
+#include "heliumutils.h"
+#include <array>
+#include <cstdint>
+
+/*
+Vertex input descriptions derived from a vertex type.
+Each vertex type specializes VertexLayout with ATTRIBUTES, its attributes in shader location order (location i reads ATTRIBUTES[i]).
+The Vulkan binding and attribute descriptions are then built at compile time, so the pipeline always matches the struct it reads.
+*/
+struct VertexAttribute{
+    VkFormat format;
+    uint32_t offset;
+};
+
+template <typename V>
+struct VertexLayout;
+
+// Whole vertex per vertex, V tightly packed one after the other.
+template <typename V>
+constexpr VkVertexInputBindingDescription vertexBindingDescription(uint32_t binding = 0){
+    VkVertexInputBindingDescription bindingDescription{};
+    bindingDescription.binding = binding;
+    bindingDescription.stride = sizeof(V);
+    bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+    return bindingDescription;
+}
+
+template <typename V>
+constexpr std::array<VkVertexInputAttributeDescription, VertexLayout<V>::ATTRIBUTES.size()> vertexAttributeDescriptions(uint32_t binding = 0){
+    std::array<VkVertexInputAttributeDescription, VertexLayout<V>::ATTRIBUTES.size()> attributeDescriptions{};
+    for (uint32_t i = 0; i < attributeDescriptions.size(); i++){
+        attributeDescriptions[i].binding = binding;
+        attributeDescriptions[i].location = i;
+        attributeDescriptions[i].format = VertexLayout<V>::ATTRIBUTES[i].format;
+        attributeDescriptions[i].offset = VertexLayout<V>::ATTRIBUTES[i].offset;
+    }
+    return attributeDescriptions;
+}